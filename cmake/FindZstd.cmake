@@ -0,0 +1,18 @@
+# - Find Zstd
+# Find the native zstd includes and library.
+# Once done this will define
+#
+#  ZSTD_INCLUDE_DIR    - where to find zstd header files, etc.
+#  ZSTD_LIBRARY        - List of libraries when using zstd.
+#  ZSTD_FOUND          - True if zstd found.
+#
+
+FIND_LIBRARY(ZSTD_LIBRARY NAMES zstd libzstd HINTS ${ZSTD_ROOT_DIR}/lib)
+find_path(ZSTD_INCLUDE_DIR NAMES zstd.h HINTS ${ZSTD_ROOT_DIR}/include)
+
+# handle the QUIETLY and REQUIRED arguments and set ZSTD_FOUND to TRUE if
+# all listed variables are TRUE
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Zstd REQUIRED_VARS ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+
+MARK_AS_ADVANCED(ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
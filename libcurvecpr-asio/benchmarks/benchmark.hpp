@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_BENCHMARKS_BENCHMARK_HPP
+#define CURVECP_ASIO_BENCHMARKS_BENCHMARK_HPP
+
+#include <curvecp/curvecp.hpp>
+
+#include <boost/asio/streambuf.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * Monotonic stopwatch that accumulates elapsed time over multiple
+ * start/stop intervals.
+ */
+class stopwatch {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  stopwatch()
+    : elapsed_(0)
+  {
+  }
+
+  /**
+   * Starts a new measurement interval.
+   */
+  void start() { started_ = clock::now(); }
+
+  /**
+   * Ends the current measurement interval and adds it to the total.
+   */
+  void stop() { elapsed_ += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started_).count(); }
+
+  /**
+   * Returns the total accumulated time in nanoseconds.
+   */
+  std::uint64_t nanoseconds() const { return elapsed_; }
+private:
+  /// Start of the current interval
+  clock::time_point started_;
+  /// Accumulated time in nanoseconds
+  std::uint64_t elapsed_;
+};
+
+/**
+ * Collects samples and reports their distribution.
+ */
+class histogram {
+public:
+  /**
+   * Records a new sample.
+   *
+   * @param value Sample value
+   */
+  void add(double value) { samples_.push_back(value); }
+
+  /**
+   * Returns the number of recorded samples.
+   */
+  std::size_t count() const { return samples_.size(); }
+
+  /**
+   * Returns the given percentile of recorded samples.
+   *
+   * @param p Percentile in range [0, 100]
+   */
+  double percentile(double p)
+  {
+    if (samples_.empty())
+      return 0.0;
+
+    std::sort(samples_.begin(), samples_.end());
+    std::size_t idx = static_cast<std::size_t>(p / 100.0 * (samples_.size() - 1) + 0.5);
+    return samples_[std::min(idx, samples_.size() - 1)];
+  }
+
+  /**
+   * Prints the distribution summary on a single line.
+   *
+   * @param label Label to print in front of the summary
+   * @param unit Unit of the samples
+   */
+  void print(const char *label, const char *unit)
+  {
+    std::printf("%-24s n=%-8zu p50=%.1f%s p90=%.1f%s p99=%.1f%s p99.9=%.1f%s max=%.1f%s\n",
+      label, count(),
+      percentile(50), unit, percentile(90), unit, percentile(99), unit,
+      percentile(99.9), unit, percentile(100), unit);
+  }
+private:
+  /// Recorded samples
+  std::vector<double> samples_;
+};
+
+/**
+ * Returns nanoseconds per operation, guarding against empty runs.
+ */
+inline double per_op(std::uint64_t nanoseconds, std::uint64_t operations)
+{
+  return operations ? static_cast<double>(nanoseconds) / operations : 0.0;
+}
+
+
+/**
+ * Drives a detail::session directly, without any sockets or crypto, by
+ * putting blocks into its receive queue and draining its send queue. Also
+ * acts as the stream of the session I/O operations, and exposes the
+ * libcurvecpr messager callbacks of the session for benchmarks that call
+ * them one by one.
+ */
+class session_driver : public curvecp::detail::session {
+public:
+  session_driver(boost::asio::io_context &service, session::type type = session::type::server)
+    : session(service, type),
+      service_(service),
+      received_offset_(0),
+      sent_offset_(0),
+      sent_bytes_(0)
+  {
+    std::memset(&messager_handle_, 0, sizeof(messager_handle_));
+    messager_handle_.cf.priv = this;
+    set_recvmarkq_maximum(1 << 20);
+  }
+
+  boost::asio::io_context &get_io_context() { return service_; }
+
+  template <typename Operation, typename Handler>
+  void async_io_operation(const Operation &op, BOOST_ASIO_MOVE_ARG(Handler) handler)
+  {
+    curvecp::detail::io_op<session_driver, Operation, typename std::decay<Handler>::type>(*this, *this, op,
+      BOOST_ASIO_MOVE_CAST(Handler)(handler))(boost::system::error_code(), true);
+  }
+
+  int sendq_head(curvecpr_block **block)
+  {
+    return session::handle_sendq_head(&messager_handle_, block);
+  }
+
+  int sendq_move_to_sendmarkq(const curvecpr_block *block, curvecpr_block **stored)
+  {
+    return session::handle_sendq_move_to_sendmarkq(&messager_handle_, block, stored);
+  }
+
+  int sendmarkq_get(crypto_uint32 id, curvecpr_block **block)
+  {
+    return session::handle_sendmarkq_get(&messager_handle_, id, block);
+  }
+
+  int sendmarkq_remove_range(unsigned long long start, unsigned long long end)
+  {
+    return session::handle_sendmarkq_remove_range(&messager_handle_, start, end);
+  }
+
+  int recvmarkq_put(const curvecpr_block *block)
+  {
+    return session::handle_recvmarkq_put(&messager_handle_, block, nullptr);
+  }
+
+  int recvmarkq_get_nth_unacknowledged(unsigned int n, curvecpr_block **block)
+  {
+    return session::handle_recvmarkq_get_nth_unacknowledged(&messager_handle_, n, block);
+  }
+
+  int recvmarkq_remove_range(unsigned long long start, unsigned long long end)
+  {
+    return session::handle_recvmarkq_remove_range(&messager_handle_, start, end);
+  }
+
+  /**
+   * Delivers a block received from the other end.
+   *
+   * @param block Received block
+   */
+  void deliver(const curvecpr_block &block)
+  {
+    recvmarkq_put(&block);
+    recvmarkq_remove_range(block.offset, block.offset + block.data_len);
+  }
+
+  /**
+   * Delivers stream data, split into as many blocks as needed.
+   *
+   * @param data Received data, or nullptr for zeroes
+   * @param length Length of received data
+   */
+  void deliver(const unsigned char *data, std::size_t length)
+  {
+    curvecpr_block block;
+    std::memset(&block, 0, sizeof(block));
+    block.eof = CURVECPR_BLOCK_STREAM;
+
+    while (length > 0) {
+      block.offset = received_offset_;
+      block.data_len = static_cast<unsigned int>(std::min<std::size_t>(length, sizeof(block.data)));
+      if (data) {
+        std::memcpy(block.data, data, block.data_len);
+        data += block.data_len;
+      }
+      received_offset_ += block.data_len;
+      length -= block.data_len;
+      deliver(block);
+    }
+  }
+
+  /**
+   * Drains all pending blocks from the send queue as if they were
+   * acknowledged right away.
+   *
+   * @param function Function called with each block before it is removed
+   */
+  template <typename Function>
+  void drain(Function function)
+  {
+    curvecpr_block *head;
+    while (sendq_head(&head) == 0) {
+      head->offset = sent_offset_;
+      sent_offset_ += head->data_len;
+      sent_bytes_ += head->data_len;
+      function(*head);
+
+      curvecpr_block *stored;
+      if (sendq_move_to_sendmarkq(head, &stored) != 0)
+        break;
+      sendmarkq_remove_range(stored->offset, stored->offset + stored->data_len);
+    }
+  }
+
+  void drain() { drain([](const curvecpr_block&) {}); }
+
+  /**
+   * Closes the session.
+   */
+  void finish() { session::do_close(boost::system::error_code()); }
+
+  /**
+   * Returns the number of bytes carried by drained blocks.
+   */
+  std::uint64_t sent_bytes() const { return sent_bytes_; }
+private:
+  /// ASIO IO context
+  boost::asio::io_context &service_;
+  /// Messager handle that routes callbacks to this session
+  curvecpr_messager messager_handle_;
+  /// Offset of the next delivered block
+  std::uint64_t received_offset_;
+  /// Offset of the next drained block
+  std::uint64_t sent_offset_;
+  /// Number of bytes carried by drained blocks
+  std::uint64_t sent_bytes_;
+};
+
+/**
+ * Minimal stream facade over the session driver, so that the generic ASIO
+ * composed operations can be used with it.
+ */
+class driver_stream {
+public:
+  typedef boost::asio::io_context::executor_type executor_type;
+
+  explicit driver_stream(session_driver &driver)
+    : driver_(driver)
+  {
+  }
+
+  executor_type get_executor() { return driver_.get_io_context().get_executor(); }
+
+  template <typename MutableBufferSequence, typename ReadHandler>
+  void async_read_some(const MutableBufferSequence &buffers, ReadHandler handler)
+  {
+    driver_.async_io_operation(curvecp::detail::read_op<MutableBufferSequence>(buffers), handler);
+  }
+
+  template <typename ConstBufferSequence, typename WriteHandler>
+  void async_write_some(const ConstBufferSequence &buffers, WriteHandler handler)
+  {
+    driver_.async_io_operation(curvecp::detail::write_op<ConstBufferSequence>(buffers), handler);
+  }
+
+  template <typename MutableBufferSequence, typename ReadHandler>
+  void async_read_exactly(const MutableBufferSequence &buffers, ReadHandler handler)
+  {
+    driver_.async_io_operation(curvecp::detail::read_exactly_op<MutableBufferSequence>(buffers), handler);
+  }
+
+  template <typename ConstBufferSequence, typename WriteHandler>
+  void async_write_all(const ConstBufferSequence &buffers, WriteHandler handler)
+  {
+    driver_.async_io_operation(curvecp::detail::write_all_op<ConstBufferSequence>(buffers), handler);
+  }
+
+  template <typename ReadHandler>
+  void async_read_until(boost::asio::streambuf &buffer, const std::string &delimiter, ReadHandler handler)
+  {
+    typedef boost::asio::basic_streambuf_ref<std::allocator<char>> buffer_type;
+    driver_.async_io_operation(curvecp::detail::read_until_op<buffer_type>(buffer_type(buffer), delimiter), handler);
+  }
+private:
+  session_driver &driver_;
+};
+
+}
+
+#endif
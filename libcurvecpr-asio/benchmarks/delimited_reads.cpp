@@ -0,0 +1,134 @@
+/*
+ * Delimited read benchmark.
+ *
+ * Reads batches of delimiter-terminated records on a detail::session driven
+ * directly, without any sockets or crypto, and compares the cost per record
+ * of the generic boost::asio::async_read_until composed operation, which
+ * reads into a streambuf and scans it there, with the native
+ * async_read_until, which scans the received blocks in place. Both a single
+ * character and a two-character delimiter are measured at several record
+ * sizes. Received data is delivered into the session before each batch, so
+ * the measurements show the per-record overhead rather than waiting.
+ *
+ * A second part measures the throughput of the byte search kernels on
+ * ranges of a few sizes that do not contain the byte.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+
+#include <cstdlib>
+#include <string>
+
+class delimited_benchmark {
+public:
+  delimited_benchmark(bool native, const std::string &delimiter, std::size_t record, std::size_t batch)
+    : driver_(service_),
+      stream_(driver_),
+      native_(native),
+      delimiter_(delimiter),
+      batch_(batch),
+      records_(0),
+      bytes_(0)
+  {
+    // Record contents never contain the first delimiter character
+    for (std::size_t i = 0; i < batch; i++) {
+      for (std::size_t j = 0; j + delimiter.size() < record; j++)
+        data_.push_back(static_cast<unsigned char>('a' + (i + j) % 26));
+      data_.insert(data_.end(), delimiter.begin(), delimiter.end());
+    }
+  }
+
+  void run(std::size_t batches)
+  {
+    auto handler = [this](const boost::system::error_code &ec, std::size_t bytes) {
+      if (!ec) {
+        buffer_.consume(bytes);
+        bytes_ += bytes;
+        records_++;
+      }
+    };
+
+    for (std::size_t i = 0; i < batches; i++) {
+      driver_.deliver(&data_[0], data_.size());
+
+      time_.start();
+      for (std::size_t j = 0; j < batch_; j++) {
+        if (native_)
+          stream_.async_read_until(buffer_, delimiter_, handler);
+        else
+          boost::asio::async_read_until(stream_, buffer_, delimiter_, handler);
+        service_.poll();
+        service_.restart();
+      }
+      time_.stop();
+    }
+  }
+
+  void print(std::size_t record)
+  {
+    std::printf("%-8s %-6s %6zu | %10.1f ns/record %8.0f MB/s\n", native_ ? "native" : "asio",
+      delimiter_.size() == 1 ? "\"\\n\"" : "\"\\r\\n\"", record,
+      benchmark::per_op(time_.nanoseconds(), records_), bytes_ / (time_.nanoseconds() / 1e3));
+  }
+private:
+  boost::asio::io_context service_;
+  benchmark::session_driver driver_;
+  benchmark::driver_stream stream_;
+  bool native_;
+  std::string delimiter_;
+  std::size_t batch_;
+  std::vector<unsigned char> data_;
+  boost::asio::streambuf buffer_;
+  benchmark::stopwatch time_;
+  std::uint64_t records_;
+  std::uint64_t bytes_;
+};
+
+void run_kernels(std::size_t iterations)
+{
+  typedef curvecp::detail::byte_search byte_search;
+
+  std::vector<unsigned char> data(1024, 'a');
+  for (std::size_t length : { 32, 256, 1024 }) {
+    for (byte_search::kernel k : { byte_search::kernel::portable, byte_search::kernel::sse2, byte_search::kernel::avx2 }) {
+      if (static_cast<int>(k) > static_cast<int>(byte_search::best_kernel()))
+        break;
+
+      std::size_t found = 0;
+      benchmark::stopwatch time;
+      time.start();
+      for (std::size_t i = 0; i < iterations; i++) {
+        // The length depends on the previous result, so calls are not hoisted
+        found += byte_search::find(&data[0], length - (found & 1), '\n', k);
+      }
+      time.stop();
+
+      std::printf("%-8s %6zu | %7.2f GB/s (%zu)\n", byte_search::kernel_name(k), length,
+        iterations * length / static_cast<double>(time.nanoseconds()), found & 1);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+
+  std::printf("Records read one per operation, 64 records per batch.\n");
+  for (std::size_t record : { 16, 128, 1024, 8192 }) {
+    for (const char *delimiter : { "\n", "\r\n" }) {
+      for (bool native : { false, true }) {
+        delimited_benchmark bench(native, delimiter, record, 64);
+        bench.run(std::max<std::size_t>(records / 64, 10));
+        bench.print(record);
+      }
+    }
+  }
+
+  std::printf("Byte search kernels on ranges without a match:\n");
+  run_kernels(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000000);
+  return 0;
+}
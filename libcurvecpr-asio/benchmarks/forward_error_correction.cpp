@@ -0,0 +1,350 @@
+/*
+ * Forward error correction benchmark.
+ *
+ * Sends a stream of messages between two detail::session instances driven
+ * directly, without any sockets or crypto, over a simulated long-delay link
+ * with random or bursty loss, like the unordered messages benchmark. Lost
+ * blocks arrive again after a retransmission timeout, while repairs of
+ * forward error correction share the link but are never retransmitted. The
+ * receiver records the delivery latency of every message, so the tail of
+ * the distribution shows how often a message had to wait for a
+ * retransmission. Time is simulated, so the latencies are deterministic.
+ *
+ * Before that, the benchmark checks that one lost block in every group of
+ * a full send window is rebuilt even when the repairs arrive late, and
+ * fails otherwise, so it also runs as a test.
+ *
+ * A second part measures the throughput of the repair kernels on 1024-byte
+ * blocks with the portable implementation and the SIMD ones supported by
+ * the processor.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+
+/**
+ * Adds repair packets to the shared session driver.
+ */
+class fec_driver : public benchmark::session_driver {
+public:
+  explicit fec_driver(boost::asio::io_context &service)
+    : session_driver(service)
+  {
+  }
+
+  void deliver_repair(const std::vector<unsigned char> &frame)
+  {
+    session::lower_receive_datagram(&frame[0], frame.size());
+  }
+
+  /**
+   * Exchanges the hellos that announce forward error correction, so that
+   * both drivers send repairs.
+   *
+   * @param peer Driver of the other end
+   */
+  void exchange_hellos(fec_driver &peer)
+  {
+    drain([&peer](const curvecpr_block &block) { peer.deliver(block); });
+    peer.drain([this](const curvecpr_block &block) { deliver(block); });
+  }
+
+  template <typename Function>
+  void drain(Function function)
+  {
+    session_driver::drain(function);
+
+    // The send queue is now empty, which closes an incomplete group
+    session::close_idle_group();
+  }
+};
+
+/**
+ * Simulated link, in ticks of one millisecond. Loss follows a two-state
+ * Gilbert-Elliott model; with equal loss in both states it is random.
+ */
+struct network {
+  /// Probability that a packet is lost in the good state
+  double good_loss;
+  /// Probability that a packet is lost in the bad state
+  double bad_loss;
+  /// Probability of moving from the good to the bad state per packet
+  double enter_bad;
+  /// Probability of moving from the bad to the good state per packet
+  double leave_bad;
+  /// One-way delay
+  std::uint64_t delay;
+  /// Time until a lost block is retransmitted
+  std::uint64_t rto;
+
+  /**
+   * Returns the long-run packet loss rate.
+   */
+  double average_loss() const
+  {
+    double bad = enter_bad + leave_bad > 0 ? enter_bad / (enter_bad + leave_bad) : 0.0;
+    return (1 - bad) * good_loss + bad * bad_loss;
+  }
+};
+
+class fec_benchmark {
+public:
+  fec_benchmark(const network &net, std::size_t data_blocks, std::size_t repair_blocks)
+    : sender_(service_),
+      receiver_(service_),
+      network_(net),
+      random_(42),
+      size_(64, 4096),
+      bad_(false),
+      tick_(0),
+      messages_(0),
+      blocks_(0)
+  {
+    sender_.set_forward_error_correction(data_blocks, repair_blocks);
+    receiver_.set_forward_error_correction(data_blocks, repair_blocks);
+    sender_.set_lower_send_handler([this](const unsigned char *buf, std::size_t num) {
+      if (!lost())
+        repairs_.insert(std::make_pair(tick_ + network_.delay, std::vector<unsigned char>(buf, buf + num)));
+    });
+
+    receiver_.exchange_hellos(sender_);
+    repairs_.clear();
+  }
+
+  void run(std::size_t messages, std::size_t per_tick)
+  {
+    std::vector<unsigned char> message(size_.max());
+    std::vector<unsigned char> received(size_.max());
+    boost::system::error_code ec;
+    std::size_t bytes;
+
+    while (latency_.count() < messages) {
+      for (std::size_t i = 0; i < per_tick && messages_ < messages; i++) {
+        std::size_t length = size_(random_);
+        std::memcpy(&message[0], &tick_, sizeof(tick_));
+        sender_.write_message(boost::asio::buffer(message, length), ec, bytes);
+        messages_++;
+      }
+
+      sender_.drain([this](const curvecpr_block &block) {
+        // Retransmissions are lost independently at the average rate
+        std::uint64_t arrival = tick_ + network_.delay;
+        if (lost()) {
+          arrival += network_.rto;
+          while (loss_(random_) < network_.average_loss())
+            arrival += network_.rto;
+        }
+        in_flight_.insert(std::make_pair(arrival, block));
+        blocks_++;
+      });
+
+      // Repairs of a group are sent after its blocks, so they also arrive
+      // after the blocks that were not lost
+      for (auto it = in_flight_.begin(); it != in_flight_.end() && it->first <= tick_; it = in_flight_.erase(it))
+        receiver_.deliver(it->second);
+      for (auto it = repairs_.begin(); it != repairs_.end() && it->first <= tick_; it = repairs_.erase(it))
+        receiver_.deliver_repair(it->second);
+
+      while (receiver_.read_message(boost::asio::buffer(received), ec, bytes) && !ec) {
+        std::uint64_t sent;
+        std::memcpy(&sent, &received[0], sizeof(sent));
+        latency_.add(static_cast<double>(tick_ - sent));
+      }
+
+      tick_++;
+    }
+
+    // Rebuilt blocks are only acknowledged once their retransmissions have
+    // arrived, so release whatever is left as a close would
+    receiver_.finish();
+  }
+
+  void print(const char *label)
+  {
+    const curvecp::detail::session::fec_counters &sent = sender_.get_fec_counters();
+    const curvecp::detail::session::fec_counters &received = receiver_.get_fec_counters();
+
+    latency_.print(label, "ms");
+    std::printf("%-24s overhead %.1f%%, %llu blocks rebuilt\n", "",
+      blocks_ ? 100.0 * sent.repairs_sent / blocks_ : 0.0,
+      static_cast<unsigned long long>(received.blocks_rebuilt));
+  }
+private:
+  bool lost()
+  {
+    if (bad_)
+      bad_ = loss_(random_) >= network_.leave_bad;
+    else
+      bad_ = loss_(random_) < network_.enter_bad;
+
+    return loss_(random_) < (bad_ ? network_.bad_loss : network_.good_loss);
+  }
+private:
+  boost::asio::io_context service_;
+  fec_driver sender_;
+  fec_driver receiver_;
+  network network_;
+  std::mt19937_64 random_;
+  std::uniform_int_distribution<std::size_t> size_;
+  std::uniform_real_distribution<double> loss_;
+  bool bad_;
+  std::multimap<std::uint64_t, curvecpr_block> in_flight_;
+  std::multimap<std::uint64_t, std::vector<unsigned char>> repairs_;
+  std::uint64_t tick_;
+  std::uint64_t messages_;
+  std::uint64_t blocks_;
+  benchmark::histogram latency_;
+};
+
+/**
+ * Sends a full send window of 512 blocks in groups of 8 with one repair
+ * each and loses one block of every group. The repairs only arrive after
+ * all other blocks, as when they were delayed on the link, so the receiver
+ * must still hold copies of the blocks of the oldest groups to rebuild the
+ * stream without any retransmissions.
+ *
+ * @return True when every lost block was rebuilt and the stream is intact
+ */
+bool check_window_rebuild()
+{
+  const std::size_t window = 512;
+  const std::size_t group = 8;
+
+  boost::asio::io_context service;
+  fec_driver sender(service);
+  fec_driver receiver(service);
+  sender.set_forward_error_correction(group, 1);
+  receiver.set_forward_error_correction(group, 1);
+
+  std::vector<std::vector<unsigned char>> repairs;
+  sender.set_lower_send_handler([&repairs](const unsigned char *buf, std::size_t num) {
+    repairs.push_back(std::vector<unsigned char>(buf, buf + num));
+  });
+  receiver.exchange_hellos(sender);
+  repairs.clear();
+
+  std::vector<unsigned char> stream(window * sizeof(curvecpr_block().data));
+  std::mt19937 random(11);
+  for (unsigned char &b : stream)
+    b = static_cast<unsigned char>(random());
+
+  std::vector<curvecpr_block> blocks;
+  boost::system::error_code ec;
+  for (std::size_t written = 0; written < stream.size(); ) {
+    written += sender.write_some(boost::asio::buffer(&stream[written], stream.size() - written), ec);
+    sender.drain([&blocks](const curvecpr_block &block) { blocks.push_back(block); });
+  }
+
+  std::size_t lost = 0;
+  for (std::size_t i = 0; i < blocks.size(); i++) {
+    if (i % group == group / 2)
+      lost++;
+    else
+      receiver.deliver(blocks[i]);
+  }
+  for (const std::vector<unsigned char> &repair : repairs)
+    receiver.deliver_repair(repair);
+
+  std::vector<unsigned char> received(stream.size());
+  std::size_t bytes = 0;
+  while (bytes < received.size()) {
+    std::size_t n = receiver.read_some(boost::asio::buffer(&received[bytes], received.size() - bytes), ec);
+    if (ec)
+      break;
+    bytes += n;
+  }
+
+  std::uint64_t rebuilt = receiver.get_fec_counters().blocks_rebuilt;
+  std::printf("Full window of %zu blocks, one lost per group of %zu: %llu of %zu rebuilt\n",
+    blocks.size(), group, static_cast<unsigned long long>(rebuilt), lost);
+
+  receiver.finish();
+  sender.finish();
+  return blocks.size() == window && rebuilt == lost && bytes == stream.size() && received == stream;
+}
+
+void run_kernels(std::size_t iterations)
+{
+  typedef curvecp::detail::fec_codec fec_codec;
+
+  std::vector<unsigned char> dst(1024);
+  std::vector<unsigned char> src(1024);
+  std::mt19937 random(7);
+  for (unsigned char &b : src)
+    b = static_cast<unsigned char>(random());
+
+  for (fec_codec::kernel k : { fec_codec::kernel::scalar, fec_codec::kernel::ssse3, fec_codec::kernel::avx2 }) {
+    if (static_cast<int>(k) > static_cast<int>(fec_codec::best_kernel()))
+      break;
+
+    benchmark::stopwatch xor_time;
+    xor_time.start();
+    for (std::size_t i = 0; i < iterations; i++)
+      fec_codec::multiply_add(&dst[0], &src[0], 1, src.size(), k);
+    xor_time.stop();
+
+    benchmark::stopwatch multiply_time;
+    multiply_time.start();
+    for (std::size_t i = 0; i < iterations; i++)
+      fec_codec::multiply_add(&dst[0], &src[0], 0x53, src.size(), k);
+    multiply_time.stop();
+
+    std::printf("%-8s | xor %7.2f GB/s | multiply-add %7.2f GB/s\n", fec_codec::kernel_name(k),
+      iterations * src.size() / static_cast<double>(xor_time.nanoseconds()),
+      iterations * src.size() / static_cast<double>(multiply_time.nanoseconds()));
+  }
+
+  // Keep the results alive
+  std::printf("%-8s   (checksum %u)\n", "", static_cast<unsigned>(dst[0] ^ dst[1023]));
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+
+  struct scheme {
+    const char *label;
+    std::size_t data_blocks;
+    std::size_t repair_blocks;
+  };
+  const scheme schemes[] = {
+    { "  no fec", 0, 0 },
+    { "  fec 8+1 (xor)", 8, 1 },
+    { "  fec 8+2", 8, 2 },
+    { "  fec 16+4", 16, 4 },
+  };
+
+  struct link {
+    const char *label;
+    network net;
+  };
+  const link links[] = {
+    { "1% random loss", { 0.01, 0.01, 0.0, 1.0, 40, 120 } },
+    { "5% random loss", { 0.05, 0.05, 0.0, 1.0, 40, 120 } },
+    { "burst loss (mean burst 4)", { 0.0, 0.5, 0.01, 0.25, 40, 120 } },
+  };
+
+  if (!check_window_rebuild()) {
+    std::printf("FAILED: lost blocks of a full send window were not rebuilt\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("Four messages of 64-4096 bytes per ms, 40 ms one-way delay, 120 ms retransmission timeout.\n");
+  for (const link &l : links) {
+    std::printf("%s, %.1f%% average:\n", l.label, l.net.average_loss() * 100);
+    for (const scheme &s : schemes) {
+      fec_benchmark bench(l.net, s.data_blocks, s.repair_blocks);
+      bench.run(messages, 4);
+      bench.print(s.label);
+    }
+  }
+
+  std::printf("Repair kernels on 1024-byte blocks:\n");
+  run_kernels(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000);
+  return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * Handler allocation benchmark.
+ *
+ * Drives read and write operations on a detail::session directly, without
+ * any sockets or crypto, and counts the heap allocations made by the
+ * operations themselves: dispatching onto the session strand, parking on
+ * the session timers and invoking the completion handler. Blocks are fed
+ * into and drained out of the session queues outside of the measured
+ * windows. The datagram path is measured separately by sending a datagram
+ * through a pair of loopback transports while a receive is armed, with
+ * both handlers bound to the session strand and memory the way streams
+ * bind them. Global operator new and delete are replaced with counting
+ * versions. Each configuration is measured with a plain handler, which uses
+ * the per-session recycling allocator, with a handler that selects the
+ * default ASIO allocator and with a handler that carries its own allocator,
+ * in which case its allocations are reported separately.
+ *
+ * Plain handlers and handlers with their own allocator must not make any
+ * global heap allocations once warmed up; the benchmark exits with a
+ * failure when they do, so it also runs as a test.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <boost/asio/ip/udp.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace counters {
+  std::atomic<std::uint64_t> allocations(0);
+  std::atomic<std::uint64_t> handler_allocations(0);
+}
+
+void *operator new(std::size_t size)
+{
+  void *ptr = std::malloc(size ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc();
+
+  counters::allocations++;
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+/**
+ * Allocator carried by handlers that provide their own; counts its
+ * allocations and takes memory from malloc so that they do not show up as
+ * global heap allocations.
+ */
+template <typename T>
+struct counting_allocator {
+  typedef T value_type;
+
+  counting_allocator() {}
+
+  template <typename U>
+  counting_allocator(const counting_allocator<U>&) {}
+
+  T *allocate(std::size_t n)
+  {
+    counters::handler_allocations++;
+    return static_cast<T*>(std::malloc(sizeof(T) * n));
+  }
+
+  void deallocate(T *ptr, std::size_t) { std::free(ptr); }
+
+  template <typename U>
+  bool operator==(const counting_allocator<U>&) const { return true; }
+
+  template <typename U>
+  bool operator!=(const counting_allocator<U>&) const { return false; }
+};
+
+/**
+ * Which allocator the completion handlers select.
+ */
+enum class handler_kind {
+  // Plain handler, uses the per-session recycling allocator
+  plain,
+  // Handler that selects the default ASIO allocator
+  asio_default,
+  // Handler that carries its own allocator
+  own_allocator
+};
+
+const char *handler_kind_name(handler_kind kind)
+{
+  switch (kind) {
+    case handler_kind::plain: return "recycled";
+    case handler_kind::asio_default: return "asio";
+    case handler_kind::own_allocator: return "own";
+  }
+  return "?";
+}
+
+/**
+ * Completion handler that records the result of an operation.
+ */
+struct completion {
+  std::size_t *completed;
+
+  void operator()(const boost::system::error_code&, std::size_t) const { (*completed)++; }
+};
+
+struct asio_default_completion : completion {
+  typedef std::allocator<void> allocator_type;
+  allocator_type get_allocator() const { return allocator_type(); }
+};
+
+struct own_allocator_completion : completion {
+  typedef counting_allocator<void> allocator_type;
+  allocator_type get_allocator() const { return allocator_type(); }
+};
+
+/**
+ * Allocation counts of one kind of operation.
+ */
+struct operation_results {
+  benchmark::stopwatch time;
+  std::uint64_t operations = 0, allocations = 0, handler_allocations = 0;
+
+  void print(const char *label)
+  {
+    std::printf("  %-24s %8.2f heap/op %8.2f handler/op %8.1f ns/op\n", label,
+      static_cast<double>(allocations) / operations,
+      static_cast<double>(handler_allocations) / operations,
+      benchmark::per_op(time.nanoseconds(), operations));
+  }
+};
+
+/**
+ * Measures the allocations made within a window, excluding work done by
+ * the benchmark itself.
+ */
+class allocation_window {
+public:
+  explicit allocation_window(operation_results &results)
+    : results_(results)
+  {
+    results_.time.start();
+    allocations_ = counters::allocations;
+    handler_allocations_ = counters::handler_allocations;
+  }
+
+  ~allocation_window()
+  {
+    results_.allocations += counters::allocations - allocations_;
+    results_.handler_allocations += counters::handler_allocations - handler_allocations_;
+    results_.time.stop();
+  }
+private:
+  operation_results &results_;
+  std::uint64_t allocations_;
+  std::uint64_t handler_allocations_;
+};
+
+template <typename Handler>
+class allocation_benchmark {
+public:
+  typedef boost::asio::mutable_buffers_1 read_buffers;
+  typedef boost::asio::const_buffers_1 write_buffers;
+
+  allocation_benchmark(std::size_t record)
+    : driver_(service_),
+      record_(record),
+      read_buffer_(record),
+      write_buffer_(record, 104),
+      completed_(0),
+      sender_(service_, network_),
+      receiver_(service_, network_),
+      receiver_endpoint_(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 2))
+  {
+    sender_.bind(curvecp::transport::endpoint_type(
+      boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 1)));
+    receiver_.bind(receiver_endpoint_);
+  }
+
+  void run(std::size_t rounds, bool measure)
+  {
+    for (std::size_t i = 0; i < rounds; i++) {
+      parked_read(measure);
+      ready_read(measure);
+      write(measure);
+      datagram(measure);
+    }
+  }
+
+  void print(handler_kind kind)
+  {
+    std::printf("%s handlers, %zu-byte records:\n", handler_kind_name(kind), record_);
+    parked_read_.print("read (parked)");
+    ready_read_.print("read (data available)");
+    write_.print("write");
+    datagram_.print("datagram (loopback)");
+  }
+
+  /**
+   * Returns the number of global heap allocations made by all measured
+   * operations.
+   */
+  std::uint64_t heap_allocations() const
+  {
+    return parked_read_.allocations + ready_read_.allocations + write_.allocations + datagram_.allocations;
+  }
+private:
+  Handler handler()
+  {
+    Handler h;
+    h.completed = &completed_;
+    return h;
+  }
+
+  void start_read()
+  {
+    curvecp::detail::io_op<benchmark::session_driver, curvecp::detail::read_op<read_buffers>, Handler>(
+      driver_, driver_, curvecp::detail::read_op<read_buffers>(boost::asio::buffer(read_buffer_)),
+      handler())(boost::system::error_code(), true);
+  }
+
+  void poll()
+  {
+    service_.poll();
+    service_.restart();
+  }
+
+  void parked_read(bool measure)
+  {
+    operation_results ignored;
+    {
+      allocation_window window(measure ? parked_read_ : ignored);
+      start_read();
+      poll();
+    }
+
+    driver_.deliver(nullptr, record_);
+
+    {
+      allocation_window window(measure ? parked_read_ : ignored);
+      poll();
+    }
+    parked_read_.operations += measure;
+  }
+
+  void ready_read(bool measure)
+  {
+    driver_.deliver(nullptr, record_);
+
+    operation_results ignored;
+    {
+      allocation_window window(measure ? ready_read_ : ignored);
+      start_read();
+      poll();
+    }
+    ready_read_.operations += measure;
+  }
+
+  void write(bool measure)
+  {
+    operation_results ignored;
+    {
+      allocation_window window(measure ? write_ : ignored);
+      curvecp::detail::io_op<benchmark::session_driver, curvecp::detail::write_op<write_buffers>, Handler>(
+        driver_, driver_, curvecp::detail::write_op<write_buffers>(boost::asio::buffer(write_buffer_)),
+        handler())(boost::system::error_code(), true);
+      poll();
+    }
+    write_.operations += measure;
+
+    driver_.drain();
+  }
+
+  void datagram(bool measure)
+  {
+    operation_results ignored;
+    {
+      allocation_window window(measure ? datagram_ : ignored);
+      receiver_.async_receive_from(boost::asio::buffer(read_buffer_), sender_endpoint_,
+        curvecp::detail::bind_transport_handler(driver_.get_strand(), handler(), &driver_.get_handler_memory()));
+      sender_.async_send_to(boost::asio::buffer(write_buffer_), receiver_endpoint_,
+        curvecp::detail::bind_transport_handler(driver_.get_strand(), handler(), &driver_.get_handler_memory()));
+      poll();
+    }
+    datagram_.operations += measure;
+  }
+private:
+  boost::asio::io_context service_;
+  benchmark::session_driver driver_;
+  std::size_t record_;
+  std::vector<unsigned char> read_buffer_;
+  const std::vector<unsigned char> write_buffer_;
+  std::size_t completed_;
+  curvecp::loopback_network network_;
+  curvecp::loopback_transport sender_, receiver_;
+  curvecp::transport::endpoint_type sender_endpoint_, receiver_endpoint_;
+  operation_results parked_read_, ready_read_, write_, datagram_;
+};
+
+template <typename Handler>
+std::uint64_t measure(handler_kind kind, std::size_t record, std::size_t rounds)
+{
+  allocation_benchmark<Handler> bench(record);
+
+  // Warm up so that recycled blocks and internal queues reach their final size
+  bench.run(16, false);
+  bench.run(rounds, true);
+  bench.print(kind);
+  return bench.heap_allocations();
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+  // Handlers that select the default ASIO allocator are expected to allocate
+  std::uint64_t unexpected = 0;
+  for (std::size_t record : { 64, 1024 }) {
+    unexpected += measure<completion>(handler_kind::plain, record, rounds);
+    measure<asio_default_completion>(handler_kind::asio_default, record, rounds);
+    unexpected += measure<own_allocator_completion>(handler_kind::own_allocator, record, rounds);
+  }
+
+  if (unexpected) {
+    std::printf("FAILED: %llu heap allocations in steady state\n", static_cast<unsigned long long>(unexpected));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,292 @@
+/*
+ * Handshake rate benchmark.
+ *
+ * Opens and closes many short-lived CurveCP streams against a single acceptor
+ * on loopback and reports the sustained handshake rate, CPU time per
+ * handshake and the latency distribution of async_connect. The acceptor
+ * collects handshake timings during the run, which give a cost split of
+ * the server side: processing of Hello and Initiate packets by libcurvecpr
+ * (mostly public-key crypto), setting up new sessions and handing them
+ * over from the pending queue to accepted streams. Passing "loopback" as the
+ * transport argument runs the same benchmark over an in-process loopback
+ * network so that no system calls are involved. The acceptor backlog and
+ * the number of streams accepted per async_accept_many completion can be
+ * varied to see how many handshakes are rejected during a connection storm.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <sodium.h>
+#include <sys/resource.h>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/iterator/indirect_iterator.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace keys {
+  const std::string extension("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+  const std::string client_public("\xa3\xe7\xb1\x22\xe6\x86\x77\x7c\x39\xc3\xf8\x76\x3d\x4d\x4\xf\x39\x7\x24\x37\xa3\xf5\x7c\x5d\xfc\x56\x59\xc0\x95\xb7\xc1\x3c", 32);
+  const std::string client_private("\xd3\x51\x1b\x58\x9c\x33\x8d\xd2\x9e\x50\xe7\x14\xec\xb7\x79\x5d\x23\x51\x33\xe7\x27\x0\x40\xa\x1d\xad\x10\xd2\x4e\xac\x8e\xab", 32);
+  const std::string server_public("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32);
+  const std::string server_private("\x7a\xa4\x43\x11\x13\x5f\xb8\xe9\x1c\x3e\x2\xd3\x88\xa\x36\xce\xd0\xd8\x79\x99\x9b\xc5\xf7\x8e\x49\x90\x97\xe4\xdf\x6b\x6d\xa9", 32);
+}
+
+boost::shared_ptr<curvecp::transport> make_transport(boost::asio::io_context &service,
+                                                    curvecp::loopback_network *network)
+{
+  if (network)
+    return boost::make_shared<curvecp::loopback_transport>(service, *network);
+  return boost::make_shared<curvecp::socket_transport>(service);
+}
+
+double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+class server {
+public:
+  server(boost::asio::io_context &service, curvecp::loopback_network *network,
+         std::size_t backlog, std::size_t batch)
+    : service_(service),
+      acceptor_(make_transport(service, network)),
+      batch_(batch),
+      accepted_(0)
+  {
+    acceptor_.set_local_extension(keys::extension);
+    acceptor_.set_local_public_key(keys::server_public);
+    acceptor_.set_local_private_key(keys::server_private);
+    acceptor_.set_nonce_generator(randombytes);
+    acceptor_.set_backlog(backlog);
+    acceptor_.set_handshake_timing(true);
+  }
+
+  void start(const curvecp::transport::endpoint_type &endpoint)
+  {
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+  }
+
+  std::size_t accepted() const { return accepted_; }
+
+  curvecp::acceptor::accept_counters counters() { return acceptor_.get_accept_counters(); }
+
+  curvecp::acceptor::handshake_timings timings() { return acceptor_.get_handshake_timings(); }
+private:
+  void accept()
+  {
+    if (batch_ > 1) {
+      while (peers_.size() < batch_)
+        peers_.push_back(boost::make_shared<curvecp::stream>(service_));
+
+      acceptor_.async_accept_many(boost::make_indirect_iterator(peers_.begin()),
+        boost::make_indirect_iterator(peers_.end()),
+        boost::bind(&server::accept_many_handler, this, _1, _2));
+      return;
+    }
+
+    boost::shared_ptr<curvecp::stream> peer(boost::make_shared<curvecp::stream>(service_));
+    acceptor_.async_accept(*peer, boost::bind(&server::accept_handler, this, peer, _1));
+  }
+
+  void accept_many_handler(const boost::system::error_code &ec, std::size_t accepted)
+  {
+    for (std::size_t i = 0; i < accepted; i++) {
+      boost::shared_ptr<curvecp::stream> peer = peers_[i];
+      accepted_++;
+      peer->async_close([peer]() {});
+    }
+
+    peers_.erase(peers_.begin(), peers_.begin() + accepted);
+
+    // Errors, such as operation_aborted once the acceptor is closed, would
+    // complete the next accept right away as well
+    if (ec)
+      return;
+    accept();
+  }
+
+  void accept_handler(boost::shared_ptr<curvecp::stream> peer, const boost::system::error_code &ec)
+  {
+    if (ec)
+      return;
+
+    accepted_++;
+    peer->async_close([peer]() {});
+    accept();
+  }
+private:
+  boost::asio::io_context &service_;
+  curvecp::acceptor acceptor_;
+  std::size_t batch_;
+  std::vector<boost::shared_ptr<curvecp::stream>> peers_;
+  std::atomic<std::size_t> accepted_;
+};
+
+class client_pool {
+public:
+  client_pool(boost::asio::io_context &service,
+              curvecp::loopback_network *network,
+              const curvecp::transport::endpoint_type &endpoint,
+              std::size_t total)
+    : service_(service),
+      network_(network),
+      endpoint_(endpoint),
+      total_(total),
+      started_(0),
+      finished_(0),
+      failed_(0)
+  {
+  }
+
+  void start(std::size_t concurrency)
+  {
+    for (std::size_t i = 0; i < concurrency; i++)
+      connect();
+  }
+
+  benchmark::histogram &latency() { return latency_; }
+
+  std::size_t failed() const { return failed_; }
+private:
+  void connect()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (started_ >= total_)
+      return;
+    started_++;
+    lock.unlock();
+
+    boost::shared_ptr<curvecp::stream> stream(boost::make_shared<curvecp::stream>(
+      make_transport(service_, network_)));
+    stream->set_local_extension(keys::extension);
+    stream->set_local_public_key(keys::client_public);
+    stream->set_local_private_key(keys::client_private);
+    stream->set_remote_extension(keys::extension);
+    stream->set_remote_public_key(keys::server_public);
+    stream->set_remote_domain_name("test.server");
+    stream->set_nonce_generator(randombytes);
+
+    stream->async_connect(endpoint_,
+      boost::bind(&client_pool::connect_handler, this, stream, benchmark::stopwatch::clock::now(), _1));
+  }
+
+  void connect_handler(boost::shared_ptr<curvecp::stream> stream,
+                       benchmark::stopwatch::clock::time_point started,
+                       const boost::system::error_code &ec)
+  {
+    auto elapsed = benchmark::stopwatch::clock::now() - started;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ec)
+      failed_++;
+    else
+      latency_.add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    lock.unlock();
+
+    stream->async_close(boost::bind(&client_pool::close_handler, this, stream));
+  }
+
+  void close_handler(boost::shared_ptr<curvecp::stream> stream)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (++finished_ >= total_) {
+      service_.stop();
+      return;
+    }
+    lock.unlock();
+
+    connect();
+  }
+private:
+  boost::asio::io_context &service_;
+  curvecp::loopback_network *network_;
+  curvecp::transport::endpoint_type endpoint_;
+  std::mutex mutex_;
+  std::size_t total_;
+  std::size_t started_;
+  std::size_t finished_;
+  std::size_t failed_;
+  benchmark::histogram latency_;
+};
+
+/**
+ * Prints the cost split of the server side of handshakes.
+ */
+void print_cost_split(const curvecp::acceptor::handshake_timings &timings)
+{
+  std::printf("Server handshake cost split (per packet or session):\n");
+  std::printf("  Hello processing:      %10.1f us (%llu packets)\n",
+    benchmark::per_op(timings.hello_nanoseconds, timings.hellos) / 1000,
+    static_cast<unsigned long long>(timings.hellos));
+  std::printf("  Initiate processing:   %10.1f us (%llu packets)\n",
+    benchmark::per_op(timings.initiate_nanoseconds, timings.initiates) / 1000,
+    static_cast<unsigned long long>(timings.initiates));
+  std::printf("  session setup:         %10.1f us (%llu sessions)\n",
+    benchmark::per_op(timings.setup_nanoseconds, timings.setups) / 1000,
+    static_cast<unsigned long long>(timings.setups));
+  std::printf("  pending handoff:       %10.1f us (%llu sessions)\n",
+    benchmark::per_op(timings.handoff_nanoseconds, timings.handoffs) / 1000,
+    static_cast<unsigned long long>(timings.handoffs));
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t total = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+  std::size_t concurrency = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+  std::size_t threads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+  bool loopback = argc > 4 && std::string(argv[4]) == "loopback";
+  std::size_t backlog = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 16;
+  std::size_t batch = argc > 6 ? std::strtoul(argv[6], nullptr, 10) : 1;
+
+  if (sodium_init() == -1)
+    return 1;
+
+  boost::asio::io_context io_context;
+  curvecp::loopback_network network;
+  boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), 10001);
+
+  server srv(io_context, loopback ? &network : nullptr, backlog, batch);
+  srv.start(endpoint);
+
+  client_pool clients(io_context, loopback ? &network : nullptr, endpoint, total);
+  clients.start(concurrency);
+
+  double cpu_started = cpu_seconds();
+  benchmark::stopwatch wall;
+  wall.start();
+
+  std::list<std::shared_ptr<std::thread>> workers;
+  for (std::size_t i = 0; i < threads; i++)
+    workers.push_back(std::make_shared<std::thread>([&io_context]() { io_context.run(); }));
+  for (auto worker : workers)
+    worker->join();
+
+  wall.stop();
+  double cpu = cpu_seconds() - cpu_started;
+  double seconds = wall.nanoseconds() / 1e9;
+  std::size_t completed = clients.latency().count();
+
+  std::printf("Handshakes: %zu completed, %zu failed, %zu accepted by server in %.2f s\n",
+    completed, clients.failed(), srv.accepted(), seconds);
+  std::printf("Rate:       %.1f handshakes/s\n", completed / seconds);
+  std::printf("Backlog:    %zu sessions, %zu per accept, %llu Initiates rejected while full\n",
+    backlog, batch, static_cast<unsigned long long>(srv.counters().backlog_rejected));
+  std::printf("CPU:        %.1f us per handshake (client and server, %zu threads)\n",
+    completed ? cpu / completed * 1e6 : 0.0, threads);
+  clients.latency().print("async_connect latency", "us");
+
+  print_cost_split(srv.timings());
+  return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Hello flood benchmark.
+ *
+ * Streams data over one established CurveCP session on loopback while a
+ * separate thread floods the acceptor with Hello packets carrying random
+ * client keys from many source address prefixes (127.0.x.1), as a spoofed
+ * flood would. Every such Hello costs the server a public-key operation
+ * before it can be rejected. The data throughput of the established session
+ * is measured without a flood, under a flood without any limits and under
+ * a flood with per-source Hello limits and a global handshake budget, along
+ * with the admitted and dropped Hello counters of the acceptor.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <sodium.h>
+
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace keys {
+  const std::string extension("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+  const std::string client_public("\xa3\xe7\xb1\x22\xe6\x86\x77\x7c\x39\xc3\xf8\x76\x3d\x4d\x4\xf\x39\x7\x24\x37\xa3\xf5\x7c\x5d\xfc\x56\x59\xc0\x95\xb7\xc1\x3c", 32);
+  const std::string client_private("\xd3\x51\x1b\x58\x9c\x33\x8d\xd2\x9e\x50\xe7\x14\xec\xb7\x79\x5d\x23\x51\x33\xe7\x27\x0\x40\xa\x1d\xad\x10\xd2\x4e\xac\x8e\xab", 32);
+  const std::string server_public("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32);
+  const std::string server_private("\x7a\xa4\x43\x11\x13\x5f\xb8\xe9\x1c\x3e\x2\xd3\x88\xa\x36\xce\xd0\xd8\x79\x99\x9b\xc5\xf7\x8e\x49\x90\x97\xe4\xdf\x6b\x6d\xa9", 32);
+}
+
+/**
+ * Sends Hello packets with random contents from a number of source
+ * prefixes until stopped.
+ */
+class flooder {
+public:
+  flooder(const boost::asio::ip::udp::endpoint &target, std::size_t prefixes)
+    : target_(target),
+      stopped_(false),
+      sent_(0)
+  {
+    for (std::size_t i = 0; i < prefixes; i++) {
+      boost::shared_ptr<boost::asio::ip::udp::socket> socket(
+        boost::make_shared<boost::asio::ip::udp::socket>(service_));
+      socket->open(boost::asio::ip::udp::v4());
+      socket->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(
+        (127u << 24) | ((i / 250) << 16) | ((i % 250 + 1) << 8) | 1), 0));
+      sockets_.push_back(socket);
+    }
+  }
+
+  void start() { thread_ = std::thread(boost::bind(&flooder::run, this)); }
+
+  void stop()
+  {
+    stopped_ = true;
+    thread_.join();
+  }
+
+  std::uint64_t sent() const { return sent_; }
+private:
+  void run()
+  {
+    unsigned char packet[224];
+    std::memcpy(packet, "QvnQ5XlH", 8);
+    boost::system::error_code ec;
+
+    for (std::size_t i = 0; !stopped_; i++) {
+      randombytes_buf(packet + 8, sizeof(packet) - 8);
+      sockets_[i % sockets_.size()]->send_to(boost::asio::buffer(packet), target_, 0, ec);
+      if (!ec)
+        sent_++;
+    }
+  }
+private:
+  boost::asio::io_context service_;
+  boost::asio::ip::udp::endpoint target_;
+  std::vector<boost::shared_ptr<boost::asio::ip::udp::socket>> sockets_;
+  std::thread thread_;
+  std::atomic<bool> stopped_;
+  std::atomic<std::uint64_t> sent_;
+};
+
+/**
+ * An acceptor with one established stream that reads everything it gets.
+ */
+class sink {
+public:
+  sink(boost::asio::io_context &service, const boost::asio::ip::udp::endpoint &endpoint, bool limited)
+    : acceptor_(service),
+      peer_(service),
+      buffer_(65536),
+      received_(0)
+  {
+    acceptor_.set_local_extension(keys::extension);
+    acceptor_.set_local_public_key(keys::server_public);
+    acceptor_.set_local_private_key(keys::server_private);
+    acceptor_.set_nonce_generator(randombytes);
+    if (limited) {
+      acceptor_.set_source_hello_limit(10, 20);
+      acceptor_.set_hello_budget(1000, 1000);
+    }
+
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    acceptor_.async_accept(peer_, boost::bind(&sink::accept_handler, this, _1));
+  }
+
+  std::uint64_t received() const { return received_; }
+
+  curvecp::acceptor::accept_counters counters() { return acceptor_.get_accept_counters(); }
+private:
+  void accept_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      read();
+  }
+
+  void read()
+  {
+    peer_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&sink::read_handler, this, _1, _2));
+  }
+
+  void read_handler(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    received_ += bytes;
+    if (!ec)
+      read();
+  }
+private:
+  curvecp::acceptor acceptor_;
+  curvecp::stream peer_;
+  std::vector<unsigned char> buffer_;
+  std::atomic<std::uint64_t> received_;
+};
+
+/**
+ * A client stream that writes as fast as the session allows.
+ */
+class source {
+public:
+  source(boost::asio::io_context &service, const boost::asio::ip::udp::endpoint &endpoint)
+    : stream_(service),
+      buffer_(65536, 42),
+      connected_(false)
+  {
+    stream_.set_local_extension(keys::extension);
+    stream_.set_local_public_key(keys::client_public);
+    stream_.set_local_private_key(keys::client_private);
+    stream_.set_remote_extension(keys::extension);
+    stream_.set_remote_public_key(keys::server_public);
+    stream_.set_remote_domain_name("test.server");
+    stream_.set_nonce_generator(randombytes);
+    stream_.async_connect(endpoint, boost::bind(&source::connect_handler, this, _1));
+  }
+
+  bool connected() const { return connected_; }
+private:
+  void connect_handler(const boost::system::error_code &ec)
+  {
+    if (ec)
+      return;
+
+    connected_ = true;
+    write();
+  }
+
+  void write()
+  {
+    boost::asio::async_write(stream_, boost::asio::buffer(buffer_), boost::bind(&source::write_handler, this, _1));
+  }
+
+  void write_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      write();
+  }
+private:
+  curvecp::stream stream_;
+  std::vector<unsigned char> buffer_;
+  std::atomic<bool> connected_;
+};
+
+void run_phase(const char *label, unsigned short port, double seconds, std::size_t prefixes, bool flood, bool limited)
+{
+  boost::asio::io_context service;
+  boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), port);
+  sink server(service, endpoint, limited);
+  source client(service, endpoint);
+  flooder attacker(endpoint, prefixes);
+
+  std::thread worker([&service]() { service.run(); });
+  while (!client.connected())
+    std::this_thread::yield();
+
+  if (flood)
+    attacker.start();
+
+  benchmark::stopwatch wall;
+  std::uint64_t started = server.received();
+  wall.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<long>(seconds * 1000)));
+  wall.stop();
+  std::uint64_t bytes = server.received() - started;
+
+  if (flood)
+    attacker.stop();
+  service.stop();
+  worker.join();
+
+  curvecp::acceptor::accept_counters counters = server.counters();
+  std::printf("%-24s %10.2f MB/s %12.0f Hellos/s sent %10llu admitted %10llu dropped\n", label,
+    bytes / (wall.nanoseconds() / 1e9) / 1e6, attacker.sent() / (wall.nanoseconds() / 1e9),
+    static_cast<unsigned long long>(counters.hello_admitted),
+    static_cast<unsigned long long>(counters.hello_source_dropped + counters.hello_budget_dropped));
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 3.0;
+  std::size_t prefixes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+
+  if (sodium_init() == -1)
+    return 1;
+
+  std::printf("One bulk stream on loopback, flood from %zu source prefixes, limits of 10 Hellos/s per prefix\n"
+    "and 1000 Hellos/s in total when limited.\n", prefixes);
+
+  run_phase("no flood", 10011, seconds, prefixes, false, false);
+  run_phase("flood, no limits", 10012, seconds, prefixes, true, false);
+  run_phase("flood, limited", 10013, seconds, prefixes, true, true);
+  return 0;
+}
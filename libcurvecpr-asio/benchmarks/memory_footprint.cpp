@@ -0,0 +1,453 @@
+/*
+ * Connection scaling memory footprint benchmark.
+ *
+ * Brings up a number of sessions against a single acceptor on loopback and
+ * reports resident memory and heap allocations per session, first for idle
+ * sessions and then after a light round of traffic. Global operator new and
+ * delete are replaced with counting versions so that allocation counts and
+ * live heap bytes can be attributed to each phase. Each session count is
+ * measured in a separate child process so that results do not leak into
+ * each other. The heap memory held by the session object, the pending
+ * write buffer and the send and receive mark queues is measured
+ * separately on a session that is driven directly. Every session count is measured twice, once with each client
+ * stream owning its socket and once with all client streams attached to a
+ * shared-socket client endpoint, and the per-connection difference is
+ * reported.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <sodium.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+
+namespace counters {
+  std::atomic<std::uint64_t> allocations(0);
+  std::atomic<std::int64_t> live_bytes(0);
+}
+
+void *operator new(std::size_t size)
+{
+  void *ptr = std::malloc(size ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc();
+
+  counters::allocations++;
+  counters::live_bytes += malloc_usable_size(ptr);
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  if (!ptr)
+    return;
+
+  counters::live_bytes -= malloc_usable_size(ptr);
+  std::free(ptr);
+}
+
+namespace keys {
+  const std::string extension("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+  const std::string client_public("\xa3\xe7\xb1\x22\xe6\x86\x77\x7c\x39\xc3\xf8\x76\x3d\x4d\x4\xf\x39\x7\x24\x37\xa3\xf5\x7c\x5d\xfc\x56\x59\xc0\x95\xb7\xc1\x3c", 32);
+  const std::string client_private("\xd3\x51\x1b\x58\x9c\x33\x8d\xd2\x9e\x50\xe7\x14\xec\xb7\x79\x5d\x23\x51\x33\xe7\x27\x0\x40\xa\x1d\xad\x10\xd2\x4e\xac\x8e\xab", 32);
+  const std::string server_public("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32);
+  const std::string server_private("\x7a\xa4\x43\x11\x13\x5f\xb8\xe9\x1c\x3e\x2\xd3\x88\xa\x36\xce\xd0\xd8\x79\x99\x9b\xc5\xf7\x8e\x49\x90\x97\xe4\xdf\x6b\x6d\xa9", 32);
+}
+
+/**
+ * Point-in-time memory usage of the process.
+ */
+struct snapshot {
+  std::uint64_t resident;
+  std::uint64_t allocations;
+  std::int64_t live_bytes;
+
+  static snapshot take()
+  {
+    std::uint64_t size = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> size >> resident;
+
+    snapshot s;
+    s.resident = resident * sysconf(_SC_PAGESIZE);
+    s.allocations = counters::allocations;
+    s.live_bytes = counters::live_bytes;
+    return s;
+  }
+};
+
+/**
+ * Per-session cost of a complete measurement.
+ */
+struct result {
+  double resident;
+  double heap;
+};
+
+void print_delta(const char *label, const snapshot &from, const snapshot &to, std::size_t sessions)
+{
+  std::printf("  %-28s %10.0f B resident %10.0f B heap %8.1f allocations\n", label,
+    static_cast<double>(to.resident - from.resident) / sessions,
+    static_cast<double>(to.live_bytes - from.live_bytes) / sessions,
+    static_cast<double>(to.allocations - from.allocations) / sessions);
+}
+
+struct peer {
+  peer(boost::asio::io_context &service)
+    : stream(service),
+      buffer(64, 104)
+  {
+  }
+
+  peer(curvecp::client_endpoint &endpoint)
+    : stream(endpoint),
+      buffer(64, 104)
+  {
+  }
+
+  curvecp::stream stream;
+  std::vector<char> buffer;
+};
+
+class footprint {
+public:
+  footprint(boost::asio::io_context &service, std::size_t sessions, curvecp::client_endpoint *shared)
+    : service_(service),
+      acceptor_(service),
+      endpoint_(boost::asio::ip::make_address("127.0.0.1"), 10002),
+      sessions_(sessions),
+      shared_(shared),
+      next_connect_(0),
+      remaining_(0)
+  {
+    acceptor_.set_local_extension(keys::extension);
+    acceptor_.set_local_public_key(keys::server_public);
+    acceptor_.set_local_private_key(keys::server_private);
+    acceptor_.set_nonce_generator(randombytes);
+  }
+
+  result run()
+  {
+    acceptor_.bind(endpoint_);
+    acceptor_.listen();
+    accept();
+
+    snapshot baseline = snapshot::take();
+
+    // Construct client streams without connecting them
+    for (std::size_t i = 0; i < sessions_; i++) {
+      boost::shared_ptr<peer> client;
+      if (shared_) {
+        // The local extension is assigned by the endpoint
+        client = boost::make_shared<peer>(*shared_);
+      } else {
+        client = boost::make_shared<peer>(service_);
+        client->stream.set_local_extension(keys::extension);
+      }
+      client->stream.set_local_public_key(keys::client_public);
+      client->stream.set_local_private_key(keys::client_private);
+      client->stream.set_remote_extension(keys::extension);
+      client->stream.set_remote_public_key(keys::server_public);
+      client->stream.set_remote_domain_name("test.server");
+      client->stream.set_nonce_generator(randombytes);
+      clients_.push_back(client);
+    }
+    snapshot constructed = snapshot::take();
+
+    // Connect all clients and send a single byte so that the server creates
+    // a session; these sessions are then left idle
+    remaining_ = sessions_ * 2;
+    for (std::size_t i = 0; i < 256 && next_connect_ < sessions_; i++)
+      connect();
+    wait();
+    snapshot idle = snapshot::take();
+
+    // Exchange a 64-byte echo on every session
+    remaining_ = sessions_;
+    for (auto &client : clients_)
+      echo(client);
+    wait();
+    snapshot active = snapshot::take();
+
+    std::printf("%zu sessions, %s (client and server side in one process):\n", sessions_,
+      shared_ ? "shared client endpoint" : "socket per client");
+    print_delta("client stream construction", baseline, constructed, sessions_);
+    print_delta("idle session establishment", constructed, idle, sessions_);
+    print_delta("light activity (64 B echo)", idle, active, sessions_);
+    print_delta("total", baseline, active, sessions_);
+
+    result r;
+    r.resident = static_cast<double>(active.resident - baseline.resident) / sessions_;
+    r.heap = static_cast<double>(active.live_bytes - baseline.live_bytes) / sessions_;
+    return r;
+  }
+private:
+  void wait()
+  {
+    service_.restart();
+    service_.run();
+  }
+
+  void done()
+  {
+    if (--remaining_ == 0)
+      service_.stop();
+  }
+
+  void accept()
+  {
+    boost::shared_ptr<peer> server_peer(boost::make_shared<peer>(service_));
+    acceptor_.async_accept(server_peer->stream,
+      boost::bind(&footprint::accept_handler, this, server_peer, _1));
+  }
+
+  void accept_handler(boost::shared_ptr<peer> server_peer, const boost::system::error_code &ec)
+  {
+    if (!ec) {
+      servers_.push_back(server_peer);
+      boost::asio::async_read(server_peer->stream, boost::asio::buffer(&server_peer->buffer[0], 1),
+        boost::bind(&footprint::server_read_handler, this, server_peer, _1, _2));
+    }
+
+    accept();
+  }
+
+  void server_read_handler(boost::shared_ptr<peer> server_peer,
+                           const boost::system::error_code &ec,
+                           std::size_t bytes)
+  {
+    done();
+
+    // Echo the 64-byte message sent during the activity phase
+    boost::asio::async_read(server_peer->stream, boost::asio::buffer(server_peer->buffer),
+      boost::bind(&footprint::server_echo_handler, this, server_peer, _1, _2));
+  }
+
+  void server_echo_handler(boost::shared_ptr<peer> server_peer,
+                           const boost::system::error_code &ec,
+                           std::size_t bytes)
+  {
+    if (ec)
+      return;
+
+    boost::asio::async_write(server_peer->stream, boost::asio::buffer(server_peer->buffer),
+      [server_peer](const boost::system::error_code&, std::size_t) {});
+  }
+
+  void connect()
+  {
+    boost::shared_ptr<peer> client = clients_[next_connect_++];
+    client->stream.async_connect(endpoint_,
+      boost::bind(&footprint::connect_handler, this, client, _1));
+  }
+
+  void connect_handler(boost::shared_ptr<peer> client, const boost::system::error_code &ec)
+  {
+    if (ec) {
+      std::printf("Connect failed: %s\n", ec.message().c_str());
+      std::exit(1);
+    }
+
+    boost::asio::async_write(client->stream, boost::asio::buffer(&client->buffer[0], 1),
+      boost::bind(&footprint::client_write_handler, this, client, _1, _2));
+
+    if (next_connect_ < sessions_)
+      connect();
+  }
+
+  void client_write_handler(boost::shared_ptr<peer> client,
+                            const boost::system::error_code &ec,
+                            std::size_t bytes)
+  {
+    done();
+  }
+
+  void echo(boost::shared_ptr<peer> client)
+  {
+    boost::asio::async_write(client->stream, boost::asio::buffer(client->buffer),
+      [](const boost::system::error_code&, std::size_t) {});
+    boost::asio::async_read(client->stream, boost::asio::buffer(client->buffer),
+      boost::bind(&footprint::client_read_handler, this, client, _1, _2));
+  }
+
+  void client_read_handler(boost::shared_ptr<peer> client,
+                           const boost::system::error_code &ec,
+                           std::size_t bytes)
+  {
+    done();
+  }
+private:
+  boost::asio::io_context &service_;
+  curvecp::acceptor acceptor_;
+  boost::asio::ip::udp::endpoint endpoint_;
+  std::size_t sessions_;
+  curvecp::client_endpoint *shared_;
+  std::size_t next_connect_;
+  std::size_t remaining_;
+  std::vector<boost::shared_ptr<peer>> clients_;
+  std::vector<boost::shared_ptr<peer>> servers_;
+};
+
+/**
+ * Measures the heap memory held by each component of a session. A session
+ * is driven directly through a transfer, and the counting allocator is read
+ * around each step: constructing the session, the first write, blocks kept
+ * in flight and blocks received after a gap.
+ */
+void print_session_components()
+{
+  const std::size_t blocks = 64;
+  boost::asio::io_context service;
+  std::vector<unsigned char> data(blocks * sizeof(curvecpr_block::data), 104);
+
+  snapshot before = snapshot::take();
+  std::unique_ptr<benchmark::session_driver> driver(new benchmark::session_driver(service));
+  snapshot constructed = snapshot::take();
+
+  // The pending write buffer is allocated on the first write
+  boost::system::error_code ec;
+  std::size_t bytes;
+  driver->write(boost::asio::buffer(data), ec, bytes);
+  snapshot written = snapshot::take();
+
+  // Move the written blocks into the send mark queue and keep them there,
+  // as if none of them had been acknowledged yet
+  std::size_t sent_blocks = 0;
+  std::uint64_t offset = 0;
+  curvecpr_block *head;
+  while (driver->sendq_head(&head) == 0) {
+    head->id = static_cast<crypto_uint32>(++sent_blocks);
+    head->offset = offset;
+    head->clock = sent_blocks;
+    offset += head->data_len;
+    if (driver->sendq_move_to_sendmarkq(head, nullptr) != 0) {
+      sent_blocks--;
+      break;
+    }
+  }
+  snapshot sent = snapshot::take();
+
+  // Receive blocks after a missing one, so that they wait in the receive
+  // mark queue
+  curvecpr_block block;
+  std::memset(&block, 0, sizeof(block));
+  block.eof = CURVECPR_BLOCK_STREAM;
+  block.data_len = sizeof(block.data);
+  for (std::size_t i = 1; i <= blocks; i++) {
+    block.offset = i * sizeof(block.data);
+    driver->recvmarkq_put(&block);
+  }
+  snapshot received = snapshot::take();
+
+  driver->finish();
+  driver.reset();
+
+  auto print = [](const char *label, const snapshot &from, const snapshot &to, std::size_t count) {
+    std::printf("  %-28s %10.0f B heap %8.1f allocations\n", label,
+      count ? static_cast<double>(to.live_bytes - from.live_bytes) / count : 0.0,
+      count ? static_cast<double>(to.allocations - from.allocations) / count : 0.0);
+  };
+
+  std::printf("Per-session components (measured on a session driven directly):\n");
+  print("session object", before, constructed, 1);
+  print("pending write buffer", constructed, written, 1);
+  print("send mark queue, per block", written, sent, sent_blocks);
+  print("receive mark queue, per block", sent, received, blocks);
+}
+
+bool measure(std::size_t sessions, bool shared, result &r)
+{
+  boost::asio::io_context io_context;
+  if (shared) {
+    curvecp::client_endpoint endpoint(io_context,
+      boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0), 4);
+    footprint bench(io_context, sessions, &endpoint);
+    r = bench.run();
+    return true;
+  }
+
+  // Every client stream uses its own UDP socket
+  struct rlimit limit;
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < sessions + 64) {
+    std::printf("%zu sessions, socket per client: skipped, file descriptor limit is %lu\n",
+      sessions, static_cast<unsigned long>(limit.rlim_cur));
+    return false;
+  }
+
+  footprint bench(io_context, sessions, nullptr);
+  r = bench.run();
+  return true;
+}
+
+/**
+ * Runs a single measurement in a child process.
+ */
+bool measure_in_child(std::size_t sessions, bool shared, result &r)
+{
+  int fds[2];
+  if (pipe(fds) == -1)
+    return false;
+
+  std::fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    result child;
+    bool ok = measure(sessions, shared, child);
+    if (ok && write(fds[1], &child, sizeof(child)) != sizeof(child))
+      ok = false;
+    std::fflush(stdout);
+    _exit(ok ? 0 : 1);
+  }
+
+  close(fds[1]);
+  bool ok = read(fds[0], &r, sizeof(r)) == sizeof(r);
+  close(fds[0]);
+
+  int status;
+  waitpid(pid, &status, 0);
+  return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (sodium_init() == -1)
+    return 1;
+
+  print_session_components();
+
+  if (argc > 1) {
+    result r;
+    bool shared = argc > 2 && std::string(argv[2]) == "shared";
+    return measure(std::strtoul(argv[1], nullptr, 10), shared, r) ? 0 : 1;
+  }
+
+  for (std::size_t sessions : { 1000, 10000, 100000 }) {
+    result own, shared;
+    bool have_own = measure_in_child(sessions, false, own);
+    bool have_shared = measure_in_child(sessions, true, shared);
+
+    if (have_own && have_shared) {
+      std::printf("%zu sessions: shared client endpoint saves %.0f B resident, %.0f B heap per connection\n",
+        sessions, own.resident - shared.resident, own.heap - shared.heap);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,346 @@
+/*
+ * Multipath transport benchmark.
+ *
+ * Echoes datagrams between a client and a server multipath transport, each
+ * with two UDP paths on loopback, while the second path of the client is
+ * impaired by added delay, loss and finally a complete failure. For every
+ * phase it reports the echo rate, the share of datagrams each side sent
+ * over each path and the path estimates, showing how traffic moves to the
+ * faster path and back once the impairment is lifted.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <utility>
+
+/**
+ * Transport that impairs the datagrams sent by another transport with a
+ * fixed delay and random loss.
+ */
+class impaired_transport : public curvecp::transport {
+public:
+  explicit impaired_transport(boost::shared_ptr<curvecp::transport> inner)
+    : inner_(inner),
+      loss_(0.0)
+  {
+  }
+
+  void set_delay(const boost::posix_time::time_duration &delay) { delay_ = delay; }
+
+  void set_loss(double loss) { loss_ = loss; }
+
+  boost::asio::io_context &get_io_context() override { return inner_->get_io_context(); }
+
+  void bind(const endpoint_type &endpoint) override { inner_->bind(endpoint); }
+
+  void connect(const endpoint_type &endpoint) override { inner_->connect(endpoint); }
+
+  void open(const endpoint_type &endpoint) override { inner_->open(endpoint); }
+
+  void close() override { inner_->close(); }
+
+  endpoint_type local_endpoint() const override { return inner_->local_endpoint(); }
+
+  void async_receive(const boost::asio::mutable_buffer &buffer, handler_type handler) override
+  {
+    inner_->async_receive(buffer, std::move(handler));
+  }
+
+  void async_receive_from(const boost::asio::mutable_buffer &buffer, endpoint_type &sender,
+                          handler_type handler) override
+  {
+    inner_->async_receive_from(buffer, sender, std::move(handler));
+  }
+
+  std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer, endpoint_type &sender,
+                               boost::system::error_code &ec) override
+  {
+    return inner_->try_receive_from(buffer, sender, ec);
+  }
+
+  void async_send(const boost::asio::const_buffer &buffer, handler_type handler) override
+  {
+    impair(buffer, nullptr, std::move(handler));
+  }
+
+  void async_send_to(const boost::asio::const_buffer &buffer, const endpoint_type &destination,
+                     handler_type handler) override
+  {
+    impair(buffer, &destination, std::move(handler));
+  }
+private:
+  void impair(const boost::asio::const_buffer &buffer, const endpoint_type *destination, handler_type handler)
+  {
+    std::size_t size = boost::asio::buffer_size(buffer);
+    curvecp::detail::post_transport_handler(get_io_context(), std::move(handler), boost::system::error_code(), size);
+    if (std::uniform_real_distribution<double>(0.0, 1.0)(random_) < loss_)
+      return;
+
+    // The datagram is copied and sent once the delay has passed
+    const unsigned char *data = boost::asio::buffer_cast<const unsigned char*>(buffer);
+    boost::shared_ptr<std::vector<unsigned char>> copy(boost::make_shared<std::vector<unsigned char>>(data, data + size));
+    boost::shared_ptr<boost::asio::deadline_timer> timer(boost::make_shared<boost::asio::deadline_timer>(get_io_context()));
+    boost::shared_ptr<curvecp::transport> inner(inner_);
+    bool connected = !destination;
+    endpoint_type target = destination ? *destination : endpoint_type();
+
+    timer->expires_from_now(delay_);
+    timer->async_wait([inner, copy, timer, connected, target](const boost::system::error_code &ec) {
+      if (ec)
+        return;
+
+      auto handler = [copy](const boost::system::error_code&, std::size_t) {};
+      if (connected)
+        inner->async_send(boost::asio::buffer(*copy), handler);
+      else
+        inner->async_send_to(boost::asio::buffer(*copy), target, handler);
+    });
+  }
+private:
+  boost::shared_ptr<curvecp::transport> inner_;
+  boost::posix_time::time_duration delay_;
+  double loss_;
+  std::minstd_rand random_;
+};
+
+/**
+ * Echoes every datagram back to its sender.
+ */
+class echo_server {
+public:
+  explicit echo_server(boost::shared_ptr<curvecp::multipath_transport> transport)
+    : transport_(transport),
+      buffer_(65535)
+  {
+  }
+
+  void start() { receive(); }
+private:
+  void receive()
+  {
+    transport_->async_receive_from(boost::asio::buffer(buffer_), sender_,
+      boost::bind(&echo_server::receive_handler, this, _1, _2));
+  }
+
+  void receive_handler(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    if (ec == boost::asio::error::operation_aborted)
+      return;
+
+    if (!ec) {
+      boost::shared_ptr<std::vector<unsigned char>> reply(
+        boost::make_shared<std::vector<unsigned char>>(buffer_.begin(), buffer_.begin() + bytes));
+      transport_->async_send_to(boost::asio::buffer(*reply), sender_,
+        [reply](const boost::system::error_code&, std::size_t) {});
+    }
+
+    receive();
+  }
+private:
+  boost::shared_ptr<curvecp::multipath_transport> transport_;
+  std::vector<unsigned char> buffer_;
+  curvecp::transport::endpoint_type sender_;
+};
+
+/**
+ * Keeps a window of datagrams in flight and replaces datagrams that were
+ * echoed or are presumed lost.
+ */
+class echo_client {
+public:
+  echo_client(boost::shared_ptr<curvecp::multipath_transport> transport, std::size_t window)
+    : transport_(transport),
+      window_(window),
+      datagram_(1184, 42),
+      buffer_(65535),
+      loss_timer_(transport->get_io_context()),
+      next_(0),
+      echoed_(0)
+  {
+  }
+
+  void start()
+  {
+    receive();
+    while (in_flight_.size() < window_)
+      send();
+    schedule_loss_check();
+  }
+
+  std::uint64_t echoed() const { return echoed_; }
+private:
+  void send()
+  {
+    std::uint64_t sequence = next_++;
+    std::memcpy(&datagram_[0], &sequence, sizeof(sequence));
+    in_flight_[sequence] = benchmark::stopwatch::clock::now();
+    transport_->async_send(boost::asio::buffer(datagram_), [](const boost::system::error_code&, std::size_t) {});
+  }
+
+  void receive()
+  {
+    transport_->async_receive(boost::asio::buffer(buffer_), boost::bind(&echo_client::receive_handler, this, _1, _2));
+  }
+
+  void receive_handler(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    if (ec == boost::asio::error::operation_aborted)
+      return;
+
+    std::uint64_t sequence;
+    if (!ec && bytes >= sizeof(sequence)) {
+      std::memcpy(&sequence, &buffer_[0], sizeof(sequence));
+      if (in_flight_.erase(sequence)) {
+        echoed_++;
+        send();
+      }
+    }
+
+    receive();
+  }
+
+  void schedule_loss_check()
+  {
+    loss_timer_.expires_from_now(boost::posix_time::milliseconds(20));
+    loss_timer_.async_wait(boost::bind(&echo_client::handle_loss_check, this, _1));
+  }
+
+  void handle_loss_check(const boost::system::error_code &ec)
+  {
+    if (ec)
+      return;
+
+    // Datagrams that have not been echoed within 100 ms are replaced
+    benchmark::stopwatch::clock::time_point deadline = benchmark::stopwatch::clock::now() - std::chrono::milliseconds(100);
+    for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+      if (it->second < deadline)
+        it = in_flight_.erase(it);
+      else
+        ++it;
+    }
+
+    while (in_flight_.size() < window_)
+      send();
+    schedule_loss_check();
+  }
+private:
+  boost::shared_ptr<curvecp::multipath_transport> transport_;
+  std::size_t window_;
+  std::vector<unsigned char> datagram_;
+  std::vector<unsigned char> buffer_;
+  boost::asio::deadline_timer loss_timer_;
+  std::map<std::uint64_t, benchmark::stopwatch::clock::time_point> in_flight_;
+  std::uint64_t next_;
+  std::uint64_t echoed_;
+};
+
+boost::shared_ptr<curvecp::socket_transport> make_socket(boost::asio::io_context &service)
+{
+  boost::shared_ptr<curvecp::socket_transport> socket(boost::make_shared<curvecp::socket_transport>(service));
+  socket->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+  return socket;
+}
+
+void configure(curvecp::multipath_transport &transport)
+{
+  transport.set_probe_interval(boost::posix_time::milliseconds(20));
+  transport.set_path_timeout(boost::posix_time::milliseconds(200));
+}
+
+void print_shares(const char *side, const std::vector<curvecp::multipath_transport::path_statistics> &before,
+                  const std::vector<curvecp::multipath_transport::path_statistics> &after)
+{
+  std::uint64_t total = 0;
+  for (std::size_t i = 0; i < after.size(); i++)
+    total += after[i].sent - (i < before.size() ? before[i].sent : 0);
+
+  std::printf("  %s:", side);
+  for (std::size_t i = 0; i < after.size(); i++) {
+    std::uint64_t sent = after[i].sent - (i < before.size() ? before[i].sent : 0);
+    std::printf(" path %zu %5.1f%% (rtt %6.0f us, loss %4.2f, %s)", after[i].path,
+      total ? 100.0 * sent / total : 0.0, after[i].rtt.total_microseconds() * 1.0, after[i].loss,
+      after[i].up ? "up" : "down");
+  }
+  std::printf("\n");
+}
+
+void run(bool multipath, double seconds)
+{
+  boost::asio::io_context service;
+
+  boost::shared_ptr<curvecp::multipath_transport> server(boost::make_shared<curvecp::multipath_transport>(service));
+  boost::shared_ptr<curvecp::socket_transport> server_paths[2] = { make_socket(service), make_socket(service) };
+  server->add_path(server_paths[0]);
+  server->add_path(server_paths[1]);
+  configure(*server);
+
+  boost::shared_ptr<curvecp::multipath_transport> client(boost::make_shared<curvecp::multipath_transport>(service));
+  boost::shared_ptr<impaired_transport> impaired(boost::make_shared<impaired_transport>(make_socket(service)));
+  client->add_path(make_socket(service), server_paths[0]->local_endpoint());
+  if (multipath)
+    client->add_path(impaired, server_paths[1]->local_endpoint());
+  configure(*client);
+  client->connect(server_paths[0]->local_endpoint());
+
+  echo_server echo(server);
+  echo.start();
+  echo_client load(client, 64);
+  load.start();
+
+  struct phase {
+    const char *name;
+    boost::posix_time::time_duration delay;
+    double loss;
+  };
+  const phase phases[] = {
+    { "both paths clean", boost::posix_time::time_duration(), 0.0 },
+    { "path 1 +2 ms delay", boost::posix_time::milliseconds(2), 0.0 },
+    { "path 1 20% loss", boost::posix_time::time_duration(), 0.2 },
+    { "path 1 down", boost::posix_time::time_duration(), 1.0 },
+    { "path 1 restored", boost::posix_time::time_duration(), 0.0 },
+  };
+
+  for (const phase &p : phases) {
+    impaired->set_delay(p.delay);
+    impaired->set_loss(p.loss);
+
+    std::vector<curvecp::multipath_transport::path_statistics> client_before = client->get_path_statistics();
+    std::vector<curvecp::multipath_transport::path_statistics> server_before = server->get_path_statistics();
+    std::uint64_t echoed = load.echoed();
+
+    benchmark::stopwatch wall;
+    wall.start();
+    service.run_for(std::chrono::milliseconds(static_cast<long>(seconds * 1000)));
+    wall.stop();
+
+    std::printf("%-10s %-20s | %10.0f echoes/s\n", multipath ? "two paths" : "one path", p.name,
+      (load.echoed() - echoed) / (wall.nanoseconds() / 1e9));
+    print_shares("client", client_before, client->get_path_statistics());
+    print_shares("server", server_before, server->get_path_statistics());
+
+    if (!multipath)
+      break;
+  }
+
+  client->close();
+  server->close();
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 2.0;
+
+  std::printf("1184 B datagrams echoed on loopback, 64 in flight, one thread.\n");
+  run(false, seconds);
+  run(true, seconds);
+  return 0;
+}
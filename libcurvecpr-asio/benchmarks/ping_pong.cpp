@@ -0,0 +1,224 @@
+/*
+ * Ping-pong latency benchmark.
+ *
+ * Bounces a small message between a client stream and an accepted stream
+ * on loopback, one message in flight at a time, and reports the round-trip
+ * latency distribution. Each peer runs its own IO context on its own
+ * thread. The peers either use the default reactor-driven socket transport
+ * or the busy polling transport, whose pinned threads spin on the sockets
+ * instead of sleeping until woken up by the reactor. Busy polling needs a
+ * spare core for each polling thread to pay off.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <sodium.h>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+namespace keys {
+  const std::string extension("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+  const std::string client_public("\xa3\xe7\xb1\x22\xe6\x86\x77\x7c\x39\xc3\xf8\x76\x3d\x4d\x4\xf\x39\x7\x24\x37\xa3\xf5\x7c\x5d\xfc\x56\x59\xc0\x95\xb7\xc1\x3c", 32);
+  const std::string client_private("\xd3\x51\x1b\x58\x9c\x33\x8d\xd2\x9e\x50\xe7\x14\xec\xb7\x79\x5d\x23\x51\x33\xe7\x27\x0\x40\xa\x1d\xad\x10\xd2\x4e\xac\x8e\xab", 32);
+  const std::string server_public("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32);
+  const std::string server_private("\x7a\xa4\x43\x11\x13\x5f\xb8\xe9\x1c\x3e\x2\xd3\x88\xa\x36\xce\xd0\xd8\x79\x99\x9b\xc5\xf7\x8e\x49\x90\x97\xe4\xdf\x6b\x6d\xa9", 32);
+}
+
+const std::size_t message_size = 64;
+
+boost::shared_ptr<curvecp::transport> make_transport(boost::asio::io_context &service, bool busy_poll, int cpu)
+{
+#if defined(CURVECP_ASIO_HAS_BUSY_POLL)
+  if (busy_poll)
+    return boost::make_shared<curvecp::busy_poll_transport>(service, cpu);
+#endif
+  return boost::make_shared<curvecp::socket_transport>(service);
+}
+
+/**
+ * Accepts one stream and echoes every message back.
+ */
+class echo_server {
+public:
+  echo_server(boost::asio::io_context &service, bool busy_poll, int cpu)
+    : acceptor_(make_transport(service, busy_poll, cpu)),
+      peer_(service),
+      buffer_(message_size)
+  {
+    acceptor_.set_local_extension(keys::extension);
+    acceptor_.set_local_public_key(keys::server_public);
+    acceptor_.set_local_private_key(keys::server_private);
+    acceptor_.set_nonce_generator(randombytes);
+  }
+
+  void start(const curvecp::transport::endpoint_type &endpoint)
+  {
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    acceptor_.async_accept(peer_, boost::bind(&echo_server::accept_handler, this, _1));
+  }
+
+  curvecp::transport::endpoint_type local_endpoint() const { return acceptor_.local_endpoint(); }
+private:
+  void accept_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      read();
+  }
+
+  void read()
+  {
+    boost::asio::async_read(peer_, boost::asio::buffer(buffer_),
+      boost::bind(&echo_server::read_handler, this, _1));
+  }
+
+  void read_handler(const boost::system::error_code &ec)
+  {
+    if (ec)
+      return;
+
+    boost::asio::async_write(peer_, boost::asio::buffer(buffer_),
+      boost::bind(&echo_server::write_handler, this, _1));
+  }
+
+  void write_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      read();
+  }
+private:
+  curvecp::acceptor acceptor_;
+  curvecp::stream peer_;
+  std::vector<unsigned char> buffer_;
+};
+
+/**
+ * Sends a message, waits for its echo and records the round trip.
+ */
+class ping_client {
+public:
+  ping_client(boost::asio::io_context &service, bool busy_poll, int cpu, std::size_t warmup, std::size_t rounds)
+    : stream_(make_transport(service, busy_poll, cpu)),
+      message_(message_size, 42),
+      reply_(message_size),
+      warmup_(warmup),
+      rounds_(rounds),
+      completed_(0),
+      done_(false)
+  {
+    stream_.set_local_extension(keys::extension);
+    stream_.set_local_public_key(keys::client_public);
+    stream_.set_local_private_key(keys::client_private);
+    stream_.set_remote_extension(keys::extension);
+    stream_.set_remote_public_key(keys::server_public);
+    stream_.set_remote_domain_name("test.server");
+    stream_.set_nonce_generator(randombytes);
+  }
+
+  void start(const curvecp::transport::endpoint_type &endpoint)
+  {
+    stream_.async_connect(endpoint, boost::bind(&ping_client::connect_handler, this, _1));
+  }
+
+  bool done() const { return done_; }
+
+  benchmark::histogram &latency() { return latency_; }
+private:
+  void connect_handler(const boost::system::error_code &ec)
+  {
+    if (ec) {
+      done_ = true;
+      return;
+    }
+
+    ping();
+  }
+
+  void ping()
+  {
+    started_ = benchmark::stopwatch::clock::now();
+    boost::asio::async_write(stream_, boost::asio::buffer(message_),
+      [](const boost::system::error_code&, std::size_t) {});
+    boost::asio::async_read(stream_, boost::asio::buffer(reply_),
+      boost::bind(&ping_client::read_handler, this, _1));
+  }
+
+  void read_handler(const boost::system::error_code &ec)
+  {
+    if (ec) {
+      done_ = true;
+      return;
+    }
+
+    if (completed_++ >= warmup_) {
+      latency_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        benchmark::stopwatch::clock::now() - started_).count() / 1000.0);
+    }
+
+    if (completed_ >= warmup_ + rounds_)
+      done_ = true;
+    else
+      ping();
+  }
+private:
+  curvecp::stream stream_;
+  std::vector<unsigned char> message_;
+  std::vector<unsigned char> reply_;
+  std::size_t warmup_;
+  std::size_t rounds_;
+  std::size_t completed_;
+  benchmark::stopwatch::clock::time_point started_;
+  benchmark::histogram latency_;
+  std::atomic<bool> done_;
+};
+
+void run(const char *label, bool busy_poll, std::size_t rounds)
+{
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  boost::asio::io_context server_service;
+  boost::asio::io_context client_service;
+
+  echo_server server(server_service, busy_poll, 0);
+  server.start(curvecp::transport::endpoint_type(
+    boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0)));
+
+  ping_client client(client_service, busy_poll, static_cast<int>(1 % cores), rounds / 10, rounds);
+  client.start(server.local_endpoint());
+
+  std::thread server_thread([&server_service]() { server_service.run(); });
+  std::thread client_thread([&client_service]() { client_service.run(); });
+
+  while (!client.done())
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  client.latency().print(label, "us");
+
+  client_service.stop();
+  server_service.stop();
+  client_thread.join();
+  server_thread.join();
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t rounds = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+
+  if (sodium_init() == -1)
+    return 1;
+
+  std::printf("%zu B messages bounced on loopback, one in flight, %u cores.\n", message_size,
+    std::thread::hardware_concurrency());
+
+  run("epoll", false, rounds);
+#if defined(CURVECP_ASIO_HAS_BUSY_POLL)
+  run("busy poll", true, rounds);
+#endif
+  return 0;
+}
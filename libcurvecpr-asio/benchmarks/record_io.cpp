@@ -0,0 +1,174 @@
+/*
+ * Record I/O benchmark.
+ *
+ * Reads and writes batches of small fixed-size records on a detail::session
+ * driven directly, without any sockets or crypto, and compares the cost per
+ * record of the generic boost::asio::async_read and async_write composed
+ * operations with the native async_read_exactly and async_write_all
+ * operations. Records are read and written either one per operation or as
+ * a scatter/gather sequence of one buffer per record. Received data is
+ * delivered into the session before each batch, so the measurements show
+ * the per-operation overhead rather than waiting.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <cstdlib>
+
+/**
+ * How records are transferred.
+ */
+enum class method {
+  // boost::asio::async_read/async_write, one record per operation
+  asio_single,
+  // boost::asio::async_read/async_write, one buffer per record
+  asio_sequence,
+  // async_read_exactly/async_write_all, one record per operation
+  native_single,
+  // async_read_exactly/async_write_all, one buffer per record
+  native_sequence
+};
+
+const char *method_name(method m)
+{
+  switch (m) {
+    case method::asio_single: return "asio, single";
+    case method::asio_sequence: return "asio, sequence";
+    case method::native_single: return "native, single";
+    case method::native_sequence: return "native, sequence";
+  }
+  return "?";
+}
+
+class record_benchmark {
+public:
+  record_benchmark(method m, std::size_t record, std::size_t batch)
+    : driver_(service_),
+      stream_(driver_),
+      method_(m),
+      record_(record),
+      batch_(batch),
+      data_(record * batch, 104),
+      records_(0)
+  {
+    for (std::size_t i = 0; i < batch_; i++) {
+      read_buffers_.push_back(boost::asio::buffer(&data_[i * record_], record_));
+      write_buffers_.push_back(boost::asio::buffer(&data_[i * record_], record_));
+    }
+  }
+
+  void run(std::size_t batches)
+  {
+    for (std::size_t i = 0; i < batches; i++) {
+      driver_.deliver(nullptr, record_ * batch_);
+
+      read_time_.start();
+      read_batch();
+      read_time_.stop();
+
+      write_time_.start();
+      write_batch();
+      write_time_.stop();
+
+      driver_.drain();
+      records_ += batch_;
+    }
+  }
+
+  void print()
+  {
+    std::printf("%-18s %6zu %6zu | %10.1f %10.1f\n", method_name(method_), record_, batch_,
+      benchmark::per_op(read_time_.nanoseconds(), records_),
+      benchmark::per_op(write_time_.nanoseconds(), records_));
+  }
+private:
+  void poll()
+  {
+    service_.poll();
+    service_.restart();
+  }
+
+  void read_batch()
+  {
+    auto handler = [](const boost::system::error_code&, std::size_t) {};
+
+    switch (method_) {
+      case method::asio_single: {
+        for (std::size_t i = 0; i < batch_; i++) {
+          boost::asio::async_read(stream_, read_buffers_[i], handler);
+          poll();
+        }
+        break;
+      }
+      case method::asio_sequence: boost::asio::async_read(stream_, read_buffers_, handler); poll(); break;
+      case method::native_single: {
+        for (std::size_t i = 0; i < batch_; i++) {
+          stream_.async_read_exactly(read_buffers_[i], handler);
+          poll();
+        }
+        break;
+      }
+      case method::native_sequence: stream_.async_read_exactly(read_buffers_, handler); poll(); break;
+    }
+  }
+
+  void write_batch()
+  {
+    auto handler = [](const boost::system::error_code&, std::size_t) {};
+
+    switch (method_) {
+      case method::asio_single: {
+        for (std::size_t i = 0; i < batch_; i++) {
+          boost::asio::async_write(stream_, write_buffers_[i], handler);
+          poll();
+        }
+        break;
+      }
+      case method::asio_sequence: boost::asio::async_write(stream_, write_buffers_, handler); poll(); break;
+      case method::native_single: {
+        for (std::size_t i = 0; i < batch_; i++) {
+          stream_.async_write_all(write_buffers_[i], handler);
+          poll();
+        }
+        break;
+      }
+      case method::native_sequence: stream_.async_write_all(write_buffers_, handler); poll(); break;
+    }
+  }
+private:
+  boost::asio::io_context service_;
+  benchmark::session_driver driver_;
+  benchmark::driver_stream stream_;
+  method method_;
+  std::size_t record_;
+  std::size_t batch_;
+  std::vector<unsigned char> data_;
+  std::vector<boost::asio::mutable_buffer> read_buffers_;
+  std::vector<boost::asio::const_buffer> write_buffers_;
+  benchmark::stopwatch read_time_, write_time_;
+  std::uint64_t records_;
+};
+
+int main(int argc, char **argv)
+{
+  std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  std::printf("All timings in ns per record.\n");
+  std::printf("%-18s %6s %6s | %10s %10s\n", "method", "record", "batch", "read", "write");
+
+  for (std::size_t record : { 64, 512 }) {
+    for (std::size_t batch : { 16, 64 }) {
+      for (method m : { method::asio_single, method::asio_sequence, method::native_single, method::native_sequence }) {
+        record_benchmark bench(m, record, batch);
+        bench.run(std::max<std::size_t>(records / batch, 10));
+        bench.print();
+      }
+    }
+  }
+
+  return 0;
+}
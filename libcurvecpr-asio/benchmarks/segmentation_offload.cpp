@@ -0,0 +1,258 @@
+/*
+ * UDP segmentation offload benchmark.
+ *
+ * Measures bulk throughput over UDP on loopback with and without
+ * segmentation offload on the socket transports. The first part sends
+ * bursts of CurveCP-sized datagrams between two transports directly, so
+ * it shows the cost of the datagram path alone: with offload each burst
+ * is handed to the kernel as a few super-datagrams and arrives coalesced.
+ * The second part streams data over a CurveCP session, where packets of
+ * the session are coalesced whenever several of them are sent while
+ * handlers run.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <sodium.h>
+
+#include <boost/asio/write.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace keys {
+  const std::string extension("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+  const std::string client_public("\xa3\xe7\xb1\x22\xe6\x86\x77\x7c\x39\xc3\xf8\x76\x3d\x4d\x4\xf\x39\x7\x24\x37\xa3\xf5\x7c\x5d\xfc\x56\x59\xc0\x95\xb7\xc1\x3c", 32);
+  const std::string client_private("\xd3\x51\x1b\x58\x9c\x33\x8d\xd2\x9e\x50\xe7\x14\xec\xb7\x79\x5d\x23\x51\x33\xe7\x27\x0\x40\xa\x1d\xad\x10\xd2\x4e\xac\x8e\xab", 32);
+  const std::string server_public("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32);
+  const std::string server_private("\x7a\xa4\x43\x11\x13\x5f\xb8\xe9\x1c\x3e\x2\xd3\x88\xa\x36\xce\xd0\xd8\x79\x99\x9b\xc5\xf7\x8e\x49\x90\x97\xe4\xdf\x6b\x6d\xa9", 32);
+}
+
+boost::shared_ptr<curvecp::socket_transport> make_transport(boost::asio::io_context &service, bool offload)
+{
+  boost::shared_ptr<curvecp::socket_transport> transport(boost::make_shared<curvecp::socket_transport>(service));
+  transport->set_segmentation_offload(offload);
+  return transport;
+}
+
+/**
+ * Sends bursts of datagrams and starts the next burst once the last
+ * datagram of the previous one has arrived.
+ */
+class burst_test {
+public:
+  burst_test(boost::asio::io_context &service, bool offload, std::size_t burst)
+    : sender_(make_transport(service, offload)),
+      receiver_(make_transport(service, offload)),
+      burst_(burst),
+      datagrams_(burst, std::vector<unsigned char>(1184, 42)),
+      buffer_(65535),
+      sent_(0),
+      received_(0),
+      bytes_(0)
+  {
+    receiver_->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    sender_->connect(receiver_->local_endpoint());
+  }
+
+  void start()
+  {
+    receive();
+    send_burst();
+  }
+
+  void stop()
+  {
+    sender_->close();
+    receiver_->close();
+  }
+
+  std::uint64_t received() const { return received_; }
+
+  std::uint64_t bytes() const { return bytes_; }
+private:
+  void send_burst()
+  {
+    for (std::vector<unsigned char> &datagram : datagrams_) {
+      std::memcpy(&datagram[0], &sent_, sizeof(sent_));
+      sent_++;
+      sender_->async_send(boost::asio::buffer(datagram), [](const boost::system::error_code&, std::size_t) {});
+    }
+  }
+
+  void receive()
+  {
+    receiver_->async_receive_from(boost::asio::buffer(buffer_), sender_endpoint_,
+      boost::bind(&burst_test::receive_handler, this, _1, _2));
+  }
+
+  void receive_handler(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    if (ec)
+      return;
+
+    received_++;
+    bytes_ += bytes;
+
+    std::uint64_t sequence;
+    std::memcpy(&sequence, &buffer_[0], sizeof(sequence));
+    if (sequence + 1 == sent_)
+      send_burst();
+
+    receive();
+  }
+private:
+  boost::shared_ptr<curvecp::socket_transport> sender_;
+  boost::shared_ptr<curvecp::socket_transport> receiver_;
+  std::size_t burst_;
+  std::vector<std::vector<unsigned char>> datagrams_;
+  std::vector<unsigned char> buffer_;
+  curvecp::transport::endpoint_type sender_endpoint_;
+  std::uint64_t sent_;
+  std::uint64_t received_;
+  std::uint64_t bytes_;
+};
+
+/**
+ * An acceptor with one established stream that reads everything it gets.
+ */
+class sink {
+public:
+  sink(boost::asio::io_context &service, bool offload)
+    : acceptor_(make_transport(service, offload)),
+      peer_(service),
+      buffer_(65536),
+      received_(0)
+  {
+    acceptor_.set_local_extension(keys::extension);
+    acceptor_.set_local_public_key(keys::server_public);
+    acceptor_.set_local_private_key(keys::server_private);
+    acceptor_.set_nonce_generator(randombytes);
+
+    acceptor_.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    acceptor_.listen();
+    acceptor_.async_accept(peer_, boost::bind(&sink::accept_handler, this, _1));
+  }
+
+  curvecp::transport::endpoint_type local_endpoint() const { return acceptor_.local_endpoint(); }
+
+  std::uint64_t received() const { return received_; }
+private:
+  void accept_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      read();
+  }
+
+  void read()
+  {
+    peer_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&sink::read_handler, this, _1, _2));
+  }
+
+  void read_handler(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    received_ += bytes;
+    if (!ec)
+      read();
+  }
+private:
+  curvecp::acceptor acceptor_;
+  curvecp::stream peer_;
+  std::vector<unsigned char> buffer_;
+  std::uint64_t received_;
+};
+
+/**
+ * A client stream that writes as fast as the session allows.
+ */
+class source {
+public:
+  source(boost::asio::io_context &service, bool offload, const curvecp::transport::endpoint_type &endpoint)
+    : stream_(make_transport(service, offload)),
+      buffer_(65536, 42)
+  {
+    stream_.set_local_extension(keys::extension);
+    stream_.set_local_public_key(keys::client_public);
+    stream_.set_local_private_key(keys::client_private);
+    stream_.set_remote_extension(keys::extension);
+    stream_.set_remote_public_key(keys::server_public);
+    stream_.set_remote_domain_name("test.server");
+    stream_.set_nonce_generator(randombytes);
+    stream_.async_connect(endpoint, boost::bind(&source::connect_handler, this, _1));
+  }
+private:
+  void connect_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      write();
+  }
+
+  void write()
+  {
+    boost::asio::async_write(stream_, boost::asio::buffer(buffer_), boost::bind(&source::write_handler, this, _1));
+  }
+
+  void write_handler(const boost::system::error_code &ec)
+  {
+    if (!ec)
+      write();
+  }
+private:
+  curvecp::stream stream_;
+  std::vector<unsigned char> buffer_;
+};
+
+void run_bursts(bool offload, std::size_t burst, double seconds)
+{
+  boost::asio::io_context service;
+  burst_test test(service, offload, burst);
+  test.start();
+
+  benchmark::stopwatch wall;
+  wall.start();
+  service.run_for(std::chrono::milliseconds(static_cast<long>(seconds * 1000)));
+  wall.stop();
+  test.stop();
+
+  std::printf("datagrams, offload %-3s %5zu burst | %10.0f datagrams/s %10.1f MB/s\n", offload ? "on" : "off", burst,
+    test.received() / (wall.nanoseconds() / 1e9), test.bytes() / (wall.nanoseconds() / 1e9) / 1e6);
+}
+
+void run_stream(bool offload, double seconds)
+{
+  boost::asio::io_context service;
+  sink server(service, offload);
+  source client(service, offload, server.local_endpoint());
+
+  benchmark::stopwatch wall;
+  wall.start();
+  service.run_for(std::chrono::milliseconds(static_cast<long>(seconds * 1000)));
+  wall.stop();
+
+  std::printf("stream, offload %-3s             | %10.1f MB/s\n", offload ? "on" : "off",
+    server.received() / (wall.nanoseconds() / 1e9) / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 2.0;
+
+  if (sodium_init() == -1)
+    return 1;
+
+#if !defined(CURVECP_ASIO_HAS_UDP_OFFLOAD)
+  std::printf("Segmentation offload is not supported on this platform, both runs use plain sends.\n");
+#endif
+  std::printf("1184 B datagrams over UDP on loopback, one thread.\n");
+
+  for (std::size_t burst : { 8, 64 }) {
+    run_bursts(false, burst, seconds);
+    run_bursts(true, burst, seconds);
+  }
+
+  run_stream(false, seconds);
+  run_stream(true, seconds);
+  return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * Session queue microbenchmark.
+ *
+ * Drives a detail::session directly through its static libcurvecpr messager
+ * callbacks, without any sockets or crypto, so that the cost of the send and
+ * receive queue data structures can be measured in isolation.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <cstdlib>
+#include <random>
+#include <utility>
+
+/**
+ * Packet loss pattern applied to the first transmission of each block.
+ */
+enum class loss_pattern {
+  // No loss
+  none,
+  // Independent random loss of 1% of blocks
+  random_1,
+  // Independent random loss of 5% of blocks
+  random_5,
+  // Gilbert-Elliott bursts averaging four blocks, about 2% overall
+  burst
+};
+
+const char *loss_pattern_name(loss_pattern pattern)
+{
+  switch (pattern) {
+    case loss_pattern::none: return "none";
+    case loss_pattern::random_1: return "rand1%";
+    case loss_pattern::random_5: return "rand5%";
+    case loss_pattern::burst: return "burst";
+  }
+  return "?";
+}
+
+/**
+ * Per-callback timing results of one configuration.
+ */
+struct results {
+  benchmark::stopwatch write, sendq, recvmarkq_put, recvmarkq_nth, recvmarkq_remove,
+    read, sendmarkq_get, sendmarkq_remove;
+  std::uint64_t writes = 0, blocks = 0, nth_calls = 0, reads = 0, bytes = 0;
+};
+
+class queue_benchmark {
+public:
+  queue_benchmark(std::size_t depth, loss_pattern loss, double reorder)
+    : driver_(service_),
+      depth_(depth),
+      loss_(loss),
+      reorder_(reorder),
+      random_(42),
+      in_burst_(false),
+      chunk_(sizeof(curvecpr_block::data), 104),
+      next_id_(0),
+      sent_offset_(0)
+  {
+    driver_.set_pending_maximum(depth * sizeof(curvecpr_block::data));
+    driver_.set_sendmarkq_maximum(depth);
+    driver_.set_recvmarkq_maximum(depth);
+  }
+
+  void run(std::size_t rounds)
+  {
+    for (std::size_t i = 0; i < rounds; i++)
+      round();
+  }
+
+  void print()
+  {
+    std::printf("%6zu %7s %7.0f%% | %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+      depth_, loss_pattern_name(loss_), reorder_ * 100,
+      benchmark::per_op(results_.write.nanoseconds(), results_.writes),
+      benchmark::per_op(results_.sendq.nanoseconds(), results_.blocks),
+      benchmark::per_op(results_.recvmarkq_put.nanoseconds(), results_.blocks),
+      benchmark::per_op(results_.recvmarkq_nth.nanoseconds(), results_.nth_calls),
+      benchmark::per_op(results_.recvmarkq_remove.nanoseconds(), results_.blocks),
+      benchmark::per_op(results_.read.nanoseconds(), results_.reads),
+      benchmark::per_op(results_.sendmarkq_get.nanoseconds(), results_.blocks),
+      benchmark::per_op(results_.sendmarkq_remove.nanoseconds(), results_.blocks));
+  }
+private:
+  bool lose_block()
+  {
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    switch (loss_) {
+      case loss_pattern::none: return false;
+      case loss_pattern::random_1: return u(random_) < 0.01;
+      case loss_pattern::random_5: return u(random_) < 0.05;
+      case loss_pattern::burst: {
+        in_burst_ = in_burst_ ? u(random_) >= 0.25 : u(random_) < 0.005;
+        return in_burst_;
+      }
+    }
+    return false;
+  }
+
+  void deliver(const std::vector<curvecpr_block*> &blocks)
+  {
+    results_.recvmarkq_put.start();
+    for (curvecpr_block *b : blocks)
+      driver_.recvmarkq_put(b);
+    results_.recvmarkq_put.stop();
+
+    // Walk unacknowledged blocks in the same way as the messager does when
+    // building acknowledgement ranges
+    std::vector<std::pair<unsigned long long, unsigned long long>> ranges;
+    results_.recvmarkq_nth.start();
+    curvecpr_block *b;
+    for (unsigned int n = 0; driver_.recvmarkq_get_nth_unacknowledged(n, &b) == 0; n++) {
+      ranges.push_back({ b->offset, b->offset + b->data_len });
+      results_.nth_calls++;
+    }
+    results_.recvmarkq_nth.stop();
+
+    results_.recvmarkq_remove.start();
+    for (const auto &range : ranges)
+      driver_.recvmarkq_remove_range(range.first, range.second);
+    results_.recvmarkq_remove.stop();
+  }
+
+  void acknowledge(const std::vector<curvecpr_block*> &blocks)
+  {
+    std::vector<std::pair<crypto_uint32, std::pair<unsigned long long, unsigned long long>>> acks;
+    for (curvecpr_block *b : blocks)
+      acks.push_back({ b->id, { b->offset, b->offset + b->data_len } });
+
+    results_.sendmarkq_get.start();
+    curvecpr_block *b;
+    for (const auto &ack : acks)
+      driver_.sendmarkq_get(ack.first, &b);
+    results_.sendmarkq_get.stop();
+
+    results_.sendmarkq_remove.start();
+    for (const auto &ack : acks)
+      driver_.sendmarkq_remove_range(ack.second.first, ack.second.second);
+    results_.sendmarkq_remove.stop();
+  }
+
+  void read(std::vector<unsigned char> &buffer)
+  {
+    boost::system::error_code ec;
+    std::size_t bytes;
+
+    results_.read.start();
+    driver_.read(boost::asio::buffer(buffer), ec, bytes);
+    results_.read.stop();
+    results_.reads++;
+  }
+
+  void round()
+  {
+    boost::system::error_code ec;
+    std::size_t bytes;
+
+    // Fill the pending write ring until it refuses more data
+    results_.write.start();
+    while (driver_.write(boost::asio::buffer(chunk_), ec, bytes))
+      results_.writes++;
+    results_.write.stop();
+
+    // Turn pending data into blocks and move them into the send mark queue
+    std::vector<curvecpr_block*> sent;
+    results_.sendq.start();
+    curvecpr_block *head;
+    while (sent.size() < depth_ && driver_.sendq_head(&head) == 0) {
+      head->id = ++next_id_;
+      head->offset = sent_offset_;
+      head->clock = next_id_;
+      sent_offset_ += head->data_len;
+
+      curvecpr_block *stored = nullptr;
+      if (driver_.sendq_move_to_sendmarkq(head, &stored) != 0)
+        break;
+      sent.push_back(stored);
+    }
+    results_.sendq.stop();
+
+    if (sent.empty())
+      return;
+
+    // Apply the loss pattern and reordering to the first transmission
+    std::vector<curvecpr_block*> delivered, lost;
+    std::size_t round_bytes = 0;
+    for (curvecpr_block *b : sent) {
+      round_bytes += b->data_len;
+      (lose_block() ? lost : delivered).push_back(b);
+    }
+
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    std::uniform_int_distribution<std::size_t> distance(1, 8);
+    for (std::size_t i = 0; i < delivered.size(); i++) {
+      if (u(random_) < reorder_)
+        std::swap(delivered[i], delivered[std::min(i + distance(random_), delivered.size() - 1)]);
+    }
+
+    std::vector<unsigned char> buffer(round_bytes);
+    deliver(delivered);
+    read(buffer);
+    acknowledge(delivered);
+
+    // Retransmissions of lost blocks complete the round
+    if (!lost.empty()) {
+      deliver(lost);
+      read(buffer);
+      acknowledge(lost);
+    }
+
+    results_.blocks += sent.size();
+    results_.bytes += round_bytes;
+  }
+private:
+  boost::asio::io_context service_;
+  benchmark::session_driver driver_;
+  std::size_t depth_;
+  loss_pattern loss_;
+  double reorder_;
+  std::mt19937 random_;
+  bool in_burst_;
+  std::vector<unsigned char> chunk_;
+  crypto_uint32 next_id_;
+  std::uint64_t sent_offset_;
+  results results_;
+};
+
+int main(int argc, char **argv)
+{
+  std::size_t blocks_per_config = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+
+  std::printf("All timings in ns per operation (read: per read call).\n");
+  std::printf("%6s %7s %8s | %8s %8s %8s %8s %8s %8s %8s %8s\n",
+    "depth", "loss", "reorder", "write", "sendq", "rq_put", "rq_nth", "rq_rm", "read", "sq_get", "sq_rm");
+
+  for (std::size_t depth : { 16, 64, 256, 512 }) {
+    for (loss_pattern loss : { loss_pattern::none, loss_pattern::random_1, loss_pattern::random_5, loss_pattern::burst }) {
+      for (double reorder : { 0.0, 0.1 }) {
+        queue_benchmark bench(depth, loss, reorder);
+        bench.run(std::max<std::size_t>(blocks_per_config / depth, 10));
+        bench.print();
+      }
+    }
+  }
+
+  return 0;
+}
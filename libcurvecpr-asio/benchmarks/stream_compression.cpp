@@ -0,0 +1,155 @@
+/*
+ * Stream compression benchmark.
+ *
+ * Streams data between two detail::session instances driven directly,
+ * without any sockets or crypto, with compression off and on. The data is
+ * either compressible JSON log records, random bytes, or alternating runs
+ * of both, which shows how quickly the sender stops and resumes compressing.
+ * For each case it reports the throughput and the processing cost per
+ * application byte of both ends together, the ratio of bytes carried in
+ * blocks to application bytes, the number of compressed and raw chunks, and
+ * the application throughput the ratio allows on a 100 Mbit/s link.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <cstdlib>
+#include <random>
+#include <string>
+
+/**
+ * Kind of data written to the stream.
+ */
+enum class payload {
+  json,
+  random,
+  mixed
+};
+
+/**
+ * Generates the data written to the stream.
+ */
+class payload_generator {
+public:
+  explicit payload_generator(payload kind)
+    : kind_(kind),
+      random_(42),
+      generated_(0)
+  {
+  }
+
+  void fill(std::vector<unsigned char> &buffer)
+  {
+    buffer.clear();
+    bool incompressible = kind_ == payload::random || (kind_ == payload::mixed && (generated_ >> 20) % 2 == 1);
+    if (incompressible) {
+      buffer.resize(65536);
+      for (unsigned char &b : buffer)
+        b = static_cast<unsigned char>(random_());
+    } else {
+      static const char *levels[] = { "debug", "info", "info", "info", "warning", "error" };
+      static const char *services[] = { "gateway", "billing", "auth", "search", "storage" };
+      char record[256];
+      while (buffer.size() < 65536) {
+        int length = std::snprintf(record, sizeof(record),
+          "{\"ts\":%llu,\"level\":\"%s\",\"service\":\"%s\",\"request_id\":\"%08x\","
+          "\"latency_ms\":%u,\"status\":%u,\"message\":\"request completed\"}\n",
+          static_cast<unsigned long long>(1400000000000ULL + generated_ + buffer.size()),
+          levels[random_() % 6], services[random_() % 5], static_cast<unsigned>(random_()),
+          static_cast<unsigned>(random_() % 500), random_() % 10 ? 200u : 503u);
+        buffer.insert(buffer.end(), record, record + length);
+      }
+    }
+    generated_ += buffer.size();
+  }
+private:
+  payload kind_;
+  std::mt19937 random_;
+  std::uint64_t generated_;
+};
+
+void run(const char *label, payload kind, bool compression, std::size_t total)
+{
+  boost::asio::io_context service;
+  benchmark::session_driver sender(service);
+  benchmark::session_driver receiver(service);
+  sender.set_compression(compression);
+  receiver.set_compression(compression);
+  // Compression is configured on the strands
+  service.poll();
+
+  // The receiver announces the codecs it can decompress first
+  receiver.drain([&](const curvecpr_block &block) { sender.deliver(block); });
+
+  payload_generator generator(kind);
+  std::vector<unsigned char> data;
+  std::vector<unsigned char> received(65536);
+  std::size_t offset = 0;
+  std::uint64_t written = 0;
+  std::uint64_t read = 0;
+  boost::system::error_code ec;
+
+  benchmark::stopwatch time;
+  time.start();
+  while (read < total) {
+    if (written < total) {
+      if (offset == data.size()) {
+        generator.fill(data);
+        offset = 0;
+      }
+      std::size_t bytes = sender.write_some(boost::asio::buffer(&data[offset], data.size() - offset), ec);
+      offset += bytes;
+      written += bytes;
+    }
+
+    sender.drain([&](const curvecpr_block &block) { receiver.deliver(block); });
+
+    std::size_t bytes;
+    while ((bytes = receiver.read_some(boost::asio::buffer(received), ec)) > 0)
+      read += bytes;
+    if (ec && ec != boost::asio::error::would_block && ec != boost::asio::error::eof) {
+      std::printf("%-28s failed: %s\n", label, ec.message().c_str());
+      break;
+    }
+  }
+  time.stop();
+
+  const curvecp::detail::session::compression_counters &counters = sender.get_compression_counters();
+  double ratio = read ? static_cast<double>(sender.sent_bytes()) / read : 0.0;
+  std::printf("%-28s | %8.1f MB/s | %6.2f ns/byte | wire ratio %5.3f | %6llu compressed %6llu raw chunks"
+    " | %7.1f MB/s at 100 Mbit/s\n",
+    label, read / (time.nanoseconds() / 1e3), benchmark::per_op(time.nanoseconds(), read), ratio,
+    static_cast<unsigned long long>(counters.chunks_compressed),
+    static_cast<unsigned long long>(counters.chunks_raw),
+    ratio > 0 ? 12.5 / ratio : 0.0);
+
+  sender.finish();
+  receiver.finish();
+}
+
+int main(int argc, char **argv)
+{
+  std::size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+
+  if (!curvecp::detail::compression_codec::supported())
+    std::printf("Built without CURVECP_ASIO_ENABLE_ZSTD, chunks are always sent raw.\n");
+
+  struct test {
+    const char *label;
+    payload kind;
+    bool compression;
+  };
+  const test tests[] = {
+    { "json logs, uncompressed", payload::json, false },
+    { "json logs, compressed", payload::json, true },
+    { "random, uncompressed", payload::random, false },
+    { "random, compressed", payload::random, true },
+    { "mixed 1 MiB runs, compressed", payload::mixed, true },
+  };
+
+  std::printf("%zu MiB streamed between two sessions, 16 KiB chunks, zstd level 3.\n", megabytes);
+  for (const test &t : tests)
+    run(t.label, t.kind, t.compression, megabytes << 20);
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Multiplexed substream benchmark.
+ *
+ * Runs request/response exchanges between two multiplexed detail::session
+ * instances driven directly, without any sockets or crypto, with a varying
+ * number of concurrent substreams. Each exchange opens a substream, sends a
+ * request, reads the response until EOF and closes the substream, so the
+ * cost per request includes opening, flow control and teardown. Global
+ * operator new and delete are replaced with counting versions so that the
+ * heap used by each open substream can be compared with the heap used by a
+ * separate session.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <malloc.h>
+
+#include <cstdlib>
+#include <new>
+
+namespace counters {
+  std::int64_t live_bytes = 0;
+}
+
+void *operator new(std::size_t size)
+{
+  void *ptr = std::malloc(size ? size : 1);
+  if (!ptr)
+    throw std::bad_alloc();
+
+  counters::live_bytes += malloc_usable_size(ptr);
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  if (!ptr)
+    return;
+
+  counters::live_bytes -= malloc_usable_size(ptr);
+  std::free(ptr);
+}
+
+/**
+ * Moves all pending blocks of one end of the simulated connection into the
+ * other end.
+ */
+void transfer(benchmark::session_driver &from, benchmark::session_driver &to)
+{
+  from.drain([&to](const curvecpr_block &block) { to.deliver(block); });
+}
+
+class substream_benchmark {
+public:
+  substream_benchmark(std::size_t concurrency, std::size_t request, std::size_t response)
+    : client_(service_, benchmark::session_driver::type::client),
+      server_(service_, benchmark::session_driver::type::server),
+      concurrency_(concurrency),
+      request_(request, 113),
+      response_(response, 114),
+      requests_(0),
+      peak_heap_(0)
+  {
+    client_.set_multiplexed(true);
+    server_.set_multiplexed(true);
+  }
+
+  void run(std::size_t requests)
+  {
+    std::vector<std::uint32_t> active;
+    std::int64_t baseline = counters::live_bytes;
+    boost::system::error_code ec;
+    std::size_t bytes;
+    unsigned char buffer[4096];
+    std::size_t opened = 0;
+
+    time_.start();
+    while (requests_ < requests) {
+      // Keep the configured number of exchanges in flight
+      while (active.size() < concurrency_ && opened < requests) {
+        std::uint32_t id = client_.open_substream();
+        client_.write_substream(id, boost::asio::buffer(request_), ec, bytes);
+        client_.close_substream(id);
+        active.push_back(id);
+        opened++;
+      }
+      peak_heap_ = std::max(peak_heap_, counters::live_bytes - baseline);
+      transfer(client_, server_);
+
+      // Server reads each request and answers it in full
+      std::uint32_t id;
+      while (server_.accept_substream(id, ec) && !ec)
+        accepted_.push_back(id);
+      for (auto it = accepted_.begin(); it != accepted_.end();) {
+        while (server_.read_substream(*it, boost::asio::buffer(buffer), ec, bytes) && !ec)
+          ;
+        if (ec == boost::asio::error::eof) {
+          server_.write_substream(*it, boost::asio::buffer(response_), ec, bytes);
+          server_.close_substream(*it);
+          it = accepted_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      transfer(server_, client_);
+
+      // Client reads responses until EOF
+      for (auto it = active.begin(); it != active.end();) {
+        while (client_.read_substream(*it, boost::asio::buffer(buffer), ec, bytes) && !ec)
+          ;
+        if (ec == boost::asio::error::eof) {
+          it = active.erase(it);
+          requests_++;
+        } else {
+          ++it;
+        }
+      }
+      transfer(client_, server_);
+    }
+    time_.stop();
+  }
+
+  void print()
+  {
+    std::printf("%11zu | %10.1f %12.0f\n", concurrency_,
+      benchmark::per_op(time_.nanoseconds(), requests_),
+      static_cast<double>(peak_heap_) / concurrency_);
+  }
+private:
+  boost::asio::io_context service_;
+  benchmark::session_driver client_;
+  benchmark::session_driver server_;
+  std::size_t concurrency_;
+  std::vector<unsigned char> request_;
+  std::vector<unsigned char> response_;
+  std::vector<std::uint32_t> accepted_;
+  std::uint64_t requests_;
+  std::int64_t peak_heap_;
+  benchmark::stopwatch time_;
+};
+
+int main(int argc, char **argv)
+{
+  std::size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+  // Heap used by one more session, without the pending buffer that is only
+  // allocated on the first write
+  boost::asio::io_context service;
+  std::int64_t before = counters::live_bytes;
+  {
+    boost::shared_ptr<benchmark::session_driver> session(
+      new benchmark::session_driver(service, benchmark::session_driver::type::client));
+    std::printf("Separate session: %zu B object, %lld B heap, plus a handshake per stream.\n\n",
+      sizeof(benchmark::session_driver), static_cast<long long>(counters::live_bytes - before));
+  }
+
+  std::printf("256 B requests, 1 KiB responses, all timings in ns per request.\n");
+  std::printf("%11s | %10s %12s\n", "concurrency", "request", "heap/stream");
+
+  for (std::size_t concurrency : { 1, 16, 256, 1024 }) {
+    substream_benchmark bench(concurrency, 256, 1024);
+    bench.run(std::max<std::size_t>(requests, concurrency));
+    bench.print();
+  }
+
+  return 0;
+}
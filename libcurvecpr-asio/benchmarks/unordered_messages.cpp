@@ -0,0 +1,131 @@
+/*
+ * Unordered message delivery benchmark.
+ *
+ * Sends a stream of independent messages between two detail::session
+ * instances driven directly, without any sockets or crypto, over a
+ * simulated network with a fixed one-way delay and random block loss. Lost
+ * blocks arrive again after a retransmission timeout, so acknowledgement and
+ * retransmission behave as they would with the messager. Each message
+ * carries the tick at which it was sent and the receiver records the
+ * delivery latency, comparing ordered delivery, where a lost block holds
+ * back all later messages, with unordered delivery, where it only holds
+ * back the message it belongs to. Time is simulated, so the latencies are
+ * deterministic; the processing cost per message is measured separately.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+
+/**
+ * Simulated network parameters, in ticks of one millisecond.
+ */
+struct network {
+  /// Probability that a block is lost
+  double loss;
+  /// One-way delay
+  std::uint64_t delay;
+  /// Time until a lost block is retransmitted
+  std::uint64_t rto;
+};
+
+class delivery_benchmark {
+public:
+  delivery_benchmark(const network &net, bool unordered)
+    : sender_(service_),
+      receiver_(service_),
+      network_(net),
+      random_(42),
+      size_(64, 4096),
+      tick_(0),
+      messages_(0)
+  {
+    sender_.set_unordered_messages(unordered);
+    receiver_.set_unordered_messages(unordered);
+  }
+
+  void run(std::size_t messages)
+  {
+    std::vector<unsigned char> message(size_.max());
+    std::vector<unsigned char> received(size_.max());
+    boost::system::error_code ec;
+    std::size_t bytes;
+
+    while (latency_.count() < messages) {
+      // Send one message per tick while there are messages left to send
+      if (messages_ < messages) {
+        std::size_t length = size_(random_);
+        std::memcpy(&message[0], &tick_, sizeof(tick_));
+        sender_.write_message(boost::asio::buffer(message, length), ec, bytes);
+        messages_++;
+      }
+
+      sender_.drain([this](const curvecpr_block &block) {
+        std::uint64_t arrival = tick_ + network_.delay;
+        while (loss_(random_) < network_.loss)
+          arrival += network_.rto;
+        in_flight_.insert(std::make_pair(arrival, block));
+      });
+
+      // Deliver the blocks that arrive in this tick and read all messages
+      // that have become available
+      for (auto it = in_flight_.begin(); it != in_flight_.end() && it->first <= tick_; it = in_flight_.erase(it))
+        receiver_.deliver(it->second);
+
+      time_.start();
+      while (receiver_.read_message(boost::asio::buffer(received), ec, bytes) && !ec) {
+        std::uint64_t sent;
+        std::memcpy(&sent, &received[0], sizeof(sent));
+        latency_.add(static_cast<double>(tick_ - sent));
+      }
+      time_.stop();
+
+      tick_++;
+    }
+  }
+
+  void print(const char *label)
+  {
+    latency_.print(label, "ms");
+    std::printf("%-24s %.1f ns/message\n", "", benchmark::per_op(time_.nanoseconds(), latency_.count()));
+  }
+private:
+  boost::asio::io_context service_;
+  benchmark::session_driver sender_;
+  benchmark::session_driver receiver_;
+  network network_;
+  std::mt19937_64 random_;
+  std::uniform_int_distribution<std::size_t> size_;
+  std::uniform_real_distribution<double> loss_;
+  std::multimap<std::uint64_t, curvecpr_block> in_flight_;
+  std::uint64_t tick_;
+  std::uint64_t messages_;
+  benchmark::histogram latency_;
+  benchmark::stopwatch time_;
+};
+
+int main(int argc, char **argv)
+{
+  std::size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+
+  std::printf("One message of 64-4096 bytes per ms, 10 ms one-way delay, 50 ms retransmission timeout.\n");
+
+  for (double loss : { 0.0, 0.01, 0.05 }) {
+    network net = { loss, 10, 50 };
+    std::printf("%.0f%% block loss:\n", loss * 100);
+
+    delivery_benchmark ordered(net, false);
+    ordered.run(messages);
+    ordered.print("  ordered");
+
+    delivery_benchmark unordered(net, true);
+    unordered.run(messages);
+    unordered.print("  unordered");
+  }
+
+  return 0;
+}
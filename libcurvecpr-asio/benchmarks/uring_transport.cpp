@@ -0,0 +1,195 @@
+/*
+ * io_uring transport benchmark.
+ *
+ * Echoes CurveCP-sized datagrams between two transports over UDP on
+ * loopback, keeping a fixed window of datagrams in flight, and compares
+ * the epoll-based socket_transport with the io_uring-based uring_transport.
+ * The server drains all available datagrams per receive completion and
+ * echoes each one back, so with larger windows the io_uring transport can
+ * submit many sends with a single system call and receive many datagrams
+ * per ring wakeup. Reports datagrams per second and CPU time per datagram.
+ */
+#include "benchmark.hpp"
+
+#include <curvecp/curvecp.hpp>
+#include <sys/resource.h>
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <cstdlib>
+
+double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/**
+ * Echoes every received datagram back to its sender.
+ */
+class echo_server {
+public:
+  echo_server(boost::shared_ptr<curvecp::transport> transport)
+    : transport_(transport),
+      receive_buffer_(2048),
+      slots_(1024, std::vector<unsigned char>(2048)),
+      next_slot_(0)
+  {
+  }
+
+  void start()
+  {
+    transport_->async_receive_from(boost::asio::buffer(receive_buffer_), sender_,
+      boost::bind(&echo_server::receive_handler, this, _1, _2));
+  }
+private:
+  void receive_handler(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    if (ec)
+      return;
+
+    echo(receive_buffer_, bytes, sender_);
+
+    // Drain everything that is already available
+    boost::system::error_code drain_ec;
+    for (;;) {
+      std::size_t length = transport_->try_receive_from(boost::asio::buffer(receive_buffer_), sender_, drain_ec);
+      if (drain_ec)
+        break;
+      echo(receive_buffer_, length, sender_);
+    }
+
+    start();
+  }
+
+  void echo(const std::vector<unsigned char> &data, std::size_t length, const curvecp::transport::endpoint_type &to)
+  {
+    std::vector<unsigned char> &slot = slots_[next_slot_++ % slots_.size()];
+    std::memcpy(&slot[0], &data[0], length);
+    transport_->async_send_to(boost::asio::buffer(&slot[0], length), to,
+      [](const boost::system::error_code&, std::size_t) {});
+  }
+private:
+  boost::shared_ptr<curvecp::transport> transport_;
+  std::vector<unsigned char> receive_buffer_;
+  curvecp::transport::endpoint_type sender_;
+  std::vector<std::vector<unsigned char>> slots_;
+  std::size_t next_slot_;
+};
+
+/**
+ * Keeps a window of datagrams in flight and counts the echoes.
+ */
+class echo_client {
+public:
+  echo_client(boost::shared_ptr<curvecp::transport> transport, std::size_t window)
+    : transport_(transport),
+      window_(window),
+      payload_(1184, 42),
+      receive_buffer_(2048),
+      echoed_(0)
+  {
+  }
+
+  void start()
+  {
+    for (std::size_t i = 0; i < window_; i++)
+      send();
+    receive();
+  }
+
+  std::uint64_t echoed() const { return echoed_; }
+private:
+  void send()
+  {
+    transport_->async_send(boost::asio::buffer(payload_), [](const boost::system::error_code&, std::size_t) {});
+  }
+
+  void receive()
+  {
+    transport_->async_receive(boost::asio::buffer(receive_buffer_),
+      boost::bind(&echo_client::receive_handler, this, _1, _2));
+  }
+
+  void receive_handler(const boost::system::error_code &ec, std::size_t)
+  {
+    if (ec)
+      return;
+
+    echoed_++;
+    send();
+
+    boost::system::error_code drain_ec;
+    curvecp::transport::endpoint_type sender;
+    for (;;) {
+      transport_->try_receive_from(boost::asio::buffer(receive_buffer_), sender, drain_ec);
+      if (drain_ec)
+        break;
+      echoed_++;
+      send();
+    }
+
+    receive();
+  }
+private:
+  boost::shared_ptr<curvecp::transport> transport_;
+  std::size_t window_;
+  std::vector<unsigned char> payload_;
+  std::vector<unsigned char> receive_buffer_;
+  std::uint64_t echoed_;
+};
+
+template <typename Transport>
+void run(const char *label, std::size_t window, double seconds)
+{
+  boost::asio::io_context service;
+  boost::shared_ptr<curvecp::transport> server_transport(boost::make_shared<Transport>(service));
+  boost::shared_ptr<curvecp::transport> client_transport(boost::make_shared<Transport>(service));
+
+  server_transport->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+  client_transport->connect(server_transport->local_endpoint());
+
+  echo_server server(server_transport);
+  echo_client client(client_transport, window);
+  server.start();
+  client.start();
+
+  double cpu_started = cpu_seconds();
+  benchmark::stopwatch wall;
+  wall.start();
+  service.run_for(std::chrono::milliseconds(static_cast<long>(seconds * 1000)));
+  wall.stop();
+  double cpu = cpu_seconds() - cpu_started;
+
+  // Each echo is one datagram in each direction
+  double datagrams = 2.0 * client.echoed();
+  std::printf("%-8s %6zu | %12.0f %12.2f\n", label, window,
+    datagrams / (wall.nanoseconds() / 1e9), datagrams ? cpu / datagrams * 1e6 : 0.0);
+
+  client_transport->close();
+  server_transport->close();
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? std::strtod(argv[1], nullptr) : 2.0;
+
+  std::printf("1184 B datagrams echoed over UDP on loopback, one thread.\n");
+  std::printf("%-8s %6s | %12s %12s\n", "backend", "window", "datagrams/s", "CPU us/dgram");
+
+  for (std::size_t window : { 1, 16, 64, 256 }) {
+    run<curvecp::socket_transport>("epoll", window, seconds);
+#if defined(CURVECP_ASIO_HAS_IO_URING)
+    try {
+      run<curvecp::uring_transport>("io_uring", window, seconds);
+    } catch (const boost::system::system_error &e) {
+      std::printf("%-8s %6zu | not available: %s\n", "io_uring", window, e.what());
+    }
+#endif
+  }
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <curvecp/curvecp.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <sodium.h>
+#include <iostream>
+#include <memory>
+
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+static const boost::asio::ip::udp::endpoint server_endpoint(boost::asio::ip::make_address("127.0.0.1"), 10003);
+
+awaitable<void> echo(std::shared_ptr<curvecp::stream> peer)
+{
+  char data[1024];
+  try {
+    for (;;) {
+      std::size_t n = co_await peer->async_read_some(boost::asio::buffer(data), use_awaitable);
+      co_await boost::asio::async_write(*peer, boost::asio::buffer(data, n), use_awaitable);
+    }
+  } catch (const boost::system::system_error &e) {
+    std::cout << "SERVER: Stream finished (" << e.code().message() << ")." << std::endl;
+  }
+}
+
+awaitable<void> server(curvecp::acceptor &acceptor)
+{
+  for (;;) {
+    auto peer = std::make_shared<curvecp::stream>(acceptor.get_io_context());
+    co_await acceptor.async_accept(*peer, use_awaitable);
+    std::cout << "SERVER: Accepted a new stream." << std::endl;
+    boost::asio::co_spawn(acceptor.get_executor(), echo(peer), boost::asio::detached);
+  }
+}
+
+awaitable<void> client(boost::asio::io_context &service)
+{
+  curvecp::stream stream(service);
+  stream.set_local_extension(std::string("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16));
+  stream.set_local_public_key(std::string("\xa3\xe7\xb1\x22\xe6\x86\x77\x7c\x39\xc3\xf8\x76\x3d\x4d\x4\xf\x39\x7\x24\x37\xa3\xf5\x7c\x5d\xfc\x56\x59\xc0\x95\xb7\xc1\x3c", 32));
+  stream.set_local_private_key(std::string("\xd3\x51\x1b\x58\x9c\x33\x8d\xd2\x9e\x50\xe7\x14\xec\xb7\x79\x5d\x23\x51\x33\xe7\x27\x0\x40\xa\x1d\xad\x10\xd2\x4e\xac\x8e\xab", 32));
+  stream.set_remote_extension(std::string("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16));
+  stream.set_remote_public_key(std::string("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32));
+  stream.set_remote_domain_name("test.server");
+  stream.set_nonce_generator(randombytes);
+
+  co_await stream.async_connect(server_endpoint, use_awaitable);
+  std::cout << "CLIENT: Connected." << std::endl;
+
+  for (int i = 0; i < 10; i++) {
+    std::string message = "message " + std::to_string(i);
+    std::string reply(message.size(), '\0');
+
+    co_await boost::asio::async_write(stream, boost::asio::buffer(message), use_awaitable);
+    co_await boost::asio::async_read(stream, boost::asio::buffer(&reply[0], reply.size()), use_awaitable);
+    std::cout << "CLIENT: Received '" << reply << "'." << std::endl;
+  }
+
+  co_await stream.async_close(use_awaitable);
+  std::cout << "CLIENT: Closed." << std::endl;
+  service.stop();
+}
+
+int main()
+{
+  boost::asio::io_context io_context;
+
+  curvecp::acceptor acceptor(io_context);
+  acceptor.set_local_extension(std::string("\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16));
+  acceptor.set_local_public_key(std::string("\x3f\x56\xfd\x60\x4f\x31\x57\x5d\x1f\xa8\xd2\x4\x2e\x8a\xd7\xe1\x1e\x8a\x51\x64\xf0\x79\xb7\x63\x63\x14\xcd\x52\x9e\x7a\x9a\x19", 32));
+  acceptor.set_local_private_key(std::string("\x7a\xa4\x43\x11\x13\x5f\xb8\xe9\x1c\x3e\x2\xd3\x88\xa\x36\xce\xd0\xd8\x79\x99\x9b\xc5\xf7\x8e\x49\x90\x97\xe4\xdf\x6b\x6d\xa9", 32));
+  acceptor.set_nonce_generator(randombytes);
+  acceptor.bind(server_endpoint);
+  acceptor.listen();
+
+  boost::asio::co_spawn(io_context, server(acceptor), boost::asio::detached);
+  boost::asio::co_spawn(io_context, client(io_context), boost::asio::detached);
+
+  io_context.run();
+  return 0;
+}
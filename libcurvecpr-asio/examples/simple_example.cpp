@@ -1,11 +1,12 @@
 #include <curvecp/curvecp.hpp>
 #include <boost/asio/write.hpp>
 #include <sodium.h>
+#include <iostream>
 #include <list>
 
 class example {
 public:
-  example(boost::asio::io_service &service, int id)
+  example(boost::asio::io_context &service, int id)
     : service_(service),
       id_(id),
       stream_(service),
@@ -26,7 +27,7 @@ public:
   void start()
   {
     stream_.async_connect(
-      boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 10000),
+      boost::asio::ip::udp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 10000),
       boost::bind(&example::connect_handler, this, _1)
     );
   }
@@ -119,7 +120,7 @@ public:
   }
 private:
   /// ASIO I/O service
-  boost::asio::io_service &service_;
+  boost::asio::io_context &service_;
   /// Client identifier
   int id_;
   /// CurveCP stream
@@ -136,15 +137,15 @@ private:
 
 int main()
 {
-  boost::asio::io_service io_service;
+  boost::asio::io_context io_context;
 
   std::list<std::shared_ptr<example>> clients;
   for (int i = 0; i < 10; i++) {
-    auto client = std::make_shared<example>(io_service, i);
+    auto client = std::make_shared<example>(io_context, i);
     clients.push_back(client);
     client->start();
   }
 
-  io_service.run();
+  io_context.run();
   return 0;
 }
@@ -1,12 +1,13 @@
 #include <boost/asio.hpp>
 #include <curvecp/curvecp.hpp>
+#include <iostream>
 #include <list>
 #include <thread>
 #include <sodium.h>
 
 class connection {
 public:
-  connection(size_t id, boost::asio::io_service &service)
+  connection(size_t id, boost::asio::io_context &service)
     : id(id),
       stream(service),
       buffer_space(1024),
@@ -26,7 +27,7 @@ public:
 
 class example {
 public:
-  example(boost::asio::io_service &service)
+  example(boost::asio::io_context &service)
     : service_(service),
       acceptor_(service),
       next_connection_id_(0)
@@ -40,7 +41,7 @@ public:
   void start()
   {
     acceptor_.bind(boost::asio::ip::udp::endpoint(
-      boost::asio::ip::address::from_string("127.0.0.1"),
+      boost::asio::ip::make_address("127.0.0.1"),
       10000
     ));
 
@@ -114,7 +115,7 @@ public:
   }
 private:
   /// ASIO I/O service
-  boost::asio::io_service &service_;
+  boost::asio::io_context &service_;
   /// CurveCP acceptor
   curvecp::acceptor acceptor_;
   /// Connection counter
@@ -123,13 +124,13 @@ private:
 
 int main()
 {
-  boost::asio::io_service io_service;
-  example ex(io_service);
+  boost::asio::io_context io_context;
+  example ex(io_context);
   ex.start();
 
   std::list<std::shared_ptr<std::thread>> threads;
   for (int i = 0; i < 8; i++) {
-    threads.push_back(std::make_shared<std::thread>([&io_service]() { io_service.run(); }));
+    threads.push_back(std::make_shared<std::thread>([&io_context]() { io_context.run(); }));
   }
 
   for (auto thread : threads)
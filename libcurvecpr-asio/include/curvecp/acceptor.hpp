@@ -7,8 +7,10 @@
 #ifndef CURVECP_ASIO_ACCEPTOR_HPP
 #define CURVECP_ASIO_ACCEPTOR_HPP
 
+#include <curvecp/transport.hpp>
 #include <curvecp/detail/acceptor.hpp>
 #include <curvecp/detail/accept_op.hpp>
+#include <curvecp/detail/accept_many_op.hpp>
 #include <curvecp/stream.hpp>
 
 namespace curvecp {
@@ -18,23 +20,46 @@ namespace curvecp {
  */
 class acceptor {
 public:
+  /// The type of the executor associated with the acceptor
+  typedef boost::asio::io_context::executor_type executor_type;
+  /// Counters of sessions handled by the acceptor
+  typedef detail::acceptor::accept_counters accept_counters;
+  /// Time spent on the server side of handshakes
+  typedef detail::acceptor::handshake_timings handshake_timings;
+
   /**
    * Constructs a new CurveCP server acceptor.
    *
-   * @param service ASIO IO service
+   * @param service ASIO IO context
    */
-  acceptor(boost::asio::io_service &service)
+  acceptor(boost::asio::io_context &service)
     : acceptor_(boost::make_shared<detail::acceptor>(service))
   {
   }
 
+  /**
+   * Constructs a new CurveCP server acceptor over a specific datagram
+   * transport.
+   *
+   * @param transport Datagram transport
+   */
+  acceptor(boost::shared_ptr<transport> transport)
+    : acceptor_(boost::make_shared<detail::acceptor>(transport))
+  {
+  }
+
   acceptor(const acceptor&) = delete;
   acceptor &operator=(const acceptor&) = delete;
 
   /**
-   * Returns the ASIO IO service associated with this acceptor.
+   * Returns the ASIO IO context associated with this acceptor.
+   */
+  boost::asio::io_context &get_io_context() { return acceptor_->get_io_context(); }
+
+  /**
+   * Returns the executor associated with this acceptor.
    */
-  boost::asio::io_service &get_io_service() { return acceptor_->get_io_service(); }
+  executor_type get_executor() { return acceptor_->get_io_context().get_executor(); }
 
   /**
    * Configures the local CurveCP extension. Must be set before starting
@@ -69,7 +94,76 @@ public:
   void set_nonce_generator(NonceGenerator generator) { acceptor_->set_nonce_generator(generator); }
 
   /**
-   * Binds the underlying UDP socket to a specific local endpoint.
+   * Configures the maximum number of established sessions that wait to be
+   * accepted (16 by default). Initiate packets of new sessions are dropped
+   * while the backlog is full, so clients retransmit them later.
+   *
+   * @param value Maximum number of pending sessions
+   */
+  void set_backlog(std::size_t value) { acceptor_->set_backlog(value); }
+
+  /**
+   * Configures the time after which sessions that have not received any
+   * packets from their peers are evicted (disabled by default). Streams of
+   * evicted sessions observe EOF.
+   *
+   * @param timeout Idle timeout, pos_infin disables eviction
+   */
+  void set_idle_timeout(const boost::posix_time::time_duration &timeout) { acceptor_->set_idle_timeout(timeout); }
+
+  /**
+   * Configures the maximum number of sessions, accepted or not (unlimited
+   * by default). When a new session would exceed it, the least recently
+   * active session is evicted.
+   *
+   * @param value Maximum number of sessions
+   */
+  void set_maximum_sessions(std::size_t value) { acceptor_->set_maximum_sessions(value); }
+
+  /**
+   * Configures the rate at which Hello packets are accepted from each
+   * source address prefix, /24 for IPv4 and /48 for IPv6 (unlimited by
+   * default). Excess Hellos are dropped before any crypto work is done and
+   * clients retransmit them later.
+   *
+   * @param rate Hellos per second, zero disables the limit
+   * @param burst Number of Hellos that may arrive at once
+   */
+  void set_source_hello_limit(double rate, double burst) { acceptor_->set_source_hello_limit(rate, burst); }
+
+  /**
+   * Configures the rate at which Hello packets are accepted from all
+   * sources together (unlimited by default).
+   *
+   * @param rate Hellos per second, zero disables the limit
+   * @param burst Number of Hellos that may arrive at once
+   */
+  void set_hello_budget(double rate, double burst) { acceptor_->set_hello_budget(rate, burst); }
+
+  /**
+   * Returns the number of accepted sessions, of new sessions rejected
+   * because the backlog was full, of sessions evicted because they were
+   * idle or to stay within the session limit, and of admitted and dropped
+   * Hello packets.
+   */
+  accept_counters get_accept_counters() { return acceptor_->get_accept_counters(); }
+
+  /**
+   * Configures whether the time spent on the server side of handshakes is
+   * collected (off by default): processing of Hello and Initiate packets,
+   * setting up new sessions and handing them over to accepted streams.
+   *
+   * @param enabled True to collect handshake timings
+   */
+  void set_handshake_timing(bool enabled) { acceptor_->set_handshake_timing(enabled); }
+
+  /**
+   * Returns the handshake timings collected so far.
+   */
+  handshake_timings get_handshake_timings() { return acceptor_->get_handshake_timings(); }
+
+  /**
+   * Binds the underlying transport to a specific local endpoint.
    *
    * @param endpoint Endpoint to bind to
    */
@@ -93,13 +187,26 @@ public:
   async_accept(stream &peer,
                BOOST_ASIO_MOVE_ARG(AcceptHandler) handler)
   {
-    boost::asio::detail::async_result_init<
-      AcceptHandler, void (boost::system::error_code)> init(
-        BOOST_ASIO_MOVE_CAST(AcceptHandler)(handler));
+    return boost::asio::async_initiate<AcceptHandler, void (boost::system::error_code)>(
+      detail::initiate_accept_op<curvecp::detail::acceptor, curvecp::stream>(*acceptor_), handler, &peer);
+  }
 
-    detail::accept_op<curvecp::detail::acceptor, curvecp::stream, decltype(init.handler)>(
-      *acceptor_, peer, init.handler)(boost::system::error_code(), true);
-    return init.result.get();
+  /**
+   * Performs a batched accept operation. Completes as soon as at least one
+   * session is ready and accepts all ready sessions that fit into the given
+   * range of streams, reporting the number of accepted streams, which are
+   * the first ones of the range.
+   *
+   * @param first First destination stream
+   * @param last End of the destination streams
+   */
+  template <typename StreamIterator, typename AcceptHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(AcceptHandler, void (boost::system::error_code, std::size_t))
+  async_accept_many(StreamIterator first, StreamIterator last,
+                    BOOST_ASIO_MOVE_ARG(AcceptHandler) handler)
+  {
+    return boost::asio::async_initiate<AcceptHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_accept_many_op<curvecp::detail::acceptor>(*acceptor_), handler, first, last);
   }
 private:
   /// Private acceptor implementation
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_CLIENT_ENDPOINT_HPP
+#define CURVECP_ASIO_CLIENT_ENDPOINT_HPP
+
+#include <curvecp/transport.hpp>
+#include <curvecp/detail/client_endpoint.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <vector>
+
+namespace curvecp {
+
+class stream;
+
+/**
+ * Shared-socket endpoint for client streams. Instead of each stream owning
+ * a socket, a receive buffer and an outstanding receive, all streams
+ * created over the endpoint share a small number of sockets and receive
+ * their packets through the endpoint. Each attached stream is assigned a
+ * unique local extension which must not be changed. Destroying the endpoint
+ * closes the shared sockets, so it should outlive its streams.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Safe.
+ */
+class client_endpoint {
+public:
+  friend class stream;
+
+  /**
+   * Constructs a client endpoint with its own UDP or Unix domain sockets.
+   *
+   * @param service ASIO IO context
+   * @param local Local endpoint to bind the sockets to, use port zero for
+   *   ephemeral ports
+   * @param sockets Number of sockets to open
+   */
+  client_endpoint(boost::asio::io_context &service,
+                  const transport::endpoint_type &local,
+                  std::size_t sockets = 1)
+  {
+    std::vector<boost::shared_ptr<transport>> transports;
+    for (std::size_t i = 0; i < sockets; i++) {
+      boost::shared_ptr<transport> t(boost::make_shared<socket_transport>(service));
+      t->bind(local);
+      transports.push_back(t);
+    }
+
+    endpoint_ = boost::make_shared<detail::client_endpoint>(transports);
+    endpoint_->start();
+  }
+
+  /**
+   * Constructs a client endpoint over specific datagram transports.
+   *
+   * @param transports Transports shared by all streams
+   */
+  client_endpoint(const std::vector<boost::shared_ptr<transport>> &transports)
+    : endpoint_(boost::make_shared<detail::client_endpoint>(transports))
+  {
+    endpoint_->start();
+  }
+
+  ~client_endpoint()
+  {
+    endpoint_->close();
+  }
+
+  client_endpoint(const client_endpoint&) = delete;
+  client_endpoint &operator=(const client_endpoint&) = delete;
+
+  /**
+   * Returns the ASIO IO context associated with this endpoint.
+   */
+  boost::asio::io_context &get_io_context() { return endpoint_->get_io_context(); }
+
+  /**
+   * Configures the maximum number of datagrams drained from a socket per
+   * completed receive operation.
+   *
+   * @param value Maximum number of datagrams
+   */
+  void set_receive_batch_maximum(std::size_t value) { endpoint_->set_receive_batch_maximum(value); }
+
+  /**
+   * Returns the number of streams currently attached to this endpoint.
+   */
+  std::size_t stream_count() const { return endpoint_->channel_count(); }
+
+  /**
+   * Returns the number of received packets that could not be routed to
+   * any attached stream.
+   */
+  std::uint64_t unroutable_packets() const { return endpoint_->unroutable_packets(); }
+private:
+  /// Private endpoint implementation
+  boost::shared_ptr<detail::client_endpoint> endpoint_;
+};
+
+}
+
+#endif
@@ -8,6 +8,9 @@
 #define CURVECP_ASIO_CURVECP_HPP
 
 #include <curvecp/acceptor.hpp>
+#include <curvecp/client_endpoint.hpp>
 #include <curvecp/stream.hpp>
+#include <curvecp/substream.hpp>
+#include <curvecp/transport.hpp>
 
 #endif
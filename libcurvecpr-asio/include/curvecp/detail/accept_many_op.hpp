@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_ACCEPT_MANY_OP_HPP
+#define CURVECP_ASIO_DETAIL_ACCEPT_MANY_OP_HPP
+
+#include <curvecp/detail/completion.hpp>
+#include <curvecp/detail/handler_memory.hpp>
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <type_traits>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Async batched accept operation processor.
+ */
+template <typename Acceptor, typename StreamIterator, typename Handler>
+class accept_many_op {
+public:
+  /// The executor used to invoke the handler
+  typedef typename boost::asio::associated_executor<Handler,
+    boost::asio::io_context::executor_type>::type executor_type;
+  /// The allocator used for intermediate handlers
+  typedef typename boost::asio::associated_allocator<Handler,
+    handler_allocator<void>>::type allocator_type;
+
+  /**
+   * Constructs an async batched accept operation.
+   *
+   * @param acceptor Acceptor reference
+   * @param first First destination stream
+   * @param last End of the destination streams
+   * @param handler Handler to call after accept completes
+   */
+  template <typename CompletionHandler>
+  accept_many_op(Acceptor &acceptor, StreamIterator first, StreamIterator last,
+                 BOOST_ASIO_MOVE_ARG(CompletionHandler) handler)
+    : acceptor_(acceptor),
+      first_(first),
+      last_(last),
+      handler_(BOOST_ASIO_MOVE_CAST(CompletionHandler)(handler)),
+      work_(boost::asio::get_associated_executor(handler_, acceptor.get_io_context().get_executor())),
+      accepted_(0),
+      finished_(false)
+  {
+    cancellation_.install(handler_, waker{ &acceptor });
+  }
+
+  /**
+   * Returns the executor associated with the handler.
+   */
+  executor_type get_executor() const
+  {
+    return boost::asio::get_associated_executor(handler_, acceptor_.get_io_context().get_executor());
+  }
+
+  /**
+   * Returns the allocator associated with the handler, or the recycling
+   * allocator of the acceptor when the handler does not specify one.
+   */
+  allocator_type get_allocator() const
+  {
+    return boost::asio::get_associated_allocator(handler_, handler_allocator<void>(acceptor_.get_handler_memory()));
+  }
+
+  /**
+   * Executes the accept operation. If the operation needs to be retried
+   * it is scheduled via the underlying acceptor. The error code of a wait
+   * on the acceptor is ignored, as waits are cancelled to wake up the
+   * operation.
+   *
+   * @param start Set to true for direct invocation by caller
+   */
+  void operator()(const boost::system::error_code &/*ec*/ = boost::system::error_code(),
+                  bool start = false)
+  {
+    if (!finished_) {
+      if (cancellation_.cancelled()) {
+        ec_ = boost::asio::error::operation_aborted;
+      } else if (!acceptor_.accept_many(first_, last_, accepted_, ec_)) {
+        acceptor_.async_pending_accept_wait(BOOST_ASIO_MOVE_CAST(accept_many_op)(*this));
+        return;
+      }
+
+      // Invoke the handler through its associated executor; when we are called
+      // directly by the async operation, the invocation must be deferred
+      finished_ = true;
+      cancellation_.clear(handler_);
+      return dispatch_completion(handler_, acceptor_.get_io_context().get_executor(), start,
+        BOOST_ASIO_MOVE_CAST(accept_many_op)(*this));
+    }
+
+    // Call accept handler
+    work_.reset();
+    handler_(ec_, accepted_);
+  }
+private:
+  /**
+   * Wakes up a cancelled operation waiting on the acceptor.
+   */
+  struct waker {
+    Acceptor *acceptor_;
+
+    void operator()() const { acceptor_->cancel_pending_accept_wait(); }
+  };
+
+  /// Acceptor reference
+  Acceptor &acceptor_;
+  /// First destination stream
+  StreamIterator first_;
+  /// End of the destination streams
+  StreamIterator last_;
+  /// Handler to call after accept completes
+  Handler handler_;
+  /// Outstanding work on the handler executor
+  handler_work<executor_type> work_;
+  /// Cancellation state
+  operation_cancellation cancellation_;
+  /// Resulting error code
+  boost::system::error_code ec_;
+  /// Number of accepted streams
+  std::size_t accepted_;
+  /// Operation finished flag
+  bool finished_;
+};
+
+/**
+ * Initiation function object for batched accept operations, used with
+ * async_initiate.
+ */
+template <typename Acceptor>
+class initiate_accept_many_op {
+public:
+  /**
+   * Constructs the initiation function object.
+   *
+   * @param acceptor Acceptor reference
+   */
+  explicit initiate_accept_many_op(Acceptor &acceptor)
+    : acceptor_(acceptor)
+  {
+  }
+
+  template <typename Handler, typename StreamIterator>
+  void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler, StreamIterator first, StreamIterator last) const
+  {
+    accept_many_op<Acceptor, StreamIterator, typename std::decay<Handler>::type>(acceptor_, first, last,
+      BOOST_ASIO_MOVE_CAST(Handler)(handler))(boost::system::error_code(), true);
+  }
+private:
+  /// Acceptor reference
+  Acceptor &acceptor_;
+};
+
+}
+
+}
+
+#endif
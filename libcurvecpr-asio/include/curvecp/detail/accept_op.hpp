@@ -7,8 +7,17 @@
 #ifndef CURVECP_ASIO_DETAIL_ACCEPT_OP_HPP
 #define CURVECP_ASIO_DETAIL_ACCEPT_OP_HPP
 
+#include <curvecp/detail/completion.hpp>
+#include <curvecp/detail/handler_memory.hpp>
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_context.hpp>
 #include <boost/bind.hpp>
 
+#include <type_traits>
+
 namespace curvecp {
 
 namespace detail {
@@ -19,6 +28,13 @@ namespace detail {
 template <typename Acceptor, typename Stream, typename Handler>
 class accept_op {
 public:
+  /// The executor used to invoke the handler
+  typedef typename boost::asio::associated_executor<Handler,
+    boost::asio::io_context::executor_type>::type executor_type;
+  /// The allocator used for intermediate handlers
+  typedef typename boost::asio::associated_allocator<Handler,
+    handler_allocator<void>>::type allocator_type;
+
   /**
    * Constructs an async accept operation.
    *
@@ -26,54 +42,119 @@ public:
    * @param stream Target stream reference
    * @param handler Handler to call after accept completes
    */
-  accept_op(Acceptor &acceptor, Stream &stream, Handler &handler)
+  template <typename CompletionHandler>
+  accept_op(Acceptor &acceptor, Stream &stream, BOOST_ASIO_MOVE_ARG(CompletionHandler) handler)
     : acceptor_(acceptor),
       stream_(stream),
-      handler_(BOOST_ASIO_MOVE_CAST(Handler)(handler)),
+      handler_(BOOST_ASIO_MOVE_CAST(CompletionHandler)(handler)),
+      work_(boost::asio::get_associated_executor(handler_, acceptor.get_io_context().get_executor())),
       finished_(false)
   {
+    cancellation_.install(handler_, waker{ &acceptor });
+  }
+
+  /**
+   * Returns the executor associated with the handler.
+   */
+  executor_type get_executor() const
+  {
+    return boost::asio::get_associated_executor(handler_, acceptor_.get_io_context().get_executor());
+  }
+
+  /**
+   * Returns the allocator associated with the handler, or the recycling
+   * allocator of the acceptor when the handler does not specify one.
+   */
+  allocator_type get_allocator() const
+  {
+    return boost::asio::get_associated_allocator(handler_, handler_allocator<void>(acceptor_.get_handler_memory()));
   }
 
   /**
    * Executes the accept operation. If the operation needs to be retried
-   * it is scheduled via the underlying acceptor.
+   * it is scheduled via the underlying acceptor. The error code of a wait
+   * on the acceptor is ignored, as waits are cancelled to wake up the
+   * operation.
    *
    * @param start Set to true for direct invocation by caller
    */
-  void operator()(const boost::system::error_code &ec = boost::system::error_code(),
+  void operator()(const boost::system::error_code &/*ec*/ = boost::system::error_code(),
                   bool start = false)
   {
     if (!finished_) {
-      if (!acceptor_.accept(stream_, ec_)) {
+      if (cancellation_.cancelled()) {
+        ec_ = boost::asio::error::operation_aborted;
+      } else if (!acceptor_.accept(stream_, ec_)) {
         acceptor_.async_pending_accept_wait(BOOST_ASIO_MOVE_CAST(accept_op)(*this));
         return;
       }
 
+      // Invoke the handler through its associated executor; when we are called
+      // directly by the async operation, the invocation must be deferred
       finished_ = true;
-      if (start) {
-        // We are being called directly by the async operation, so need to
-        // defer the invocation of the handler
-        acceptor_.get_io_service().post(BOOST_ASIO_MOVE_CAST(accept_op)(*this));
-        return;
-      }
+      cancellation_.clear(handler_);
+      return dispatch_completion(handler_, acceptor_.get_io_context().get_executor(), start,
+        BOOST_ASIO_MOVE_CAST(accept_op)(*this));
     }
 
     // Call accept handler
+    work_.reset();
     handler_(ec_);
   }
 private:
+  /**
+   * Wakes up a cancelled operation waiting on the acceptor.
+   */
+  struct waker {
+    Acceptor *acceptor_;
+
+    void operator()() const { acceptor_->cancel_pending_accept_wait(); }
+  };
+
   /// Acceptor reference
   Acceptor &acceptor_;
   /// Target stream
   Stream &stream_;
   /// Handler to call after accept completes
   Handler handler_;
+  /// Outstanding work on the handler executor
+  handler_work<executor_type> work_;
+  /// Cancellation state
+  operation_cancellation cancellation_;
   /// Resulting error code
   boost::system::error_code ec_;
   /// Operation finished flag
   bool finished_;
 };
 
+/**
+ * Initiation function object for accept operations, used with
+ * async_initiate.
+ */
+template <typename Acceptor, typename Stream>
+class initiate_accept_op {
+public:
+  /**
+   * Constructs the initiation function object.
+   *
+   * @param acceptor Acceptor reference
+   */
+  explicit initiate_accept_op(Acceptor &acceptor)
+    : acceptor_(acceptor)
+  {
+  }
+
+  template <typename Handler>
+  void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler, Stream *stream) const
+  {
+    accept_op<Acceptor, Stream, typename std::decay<Handler>::type>(acceptor_, *stream,
+      BOOST_ASIO_MOVE_CAST(Handler)(handler))(boost::system::error_code(), true);
+  }
+private:
+  /// Acceptor reference
+  Acceptor &acceptor_;
+};
+
 }
 
 }
@@ -10,11 +10,14 @@
 #include <curvecp/stream.hpp>
 #include <curvecp/detail/session.hpp>
 #include <curvecp/detail/basic_stream.hpp>
+#include <curvecp/detail/transport.hpp>
+#include <curvecp/detail/hello_limiter.hpp>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
-#include <boost/asio/ip/udp.hpp>
+#include <boost/intrusive/list.hpp>
 
+#include <chrono>
 #include <unordered_map>
 #include <deque>
 #include <mutex>
@@ -29,19 +32,74 @@ namespace detail {
 class acceptor : public boost::enable_shared_from_this<acceptor> {
 public:
   /**
-   * Constructs a new CurveCP server acceptor.
+   * Counters of sessions handled by the acceptor.
+   */
+  struct accept_counters {
+    /// Sessions handed over to accepted streams
+    std::uint64_t accepted;
+    /// New sessions rejected because the backlog was full
+    std::uint64_t backlog_rejected;
+    /// Sessions evicted because no packets were received within the idle timeout
+    std::uint64_t idle_evicted;
+    /// Least recently active sessions evicted to stay within the session limit
+    std::uint64_t lru_evicted;
+    /// Hello packets passed on to the packet processor
+    std::uint64_t hello_admitted;
+    /// Hello packets dropped because their source prefix exceeded its rate
+    std::uint64_t hello_source_dropped;
+    /// Hello packets dropped because the global handshake budget was exhausted
+    std::uint64_t hello_budget_dropped;
+  };
+
+  /**
+   * Time spent on the server side of handshakes.
+   */
+  struct handshake_timings {
+    /// Hello packets processed
+    std::uint64_t hellos;
+    /// Nanoseconds spent processing Hello packets
+    std::uint64_t hello_nanoseconds;
+    /// Initiate packets processed
+    std::uint64_t initiates;
+    /// Nanoseconds spent processing Initiate packets, excluding session setup
+    std::uint64_t initiate_nanoseconds;
+    /// Calls to set up a new session, including rejected ones
+    std::uint64_t setups;
+    /// Nanoseconds spent setting up new sessions
+    std::uint64_t setup_nanoseconds;
+    /// Sessions handed over from the pending queue to accepted streams
+    std::uint64_t handoffs;
+    /// Nanoseconds spent handing over sessions
+    std::uint64_t handoff_nanoseconds;
+  };
+
+  /**
+   * Constructs a new CurveCP server acceptor that uses its own UDP
+   * socket.
    *
-   * @param service ASIO IO service
+   * @param service ASIO IO context
    */
-  inline acceptor(boost::asio::io_service &service);
+  inline acceptor(boost::asio::io_context &service);
+
+  /**
+   * Constructs a new CurveCP server acceptor over a specific transport.
+   *
+   * @param transport Datagram transport
+   */
+  inline acceptor(boost::shared_ptr<transport> transport);
 
   acceptor(const acceptor&) = delete;
   acceptor &operator=(const acceptor&) = delete;
 
   /**
-   * Returns the ASIO IO service associated with this acceptor.
+   * Returns the ASIO IO context associated with this acceptor.
    */
-  boost::asio::io_service &get_io_service() { return socket_.get_io_service(); }
+  boost::asio::io_context &get_io_context() { return transport_->get_io_context(); }
+
+  /**
+   * Returns the memory used for intermediate handlers of accept operations.
+   */
+  handler_memory &get_handler_memory() { return handler_memory_; }
 
    /**
    * Configures the local CurveCP extension. Must be set before listening.
@@ -73,7 +131,68 @@ public:
   void set_nonce_generator(NonceGenerator generator) { nonce_generator_ = generator; }
 
   /**
-   * Binds the underlying UDP socket to a specific local endpoint.
+   * Configures the maximum number of established sessions that wait to be
+   * accepted. Initiate packets of new sessions are dropped while the
+   * backlog is full, so clients retransmit them later.
+   *
+   * @param value Maximum number of pending sessions
+   */
+  inline void set_backlog(std::size_t value);
+
+  /**
+   * Configures the time after which sessions that have not received any
+   * packets from their peers are evicted.
+   *
+   * @param timeout Idle timeout, pos_infin disables eviction
+   */
+  inline void set_idle_timeout(const boost::posix_time::time_duration &timeout);
+
+  /**
+   * Configures the maximum number of sessions. When a new session would
+   * exceed it, the least recently active session is evicted.
+   *
+   * @param value Maximum number of sessions
+   */
+  inline void set_maximum_sessions(std::size_t value);
+
+  /**
+   * Configures the rate at which Hello packets are accepted from each
+   * source address prefix. Excess packets are dropped before any crypto
+   * work is done.
+   *
+   * @param rate Hellos per second, zero disables the limit
+   * @param burst Number of Hellos that may arrive at once
+   */
+  inline void set_source_hello_limit(double rate, double burst);
+
+  /**
+   * Configures the rate at which Hello packets are accepted in total.
+   *
+   * @param rate Hellos per second, zero disables the limit
+   * @param burst Number of Hellos that may arrive at once
+   */
+  inline void set_hello_budget(double rate, double burst);
+
+  /**
+   * Returns the acceptor counters.
+   */
+  inline accept_counters get_accept_counters();
+
+  /**
+   * Configures whether the time spent on handshakes is collected. Off by
+   * default, as it reads the clock several times per handshake packet.
+   *
+   * @param enabled True to collect handshake timings
+   */
+  inline void set_handshake_timing(bool enabled);
+
+  /**
+   * Returns the handshake timings collected so far.
+   */
+  inline handshake_timings get_handshake_timings();
+
+  /**
+   * Binds the underlying transport to a specific local endpoint.
    *
    * @param endpoint Endpoint to bind to
    */
@@ -93,6 +212,20 @@ public:
    */
   inline bool accept(curvecp::stream &stream, boost::system::error_code &error);
 
+  /**
+   * Performs an accept operation for a range of streams, accepting as many
+   * pending sessions as are available and fit into the range.
+   *
+   * @param first First destination stream
+   * @param last End of the destination streams
+   * @param accepted Resulting number of accepted streams
+   * @param error Error code
+   * @return True if at least one stream has been accepted, false if accept needs retry
+   */
+  template <typename StreamIterator>
+  inline bool accept_many(StreamIterator first, StreamIterator last, std::size_t &accepted,
+                          boost::system::error_code &error);
+
   /**
    * Returns the endpoint to which the local socket is bound.
    */
@@ -106,14 +239,32 @@ public:
    */
   template <typename Handler>
   inline void async_pending_accept_wait(BOOST_ASIO_MOVE_ARG(Handler) handler);
+
+  /**
+   * Wakes up pending accept operations so that they can observe their
+   * cancellation. Safe to call from any thread.
+   */
+  inline void cancel_pending_accept_wait();
 protected:
+  inline void initialize();
+
   inline void handle_session_close(const std::string &sessionKey);
 
-  inline void handle_upper_send(boost::shared_ptr<session> session,
+  inline void handle_upper_send(session *session,
                                 const unsigned char *buffer,
                                 std::size_t length);
 
   inline void handle_lower_read(const boost::system::error_code &error, std::size_t bytes);
+
+  inline void evict_session(session &session, std::uint64_t &counter);
+
+  inline void schedule_idle_sweep();
+
+  inline void handle_idle_sweep(const boost::system::error_code &error);
+
+  inline int put_session(const struct curvecpr_session *s, struct curvecpr_session **s_stored);
+
+  inline static std::uint64_t nanoseconds_since(std::chrono::steady_clock::time_point started);
 protected:
   /**
    * Internal handler for libcurvecpr.
@@ -156,23 +307,45 @@ private:
   /// Mutex
   std::recursive_mutex mutex_;
   /// Dispatch strand
-  boost::asio::strand strand_;
-  /// Underlying UDP socket
-  boost::asio::ip::udp::socket socket_;
+  session::strand_type strand_;
+  /// Underlying datagram transport
+  boost::shared_ptr<transport> transport_;
   /// Maximum number of allowed pending sessions
   std::size_t maximum_pending_sessions_;
+  /// Acceptor counters
+  accept_counters accept_counters_;
+  /// True when handshake timings are collected
+  bool handshake_timing_;
+  /// Handshake timings
+  handshake_timings handshake_timings_;
   /// Pending sessions waiting an accept call
   std::deque<boost::shared_ptr<session>> pending_sessions_;
   /// Session storage
   std::unordered_map<std::string, boost::shared_ptr<session>> sessions_;
+  /// Maximum number of sessions
+  std::size_t maximum_sessions_;
+  /// Sessions ordered from the least to the most recently active
+  boost::intrusive::list<session,
+    boost::intrusive::member_hook<session, decltype(session::activity_hook_), &session::activity_hook_>,
+    boost::intrusive::constant_time_size<false>> activity_;
+  /// Time after which idle sessions are evicted
+  boost::posix_time::time_duration idle_timeout_;
+  /// Idle session eviction timer
+  boost::asio::deadline_timer idle_timer_;
+  /// Idle session eviction pending flag
+  bool idle_sweep_pending_;
+  /// Pre-crypto Hello rate limiter
+  hello_limiter hello_limiter_;
   /// Server packet processor
   curvecpr_server server_;
   /// Receive endpoint
-  boost::asio::ip::udp::endpoint lower_recv_endpoint_;
+  transport::endpoint_type lower_recv_endpoint_;
   /// Receive buffer space
   std::vector<unsigned char> lower_recv_buffer_;
   /// Pending ready accept timer
   boost::asio::deadline_timer pending_ready_accept_;
+  /// Recycled memory for intermediate handlers of accept operations
+  handler_memory handler_memory_;
   /// Nonce generator
   std::function<void(unsigned char*, size_t)> nonce_generator_;
 };
@@ -8,10 +8,10 @@
 #define CURVECP_ASIO_DETAIL_BASIC_STREAM_HPP
 
 #include <curvecp/detail/session.hpp>
+#include <curvecp/detail/transport.hpp>
 #include <curvecp/detail/io.hpp>
 
-#include <boost/asio/io_service.hpp>
-#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/io_context.hpp>
 
 namespace curvecp {
 
@@ -23,15 +23,15 @@ namespace detail {
 class basic_stream {
 public:
   /// The endpoint type
-  typedef boost::asio::ip::udp::socket::endpoint_type endpoint_type;
+  typedef transport::endpoint_type endpoint_type;
 
   /**
    * Constructs an internal CurveCP client stream implementation.
    *
-   * @param service ASIO IO service
+   * @param service ASIO IO context
    * @param session Internal session reference
    */
-  basic_stream(boost::asio::io_service &service, session &session)
+  basic_stream(boost::asio::io_context &service, session &session)
     : ref_session_(session),
       pending_ready_connect_(service)
   {
@@ -42,9 +42,15 @@ public:
   basic_stream &operator=(const basic_stream&) = delete;
 
   /**
-   * Returns the ASIO IO service associated with this stream.
+   * Returns the ASIO IO context associated with this stream.
    */
-  virtual boost::asio::io_service &get_io_service() = 0;
+  virtual boost::asio::io_context &get_io_context() = 0;
+
+  /**
+   * Returns the memory used for intermediate handlers of operations on
+   * this stream.
+   */
+  handler_memory &get_handler_memory() { return ref_session_.get_handler_memory(); }
 
   /**
    * Configures the local CurveCP extension. Must be set before starting
@@ -100,6 +106,48 @@ public:
   virtual void set_remote_domain_name(const std::string &domain)
   {}
 
+  /**
+   * Configures retransmission of Hello packets. The timeout starts at the
+   * initial value, or at twice the round-trip time estimate when one is
+   * available, and doubles with every retransmission up to the maximum.
+   * Must be set before starting the connection.
+   *
+   * @param initial Initial retransmission timeout
+   * @param maximum Maximum retransmission timeout
+   * @param attempts Number of Hello packets sent before giving up
+   */
+  virtual void set_hello_backoff(const boost::posix_time::time_duration &/*initial*/,
+                                 const boost::posix_time::time_duration &/*maximum*/,
+                                 int /*attempts*/)
+  {}
+
+  /**
+   * Configures the round-trip time estimate that seeds the Hello
+   * retransmission timeout. Must be set before starting the connection.
+   *
+   * @param rtt Round-trip time estimate
+   */
+  virtual void set_rtt_estimate(const boost::posix_time::time_duration &/*rtt*/)
+  {}
+
+  /**
+   * Configures the delay after which the next candidate endpoint joins a
+   * connection race. Must be set before starting the connection.
+   *
+   * @param delay Delay between connection attempts
+   */
+  virtual void set_connect_stagger(const boost::posix_time::time_duration &/*delay*/)
+  {}
+
+  /**
+   * Returns the round-trip time measured during the handshake, or zero when
+   * it could not be measured.
+   */
+  virtual boost::posix_time::time_duration get_handshake_rtt()
+  {
+    return boost::posix_time::time_duration();
+  }
+
   /**
    * Configures the secure nonce generator. Must be set before starting the
    * connection.
@@ -113,7 +161,7 @@ public:
   }
 
   /**
-   * Binds the underlying UDP socket to a specific local endpoint.
+   * Binds the underlying transport to a specific local endpoint.
    *
    * @param endpoint Endpoint to bind to
    */
@@ -121,14 +169,14 @@ public:
   {}
 
   /**
-   * Connects the underlying UDP socket with a specific remote endpoint and
-   * starts the CurveCP connection.
+   * Starts the CurveCP connection with the first of the candidate remote
+   * endpoints that responds and connects the underlying transport with it.
    *
-   * @param endpoint Endpoint to connect with
+   * @param endpoints Candidate endpoints, in order of preference
    * @param ec Resulting error code
    * @return True when connect has been completed, false when it must be retried
    */
-  virtual bool connect(const endpoint_type &endpoint,
+  virtual bool connect(const std::vector<endpoint_type> &/*endpoints*/,
                        boost::system::error_code &ec)
   {
     ec = boost::system::error_code();
@@ -143,7 +191,229 @@ public:
   template <typename Handler>
   void async_pending_connect_wait(BOOST_ASIO_MOVE_ARG(Handler) handler)
   {
-    pending_ready_connect_.async_wait(ref_session_.get_strand().wrap(handler));
+    pending_ready_connect_.async_wait(boost::asio::bind_executor(ref_session_.get_strand(),
+      BOOST_ASIO_MOVE_CAST(Handler)(handler)));
+  }
+
+  /**
+   * Wakes up a pending connect operation so that it can observe its
+   * cancellation. Safe to call from any thread.
+   */
+  void cancel_pending_connect_wait()
+  {
+    boost::asio::dispatch(ref_session_.get_strand(), [this]() { pending_ready_connect_.cancel(); });
+  }
+
+  /**
+   * Enables reliable but unordered delivery of messages.
+   *
+   * @param value True to deliver messages out of order
+   */
+  void set_unordered_messages(bool value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_unordered_messages(value); });
+  }
+
+  /**
+   * Enables multiplexing of logical substreams over the session.
+   *
+   * @param value True to multiplex substreams
+   */
+  void set_multiplexed(bool value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_multiplexed(value); });
+  }
+
+  /**
+   * Configures the receive window of each substream.
+   *
+   * @param value Window size in bytes
+   */
+  void set_substream_window(std::size_t value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_substream_window(value); });
+  }
+
+  /**
+   * Opens a new substream.
+   *
+   * @return Substream identifier
+   */
+  std::uint32_t open_substream()
+  {
+    return ref_session_.invoke([this]() { return ref_session_.open_substream(); });
+  }
+
+  /**
+   * Shuts down the sending side of a substream.
+   *
+   * @param id Substream identifier
+   */
+  void close_substream(std::uint32_t id)
+  {
+    ref_session_.invoke([this, id]() { ref_session_.close_substream(id); });
+  }
+
+  /**
+   * Configures the maximum number of received datagrams that are queued
+   * until they are read.
+   *
+   * @param value Maximum number of queued datagrams
+   */
+  void set_datagram_queue_maximum(std::size_t value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_datagram_queue_maximum(value); });
+  }
+
+  /**
+   * Enables the unreliable datagram channel.
+   *
+   * @param value True to accept and send datagrams
+   */
+  void set_datagrams(bool value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_datagrams(value); });
+  }
+
+  /**
+   * Returns the datagram channel counters.
+   */
+  session::datagram_counters get_datagram_counters()
+  {
+    return ref_session_.invoke([this]() { return ref_session_.get_datagram_counters(); });
+  }
+
+  /**
+   * Configures forward error correction of sent blocks.
+   *
+   * @param data_blocks Number of blocks in a group
+   * @param repair_blocks Number of repairs per group, zero to disable
+   */
+  void set_forward_error_correction(std::size_t data_blocks, std::size_t repair_blocks)
+  {
+    ref_session_.invoke([this, data_blocks, repair_blocks]() {
+      ref_session_.set_forward_error_correction(data_blocks, repair_blocks);
+    });
+  }
+
+  /**
+   * Returns the forward error correction counters.
+   */
+  session::fec_counters get_fec_counters()
+  {
+    return ref_session_.invoke([this]() { return ref_session_.get_fec_counters(); });
+  }
+
+  /**
+   * Enables compression of the byte stream.
+   *
+   * @param value True to compress the byte stream
+   */
+  void set_compression(bool value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_compression(value); });
+  }
+
+  /**
+   * Configures the zstd compression level.
+   *
+   * @param value Compression level
+   */
+  void set_compression_level(int value)
+  {
+    ref_session_.invoke([this, value]() { ref_session_.set_compression_level(value); });
+  }
+
+  /**
+   * Returns the stream compression counters.
+   */
+  session::compression_counters get_compression_counters()
+  {
+    return ref_session_.invoke([this]() { return ref_session_.get_compression_counters(); });
+  }
+
+  /**
+   * Returns the number of bytes that can be read without waiting, or zero
+   * when the session strand is busy.
+   */
+  std::size_t available()
+  {
+    std::size_t bytes = 0;
+    ref_session_.try_invoke([&]() { bytes = ref_session_.available(); });
+    return bytes;
+  }
+
+  /**
+   * Reads data that is already available into the buffers, without waiting.
+   *
+   * @param buffers A mutable buffer sequence to write to
+   * @param ec Resulting error code, would_block when no data is available
+   *   or the session strand is busy
+   * @return Number of bytes transferred
+   */
+  template <typename MutableBufferSequence>
+  std::size_t try_read_some(const MutableBufferSequence &buffers,
+                            boost::system::error_code &ec)
+  {
+    std::size_t total = 0;
+    ec = boost::asio::error::would_block;
+    ref_session_.try_invoke([&]() {
+      ec = boost::system::error_code();
+
+      auto end = boost::asio::buffer_sequence_end(buffers);
+      for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end; ++it) {
+        boost::asio::mutable_buffer buffer(*it);
+        if (buffer.size() == 0)
+          continue;
+
+        std::size_t bytes = ref_session_.read_some(buffer, ec);
+        total += bytes;
+        if (ec || bytes < buffer.size())
+          break;
+      }
+
+      // Errors are reported by the next call when some data was read
+      if (total > 0)
+        ec = boost::system::error_code();
+    });
+    return total;
+  }
+
+  /**
+   * Writes as much data from the buffers as fits into the pending write
+   * buffer, without waiting.
+   *
+   * @param buffers A constant buffer sequence to read from
+   * @param ec Resulting error code, would_block when the buffer is full
+   *   or the session strand is busy
+   * @return Number of bytes transferred
+   */
+  template <typename ConstBufferSequence>
+  std::size_t try_write_some(const ConstBufferSequence &buffers,
+                             boost::system::error_code &ec)
+  {
+    std::size_t total = 0;
+    ec = boost::asio::error::would_block;
+    ref_session_.try_invoke([&]() {
+      ec = boost::system::error_code();
+
+      auto end = boost::asio::buffer_sequence_end(buffers);
+      for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end; ++it) {
+        boost::asio::const_buffer buffer(*it);
+        if (buffer.size() == 0)
+          continue;
+
+        std::size_t bytes = ref_session_.write_some(buffer, ec);
+        total += bytes;
+        if (ec || bytes < buffer.size())
+          break;
+      }
+
+      // Errors are reported by the next call when some data was written
+      if (total > 0)
+        ec = boost::system::error_code();
+    });
+    return total;
   }
 
   /**
@@ -153,9 +423,10 @@ public:
    * @param handler Handler to be called after operation completes
    */
   template <typename Operation, typename Handler>
-  void async_io_operation(const Operation &op, Handler &handler)
+  void async_io_operation(const Operation &op, BOOST_ASIO_MOVE_ARG(Handler) handler)
   {
-    io_op<basic_stream, Operation, Handler>(ref_session_, *this, op, handler)(boost::system::error_code(), true);
+    io_op<basic_stream, Operation, typename std::decay<Handler>::type>(ref_session_, *this, op,
+      BOOST_ASIO_MOVE_CAST(Handler)(handler))(boost::system::error_code(), true);
   }
 protected:
   /// Session
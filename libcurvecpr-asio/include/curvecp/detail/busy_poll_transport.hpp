@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_BUSY_POLL_TRANSPORT_HPP
+#define CURVECP_ASIO_DETAIL_BUSY_POLL_TRANSPORT_HPP
+
+#include <curvecp/detail/datagram_queue.hpp>
+#include <curvecp/detail/transport.hpp>
+
+// Thread pinning and socket busy polling are Linux interfaces
+#if defined(__linux__) && !defined(CURVECP_ASIO_DISABLE_BUSY_POLL)
+#define CURVECP_ASIO_HAS_BUSY_POLL 1
+#endif
+
+#if defined(CURVECP_ASIO_HAS_BUSY_POLL)
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Transport over a kernel datagram socket for latency-critical peers. A
+ * dedicated thread spins on non-blocking receives instead of waiting for
+ * the reactor to be woken up and moves received datagrams into a queue,
+ * from which receive operations are completed through the IO context.
+ * The thread never runs handlers itself. After spinning without any
+ * activity for the idle spin budget the thread blocks until the next
+ * datagram arrives. The IO context must still be run as usual. Must be
+ * owned by a boost::shared_ptr.
+ */
+class busy_poll_transport : public transport,
+                            public boost::enable_shared_from_this<busy_poll_transport> {
+public:
+  /**
+   * Constructs a new busy polling transport.
+   *
+   * @param service ASIO IO context
+   * @param cpu CPU to pin the polling thread to, -1 leaves it unpinned
+   */
+  inline explicit busy_poll_transport(boost::asio::io_context &service, int cpu = -1);
+
+  inline ~busy_poll_transport();
+
+  busy_poll_transport(const busy_poll_transport&) = delete;
+  busy_poll_transport &operator=(const busy_poll_transport&) = delete;
+
+  /**
+   * Configures how long the polling thread spins without receiving any
+   * datagrams before it blocks. Must be set before
+   * the transport is bound or connected.
+   *
+   * @param budget Idle spin budget
+   */
+  void set_idle_spin_budget(const boost::posix_time::time_duration &budget) { spin_budget_ = budget; }
+
+  /**
+   * Configures SO_BUSY_POLL on the socket, so that the kernel polls the
+   * device queue for up to the given time on receives instead of waiting
+   * for an interrupt. Must be set before the transport is bound or
+   * connected. Values above net.core.busy_read require CAP_NET_ADMIN.
+   *
+   * @param microseconds Busy poll time, zero disables it
+   */
+  void set_socket_busy_poll(int microseconds) { socket_busy_poll_ = microseconds; }
+
+  boost::asio::io_context &get_io_context() override { return service_; }
+
+  inline void bind(const endpoint_type &endpoint) override;
+
+  inline void connect(const endpoint_type &endpoint) override;
+
+  inline void open(const endpoint_type &endpoint) override;
+
+  inline void close() override;
+
+  inline endpoint_type local_endpoint() const override;
+
+  inline void async_receive(const boost::asio::mutable_buffer &buffer,
+                            handler_type handler) override;
+
+  inline void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                 endpoint_type &sender,
+                                 handler_type handler) override;
+
+  inline std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                      endpoint_type &sender,
+                                      boost::system::error_code &ec) override;
+
+  inline void async_send(const boost::asio::const_buffer &buffer,
+                         handler_type handler) override;
+
+  inline void async_send_to(const boost::asio::const_buffer &buffer,
+                            const endpoint_type &destination,
+                            handler_type handler) override;
+protected:
+  /**
+   * A send retried once other handlers have run, after the socket send
+   * buffer was found full.
+   */
+  struct retry_send {
+    /// Transport to send through
+    boost::shared_ptr<busy_poll_transport> self;
+    /// Datagram payload
+    boost::asio::const_buffer buffer;
+    /// Destination endpoint, unused on connected sockets
+    endpoint_type destination;
+    /// True when sent to the connected endpoint
+    bool connected;
+    /// Completion handler
+    handler_type handler;
+
+    void operator()() { self->send(buffer, connected ? nullptr : &destination, std::move(handler)); }
+  };
+
+  inline void open_socket(const endpoint_type &endpoint);
+
+  inline void start();
+
+  inline void stop(std::unique_lock<std::mutex> &lock);
+
+  inline void wake();
+
+  inline void send(const boost::asio::const_buffer &buffer,
+                   const endpoint_type *destination,
+                   handler_type handler);
+
+  inline bool poll_once();
+
+  inline void run(unsigned generation);
+private:
+  /// ASIO IO context
+  boost::asio::io_context &service_;
+  /// Mutex
+  mutable std::mutex mutex_;
+  /// Datagram socket, -1 when closed
+  int socket_;
+  /// Socket protocol
+  int protocol_;
+  /// Event descriptor that wakes up a blocked polling thread
+  int wakeup_;
+  /// CPU the polling thread is pinned to, -1 when unpinned
+  int cpu_;
+  /// Time spent spinning without activity before blocking
+  boost::posix_time::time_duration spin_budget_;
+  /// SO_BUSY_POLL time in microseconds, zero when disabled
+  int socket_busy_poll_;
+  /// Polling thread
+  std::thread poller_;
+  /// Generation of the polling thread, a thread exits once it changes
+  std::atomic<unsigned> generation_;
+  /// Buffer the polling thread receives into
+  std::vector<unsigned char> poll_buffer_;
+  /// Sender destination for receives on a connected transport
+  endpoint_type connected_sender_;
+  /// Datagrams waiting for reception
+  datagram_queue receive_queue_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/busy_poll_transport.ipp>
+
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_BYTE_SEARCH_HPP
+#define CURVECP_ASIO_DETAIL_BYTE_SEARCH_HPP
+
+#include <curvecp/detail/simd.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Search for the first occurrence of a byte, used to find delimiters in
+ * received blocks. The SSE2 and AVX2 kernels compare 16 or 32 bytes at a
+ * time and are inlined into the scan, which matters for the short ranges
+ * left in a block; the portable kernel is the C library memchr.
+ */
+class byte_search {
+public:
+  /**
+   * Implementation of the search.
+   */
+  enum class kernel {
+    // C library memchr
+    portable,
+    // 128-bit SSE2 comparisons
+    sse2,
+    // 256-bit AVX2 comparisons
+    avx2
+  };
+
+  /**
+   * Returns the fastest kernel supported by the processor.
+   */
+  static kernel best_kernel()
+  {
+    static const kernel best = detect_kernel();
+    return best;
+  }
+
+  /**
+   * Returns the name of a kernel.
+   *
+   * @param k Kernel
+   */
+  static const char *kernel_name(kernel k)
+  {
+    switch (k) {
+      case kernel::sse2: return "sse2";
+      case kernel::avx2: return "avx2";
+      default: return "memchr";
+    }
+  }
+
+  /**
+   * Finds the first occurrence of a byte.
+   *
+   * @param data Buffer to search
+   * @param length Length of the buffer
+   * @param value Byte to search for
+   * @param k Kernel to use
+   * @return Index of the byte, or length when it does not occur
+   */
+  static std::size_t find(const unsigned char *data, std::size_t length, unsigned char value,
+                          kernel k = best_kernel())
+  {
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+    if (k == kernel::avx2)
+      return find_avx2(data, length, value);
+    else if (k == kernel::sse2)
+      return find_sse2(data, length, value);
+#endif
+
+    const void *found = length ? std::memchr(data, value, length) : nullptr;
+    return found ? static_cast<const unsigned char*>(found) - data : length;
+  }
+private:
+  static kernel detect_kernel()
+  {
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return kernel::avx2;
+    if (__builtin_cpu_supports("sse2"))
+      return kernel::sse2;
+#endif
+    return kernel::portable;
+  }
+
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+  __attribute__((target("sse2")))
+  static std::size_t find_sse2(const unsigned char *data, std::size_t length, unsigned char value)
+  {
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+
+    // Four vectors per iteration share a single branch
+    std::size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+      __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), needle);
+      __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16)), needle);
+      __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 32)), needle);
+      __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 48)), needle);
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) {
+        std::uint64_t mask = static_cast<std::uint64_t>(_mm_movemask_epi8(a)) |
+                             static_cast<std::uint64_t>(_mm_movemask_epi8(b)) << 16 |
+                             static_cast<std::uint64_t>(_mm_movemask_epi8(c)) << 32 |
+                             static_cast<std::uint64_t>(_mm_movemask_epi8(d)) << 48;
+        return i + __builtin_ctzll(mask);
+      }
+    }
+
+    for (; i + 16 <= length; i += 16) {
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), needle));
+      if (mask)
+        return i + __builtin_ctz(mask);
+    }
+
+    for (; i < length; i++) {
+      if (data[i] == value)
+        return i;
+    }
+    return length;
+  }
+
+  __attribute__((target("avx2")))
+  static std::size_t find_avx2(const unsigned char *data, std::size_t length, unsigned char value)
+  {
+    const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+
+    // Four vectors per iteration share a single branch
+    std::size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+      __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), needle);
+      __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32)), needle);
+      __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 64)), needle);
+      __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 96)), needle);
+      if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)))) {
+        std::uint64_t low = static_cast<std::uint32_t>(_mm256_movemask_epi8(a)) |
+                            static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(b))) << 32;
+        if (low)
+          return i + __builtin_ctzll(low);
+        std::uint64_t high = static_cast<std::uint32_t>(_mm256_movemask_epi8(c)) |
+                             static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(d))) << 32;
+        return i + 64 + __builtin_ctzll(high);
+      }
+    }
+
+    for (; i + 32 <= length; i += 32) {
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), needle)));
+      if (mask)
+        return i + __builtin_ctz(mask);
+    }
+
+    // The tail is shorter than a vector
+    return i + find_sse2(data + i, length - i, value);
+  }
+#endif
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_CLIENT_ENDPOINT_HPP
+#define CURVECP_ASIO_DETAIL_CLIENT_ENDPOINT_HPP
+
+#include <curvecp/detail/datagram_queue.hpp>
+#include <curvecp/detail/transport.hpp>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+class client_endpoint;
+
+/**
+ * Transport of a single client stream attached to a client endpoint. It
+ * sends through one of the shared endpoint sockets and receives the packets
+ * that the endpoint has routed to it.
+ */
+class client_endpoint_channel : public transport {
+public:
+  friend class client_endpoint;
+
+  /**
+   * Constructs a new channel. Channels should be created through the
+   * client endpoint.
+   *
+   * @param endpoint Client endpoint the channel is attached to
+   * @param socket Index of the endpoint socket used for sending
+   * @param extension Unique 16-byte local extension used for routing
+   */
+  inline client_endpoint_channel(boost::shared_ptr<client_endpoint> endpoint,
+                                 std::size_t socket,
+                                 const std::string &extension);
+
+  inline ~client_endpoint_channel();
+
+  client_endpoint_channel(const client_endpoint_channel&) = delete;
+  client_endpoint_channel &operator=(const client_endpoint_channel&) = delete;
+
+  inline boost::asio::io_context &get_io_context() override;
+
+  /**
+   * Returns the local CurveCP extension that the endpoint uses to route
+   * packets to this channel.
+   */
+  const std::string &extension() const { return extension_; }
+
+  inline void bind(const endpoint_type &endpoint) override;
+
+  inline void connect(const endpoint_type &endpoint) override;
+
+  inline void open(const endpoint_type &endpoint) override;
+
+  inline void close() override;
+
+  inline endpoint_type local_endpoint() const override;
+
+  inline void async_receive(const boost::asio::mutable_buffer &buffer,
+                            handler_type handler) override;
+
+  inline void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                 endpoint_type &sender,
+                                 handler_type handler) override;
+
+  inline std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                      endpoint_type &sender,
+                                      boost::system::error_code &ec) override;
+
+  inline std::size_t maximum_datagram_size() const override;
+
+  inline void async_send(const boost::asio::const_buffer &buffer,
+                         handler_type handler) override;
+
+  inline void async_send_to(const boost::asio::const_buffer &buffer,
+                            const endpoint_type &destination,
+                            handler_type handler) override;
+protected:
+  inline void deliver(const endpoint_type &source, const boost::asio::const_buffer &buffer);
+private:
+  /// Client endpoint
+  boost::shared_ptr<client_endpoint> endpoint_;
+  /// Index of the endpoint socket used for sending
+  std::size_t socket_;
+  /// Local extension used for routing
+  std::string extension_;
+  /// Mutex
+  mutable std::mutex mutex_;
+  /// True when packets routed to the channel are accepted
+  bool open_;
+  /// True when connected to a remote endpoint
+  bool connected_;
+  /// Connected remote endpoint
+  endpoint_type remote_;
+  /// Sender destination for receives on a connected channel
+  endpoint_type connected_sender_;
+  /// Packets waiting for reception
+  datagram_queue receive_queue_;
+};
+
+/**
+ * Internal shared-socket client endpoint implementation. Server packets
+ * carry the client extension in cleartext right after the packet magic,
+ * so each attached channel is assigned a unique extension which is used
+ * to route incoming packets without any cryptographic work.
+ */
+class client_endpoint : public boost::enable_shared_from_this<client_endpoint> {
+public:
+  friend class client_endpoint_channel;
+
+  /// Largest packet a CurveCP server sends to a client (Server Message)
+  static const std::size_t maximum_packet_size = 1152;
+
+  /**
+   * Constructs a new client endpoint over the given transports, which must
+   * already be bound. Receiving starts with the call to start().
+   *
+   * @param transports Transports shared by all attached channels
+   */
+  inline client_endpoint(const std::vector<boost::shared_ptr<transport>> &transports);
+
+  client_endpoint(const client_endpoint&) = delete;
+  client_endpoint &operator=(const client_endpoint&) = delete;
+
+  /**
+   * Returns the ASIO IO context associated with this endpoint.
+   */
+  boost::asio::io_context &get_io_context() { return sockets_.front().transport->get_io_context(); }
+
+  /**
+   * Configures the maximum number of datagrams drained from a socket per
+   * completed receive operation.
+   *
+   * @param value Maximum number of datagrams
+   */
+  void set_receive_batch_maximum(std::size_t value) { receive_batch_maximum_ = value; }
+
+  /**
+   * Starts receiving on all transports.
+   */
+  inline void start();
+
+  /**
+   * Closes all transports. Attached channels are unable to send or
+   * receive afterwards.
+   */
+  inline void close();
+
+  /**
+   * Creates a new channel attached to this endpoint. Sockets are assigned
+   * to channels in a round-robin fashion.
+   */
+  inline boost::shared_ptr<client_endpoint_channel> create_channel();
+
+  /**
+   * Returns the number of currently attached channels.
+   */
+  inline std::size_t channel_count() const;
+
+  /**
+   * Returns the number of received packets that could not be routed to
+   * any attached channel.
+   */
+  inline std::uint64_t unroutable_packets() const;
+protected:
+  inline void detach(const std::string &extension);
+
+  inline void start_receive(std::size_t index);
+
+  inline void handle_receive(std::size_t index,
+                             const boost::system::error_code &error,
+                             std::size_t bytes);
+
+  inline void route(const transport::endpoint_type &source,
+                    const unsigned char *buffer,
+                    std::size_t length);
+private:
+  /**
+   * A shared socket along with its receive state.
+   */
+  struct socket_state {
+    /// Underlying transport
+    boost::shared_ptr<detail::transport> transport;
+    /// Receive buffer space
+    std::vector<unsigned char> buffer;
+    /// Sender of the last received datagram
+    detail::transport::endpoint_type sender;
+  };
+
+  /// Shared sockets
+  std::vector<socket_state> sockets_;
+  /// Mutex
+  mutable std::mutex mutex_;
+  /// Attached channels by their local extension
+  std::unordered_map<std::string, client_endpoint_channel*> channels_;
+  /// Counter used to generate unique extensions
+  std::uint64_t next_extension_;
+  /// Socket assigned to the next channel
+  std::size_t next_socket_;
+  /// Maximum number of datagrams drained per completed receive
+  std::size_t receive_batch_maximum_;
+  /// Number of packets that could not be routed
+  std::uint64_t unroutable_packets_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/client_endpoint.ipp>
+
+#endif
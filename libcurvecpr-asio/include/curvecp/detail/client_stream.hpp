@@ -11,13 +11,17 @@
 
 #include <curvecp/detail/session.hpp>
 #include <curvecp/detail/basic_stream.hpp>
+#include <curvecp/detail/transport.hpp>
 
-#include <boost/asio/io_service.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_context.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/asio/deadline_timer.hpp>
-#include <boost/asio/ip/udp.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include <deque>
+#include <random>
+#include <vector>
 
 namespace curvecp {
 
@@ -29,25 +33,44 @@ namespace detail {
 class client_stream : public basic_stream {
 public:
   /**
-   * Constructs an internal CurveCP client stream implementation.
+   * Constructs an internal CurveCP client stream implementation that
+   * uses its own UDP socket.
    *
-   * @param service ASIO IO service
+   * @param service ASIO IO context
    */
-  inline client_stream(boost::asio::io_service &service);
+  inline client_stream(boost::asio::io_context &service);
 
   /**
-   * Returns the ASIO IO service associated with this stream.
+   * Constructs an internal CurveCP client stream implementation over
+   * a specific transport.
+   *
+   * @param transport Datagram transport
    */
-  boost::asio::io_service &get_io_service() { return socket_.get_io_service(); }
+  inline client_stream(boost::shared_ptr<transport> transport);
+
+  /**
+   * Returns the ASIO IO context associated with this stream.
+   */
+  boost::asio::io_context &get_io_context() { return transport_->get_io_context(); }
 
   /**
    * Configures the local CurveCP extension. Must be set before starting
-   * the connection.
+   * the connection. Ignored once an extension has been assigned by a
+   * client endpoint.
    *
    * @param extension A 16-byte local extension
    */
   inline void set_local_extension(const std::string &extension);
 
+  /**
+   * Assigns the local CurveCP extension on behalf of a client endpoint,
+   * which routes replies to this stream by it. The extension can not be
+   * changed afterwards.
+   *
+   * @param extension A 16-byte local extension
+   */
+  inline void assign_local_extension(const std::string &extension);
+
   /**
    * Configures the local CurveCP public key. Must be set before starting
    * the connection.
@@ -89,27 +112,72 @@ public:
   inline void set_remote_domain_name(const std::string &domain);
 
   /**
-   * Binds the underlying UDP socket to a specific local endpoint.
+   * Configures retransmission of Hello packets. Must be set before
+   * starting the connection.
+   *
+   * @param initial Initial retransmission timeout
+   * @param maximum Maximum retransmission timeout
+   * @param attempts Number of Hello packets sent before giving up
+   */
+  inline void set_hello_backoff(const boost::posix_time::time_duration &initial,
+                                const boost::posix_time::time_duration &maximum,
+                                int attempts) override;
+
+  /**
+   * Configures the round-trip time estimate that seeds the Hello
+   * retransmission timeout. Must be set before starting the connection.
+   *
+   * @param rtt Round-trip time estimate
+   */
+  inline void set_rtt_estimate(const boost::posix_time::time_duration &rtt) override;
+
+  /**
+   * Configures the delay after which the next candidate endpoint joins a
+   * connection race. Must be set before starting the connection.
+   *
+   * @param delay Delay between connection attempts
+   */
+  inline void set_connect_stagger(const boost::posix_time::time_duration &delay) override;
+
+  /**
+   * Returns the round-trip time measured between sending a Hello packet
+   * and receiving the cookie, or zero when it could not be measured.
+   */
+  boost::posix_time::time_duration get_handshake_rtt() override { return handshake_rtt_; }
+
+  /**
+   * Binds the underlying transport to a specific local endpoint.
    *
    * @param endpoint Endpoint to bind to
    */
   inline void bind(const endpoint_type &endpoint) override;
 
   /**
-   * Connects the underlying UDP socket with a specific remote endpoint and
-   * starts the CurveCP connection.
+   * Starts the CurveCP connection. With several candidate endpoints, Hello
+   * packets are sent to one more candidate after every stagger delay and
+   * the first candidate that answers with a cookie wins the race; all
+   * candidates must use the same address family and server keys.
    *
-   * @param endpoint Endpoint to connect with
+   * @param endpoints Candidate endpoints, in order of preference
    * @param ec Resulting error code
    * @return True when connect has been completed, false when it must be retried
    */
-  inline bool connect(const endpoint_type &endpoint,
+  inline bool connect(const std::vector<endpoint_type> &endpoints,
                       boost::system::error_code &ec) override;
 protected:
+  inline void initialize();
+
+  inline void start_lower_receive();
+
+  inline void send_lower(const unsigned char *buffer, std::size_t length,
+                         const endpoint_type *destination);
+
   inline void handle_upper_send(const unsigned char *buffer, std::size_t length);
 
   inline void handle_hello_timeout(const boost::system::error_code &error);
 
+  inline void handle_connect_stagger(const boost::system::error_code &error);
+
   inline void handle_lower_read(const boost::system::error_code &error, std::size_t bytes);
 protected:
   /**
@@ -134,8 +202,8 @@ protected:
                                       size_t num);
 private:
   session session_;
-  /// Transport UDP socket
-  boost::asio::ip::udp::socket socket_;
+  /// Datagram transport
+  boost::shared_ptr<transport> transport_;
   /// Client packet processor
   curvecpr_client client_;
   /// Receive buffer space
@@ -144,6 +212,51 @@ private:
   boost::asio::deadline_timer hello_timed_out_;
   /// Hello retries
   int hello_retries_;
+  /// Initial Hello retransmission timeout without a round-trip time estimate
+  boost::posix_time::time_duration hello_timeout_initial_;
+  /// Maximum Hello retransmission timeout
+  boost::posix_time::time_duration hello_timeout_maximum_;
+  /// Number of Hello packets sent before giving up
+  int hello_attempts_;
+  /// Current Hello retransmission timeout
+  boost::posix_time::time_duration hello_timeout_;
+  /// Round-trip time estimate, zero when unknown
+  boost::posix_time::time_duration rtt_estimate_;
+  /// Round-trip time measured during the last handshake
+  boost::posix_time::time_duration handshake_rtt_;
+  /// Source of retransmission timeout jitter
+  std::minstd_rand jitter_;
+
+  /**
+   * Candidate endpoint of a connection race.
+   */
+  struct candidate {
+    /// Remote endpoint
+    endpoint_type endpoint;
+    /// Time the last Hello packet was sent to the endpoint
+    boost::posix_time::ptime hello_sent;
+    /// Number of Hello packets sent to the endpoint
+    int hellos;
+  };
+
+  /// Candidate endpoints
+  std::vector<candidate> candidates_;
+  /// Number of candidates that have joined the race
+  std::size_t candidates_racing_;
+  /// True while racing several candidates over an unconnected transport
+  bool racing_;
+  /// True while the connection is being established
+  bool connecting_;
+  /// Timer to let the next candidate join the race
+  boost::asio::deadline_timer connect_stagger_timer_;
+  /// Delay between candidates joining the race
+  boost::posix_time::time_duration connect_stagger_;
+  /// Last sent Hello packet, sent to candidates as they join the race
+  std::vector<unsigned char> hello_packet_;
+  /// Sender of the last received datagram while racing
+  endpoint_type lower_recv_endpoint_;
+  /// True when the local extension has been assigned by a client endpoint
+  bool local_extension_assigned_;
 };
 
 }
@@ -38,6 +38,16 @@ public:
     return session.close() ? session::want::nothing : session::want::close;
   }
 
+  /**
+   * Stops waiting for the close to complete after the operation has been
+   * cancelled. The session continues closing in the background.
+   */
+  void abort(session&,
+             boost::system::error_code&,
+             std::size_t&) const
+  {
+  }
+
   /**
    * Calls the handler for this operation.
    *
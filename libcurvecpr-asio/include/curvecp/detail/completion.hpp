@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_COMPLETION_HPP
+#define CURVECP_ASIO_DETAIL_COMPLETION_HPP
+
+#include <boost/version.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+#if BOOST_VERSION >= 107400
+#include <boost/asio/execution/executor.hpp>
+#include <boost/asio/execution/outstanding_work.hpp>
+#include <boost/asio/prefer.hpp>
+#endif
+
+#if BOOST_VERSION >= 107700
+#include <boost/asio/associated_cancellation_slot.hpp>
+#include <boost/asio/cancellation_type.hpp>
+#endif
+
+#if BOOST_VERSION >= 108200
+#include <boost/asio/associated_immediate_executor.hpp>
+#endif
+
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Tracks outstanding work on the executor associated with a completion
+ * handler for as long as the operation is pending, so that the executor
+ * does not run out of work before the handler is invoked.
+ */
+template <typename Executor, typename Enable = void>
+class handler_work {
+public:
+  explicit handler_work(const Executor &executor)
+    : guard_(executor)
+  {
+  }
+
+  /**
+   * Stops tracking work. Must be called before invoking the handler.
+   */
+  void reset() { guard_.reset(); }
+private:
+  /// Work guard for executors following the Networking TS model
+  boost::asio::executor_work_guard<Executor> guard_;
+};
+
+#if BOOST_VERSION >= 107400
+template <typename Executor>
+class handler_work<Executor,
+  typename std::enable_if<boost::asio::execution::is_executor<Executor>::value>::type> {
+public:
+  explicit handler_work(const Executor &executor)
+    : executor_(boost::asio::prefer(executor, boost::asio::execution::outstanding_work.tracked))
+  {
+  }
+
+  /**
+   * Stops tracking work. Must be called before invoking the handler.
+   */
+  void reset() { executor_ = boost::none; }
+private:
+  typedef typename std::decay<typename boost::asio::prefer_result<const Executor&,
+    boost::asio::execution::outstanding_work_t::tracked_t>::type>::type tracked_executor;
+
+  /// Work tracking executor for standard executors
+  boost::optional<tracked_executor> executor_;
+};
+#endif
+
+/**
+ * Invokes a function representing the completion of an operation through
+ * the executor associated with its handler. Completions that happen within
+ * the initiating function never run inline; with Boost 1.82 or newer they
+ * go through the handler's associated immediate executor, older versions
+ * post them. All other completions are dispatched, so that they resume
+ * inline when already running on the handler's executor.
+ *
+ * @param handler Completion handler
+ * @param io_executor Executor of the I/O object
+ * @param immediate True when called from within the initiating function
+ * @param function Function that invokes the handler
+ */
+template <typename Handler, typename IoExecutor, typename Function>
+void dispatch_completion(const Handler &handler,
+                         const IoExecutor &io_executor,
+                         bool immediate,
+                         Function &&function)
+{
+  if (immediate) {
+#if BOOST_VERSION >= 108200
+    boost::asio::dispatch(boost::asio::get_associated_immediate_executor(handler, io_executor),
+      std::forward<Function>(function));
+#else
+    boost::asio::post(boost::asio::get_associated_executor(handler, io_executor),
+      std::forward<Function>(function));
+#endif
+  } else {
+    boost::asio::dispatch(boost::asio::get_associated_executor(handler, io_executor),
+      std::forward<Function>(function));
+  }
+}
+
+/**
+ * Per-operation cancellation state. When the completion handler has a
+ * connected cancellation slot (Boost 1.77 or newer), a cancellation
+ * request marks the operation as cancelled and invokes a waker that
+ * interrupts whatever the operation is waiting for. The operation checks
+ * the state each time it resumes.
+ */
+class operation_cancellation {
+public:
+  /**
+   * Installs a cancellation handler into the slot associated with the
+   * given completion handler, if there is one.
+   *
+   * @param handler Completion handler
+   * @param waker Function object that wakes up the waiting operation
+   */
+  template <typename Handler, typename Waker>
+  void install(Handler &handler, Waker waker)
+  {
+#if BOOST_VERSION >= 107700
+    typename boost::asio::associated_cancellation_slot<Handler>::type slot =
+      boost::asio::get_associated_cancellation_slot(handler);
+    if (!slot.is_connected())
+      return;
+
+    flag_ = boost::make_shared<std::atomic<bool>>(false);
+    slot.template emplace<cancellation_handler<Waker>>(flag_, waker);
+#else
+    (void) handler;
+    (void) waker;
+#endif
+  }
+
+  /**
+   * Removes the cancellation handler before the operation completes.
+   *
+   * @param handler Completion handler
+   */
+  template <typename Handler>
+  void clear(Handler &handler)
+  {
+#if BOOST_VERSION >= 107700
+    if (flag_)
+      boost::asio::get_associated_cancellation_slot(handler).clear();
+#else
+    (void) handler;
+#endif
+  }
+
+  /**
+   * Returns true when cancellation has been requested.
+   */
+  bool cancelled() const { return flag_ && flag_->load(); }
+private:
+#if BOOST_VERSION >= 107700
+  /**
+   * Handler installed into the cancellation slot.
+   */
+  template <typename Waker>
+  class cancellation_handler {
+  public:
+    cancellation_handler(boost::shared_ptr<std::atomic<bool>> flag, Waker waker)
+      : flag_(flag),
+        waker_(waker)
+    {
+    }
+
+    void operator()(boost::asio::cancellation_type_t type)
+    {
+      if (type == boost::asio::cancellation_type::none)
+        return;
+
+      flag_->store(true);
+      waker_();
+    }
+  private:
+    /// Shared cancellation flag
+    boost::shared_ptr<std::atomic<bool>> flag_;
+    /// Wakes up the waiting operation
+    Waker waker_;
+  };
+#endif
+
+  /// Cancellation flag, only allocated when a slot is connected
+  boost::shared_ptr<std::atomic<bool>> flag_;
+};
+
+}
+
+}
+
+#endif
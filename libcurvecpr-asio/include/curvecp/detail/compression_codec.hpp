@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_COMPRESSION_CODEC_HPP
+#define CURVECP_ASIO_DETAIL_COMPRESSION_CODEC_HPP
+
+#if defined(CURVECP_ASIO_ENABLE_ZSTD)
+#define CURVECP_ASIO_HAS_ZSTD 1
+#endif
+
+#include <cstdint>
+#include <vector>
+
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Streaming zstd compressor and decompressor of one session. Compressed
+ * data is flushed at the end of every chunk, so the peer can decompress a
+ * chunk as soon as it has arrived, while the history of earlier chunks is
+ * kept to improve the ratio of small ones. Without zstd support, which is
+ * enabled by defining CURVECP_ASIO_ENABLE_ZSTD and linking libzstd, the
+ * codec supports nothing and data is always sent uncompressed.
+ */
+class compression_codec {
+public:
+  /**
+   * Result of a decompression step.
+   */
+  enum class status {
+    // All output of the input consumed so far has been produced
+    done,
+    // More output is pending, the step must be repeated
+    more,
+    // The input is corrupt
+    error
+  };
+
+  compression_codec()
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    : compressor_(nullptr),
+      decompressor_(nullptr),
+      level_(3)
+#endif
+  {
+  }
+
+  ~compression_codec()
+  {
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    ZSTD_freeCCtx(compressor_);
+    ZSTD_freeDCtx(decompressor_);
+#endif
+  }
+
+  compression_codec(const compression_codec&) = delete;
+  compression_codec &operator=(const compression_codec&) = delete;
+
+  /**
+   * Returns true when the codec can compress and decompress data.
+   */
+  static bool supported()
+  {
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * Configures the compression level, which takes effect once the
+   * compressor is reset.
+   *
+   * @param level Compression level
+   */
+  void set_level(int level)
+  {
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    level_ = level;
+#else
+    (void) level;
+#endif
+  }
+
+  /**
+   * Compresses a chunk given in up to two parts and appends the compressed
+   * data to a buffer.
+   *
+   * @param first First part of the chunk
+   * @param first_length Length of the first part
+   * @param second Second part of the chunk
+   * @param second_length Length of the second part
+   * @param out Buffer to append to
+   * @return False when compression has failed
+   */
+  bool compress(const unsigned char *first, std::size_t first_length,
+                const unsigned char *second, std::size_t second_length,
+                std::vector<unsigned char> &out)
+  {
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    if (!compressor_) {
+      compressor_ = ZSTD_createCCtx();
+      if (!compressor_)
+        return false;
+      ZSTD_CCtx_setParameter(compressor_, ZSTD_c_compressionLevel, level_);
+    }
+
+    std::size_t start = out.size();
+    out.resize(start + ZSTD_compressBound(first_length + second_length) + 32);
+    ZSTD_outBuffer output = { &out[0], out.size(), start };
+
+    ZSTD_inBuffer input = { first, first_length, 0 };
+    while (input.pos < input.size) {
+      if (ZSTD_isError(ZSTD_compressStream2(compressor_, &output, &input, ZSTD_e_continue)))
+        return false;
+    }
+
+    input = { second, second_length, 0 };
+    for (;;) {
+      std::size_t remaining = ZSTD_compressStream2(compressor_, &output, &input, ZSTD_e_flush);
+      if (ZSTD_isError(remaining))
+        return false;
+      if (remaining == 0)
+        break;
+      out.resize(out.size() * 2);
+      output.dst = &out[0];
+      output.size = out.size();
+    }
+
+    out.resize(output.pos);
+    return true;
+#else
+    (void) first; (void) first_length; (void) second; (void) second_length; (void) out;
+    return false;
+#endif
+  }
+
+  /**
+   * Discards the compression history, which must be done whenever the peer
+   * resets its decompressor.
+   */
+  void reset_compressor()
+  {
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    if (compressor_) {
+      ZSTD_CCtx_reset(compressor_, ZSTD_reset_session_only);
+      ZSTD_CCtx_setParameter(compressor_, ZSTD_c_compressionLevel, level_);
+    }
+#endif
+  }
+
+  /**
+   * Decompresses as much input as fits into the output buffer.
+   *
+   * @param in Compressed input
+   * @param in_length Length of the input
+   * @param consumed Advanced by the number of input bytes consumed
+   * @param out Output buffer
+   * @param out_length Size of the output buffer
+   * @param produced Set to the number of output bytes produced
+   * @return Decompression status
+   */
+  status decompress(const unsigned char *in, std::size_t in_length, std::size_t &consumed,
+                    unsigned char *out, std::size_t out_length, std::size_t &produced)
+  {
+    produced = 0;
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    if (!decompressor_) {
+      decompressor_ = ZSTD_createDCtx();
+      if (!decompressor_)
+        return status::error;
+    }
+
+    ZSTD_inBuffer input = { in, in_length, consumed };
+    ZSTD_outBuffer output = { out, out_length, 0 };
+    if (ZSTD_isError(ZSTD_decompressStream(decompressor_, &output, &input)))
+      return status::error;
+
+    consumed = input.pos;
+    produced = output.pos;
+
+    // A full output buffer may hide more output of the consumed input
+    return output.pos == output.size ? status::more : status::done;
+#else
+    (void) in; (void) in_length; (void) consumed; (void) out; (void) out_length;
+    return status::error;
+#endif
+  }
+
+  /**
+   * Discards the decompression history.
+   */
+  void reset_decompressor()
+  {
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+    if (decompressor_)
+      ZSTD_DCtx_reset(decompressor_, ZSTD_reset_session_only);
+#endif
+  }
+private:
+#if defined(CURVECP_ASIO_HAS_ZSTD)
+  /// Compression context, created when first used
+  ZSTD_CCtx *compressor_;
+  /// Decompression context, created when first used
+  ZSTD_DCtx *decompressor_;
+  /// Compression level
+  int level_;
+#endif
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_COMPRESSION_LAYER_HPP
+#define CURVECP_ASIO_DETAIL_COMPRESSION_LAYER_HPP
+
+#include <curvecp/detail/compression_codec.hpp>
+
+#include <boost/system/error_code.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Compression of the stream of a session. Written data is cut into chunks
+ * that are framed by a type and a length and compressed when that pays
+ * off, and received chunks are decompressed again for reads. This class is
+ * not thread safe; the session only uses it from within its strand.
+ */
+class compression_layer {
+public:
+  /**
+   * Counters of stream compression.
+   */
+  struct counters {
+    /// Number of bytes taken from the write buffer
+    std::uint64_t bytes_in;
+    /// Number of bytes sent in their place, including framing
+    std::uint64_t bytes_out;
+    /// Number of chunks sent compressed
+    std::uint64_t chunks_compressed;
+    /// Number of chunks sent uncompressed
+    std::uint64_t chunks_raw;
+  };
+
+  /**
+   * Constructs a disabled compression layer.
+   */
+  inline compression_layer();
+
+  /**
+   * Returns true when compression has been enabled.
+   */
+  bool enabled() const { return enabled_; }
+
+  /**
+   * Enables or disables compression of the chunks that are framed next.
+   *
+   * @param value True to compress chunks
+   */
+  inline void set_enabled(bool value);
+
+  /**
+   * Configures the zstd compression level.
+   *
+   * @param value Compression level
+   */
+  void set_level(int value) { codec_.set_level(value); }
+
+  /**
+   * Returns the stream compression counters.
+   */
+  const counters &get_counters() const { return counters_; }
+
+  /**
+   * Returns true when framed chunks are waiting to be sent.
+   */
+  bool frames_pending() const { return send_head_ < send_.size(); }
+
+  /**
+   * Frames the next chunk of written data, which is given in up to two
+   * parts as it may wrap around the end of the write buffer.
+   *
+   * @param first First part of the data
+   * @param first_length Length of the first part
+   * @param second Second part of the data
+   * @param second_length Length of the second part
+   * @param compress True when the peer can decompress the chunk
+   * @return Number of bytes taken from the parts
+   */
+  inline std::size_t put_chunk(const unsigned char *first, std::size_t first_length,
+                               const unsigned char *second, std::size_t second_length,
+                               bool compress);
+
+  /**
+   * Moves framed chunks into the data of a block.
+   *
+   * @param data Block data to write to
+   * @param length Number of bytes that fit into the block
+   * @return Number of bytes written
+   */
+  inline std::size_t take_frames(unsigned char *data, std::size_t length);
+
+  /**
+   * Reads decompressed data of the received stream.
+   *
+   * @param buffer Destination buffer to read into
+   * @param length Length of the destination buffer
+   * @param source Function that reads framed chunks from the stream,
+   *   called with a buffer and its length and returning the number of
+   *   bytes read
+   * @param ec Resulting error code, bad_message on corrupt chunks
+   * @return Number of bytes transferred
+   */
+  template <typename Source>
+  inline std::size_t read(unsigned char *buffer, std::size_t length, Source source,
+                          boost::system::error_code &ec);
+
+  /**
+   * Returns the number of decompressed bytes that can be read without
+   * waiting, decompressing what has been received so far.
+   *
+   * @param source Function that reads framed chunks from the stream
+   */
+  template <typename Source>
+  inline std::size_t available(Source source);
+
+  /**
+   * Returns true when no decompressed data is waiting to be read.
+   */
+  bool drained() const { return output_head_ == output_.size() && !record_active_; }
+
+  /**
+   * Drops the state of both directions of the stream.
+   */
+  inline void clear();
+private:
+  template <typename Source>
+  inline bool pull_record(Source &source, boost::system::error_code &ec);
+
+  template <typename Source>
+  inline bool decompress_more(Source &source, boost::system::error_code &ec);
+private:
+  /// Compression flag
+  bool enabled_;
+  /// Compressor and decompressor of the stream
+  compression_codec codec_;
+  /// Number of chunks to send uncompressed before compressing again
+  std::size_t skip_;
+  /// Number of chunks skipped after the last incompressible chunk
+  std::size_t backoff_;
+  /// Framed chunks waiting to be cut into blocks
+  std::vector<unsigned char> send_;
+  /// Offset of the first unsent byte of framed chunks
+  std::size_t send_head_;
+  /// Received chunk with its header, being assembled or decompressed
+  std::vector<unsigned char> record_;
+  /// Number of bytes of the received chunk assembled so far
+  std::size_t record_fill_;
+  /// Offset of the first byte of the received chunk not yet decompressed
+  std::size_t record_pos_;
+  /// True while a received compressed chunk is being decompressed
+  bool record_active_;
+  /// True when the decompressor may hold more output of the chunk
+  bool record_more_;
+  /// Decompressed data waiting to be read
+  std::vector<unsigned char> output_;
+  /// Offset of the first unread decompressed byte
+  std::size_t output_head_;
+  /// Stream compression counters
+  counters counters_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/compression_layer.ipp>
+
+#endif
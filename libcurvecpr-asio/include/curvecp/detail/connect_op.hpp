@@ -7,8 +7,18 @@
 #ifndef CURVECP_ASIO_DETAIL_CONNECT_OP_HPP
 #define CURVECP_ASIO_DETAIL_CONNECT_OP_HPP
 
+#include <curvecp/detail/completion.hpp>
+#include <curvecp/detail/handler_memory.hpp>
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_context.hpp>
 #include <boost/bind.hpp>
 
+#include <type_traits>
+#include <vector>
+
 namespace curvecp {
 
 namespace detail {
@@ -19,60 +29,142 @@ namespace detail {
 template <typename Stream, typename Handler>
 class connect_op {
 public:
+  /// The executor used to invoke the handler
+  typedef typename boost::asio::associated_executor<Handler,
+    boost::asio::io_context::executor_type>::type executor_type;
+  /// The allocator used for intermediate handlers
+  typedef typename boost::asio::associated_allocator<Handler,
+    handler_allocator<void>>::type allocator_type;
+
   /**
    * Constructs an async connect operation.
    *
+   * @param endpoints Candidate endpoints to connect with
    * @param stream Target stream reference
    * @param handler Handler to call after accept completes
    */
-  connect_op(const typename Stream::endpoint_type &endpoint, Stream &stream, Handler &handler)
-    : endpoint_(endpoint),
+  template <typename CompletionHandler>
+  connect_op(const std::vector<typename Stream::endpoint_type> &endpoints, Stream &stream,
+             BOOST_ASIO_MOVE_ARG(CompletionHandler) handler)
+    : endpoints_(endpoints),
       stream_(stream),
-      handler_(BOOST_ASIO_MOVE_CAST(Handler)(handler)),
+      handler_(BOOST_ASIO_MOVE_CAST(CompletionHandler)(handler)),
+      work_(boost::asio::get_associated_executor(handler_, stream.get_io_context().get_executor())),
       finished_(false)
   {
+    cancellation_.install(handler_, waker{ &stream });
+  }
+
+  /**
+   * Returns the executor associated with the handler.
+   */
+  executor_type get_executor() const
+  {
+    return boost::asio::get_associated_executor(handler_, stream_.get_io_context().get_executor());
+  }
+
+  /**
+   * Returns the allocator associated with the handler, or the recycling
+   * allocator of the stream when the handler does not specify one.
+   */
+  allocator_type get_allocator() const
+  {
+    return boost::asio::get_associated_allocator(handler_, handler_allocator<void>(stream_.get_handler_memory()));
   }
 
   /**
    * Executes the connect operation. If the operation needs to be retried
-   * it is scheduled via the underlying stream.
+   * it is scheduled via the underlying stream. The error code of a wait
+   * on the stream is ignored, as waits are cancelled to wake up the
+   * operation.
    *
    * @param start Set to true for direct invocation by caller
    */
-  void operator()(const boost::system::error_code &ec = boost::system::error_code(),
+  void operator()(const boost::system::error_code &/*ec*/ = boost::system::error_code(),
                   bool start = false)
   {
     if (!finished_) {
-      if (!stream_.connect(endpoint_, ec_)) {
+      if (cancellation_.cancelled()) {
+        ec_ = boost::asio::error::operation_aborted;
+      } else if (!stream_.connect(endpoints_, ec_)) {
         stream_.async_pending_connect_wait(BOOST_ASIO_MOVE_CAST(connect_op)(*this));
         return;
       }
 
+      // Invoke the handler through its associated executor; when we are called
+      // directly by the async operation, the invocation must be deferred
       finished_ = true;
-      if (start) {
-        // We are being called directly by the async operation, so need to
-        // defer the invocation of the handler
-        stream_.get_io_service().post(BOOST_ASIO_MOVE_CAST(connect_op)(*this));
-        return;
-      }
+      cancellation_.clear(handler_);
+      return dispatch_completion(handler_, stream_.get_io_context().get_executor(), start,
+        BOOST_ASIO_MOVE_CAST(connect_op)(*this));
     }
 
     // Call connect handler
+    work_.reset();
     handler_(ec_);
   }
 private:
-  /// Endpoint to connect to
-  typename Stream::endpoint_type endpoint_;
+  /**
+   * Wakes up a cancelled operation waiting on the stream.
+   */
+  struct waker {
+    Stream *stream_;
+
+    void operator()() const { stream_->cancel_pending_connect_wait(); }
+  };
+
+  /// Candidate endpoints to connect to
+  std::vector<typename Stream::endpoint_type> endpoints_;
   /// Stream
   Stream &stream_;
   /// Handler to call after connect completes
   Handler handler_;
+  /// Outstanding work on the handler executor
+  handler_work<executor_type> work_;
+  /// Cancellation state
+  operation_cancellation cancellation_;
   /// Resulting error code
   boost::system::error_code ec_;
   /// Operation finished flag
   bool finished_;
 };
 
+/**
+ * Initiation function object for connect operations, used with
+ * async_initiate.
+ */
+template <typename Stream>
+class initiate_connect_op {
+public:
+  /**
+   * Constructs the initiation function object.
+   *
+   * @param stream Stream reference
+   */
+  explicit initiate_connect_op(Stream &stream)
+    : stream_(stream)
+  {
+  }
+
+  template <typename Handler>
+  void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler,
+                  const typename Stream::endpoint_type &endpoint) const
+  {
+    (*this)(BOOST_ASIO_MOVE_CAST(Handler)(handler), std::vector<typename Stream::endpoint_type>(1, endpoint));
+  }
+
+  template <typename Handler>
+  void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler,
+                  const std::vector<typename Stream::endpoint_type> &endpoints) const
+  {
+    connect_op<Stream, typename std::decay<Handler>::type>(endpoints, stream_,
+      BOOST_ASIO_MOVE_CAST(Handler)(handler))(boost::system::error_code(), true);
+  }
+private:
+  /// Stream reference
+  Stream &stream_;
+};
+
 }
 
 }
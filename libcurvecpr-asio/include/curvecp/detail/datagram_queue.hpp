@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_DATAGRAM_QUEUE_HPP
+#define CURVECP_ASIO_DETAIL_DATAGRAM_QUEUE_HPP
+
+#include <curvecp/detail/transport.hpp>
+
+#include <boost/asio/error.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Bounded queue of datagrams delivered in-process, with support for one
+ * outstanding receive operation. Used by transports that do not receive
+ * from a kernel socket themselves.
+ */
+class datagram_queue {
+public:
+  /**
+   * Constructs a new datagram queue.
+   *
+   * @param service ASIO IO context used to invoke handlers
+   * @param maximum Maximum number of queued datagrams
+   */
+  datagram_queue(boost::asio::io_context &service, std::size_t maximum)
+    : service_(service),
+      maximum_(maximum),
+      receive_pending_(false),
+      receive_sender_(nullptr)
+  {
+  }
+
+  datagram_queue(const datagram_queue&) = delete;
+  datagram_queue &operator=(const datagram_queue&) = delete;
+
+  /**
+   * Configures the maximum number of queued datagrams.
+   *
+   * @param value Maximum number of queued datagrams
+   */
+  void set_maximum(std::size_t value)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    maximum_ = value;
+  }
+
+  /**
+   * Delivers a datagram. It completes an outstanding receive operation if
+   * there is one, otherwise it is queued or dropped when the queue is full.
+   *
+   * @param source Endpoint of the sender
+   * @param buffer Datagram payload
+   */
+  void push(const transport::endpoint_type &source, const boost::asio::const_buffer &buffer)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const unsigned char *data = boost::asio::buffer_cast<const unsigned char*>(buffer);
+    std::size_t size = boost::asio::buffer_size(buffer);
+
+    if (receive_pending_) {
+      std::size_t length = std::min(size, boost::asio::buffer_size(receive_buffer_));
+      std::memcpy(boost::asio::buffer_cast<unsigned char*>(receive_buffer_), data, length);
+      *receive_sender_ = source;
+
+      receive_pending_ = false;
+      post_transport_handler(service_, std::move(receive_handler_), boost::system::error_code(), length);
+      return;
+    }
+
+    if (queue_.size() >= maximum_)
+      return;
+
+    queue_.push_back(datagram{ source, std::vector<unsigned char>(data, data + size) });
+  }
+
+  /**
+   * Receives a datagram, completing immediately if one is queued.
+   *
+   * @param buffer Buffer to receive into
+   * @param sender Destination for the endpoint of the sender
+   * @param handler Handler to call after a datagram has been received
+   */
+  void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                          transport::endpoint_type &sender,
+                          transport::handler_type handler)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.empty()) {
+      // Park the operation until a datagram arrives
+      receive_pending_ = true;
+      receive_buffer_ = buffer;
+      receive_sender_ = &sender;
+      receive_handler_ = std::move(handler);
+      return;
+    }
+
+    std::size_t length = pop(buffer, sender);
+    post_transport_handler(service_, std::move(handler), boost::system::error_code(), length);
+  }
+
+  /**
+   * Receives a queued datagram without waiting.
+   *
+   * @param buffer Buffer to receive into
+   * @param sender Destination for the endpoint of the sender
+   * @param ec Set to would_block when no datagram is queued
+   * @return Number of bytes received
+   */
+  std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                               transport::endpoint_type &sender,
+                               boost::system::error_code &ec)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.empty()) {
+      ec = boost::asio::error::would_block;
+      return 0;
+    }
+
+    ec = boost::system::error_code();
+    return pop(buffer, sender);
+  }
+
+  /**
+   * Discards all queued datagrams and aborts the outstanding receive
+   * operation.
+   */
+  void cancel()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_.clear();
+
+    if (receive_pending_) {
+      receive_pending_ = false;
+      post_transport_handler(service_, std::move(receive_handler_),
+        boost::system::error_code(boost::asio::error::operation_aborted), 0);
+    }
+  }
+private:
+  std::size_t pop(const boost::asio::mutable_buffer &buffer, transport::endpoint_type &sender)
+  {
+    datagram &dgram = queue_.front();
+    std::size_t length = std::min(dgram.data.size(), boost::asio::buffer_size(buffer));
+    std::memcpy(boost::asio::buffer_cast<unsigned char*>(buffer), &dgram.data[0], length);
+    sender = dgram.source;
+    queue_.pop_front();
+    return length;
+  }
+private:
+  /**
+   * A datagram waiting for reception.
+   */
+  struct datagram {
+    /// Source endpoint
+    transport::endpoint_type source;
+    /// Datagram payload
+    std::vector<unsigned char> data;
+  };
+
+  /// ASIO IO context
+  boost::asio::io_context &service_;
+  /// Mutex
+  std::mutex mutex_;
+  /// Datagrams waiting for reception
+  std::deque<datagram> queue_;
+  /// Maximum number of queued datagrams
+  std::size_t maximum_;
+  /// True when a receive operation is outstanding
+  bool receive_pending_;
+  /// Buffer of the outstanding receive operation
+  boost::asio::mutable_buffer receive_buffer_;
+  /// Sender destination of the outstanding receive operation
+  transport::endpoint_type *receive_sender_;
+  /// Handler of the outstanding receive operation
+  transport::handler_type receive_handler_;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_FEC_CODEC_HPP
+#define CURVECP_ASIO_DETAIL_FEC_CODEC_HPP
+
+#include <curvecp/detail/simd.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Erasure code over GF(2^8) used to protect groups of blocks. The j-th
+ * repair of a group is the sum of its data blocks, each multiplied by a
+ * coefficient taken from a Cauchy matrix, so any m lost blocks of a group
+ * can be rebuilt from any m of its repairs. The coefficients of the first
+ * repair are all one, which makes it a plain XOR of the group.
+ *
+ * The multiply-add kernels use SSSE3 or AVX2 shuffles of nibble tables when
+ * the processor supports them, which is detected at run time.
+ */
+class fec_codec {
+public:
+  /// Maximum number of data blocks in a group
+  static const std::size_t maximum_data_blocks = 16;
+  /// Maximum number of repairs of a group
+  static const std::size_t maximum_repair_blocks = 16;
+
+  /**
+   * Implementation of the block kernels.
+   */
+  enum class kernel {
+    // Portable implementation
+    scalar,
+    // 128-bit SSSE3 shuffles
+    ssse3,
+    // 256-bit AVX2 shuffles
+    avx2
+  };
+
+  /**
+   * Returns the fastest kernel supported by the processor.
+   */
+  static kernel best_kernel()
+  {
+    static const kernel best = detect_kernel();
+    return best;
+  }
+
+  /**
+   * Returns the name of a kernel.
+   *
+   * @param k Kernel
+   */
+  static const char *kernel_name(kernel k)
+  {
+    switch (k) {
+      case kernel::ssse3: return "ssse3";
+      case kernel::avx2: return "avx2";
+      default: return "scalar";
+    }
+  }
+
+  /**
+   * Multiplies two field elements.
+   */
+  static unsigned char multiply(unsigned char a, unsigned char b)
+  {
+    if (a == 0 || b == 0)
+      return 0;
+
+    const field_tables &t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+  }
+
+  /**
+   * Returns the multiplicative inverse of a non-zero field element.
+   */
+  static unsigned char inverse(unsigned char a)
+  {
+    const field_tables &t = tables();
+    return t.exp[255 - t.log[a]];
+  }
+
+  /**
+   * Returns the coefficient of a data block in a repair.
+   *
+   * @param repair Index of the repair
+   * @param block Index of the data block within its group
+   */
+  static unsigned char coefficient(std::size_t repair, std::size_t block)
+  {
+    // Rows x_j = j and columns y_i = 16 + i never coincide, so the matrix
+    // is Cauchy; scaling each column by (x_0 + y_i) turns the first row
+    // into ones without changing which submatrices are invertible
+    unsigned char y = static_cast<unsigned char>(maximum_repair_blocks + block);
+    return multiply(y, inverse(static_cast<unsigned char>(repair) ^ y));
+  }
+
+  /**
+   * Adds a data block multiplied by a factor to a repair, that is computes
+   * dst += factor * src.
+   *
+   * @param dst Destination buffer
+   * @param src Source buffer
+   * @param factor Field element to multiply with
+   * @param length Length of both buffers
+   * @param k Kernel to use
+   */
+  static void multiply_add(unsigned char *dst, const unsigned char *src, unsigned char factor,
+                           std::size_t length, kernel k = best_kernel())
+  {
+    if (factor == 0)
+      return;
+
+    // Split the multiplication table into its low and high nibble halves,
+    // the product of a byte is then the sum of two lookups
+    unsigned char low[16];
+    unsigned char high[16];
+    for (unsigned i = 0; i < 16; i++) {
+      low[i] = multiply(factor, static_cast<unsigned char>(i));
+      high[i] = multiply(factor, static_cast<unsigned char>(i << 4));
+    }
+
+    std::size_t done = 0;
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+    if (k == kernel::avx2)
+      done = factor == 1 ? xor_avx2(dst, src, length) : multiply_add_avx2(dst, src, low, high, length);
+    else if (k == kernel::ssse3)
+      done = factor == 1 ? xor_sse2(dst, src, length) : multiply_add_ssse3(dst, src, low, high, length);
+#endif
+
+    if (factor == 1) {
+      for (; done + 8 <= length; done += 8) {
+        std::uint64_t a, b;
+        std::memcpy(&a, dst + done, 8);
+        std::memcpy(&b, src + done, 8);
+        a ^= b;
+        std::memcpy(dst + done, &a, 8);
+      }
+    }
+
+    for (; done < length; done++)
+      dst[done] ^= low[src[done] & 15] ^ high[src[done] >> 4];
+  }
+
+  /**
+   * Inverts a square matrix in place by Gauss-Jordan elimination.
+   *
+   * @param matrix Row-major matrix of n * n elements
+   * @param n Dimension of the matrix
+   * @return False when the matrix is singular
+   */
+  static bool invert(std::vector<unsigned char> &matrix, std::size_t n)
+  {
+    std::vector<unsigned char> result(n * n, 0);
+    for (std::size_t i = 0; i < n; i++)
+      result[i * n + i] = 1;
+
+    for (std::size_t column = 0; column < n; column++) {
+      std::size_t pivot = column;
+      while (pivot < n && matrix[pivot * n + column] == 0)
+        pivot++;
+      if (pivot == n)
+        return false;
+
+      if (pivot != column) {
+        for (std::size_t i = 0; i < n; i++) {
+          std::swap(matrix[pivot * n + i], matrix[column * n + i]);
+          std::swap(result[pivot * n + i], result[column * n + i]);
+        }
+      }
+
+      unsigned char scale = inverse(matrix[column * n + column]);
+      for (std::size_t i = 0; i < n; i++) {
+        matrix[column * n + i] = multiply(matrix[column * n + i], scale);
+        result[column * n + i] = multiply(result[column * n + i], scale);
+      }
+
+      for (std::size_t row = 0; row < n; row++) {
+        unsigned char factor = matrix[row * n + column];
+        if (row == column || factor == 0)
+          continue;
+
+        for (std::size_t i = 0; i < n; i++) {
+          matrix[row * n + i] ^= multiply(factor, matrix[column * n + i]);
+          result[row * n + i] ^= multiply(factor, result[column * n + i]);
+        }
+      }
+    }
+
+    matrix.swap(result);
+    return true;
+  }
+private:
+  /**
+   * Logarithm tables of the field with the polynomial 0x11d.
+   */
+  struct field_tables {
+    unsigned char exp[512];
+    unsigned log[256];
+
+    field_tables()
+    {
+      unsigned x = 1;
+      for (unsigned i = 0; i < 255; i++) {
+        exp[i] = exp[i + 255] = static_cast<unsigned char>(x);
+        log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+          x ^= 0x11d;
+      }
+      exp[510] = exp[511] = 0;
+      log[0] = 0;
+    }
+  };
+
+  static const field_tables &tables()
+  {
+    static const field_tables t;
+    return t;
+  }
+
+  static kernel detect_kernel()
+  {
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return kernel::avx2;
+    if (__builtin_cpu_supports("ssse3"))
+      return kernel::ssse3;
+#endif
+    return kernel::scalar;
+  }
+
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+  __attribute__((target("sse2")))
+  static std::size_t xor_sse2(unsigned char *dst, const unsigned char *src, std::size_t length)
+  {
+    std::size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+      __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, s));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  static std::size_t xor_avx2(unsigned char *dst, const unsigned char *src, std::size_t length)
+  {
+    std::size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+      __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+      __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, s));
+    }
+    return i;
+  }
+
+  __attribute__((target("ssse3")))
+  static std::size_t multiply_add_ssse3(unsigned char *dst, const unsigned char *src, const unsigned char *low,
+                                        const unsigned char *high, std::size_t length)
+  {
+    const __m128i table_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(low));
+    const __m128i table_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(high));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    std::size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+      __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      __m128i product = _mm_xor_si128(
+        _mm_shuffle_epi8(table_low, _mm_and_si128(s, mask)),
+        _mm_shuffle_epi8(table_high, _mm_and_si128(_mm_srli_epi64(s, 4), mask))
+      );
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, product));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  static std::size_t multiply_add_avx2(unsigned char *dst, const unsigned char *src, const unsigned char *low,
+                                       const unsigned char *high, std::size_t length)
+  {
+    // Shuffles stay within 128-bit lanes, so both lanes get the same table
+    const __m256i table_low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(low)));
+    const __m256i table_high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(high)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    std::size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+      __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+      __m256i product = _mm256_xor_si256(
+        _mm256_shuffle_epi8(table_low, _mm256_and_si256(s, mask)),
+        _mm256_shuffle_epi8(table_high, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask))
+      );
+      __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(d, product));
+    }
+    return i;
+  }
+#endif
+};
+
+}
+
+}
+
+#endif
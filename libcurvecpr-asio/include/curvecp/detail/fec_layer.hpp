@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_FEC_LAYER_HPP
+#define CURVECP_ASIO_DETAIL_FEC_LAYER_HPP
+
+#include <curvecpr.h>
+
+#include <curvecp/detail/fec_codec.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Forward error correction of the blocks of a session. Sent blocks are
+ * protected in groups and the repairs of each group are sent as frames
+ * next to the messager messages, while copies of received blocks are kept
+ * so that lost blocks can be rebuilt from the repairs of their groups.
+ * This class is not thread safe; the session only uses it from within its
+ * strand.
+ */
+class fec_layer {
+public:
+  /**
+   * Counters of forward error correction.
+   */
+  struct counters {
+    /// Number of repairs sent
+    std::uint64_t repairs_sent;
+    /// Number of repairs received
+    std::uint64_t repairs_received;
+    /// Number of lost blocks rebuilt from repairs
+    std::uint64_t blocks_rebuilt;
+  };
+
+  /// Handler that sends a framed repair
+  typedef std::function<void(const unsigned char*, std::size_t)> send_handler;
+  /// Handler that queues a rebuilt block like a received one, returning
+  /// false when the block could not be queued
+  typedef std::function<bool(const curvecpr_block&)> rebuild_handler;
+
+  /**
+   * Constructs a disabled forward error correction layer.
+   *
+   * @param send Handler for sending repairs
+   * @param rebuild Handler for queueing rebuilt blocks
+   */
+  inline fec_layer(send_handler send, rebuild_handler rebuild);
+
+  /**
+   * Configures the size of groups and the number of repairs per group.
+   *
+   * @param data_blocks Number of blocks in a group, at most 16
+   * @param repair_blocks Number of repairs per group, at most 16 or zero
+   *   to disable forward error correction
+   */
+  inline void configure(std::size_t data_blocks, std::size_t repair_blocks);
+
+  /**
+   * Returns true when forward error correction is enabled.
+   */
+  bool enabled() const { return repair_blocks_ > 0; }
+
+  /**
+   * Configures the number of unacknowledged blocks the peer may send, which
+   * bounds the number of groups in flight.
+   *
+   * @param value Maximum number of unacknowledged blocks
+   */
+  void set_window(std::size_t value) { window_ = value; }
+
+  /**
+   * Returns the forward error correction counters.
+   */
+  const counters &get_counters() const { return counters_; }
+
+  /**
+   * Returns true when a frame carries a repair rather than a datagram.
+   *
+   * @param buf Frame that is not a messager message
+   * @param num Length of the frame
+   */
+  inline static bool is_repair(const unsigned char *buf, std::size_t num);
+
+  /**
+   * Adds a sent block to the current group, sending its repairs once the
+   * group is full.
+   *
+   * @param block Block carrying stream data
+   */
+  inline void protect(const curvecpr_block &block);
+
+  /**
+   * Returns true when some blocks have been protected but their repairs
+   * have not yet been sent.
+   */
+  bool group_open() const { return !group_lengths_.empty(); }
+
+  /**
+   * Sends the repairs of the current group.
+   */
+  inline void close_group();
+
+  /**
+   * Handles a received repair and rebuilds the blocks it covers when
+   * enough of their group has been received.
+   *
+   * @param buf Frame carrying the repair
+   * @param num Length of the frame
+   * @param distributed Offset up to which the stream has been read
+   * @return Number of rebuilt blocks, or -1 when the frame is malformed
+   */
+  inline int receive_repair(const unsigned char *buf, std::size_t num, std::uint64_t distributed);
+
+  /**
+   * Keeps a copy of a received block and rebuilds the other blocks of its
+   * group when their repairs have already been received.
+   *
+   * @param block Received block
+   * @param distributed Offset up to which the stream has been read
+   * @return Number of rebuilt blocks
+   */
+  inline std::size_t remember(const curvecpr_block &block, std::uint64_t distributed);
+
+  /**
+   * Drops the current group, block copies and waiting repairs.
+   */
+  inline void clear();
+private:
+  /**
+   * A received repair of a group of blocks.
+   */
+  struct repair {
+    /// Offset of the first block of the group
+    std::uint64_t offset;
+    /// Index of the repair within the group
+    std::size_t index;
+    /// Lengths of the blocks of the group
+    std::vector<std::uint16_t> lengths;
+    /// Repair data, as long as the longest block
+    std::vector<unsigned char> data;
+  };
+
+  inline std::size_t received_maximum() const;
+
+  inline void forget_groups(std::uint64_t offset);
+
+  inline std::size_t rebuild_group(std::uint64_t offset, std::uint64_t distributed);
+private:
+  /// Handler for sending repairs
+  send_handler send_handler_;
+  /// Handler for queueing rebuilt blocks
+  rebuild_handler rebuild_handler_;
+  /// Number of blocks in a group
+  std::size_t data_blocks_;
+  /// Number of repairs per group, zero when disabled
+  std::size_t repair_blocks_;
+  /// Maximum number of unacknowledged blocks of the peer
+  std::size_t window_;
+  /// Offset of the first block of the group being sent
+  std::uint64_t group_offset_;
+  /// Lengths of the blocks of the group being sent
+  std::vector<std::uint16_t> group_lengths_;
+  /// Repairs of the group being sent
+  std::vector<unsigned char> repairs_;
+  /// Copies of recently received blocks by offset
+  std::map<std::uint64_t, std::vector<unsigned char>> received_;
+  /// Offsets of the block copies in the order they were received
+  std::deque<std::uint64_t> received_order_;
+  /// Received repairs waiting for the blocks of their group
+  std::deque<repair> pending_;
+  /// Forward error correction counters
+  counters counters_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/fec_layer.ipp>
+
+#endif
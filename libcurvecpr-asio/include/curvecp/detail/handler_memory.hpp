@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_HANDLER_MEMORY_HPP
+#define CURVECP_ASIO_DETAIL_HANDLER_MEMORY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Recycles the memory used to store intermediate handlers of asynchronous
+ * operations. Each hop of an operation through a strand, a timer wait or
+ * a completion post needs a small block of memory; the blocks are kept in
+ * a few slots and reused by subsequent hops, so that steady-state reads
+ * and writes do not touch the heap. Requests that do not fit into a free
+ * slot fall back to the global heap. Allocation and deallocation are safe
+ * to call from any thread.
+ *
+ * The slots are reference counted by their owner and by the blocks handed
+ * out, as operations abandoned in a stopped IO context may be destroyed
+ * after the object that owns the memory.
+ */
+class handler_memory {
+public:
+  /// Number of recycled blocks
+  static const std::size_t slot_count = 4;
+
+  handler_memory()
+    : state_(new state())
+  {
+  }
+
+  ~handler_memory()
+  {
+    release(state_);
+  }
+
+  handler_memory(const handler_memory&) = delete;
+  handler_memory &operator=(const handler_memory&) = delete;
+
+  /**
+   * Allocates a block of memory.
+   *
+   * @param size Requested size in bytes
+   * @return Pointer to allocated memory
+   */
+  void *allocate(std::size_t size)
+  {
+    for (std::size_t i = 0; i < slot_count; i++) {
+      slot &s = state_->slots[i];
+      bool expected = false;
+      if (!s.in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        continue;
+
+      if (s.capacity < size) {
+        // Grow the slot; blocks of one operation type tend to have the same
+        // size, so this only happens while warming up
+        header *block;
+        try {
+          block = static_cast<header*>(::operator new(sizeof(header) + size));
+        } catch (...) {
+          s.in_use.store(false, std::memory_order_release);
+          throw;
+        }
+
+        ::operator delete(s.block);
+        block->owner = state_;
+        block->index = i;
+        s.block = block;
+        s.capacity = size;
+      }
+
+      state_->references.fetch_add(1, std::memory_order_relaxed);
+      return s.block + 1;
+    }
+
+    header *block = static_cast<header*>(::operator new(sizeof(header) + size));
+    block->owner = nullptr;
+    block->index = slot_count;
+    return block + 1;
+  }
+
+  /**
+   * Deallocates a block of memory previously returned by allocate.
+   *
+   * @param pointer Pointer to allocated memory
+   */
+  static void deallocate(void *pointer)
+  {
+    header *block = static_cast<header*>(pointer) - 1;
+    if (block->owner) {
+      state *owner = block->owner;
+      owner->slots[block->index].in_use.store(false, std::memory_order_release);
+      release(owner);
+    } else {
+      ::operator delete(block);
+    }
+  }
+private:
+  struct state;
+
+  /**
+   * Header preceding each block, records where the block came from.
+   */
+  struct alignas(std::max_align_t) header {
+    /// Slots the block belongs to, or null for heap blocks
+    state *owner;
+    /// Slot index
+    std::size_t index;
+  };
+
+  /**
+   * Recycled block.
+   */
+  struct slot {
+    /// Set while the block is handed out
+    std::atomic<bool> in_use;
+    /// Cached block
+    header *block;
+    /// Usable size of the cached block
+    std::size_t capacity;
+  };
+
+  /**
+   * Recycled blocks shared by the owner and the blocks handed out.
+   */
+  struct state {
+    state()
+      : references(1)
+    {
+      for (slot &s : slots) {
+        s.in_use.store(false, std::memory_order_relaxed);
+        s.block = nullptr;
+        s.capacity = 0;
+      }
+    }
+
+    ~state()
+    {
+      for (slot &s : slots)
+        ::operator delete(s.block);
+    }
+
+    /// Recycled blocks
+    slot slots[slot_count];
+    /// Number of references held by the owner and by handed out blocks
+    std::atomic<std::size_t> references;
+  };
+
+  /**
+   * Drops a reference to the slots, releasing them with the last one.
+   *
+   * @param s Slots to release
+   */
+  static void release(state *s)
+  {
+    if (s->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete s;
+  }
+
+  /// Recycled blocks
+  state *state_;
+};
+
+/**
+ * Allocator that obtains memory from a handler_memory instance. Used as
+ * the associated allocator of asynchronous operations whose completion
+ * handlers do not specify one. Without an instance, memory is taken from
+ * the global heap.
+ */
+template <typename T>
+class handler_allocator {
+public:
+  typedef T value_type;
+
+  explicit handler_allocator(handler_memory &memory)
+    : memory_(&memory)
+  {
+  }
+
+  explicit handler_allocator(handler_memory *memory)
+    : memory_(memory)
+  {
+  }
+
+  template <typename U>
+  handler_allocator(const handler_allocator<U> &other)
+    : memory_(other.memory_)
+  {
+  }
+
+  T *allocate(std::size_t n)
+  {
+    if (!memory_)
+      return static_cast<T*>(::operator new(sizeof(T) * n));
+
+    return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T *pointer, std::size_t)
+  {
+    if (!memory_)
+      ::operator delete(pointer);
+    else
+      handler_memory::deallocate(pointer);
+  }
+
+  template <typename U>
+  bool operator==(const handler_allocator<U> &other) const { return memory_ == other.memory_; }
+
+  template <typename U>
+  bool operator!=(const handler_allocator<U> &other) const { return memory_ != other.memory_; }
+private:
+  template <typename U> friend class handler_allocator;
+
+  /// Memory to allocate from
+  handler_memory *memory_;
+};
+
+}
+
+}
+
+#endif
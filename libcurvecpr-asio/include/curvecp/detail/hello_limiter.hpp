@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_HELLO_LIMITER_HPP
+#define CURVECP_ASIO_DETAIL_HELLO_LIMITER_HPP
+
+#include <curvecp/detail/transport.hpp>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Token bucket rate limiter for Hello packets, applied before any crypto
+ * work is done. Sources are grouped by address prefix (/24 for IPv4, /48
+ * for IPv6) and their buckets are kept in a fixed-size sketch of two rows,
+ * so memory does not grow with the number of sources. A source is limited
+ * only when its buckets in both rows are empty, so a collision with a
+ * flooding prefix in one row does not starve it. A global bucket bounds
+ * the total handshake rate. Not thread-safe.
+ */
+class hello_limiter {
+public:
+  /**
+   * Result of a Hello admission check.
+   */
+  enum class verdict {
+    // The Hello may be processed
+    admit,
+    // The source prefix has exceeded its rate
+    source_limited,
+    // The global handshake budget has been exhausted
+    budget_exhausted
+  };
+
+  /**
+   * Constructs a new Hello limiter with both limits disabled.
+   *
+   * @param width Number of buckets in each sketch row
+   */
+  explicit hello_limiter(std::size_t width = 4096)
+    : width_(width),
+      source_rate_(0),
+      source_burst_(0),
+      global_rate_(0),
+      global_burst_(0),
+      global_({ 0, 0 })
+  {
+    // Seeds are random so that sources cannot be chosen to collide
+    std::random_device random;
+    for (int row = 0; row < 2; row++) {
+      seeds_[row] = (static_cast<std::uint64_t>(random()) << 32) | random();
+      rows_[row].assign(width_, bucket({ 0, 0 }));
+    }
+  }
+
+  /**
+   * Configures the rate limit of each source prefix.
+   *
+   * @param rate Hellos per second, zero disables the limit
+   * @param burst Number of Hellos that may arrive at once
+   */
+  void set_source_limit(double rate, double burst)
+  {
+    source_rate_ = rate;
+    source_burst_ = std::max(burst, 1.0);
+    for (int row = 0; row < 2; row++)
+      rows_[row].assign(width_, bucket({ 0, 0 }));
+  }
+
+  /**
+   * Configures the global handshake budget.
+   *
+   * @param rate Hellos per second, zero disables the limit
+   * @param burst Number of Hellos that may arrive at once
+   */
+  void set_global_limit(double rate, double burst)
+  {
+    global_rate_ = rate;
+    global_burst_ = std::max(burst, 1.0);
+    global_ = bucket({ 0, 0 });
+  }
+
+  /**
+   * Checks whether a Hello from the given source may be processed and
+   * takes a token from its buckets if so.
+   *
+   * @param source Endpoint of the sender
+   * @param now Current time in microseconds
+   * @return Admission verdict
+   */
+  verdict admit(const transport::endpoint_type &source, std::uint64_t now)
+  {
+    bucket *buckets[2] = { nullptr, nullptr };
+    if (source_rate_ > 0) {
+      std::uint64_t hashes[2] = { seeds_[0], seeds_[1] };
+      hash_prefix(source, hashes);
+
+      bool limited = true;
+      for (int row = 0; row < 2; row++) {
+        buckets[row] = &rows_[row][hashes[row] % width_];
+        refill(*buckets[row], source_rate_, source_burst_, now);
+        if (buckets[row]->tokens >= 1)
+          limited = false;
+      }
+
+      if (limited)
+        return verdict::source_limited;
+    }
+
+    if (global_rate_ > 0) {
+      refill(global_, global_rate_, global_burst_, now);
+      if (global_.tokens < 1)
+        return verdict::budget_exhausted;
+      global_.tokens -= 1;
+    }
+
+    for (bucket *b : buckets) {
+      if (b)
+        b->tokens = std::max(b->tokens - 1, 0.0);
+    }
+
+    return verdict::admit;
+  }
+private:
+  /**
+   * A token bucket that is refilled lazily.
+   */
+  struct bucket {
+    /// Available tokens
+    double tokens;
+    /// Time of the last refill in microseconds, zero for a full bucket
+    std::uint64_t updated;
+  };
+
+  static void refill(bucket &b, double rate, double burst, std::uint64_t now)
+  {
+    if (b.updated == 0)
+      b.tokens = burst;
+    else if (now > b.updated)
+      b.tokens = std::min(burst, b.tokens + (now - b.updated) * rate / 1e6);
+    b.updated = now;
+  }
+
+  static void hash_prefix(const transport::endpoint_type &source, std::uint64_t hashes[2])
+  {
+    const unsigned char *data;
+    std::size_t length;
+
+    const sockaddr *address = source.data();
+    if (address->sa_family == AF_INET) {
+      data = reinterpret_cast<const unsigned char*>(
+        &reinterpret_cast<const sockaddr_in*>(address)->sin_addr);
+      length = 3;
+    } else if (address->sa_family == AF_INET6) {
+      data = reinterpret_cast<const unsigned char*>(
+        &reinterpret_cast<const sockaddr_in6*>(address)->sin6_addr);
+      length = 6;
+    } else {
+      // Other address families are limited per endpoint
+      data = reinterpret_cast<const unsigned char*>(address);
+      length = source.size();
+    }
+
+    // FNV-1a over the prefix, starting from a seeded offset for each row
+    for (int row = 0; row < 2; row++) {
+      std::uint64_t hash = hashes[row] ^ 14695981039346656037ULL;
+      for (std::size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+      }
+      hashes[row] = hash ^ (hash >> 29);
+    }
+  }
+private:
+  /// Number of buckets in each sketch row
+  std::size_t width_;
+  /// Hellos per second allowed for each source prefix
+  double source_rate_;
+  /// Burst size for each source prefix
+  double source_burst_;
+  /// Hellos per second allowed in total
+  double global_rate_;
+  /// Global burst size
+  double global_burst_;
+  /// Global handshake budget
+  bucket global_;
+  /// Hash seeds of the sketch rows
+  std::uint64_t seeds_[2];
+  /// Per-prefix buckets of the sketch rows
+  std::vector<bucket> rows_[2];
+};
+
+}
+
+}
+
+#endif
@@ -8,21 +8,50 @@
 #define CURVECP_ASIO_DETAIL_IMPL_ACCEPTOR_IPP
 
 #include <curvecp/detail/server_stream.hpp>
+#include <curvecp/detail/socket_transport.hpp>
 
 #include <boost/make_shared.hpp>
 #include <boost/asio/placeholders.hpp>
-#include <boost/asio/ip/udp.hpp>
 
 namespace curvecp {
 
 namespace detail {
 
-acceptor::acceptor(boost::asio::io_service &service)
-  : strand_(service),
-    socket_(service),
+acceptor::acceptor(boost::asio::io_context &service)
+  : strand_(service.get_executor()),
+    transport_(boost::make_shared<socket_transport>(service)),
     maximum_pending_sessions_(16),
+    accept_counters_(),
+    handshake_timing_(false),
+    handshake_timings_(),
+    maximum_sessions_(SIZE_MAX),
+    idle_timeout_(boost::posix_time::pos_infin),
+    idle_timer_(service),
+    idle_sweep_pending_(false),
     lower_recv_buffer_(65535),
     pending_ready_accept_(service)
+{
+  initialize();
+}
+
+acceptor::acceptor(boost::shared_ptr<transport> transport)
+  : strand_(transport->get_io_context().get_executor()),
+    transport_(transport),
+    maximum_pending_sessions_(16),
+    accept_counters_(),
+    handshake_timing_(false),
+    handshake_timings_(),
+    maximum_sessions_(SIZE_MAX),
+    idle_timeout_(boost::posix_time::pos_infin),
+    idle_timer_(transport->get_io_context()),
+    idle_sweep_pending_(false),
+    lower_recv_buffer_(65535),
+    pending_ready_accept_(transport->get_io_context())
+{
+  initialize();
+}
+
+void acceptor::initialize()
 {
   pending_ready_accept_.expires_at(boost::posix_time::pos_infin);
 
@@ -56,25 +85,83 @@ void acceptor::set_local_private_key(const std::string &privateKey)
   std::memcpy(server_.cf.my_global_sk, privateKey.data(), sizeof(server_.cf.my_global_sk));
 }
 
+void acceptor::set_backlog(std::size_t value)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  maximum_pending_sessions_ = value;
+}
+
+void acceptor::set_idle_timeout(const boost::posix_time::time_duration &timeout)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  idle_timeout_ = timeout;
+  idle_sweep_pending_ = false;
+  idle_timer_.cancel();
+  schedule_idle_sweep();
+}
+
+void acceptor::set_maximum_sessions(std::size_t value)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  maximum_sessions_ = value;
+  while (sessions_.size() > maximum_sessions_ && !activity_.empty())
+    evict_session(activity_.front(), accept_counters_.lru_evicted);
+}
+
+void acceptor::set_source_hello_limit(double rate, double burst)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  hello_limiter_.set_source_limit(rate, burst);
+}
+
+void acceptor::set_hello_budget(double rate, double burst)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  hello_limiter_.set_global_limit(rate, burst);
+}
+
+acceptor::accept_counters acceptor::get_accept_counters()
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  return accept_counters_;
+}
+
+void acceptor::set_handshake_timing(bool enabled)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  handshake_timing_ = enabled;
+}
+
+acceptor::handshake_timings acceptor::get_handshake_timings()
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  return handshake_timings_;
+}
+
+std::uint64_t acceptor::nanoseconds_since(std::chrono::steady_clock::time_point started)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - started).count();
+}
+
 void acceptor::bind(const detail::basic_stream::endpoint_type &endpoint)
 {
-  socket_.open(endpoint.protocol());
-  socket_.bind(endpoint);
+  transport_->bind(endpoint);
 }
 
 void acceptor::listen()
 {
-  socket_.async_receive_from(
+  transport_->async_receive_from(
     boost::asio::buffer(lower_recv_buffer_),
     lower_recv_endpoint_,
-    strand_.wrap(boost::bind(&acceptor::handle_lower_read, this,
-      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))
+    bind_transport_handler(strand_, boost::bind(&acceptor::handle_lower_read, this,
+      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred), &handler_memory_)
   );
 }
 
 detail::basic_stream::endpoint_type acceptor::local_endpoint() const
 {
-  return socket_.local_endpoint();
+  return transport_->local_endpoint();
 }
 
 bool acceptor::accept(curvecp::stream &stream, boost::system::error_code &error)
@@ -84,26 +171,95 @@ bool acceptor::accept(curvecp::stream &stream, boost::system::error_code &error)
   if (pending_sessions_.empty())
     return false;
 
+  std::chrono::steady_clock::time_point started;
+  if (handshake_timing_)
+    started = std::chrono::steady_clock::now();
+
   boost::shared_ptr<session> sp = pending_sessions_.front();
   pending_sessions_.pop_front();
   stream.stream_ = boost::make_shared<detail::server_stream>(shared_from_this(), sp);
-  sp->start();
+  accept_counters_.accepted++;
+
+  if (handshake_timing_) {
+    handshake_timings_.handoffs++;
+    handshake_timings_.handoff_nanoseconds += nanoseconds_since(started);
+  }
   return true;
 }
 
+template <typename StreamIterator>
+bool acceptor::accept_many(StreamIterator first, StreamIterator last, std::size_t &accepted,
+                           boost::system::error_code &error)
+{
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  error = boost::system::error_code();
+  accepted = 0;
+  if (first == last)
+    return true;
+  else if (pending_sessions_.empty())
+    return false;
+
+  std::chrono::steady_clock::time_point started;
+  if (handshake_timing_)
+    started = std::chrono::steady_clock::now();
+
+  // Hand over all pending sessions that fit under a single lock
+  for (; first != last && !pending_sessions_.empty(); ++first, ++accepted) {
+    boost::shared_ptr<session> sp = pending_sessions_.front();
+    pending_sessions_.pop_front();
+    (*first).stream_ = boost::make_shared<detail::server_stream>(shared_from_this(), sp);
+  }
+
+  accept_counters_.accepted += accepted;
+  if (handshake_timing_) {
+    handshake_timings_.handoffs += accepted;
+    handshake_timings_.handoff_nanoseconds += nanoseconds_since(started);
+  }
+  return accepted > 0;
+}
+
 template <typename Handler>
 void acceptor::async_pending_accept_wait(BOOST_ASIO_MOVE_ARG(Handler) handler)
 {
-  pending_ready_accept_.async_wait(strand_.wrap(handler));
+  pending_ready_accept_.async_wait(boost::asio::bind_executor(strand_, BOOST_ASIO_MOVE_CAST(Handler)(handler)));
+}
+
+void acceptor::cancel_pending_accept_wait()
+{
+  boost::asio::dispatch(strand_, [this]() { pending_ready_accept_.cancel(); });
 }
 
 void acceptor::handle_lower_read(const boost::system::error_code &error, std::size_t bytes)
 {
   std::unique_lock<std::recursive_mutex> lock(mutex_);
 
+  // Hello packets make the server do public-key work for unauthenticated
+  // sources, so they are rate limited before reaching the packet processor
+  bool admitted = true;
+  if (bytes == 224 && std::memcmp(&lower_recv_buffer_[0], "QvnQ5XlH", 8) == 0) {
+    std::uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    switch (hello_limiter_.admit(lower_recv_endpoint_, now)) {
+      case hello_limiter::verdict::admit: accept_counters_.hello_admitted++; break;
+      case hello_limiter::verdict::source_limited: accept_counters_.hello_source_dropped++; admitted = false; break;
+      case hello_limiter::verdict::budget_exhausted: accept_counters_.hello_budget_dropped++; admitted = false; break;
+    }
+  }
+
+  // Handshake packets are timed without the session setup they lead to,
+  // which is timed separately
+  bool hello = bytes >= 8 && std::memcmp(&lower_recv_buffer_[0], "QvnQ5XlH", 8) == 0;
+  bool initiate = bytes >= 8 && std::memcmp(&lower_recv_buffer_[0], "QvnQ5XlI", 8) == 0;
+  bool timed = admitted && handshake_timing_ && (hello || initiate);
+  std::uint64_t setup_nanoseconds = handshake_timings_.setup_nanoseconds;
+  std::chrono::steady_clock::time_point started;
+  if (timed)
+    started = std::chrono::steady_clock::now();
+
   // Push received datagram into server
   curvecpr_session *s = nullptr;
-  if (curvecpr_server_recv(&server_, nullptr, &lower_recv_buffer_[0], bytes, &s) == 0) {
+  if (admitted && curvecpr_server_recv(&server_, nullptr, &lower_recv_buffer_[0], bytes, &s) == 0) {
     if (s) {
       // Update client endpoint
       session *sp = static_cast<session*>(s->priv);
@@ -111,15 +267,77 @@ void acceptor::handle_lower_read(const boost::system::error_code &error, std::si
     }
   }
 
-  socket_.async_receive_from(
+  if (timed) {
+    std::uint64_t elapsed = nanoseconds_since(started) - (handshake_timings_.setup_nanoseconds - setup_nanoseconds);
+    if (hello) {
+      handshake_timings_.hellos++;
+      handshake_timings_.hello_nanoseconds += elapsed;
+    } else {
+      handshake_timings_.initiates++;
+      handshake_timings_.initiate_nanoseconds += elapsed;
+    }
+  }
+
+  transport_->async_receive_from(
     boost::asio::buffer(lower_recv_buffer_),
     lower_recv_endpoint_,
-    strand_.wrap(boost::bind(&acceptor::handle_lower_read, this,
-      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))
+    bind_transport_handler(strand_, boost::bind(&acceptor::handle_lower_read, this,
+      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred), &handler_memory_)
   );
 }
 
-void acceptor::handle_upper_send(boost::shared_ptr<session> session,
+void acceptor::evict_session(session &session, std::uint64_t &counter)
+{
+  activity_.erase(activity_.iterator_to(session));
+  auto it = sessions_.find(std::string((const char*) session.session_.their_session_pk, 32));
+  if (it == sessions_.end())
+    return;
+
+  boost::shared_ptr<detail::session> sp = (*it).second;
+  sessions_.erase(it);
+  pending_sessions_.erase(std::remove(pending_sessions_.begin(), pending_sessions_.end(), sp),
+    pending_sessions_.end());
+  counter++;
+
+  // Release the session state on its own strand; an accepted stream keeps
+  // the session alive and observes EOF, otherwise the handlers cancelled
+  // by expiring it keep it alive until they have run
+  boost::asio::dispatch(sp->get_strand(), [sp]() { sp->expire(); });
+}
+
+void acceptor::schedule_idle_sweep()
+{
+  if (idle_timeout_.is_pos_infinity() || activity_.empty())
+    return;
+
+  // A single timer expires when the least recently active session becomes
+  // idle, so sessions do not need timers of their own
+  boost::posix_time::ptime deadline = activity_.front().last_active_ + idle_timeout_;
+  if (idle_sweep_pending_ && idle_timer_.expires_at() <= deadline)
+    return;
+
+  idle_sweep_pending_ = true;
+  idle_timer_.expires_at(deadline);
+  idle_timer_.async_wait(boost::asio::bind_executor(strand_, boost::bind(&acceptor::handle_idle_sweep, this,
+    boost::asio::placeholders::error)));
+}
+
+void acceptor::handle_idle_sweep(const boost::system::error_code &error)
+{
+  if (error)
+    return;
+
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  idle_sweep_pending_ = false;
+
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  while (!activity_.empty() && activity_.front().last_active_ + idle_timeout_ <= now)
+    evict_session(activity_.front(), accept_counters_.idle_evicted);
+
+  schedule_idle_sweep();
+}
+
+void acceptor::handle_upper_send(session *session,
                                  const unsigned char *buffer,
                                  std::size_t length)
 {
@@ -130,7 +348,12 @@ void acceptor::handle_upper_send(boost::shared_ptr<session> session,
 void acceptor::handle_session_close(const std::string &sessionKey)
 {
   std::unique_lock<std::recursive_mutex> lock(mutex_);
-  sessions_.erase(sessionKey);
+  auto it = sessions_.find(sessionKey);
+  if (it == sessions_.end())
+    return;
+
+  activity_.erase(activity_.iterator_to(*(*it).second));
+  sessions_.erase(it);
 }
 
 int acceptor::handle_put_session(struct curvecpr_server *server,
@@ -140,25 +363,49 @@ int acceptor::handle_put_session(struct curvecpr_server *server,
 {
   acceptor *self = static_cast<acceptor*>(server->cf.priv);
   std::unique_lock<std::recursive_mutex> lock(self->mutex_);
+  if (!self->handshake_timing_)
+    return self->put_session(s, s_stored);
+
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  int result = self->put_session(s, s_stored);
+  self->handshake_timings_.setups++;
+  self->handshake_timings_.setup_nanoseconds += nanoseconds_since(started);
+  return result;
+}
 
-  if (self->pending_sessions_.size() >= self->maximum_pending_sessions_)
+int acceptor::put_session(const struct curvecpr_session *s, struct curvecpr_session **s_stored)
+{
+  if (pending_sessions_.size() >= maximum_pending_sessions_) {
+    accept_counters_.backlog_rejected++;
     return 1;
+  }
+
+  // Make room for the new session by evicting the least recently active ones
+  while (sessions_.size() >= maximum_sessions_ && !activity_.empty())
+    evict_session(activity_.front(), accept_counters_.lru_evicted);
 
   // Create a new session descriptor
-  boost::shared_ptr<session> sp = boost::make_shared<session>(self->get_io_service(),
+  boost::shared_ptr<session> sp = boost::make_shared<session>(get_io_context(),
     session::type::server);
-  sp->set_lower_send_handler(boost::bind(&acceptor::handle_upper_send, self, sp, _1, _2));
+  sp->set_lower_send_handler(boost::bind(&acceptor::handle_upper_send, this, sp.get(), _1, _2));
   sp->session_ = *s;
   sp->session_.priv = sp.get();
-  sp->set_endpoint(self->lower_recv_endpoint_);
+  sp->set_endpoint(lower_recv_endpoint_);
   // Store session under its public key
   std::string sessionKey((const char*) sp->session_.their_session_pk, 32);
-  self->sessions_.insert(std::pair<std::string, boost::shared_ptr<session>>{ sessionKey, sp });
-  sp->set_close_handler(boost::bind(&acceptor::handle_session_close, self, sessionKey));
+  sessions_.insert(std::pair<std::string, boost::shared_ptr<session>>{ sessionKey, sp });
+  sp->set_close_handler(boost::bind(&acceptor::handle_session_close, this, sessionKey));
+  sp->last_active_ = boost::posix_time::microsec_clock::universal_time();
+  activity_.push_back(*sp);
+  schedule_idle_sweep();
+  // Start the session as soon as its Initiate packet has been received, so
+  // that data carried in it is acknowledged right away and is ready to be
+  // read once the session is accepted
+  boost::asio::dispatch(sp->get_strand(), [sp]() { sp->start(); });
   // Put session parameters into the pending session queue
-  self->pending_sessions_.push_back(sp);
+  pending_sessions_.push_back(sp);
   // Notify waiting acceptors
-  self->pending_ready_accept_.cancel();
+  pending_ready_accept_.cancel();
 
   if (s_stored)
     *s_stored = &sp->session_;
@@ -193,7 +440,7 @@ int acceptor::handle_send(struct curvecpr_server *server,
   acceptor *self = static_cast<acceptor*>(server->cf.priv);
   std::unique_lock<std::recursive_mutex> lock(self->mutex_);
 
-  boost::asio::ip::udp::endpoint endpoint;
+  transport::endpoint_type endpoint;
   if (!s->priv) {
     // We are being called while receiving a Hello packet from client,
     // so we can use the endpoint of the last received datagram
@@ -208,10 +455,10 @@ int acceptor::handle_send(struct curvecpr_server *server,
   std::memcpy(&(*buffer)[0], buf, num);
 
   // Transmit data
-  self->socket_.async_send_to(
+  self->transport_->async_send_to(
     boost::asio::buffer(&(*buffer)[0], num),
     endpoint,
-    self->strand_.wrap([buffer](const boost::system::error_code&, std::size_t) {})
+    [buffer](const boost::system::error_code&, std::size_t) {}
   );
 
   return 0;
@@ -223,7 +470,16 @@ int acceptor::handle_recv(struct curvecpr_server *server,
                           const unsigned char *buf,
                           size_t num)
 {
+  acceptor *self = static_cast<acceptor*>(server->cf.priv);
   session *sp = static_cast<session*>(s->priv);
+
+  // Only authenticated packets mark the session as active
+  if (sp->activity_hook_.is_linked()) {
+    sp->last_active_ = boost::posix_time::microsec_clock::universal_time();
+    self->activity_.erase(self->activity_.iterator_to(*sp));
+    self->activity_.push_back(*sp);
+  }
+
   return sp->lower_receive(buf, num);
 }
 
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_BUSY_POLL_TRANSPORT_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_BUSY_POLL_TRANSPORT_IPP
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+namespace curvecp {
+
+namespace detail {
+
+busy_poll_transport::busy_poll_transport(boost::asio::io_context &service, int cpu)
+  : service_(service),
+    socket_(-1),
+    protocol_(0),
+    wakeup_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    cpu_(cpu),
+    spin_budget_(boost::posix_time::milliseconds(100)),
+    socket_busy_poll_(0),
+    generation_(0),
+    poll_buffer_(maximum_datagram_size()),
+    receive_queue_(service, 1024)
+{
+  if (wakeup_ < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "eventfd");
+}
+
+busy_poll_transport::~busy_poll_transport()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  stop(lock);
+
+  if (socket_ >= 0)
+    ::close(socket_);
+  ::close(wakeup_);
+}
+
+void busy_poll_transport::open_socket(const endpoint_type &endpoint)
+{
+  if (socket_ >= 0)
+    return;
+
+  socket_ = ::socket(endpoint.protocol().family(), SOCK_DGRAM | SOCK_CLOEXEC, endpoint.protocol().protocol());
+  if (socket_ < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "socket");
+  protocol_ = endpoint.protocol().protocol();
+
+  if (socket_busy_poll_ > 0 &&
+      setsockopt(socket_, SOL_SOCKET, SO_BUSY_POLL, &socket_busy_poll_, sizeof(socket_busy_poll_)) < 0) {
+    int error = errno;
+    ::close(socket_);
+    socket_ = -1;
+    throw boost::system::system_error(boost::system::error_code(error, boost::system::system_category()),
+      "setsockopt(SO_BUSY_POLL)");
+  }
+}
+
+void busy_poll_transport::bind(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_socket(endpoint);
+  if (::bind(socket_, endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "bind");
+  start();
+}
+
+void busy_poll_transport::connect(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_socket(endpoint);
+  if (::connect(socket_, endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "connect");
+  start();
+}
+
+void busy_poll_transport::open(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_socket(endpoint);
+  start();
+}
+
+void busy_poll_transport::start()
+{
+  if (poller_.joinable())
+    return;
+
+  // Datagrams received by the polling thread are completed through the IO
+  // context, which must not run out of work while the transport is open
+  service_.get_executor().on_work_started();
+  poller_ = std::thread(&busy_poll_transport::run, this, ++generation_);
+
+  if (cpu_ >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_, &set);
+    int error = pthread_setaffinity_np(poller_.native_handle(), sizeof(set), &set);
+    if (error != 0) {
+      std::unique_lock<std::mutex> lock(mutex_, std::adopt_lock);
+      stop(lock);
+      lock.release();
+      throw boost::system::system_error(boost::system::error_code(error, boost::system::system_category()),
+        "pthread_setaffinity_np");
+    }
+  }
+}
+
+void busy_poll_transport::stop(std::unique_lock<std::mutex> &lock)
+{
+  std::thread poller(std::move(poller_));
+  if (!poller.joinable())
+    return;
+
+  generation_++;
+  wake();
+  service_.get_executor().on_work_finished();
+
+  // No handlers run on the polling thread, so it is never the one stopping
+  // itself and can always be joined
+  lock.unlock();
+  poller.join();
+  lock.lock();
+}
+
+void busy_poll_transport::wake()
+{
+  std::uint64_t value = 1;
+  ssize_t result = ::write(wakeup_, &value, sizeof(value));
+  (void) result;
+}
+
+void busy_poll_transport::close()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0)
+    return;
+
+  receive_queue_.cancel();
+  stop(lock);
+  ::close(socket_);
+  socket_ = -1;
+}
+
+transport::endpoint_type busy_poll_transport::local_endpoint() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  if (socket_ < 0 || getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length) < 0)
+    throw boost::system::system_error(boost::asio::error::bad_descriptor);
+
+  return endpoint_type(&address, length, protocol_);
+}
+
+void busy_poll_transport::async_receive(const boost::asio::mutable_buffer &buffer,
+                                        handler_type handler)
+{
+  async_receive_from(buffer, connected_sender_, std::move(handler));
+}
+
+void busy_poll_transport::async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                             endpoint_type &sender,
+                                             handler_type handler)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0) {
+    post_transport_handler(service_, std::move(handler),
+      boost::system::error_code(boost::asio::error::bad_descriptor), 0);
+    return;
+  }
+
+  // The receive is completed once the polling thread queues a datagram
+  receive_queue_.async_receive_from(buffer, sender, std::move(handler));
+}
+
+std::size_t busy_poll_transport::try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                                  endpoint_type &sender,
+                                                  boost::system::error_code &ec)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0) {
+    ec = boost::asio::error::bad_descriptor;
+    return 0;
+  }
+
+  return receive_queue_.try_receive_from(buffer, sender, ec);
+}
+
+void busy_poll_transport::async_send(const boost::asio::const_buffer &buffer,
+                                     handler_type handler)
+{
+  send(buffer, nullptr, std::move(handler));
+}
+
+void busy_poll_transport::async_send_to(const boost::asio::const_buffer &buffer,
+                                        const endpoint_type &destination,
+                                        handler_type handler)
+{
+  send(buffer, &destination, std::move(handler));
+}
+
+void busy_poll_transport::send(const boost::asio::const_buffer &buffer,
+                               const endpoint_type *destination,
+                               handler_type handler)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0) {
+    post_transport_handler(service_, std::move(handler),
+      boost::system::error_code(boost::asio::error::bad_descriptor), 0);
+    return;
+  }
+
+  // Datagrams are sent right away from the calling thread
+  ssize_t result;
+  if (destination) {
+    result = ::sendto(socket_, buffer.data(), buffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL,
+      destination->data(), static_cast<socklen_t>(destination->size()));
+  } else {
+    result = ::send(socket_, buffer.data(), buffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+
+  if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    // The socket send buffer is full, retry once other handlers have run
+    boost::asio::post(service_, retry_send{ shared_from_this(), buffer,
+      destination ? *destination : endpoint_type(), !destination, std::move(handler) });
+    return;
+  }
+
+  boost::system::error_code ec;
+  if (result < 0)
+    ec = boost::system::error_code(errno, boost::system::system_category());
+  post_transport_handler(service_, std::move(handler), ec, result < 0 ? 0 : static_cast<std::size_t>(result));
+}
+
+bool busy_poll_transport::poll_once()
+{
+  // The socket is only closed after this thread has been joined, so it is
+  // used without taking the mutex, which would hold up senders
+  sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  ssize_t result = ::recvfrom(socket_, &poll_buffer_[0], poll_buffer_.size(), MSG_DONTWAIT,
+    reinterpret_cast<sockaddr*>(&address), &length);
+
+  // Errors, such as reports of unreachable ports, are dropped like lost
+  // datagrams
+  if (result < 0)
+    return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+
+  // The datagram is only queued here; the receive handler is posted to the
+  // IO context, so no handlers run on the polling thread
+  receive_queue_.push(endpoint_type(&address, length, protocol_),
+    boost::asio::buffer(&poll_buffer_[0], static_cast<std::size_t>(result)));
+  return true;
+}
+
+void busy_poll_transport::run(unsigned generation)
+{
+  typedef std::chrono::steady_clock clock;
+  clock::time_point active = clock::now();
+
+  // The transport joins this thread before it is destroyed, so it is used
+  // without holding a reference
+  while (generation_ == generation) {
+    if (poll_once()) {
+      active = clock::now();
+      continue;
+    }
+
+    // Completions run on other threads, which must not be kept waiting
+    // for a core that is shared with this one
+    if (clock::now() - active < std::chrono::microseconds(spin_budget_.total_microseconds())) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // Out of spin budget, so block until a datagram arrives or the thread
+    // is woken up
+    pollfd descriptors[2];
+    descriptors[0].fd = wakeup_;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = socket_;
+    descriptors[1].events = POLLIN;
+    ::poll(descriptors, socket_ >= 0 ? 2 : 1, -1);
+
+    std::uint64_t value;
+    ssize_t result = ::read(wakeup_, &value, sizeof(value));
+    (void) result;
+    active = clock::now();
+  }
+}
+
+}
+
+}
+
+#endif
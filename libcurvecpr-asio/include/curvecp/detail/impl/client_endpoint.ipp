@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_CLIENT_ENDPOINT_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_CLIENT_ENDPOINT_IPP
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/system/system_error.hpp>
+
+namespace curvecp {
+
+namespace detail {
+
+client_endpoint_channel::client_endpoint_channel(boost::shared_ptr<client_endpoint> endpoint,
+                                                 std::size_t socket,
+                                                 const std::string &extension)
+  : endpoint_(endpoint),
+    socket_(socket),
+    extension_(extension),
+    open_(false),
+    connected_(false),
+    receive_queue_(endpoint->get_io_context(), 64)
+{
+}
+
+client_endpoint_channel::~client_endpoint_channel()
+{
+  endpoint_->detach(extension_);
+}
+
+boost::asio::io_context &client_endpoint_channel::get_io_context()
+{
+  return endpoint_->get_io_context();
+}
+
+void client_endpoint_channel::bind(const endpoint_type&)
+{
+  // Channels always use the local endpoint of the shared socket
+  throw boost::system::system_error(boost::asio::error::operation_not_supported);
+}
+
+void client_endpoint_channel::connect(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  remote_ = endpoint;
+  open_ = true;
+  connected_ = true;
+}
+
+void client_endpoint_channel::open(const endpoint_type&)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_ = true;
+}
+
+void client_endpoint_channel::close()
+{
+  // The shared socket stays open, only this channel stops receiving
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_ = false;
+  connected_ = false;
+  lock.unlock();
+
+  receive_queue_.cancel();
+}
+
+client_endpoint_channel::endpoint_type client_endpoint_channel::local_endpoint() const
+{
+  return endpoint_->sockets_[socket_].transport->local_endpoint();
+}
+
+void client_endpoint_channel::async_receive(const boost::asio::mutable_buffer &buffer,
+                                            handler_type handler)
+{
+  receive_queue_.async_receive_from(buffer, connected_sender_, std::move(handler));
+}
+
+void client_endpoint_channel::async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                                 endpoint_type &sender,
+                                                 handler_type handler)
+{
+  receive_queue_.async_receive_from(buffer, sender, std::move(handler));
+}
+
+std::size_t client_endpoint_channel::try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                                      endpoint_type &sender,
+                                                      boost::system::error_code &ec)
+{
+  return receive_queue_.try_receive_from(buffer, sender, ec);
+}
+
+std::size_t client_endpoint_channel::maximum_datagram_size() const
+{
+  return client_endpoint::maximum_packet_size;
+}
+
+void client_endpoint_channel::async_send(const boost::asio::const_buffer &buffer,
+                                         handler_type handler)
+{
+  endpoint_type destination;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    destination = remote_;
+  }
+
+  async_send_to(buffer, destination, std::move(handler));
+}
+
+void client_endpoint_channel::async_send_to(const boost::asio::const_buffer &buffer,
+                                            const endpoint_type &destination,
+                                            handler_type handler)
+{
+  endpoint_->sockets_[socket_].transport->async_send_to(buffer, destination, std::move(handler));
+}
+
+void client_endpoint_channel::deliver(const endpoint_type &source, const boost::asio::const_buffer &buffer)
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!open_ || (connected_ && source != remote_))
+      return;
+  }
+
+  receive_queue_.push(source, buffer);
+}
+
+client_endpoint::client_endpoint(const std::vector<boost::shared_ptr<transport>> &transports)
+  : next_extension_(1),
+    next_socket_(0),
+    receive_batch_maximum_(32),
+    unroutable_packets_(0)
+{
+  if (transports.empty())
+    throw boost::system::system_error(boost::asio::error::invalid_argument);
+
+  for (const boost::shared_ptr<transport> &t : transports) {
+    socket_state state;
+    state.transport = t;
+    state.buffer.resize(65535);
+    sockets_.push_back(state);
+  }
+}
+
+void client_endpoint::start()
+{
+  for (std::size_t i = 0; i < sockets_.size(); i++)
+    start_receive(i);
+}
+
+void client_endpoint::close()
+{
+  for (socket_state &state : sockets_)
+    state.transport->close();
+}
+
+boost::shared_ptr<client_endpoint_channel> client_endpoint::create_channel()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // Encode the counter into the extension; the remaining bytes are zero
+  std::string extension(16, '\0');
+  std::uint64_t id = next_extension_++;
+  for (int i = 0; i < 8; i++)
+    extension[i] = static_cast<char>((id >> (56 - 8 * i)) & 0xFF);
+
+  std::size_t socket = next_socket_;
+  next_socket_ = (next_socket_ + 1) % sockets_.size();
+
+  boost::shared_ptr<client_endpoint_channel> channel(
+    boost::make_shared<client_endpoint_channel>(shared_from_this(), socket, extension));
+  channels_[extension] = channel.get();
+  return channel;
+}
+
+std::size_t client_endpoint::channel_count() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  return channels_.size();
+}
+
+std::uint64_t client_endpoint::unroutable_packets() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  return unroutable_packets_;
+}
+
+void client_endpoint::detach(const std::string &extension)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  channels_.erase(extension);
+}
+
+void client_endpoint::start_receive(std::size_t index)
+{
+  socket_state &state = sockets_[index];
+  state.transport->async_receive_from(
+    boost::asio::buffer(state.buffer),
+    state.sender,
+    boost::bind(&client_endpoint::handle_receive, shared_from_this(), index,
+      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
+  );
+}
+
+void client_endpoint::handle_receive(std::size_t index,
+                                     const boost::system::error_code &error,
+                                     std::size_t bytes)
+{
+  if (error == boost::asio::error::operation_aborted || error == boost::asio::error::bad_descriptor)
+    return;
+
+  socket_state &state = sockets_[index];
+  if (!error)
+    route(state.sender, &state.buffer[0], bytes);
+
+  // Drain datagrams that are already waiting so that a burst is handled
+  // with a single reactor round trip
+  for (std::size_t i = 0; i < receive_batch_maximum_; i++) {
+    boost::system::error_code ec;
+    std::size_t length = state.transport->try_receive_from(boost::asio::buffer(state.buffer),
+      state.sender, ec);
+    if (ec)
+      break;
+
+    route(state.sender, &state.buffer[0], length);
+  }
+
+  start_receive(index);
+}
+
+void client_endpoint::route(const transport::endpoint_type &source,
+                            const unsigned char *buffer,
+                            std::size_t length)
+{
+  // Both Cookie and Server Message packets start with an 8-byte magic,
+  // followed by the client extension and the server extension
+  if (length < 40 || length > maximum_packet_size)
+    return;
+
+  std::string extension(reinterpret_cast<const char*>(buffer + 8), 16);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = channels_.find(extension);
+  if (it == channels_.end()) {
+    unroutable_packets_++;
+    return;
+  }
+
+  it->second->deliver(source, boost::asio::buffer(buffer, length));
+}
+
+}
+
+}
+
+#endif
@@ -8,6 +8,7 @@
 #define CURVECP_ASIO_DETAIL_IMPL_CLIENT_STREAM_IPP
 
 #include <curvecp/detail/io.hpp>
+#include <curvecp/detail/socket_transport.hpp>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
@@ -15,22 +16,61 @@
 #include <boost/asio/placeholders.hpp>
 #include <boost/asio/read.hpp>
 
+#include <algorithm>
+
 namespace curvecp {
 
 namespace detail {
 
-client_stream::client_stream(boost::asio::io_service &service)
+client_stream::client_stream(boost::asio::io_context &service)
   : basic_stream(service, session_),
-    socket_(service),
     session_(service, session::type::client),
-    lower_recv_buffer_(65535),
+    transport_(boost::make_shared<socket_transport>(service)),
+    lower_recv_buffer_(transport_->maximum_datagram_size()),
     hello_timed_out_(service),
-    hello_retries_(0)
+    hello_retries_(0),
+    hello_timeout_initial_(boost::posix_time::milliseconds(250)),
+    hello_timeout_maximum_(boost::posix_time::seconds(8)),
+    hello_attempts_(6),
+    jitter_(std::random_device()()),
+    candidates_racing_(0),
+    racing_(false),
+    connecting_(false),
+    connect_stagger_timer_(service),
+    connect_stagger_(boost::posix_time::milliseconds(250)),
+    local_extension_assigned_(false)
+{
+  initialize();
+}
+
+client_stream::client_stream(boost::shared_ptr<transport> transport)
+  : basic_stream(transport->get_io_context(), session_),
+    session_(transport->get_io_context(), session::type::client),
+    transport_(transport),
+    lower_recv_buffer_(transport_->maximum_datagram_size()),
+    hello_timed_out_(transport->get_io_context()),
+    hello_retries_(0),
+    hello_timeout_initial_(boost::posix_time::milliseconds(250)),
+    hello_timeout_maximum_(boost::posix_time::seconds(8)),
+    hello_attempts_(6),
+    jitter_(std::random_device()()),
+    candidates_racing_(0),
+    racing_(false),
+    connecting_(false),
+    connect_stagger_timer_(transport->get_io_context()),
+    connect_stagger_(boost::posix_time::milliseconds(250)),
+    local_extension_assigned_(false)
+{
+  initialize();
+}
+
+void client_stream::initialize()
 {
   session_.set_lower_send_handler(boost::bind(&client_stream::handle_upper_send, this, _1, _2));
   session_.set_close_handler([this]() {
     hello_timed_out_.cancel();
-    socket_.close();
+    connect_stagger_timer_.cancel();
+    transport_->close();
   });
 
   struct curvecpr_client_cf client_cf;
@@ -45,10 +85,19 @@ client_stream::client_stream(boost::asio::io_service &service)
 
 void client_stream::set_local_extension(const std::string &extension)
 {
+  if (local_extension_assigned_)
+    return;
+
   std::memset(client_.cf.my_extension, 0, sizeof(client_.cf.my_extension));
   std::memcpy(client_.cf.my_extension, extension.data(), sizeof(client_.cf.my_extension));
 }
 
+void client_stream::assign_local_extension(const std::string &extension)
+{
+  set_local_extension(extension);
+  local_extension_assigned_ = true;
+}
+
 void client_stream::set_local_public_key(const std::string &publicKey)
 {
   std::memset(client_.cf.my_global_pk, 0, sizeof(client_.cf.my_global_pk));
@@ -80,57 +129,161 @@ void client_stream::set_remote_domain_name(const std::string &domain)
   curvecpr_util_encode_domain_name(client_.cf.their_domain_name, domain.data());
 }
 
+void client_stream::set_hello_backoff(const boost::posix_time::time_duration &initial,
+                                      const boost::posix_time::time_duration &maximum,
+                                      int attempts)
+{
+  hello_timeout_initial_ = initial;
+  hello_timeout_maximum_ = maximum;
+  hello_attempts_ = attempts;
+}
+
+void client_stream::set_rtt_estimate(const boost::posix_time::time_duration &rtt)
+{
+  rtt_estimate_ = rtt;
+}
+
+void client_stream::set_connect_stagger(const boost::posix_time::time_duration &delay)
+{
+  connect_stagger_ = delay;
+}
+
 void client_stream::bind(const endpoint_type &endpoint)
 {
-  socket_.open(endpoint.protocol());
-  socket_.bind(endpoint);
+  transport_->bind(endpoint);
 }
 
-bool client_stream::connect(const endpoint_type &endpoint, boost::system::error_code &ec)
+bool client_stream::connect(const std::vector<endpoint_type> &endpoints, boost::system::error_code &ec)
 {
+  ec = boost::system::error_code();
+
   if (session_.is_running()) {
-    ec = boost::system::error_code();
     return true;
-  } else {
-    if (hello_retries_ < 0) {
-      hello_retries_ = 0;
-      ec = boost::system::error_code(boost::asio::error::connection_refused);
-      return true;
-    }
-
+  } else if (hello_retries_ < 0) {
     hello_retries_ = 0;
-    socket_.connect(endpoint);
-    socket_.async_receive(
+    connecting_ = false;
+    ec = boost::system::error_code(boost::asio::error::connection_refused);
+    return true;
+  } else if (connecting_) {
+    return false;
+  } else if (endpoints.empty()) {
+    ec = boost::system::error_code(boost::asio::error::invalid_argument);
+    return true;
+  }
+
+  connecting_ = true;
+  candidates_.clear();
+  for (const endpoint_type &endpoint : endpoints)
+    candidates_.push_back(candidate{ endpoint, boost::posix_time::ptime(), 0 });
+
+  // A single candidate is connected right away, several candidates race
+  // over an unconnected transport until one of them answers
+  candidates_racing_ = 1;
+  racing_ = candidates_.size() > 1;
+  if (racing_)
+    transport_->open(endpoints.front());
+  else
+    transport_->connect(endpoints.front());
+  start_lower_receive();
+
+  // Seed the retransmission timeout from the round-trip time when known
+  hello_retries_ = 0;
+  hello_timeout_ = hello_timeout_initial_;
+  if (!rtt_estimate_.is_zero())
+    hello_timeout_ = std::max(std::min(rtt_estimate_ * 2, hello_timeout_maximum_), boost::posix_time::time_duration(boost::posix_time::milliseconds(10)));
+  handle_hello_timeout(boost::system::error_code());
+
+  if (racing_) {
+    connect_stagger_timer_.expires_from_now(connect_stagger_);
+    connect_stagger_timer_.async_wait(boost::asio::bind_executor(session_.get_strand(),
+      boost::bind(&client_stream::handle_connect_stagger, this, _1)));
+  }
+
+  return false;
+}
+
+void client_stream::start_lower_receive()
+{
+  if (racing_) {
+    transport_->async_receive_from(
       boost::asio::buffer(lower_recv_buffer_),
-      session_.get_strand().wrap(boost::bind(&client_stream::handle_lower_read, this,
-        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))
+      lower_recv_endpoint_,
+      bind_transport_handler(session_.get_strand(), boost::bind(&client_stream::handle_lower_read, this,
+        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred),
+        &session_.get_handler_memory())
+    );
+  } else {
+    transport_->async_receive(
+      boost::asio::buffer(lower_recv_buffer_),
+      bind_transport_handler(session_.get_strand(), boost::bind(&client_stream::handle_lower_read, this,
+        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred),
+        &session_.get_handler_memory())
     );
-
-    handle_hello_timeout(boost::system::error_code());
-    return false;
   }
 }
 
+void client_stream::send_lower(const unsigned char *buffer, std::size_t length,
+                               const endpoint_type *destination)
+{
+  boost::shared_ptr<std::vector<unsigned char>> data(
+    boost::make_shared<std::vector<unsigned char>>(buffer, buffer + length));
+  auto handler = [data](const boost::system::error_code&, std::size_t) {};
+
+  // Transmit data
+  if (destination)
+    transport_->async_send_to(boost::asio::buffer(*data), *destination, handler);
+  else
+    transport_->async_send(boost::asio::buffer(*data), handler);
+}
+
 void client_stream::handle_hello_timeout(const boost::system::error_code &error)
 {
   if (error)
     return;
 
-  if (++hello_retries_ > 5) {
+  if (hello_retries_ >= hello_attempts_ && candidates_racing_ == candidates_.size()) {
     hello_retries_ = -1;
+    connect_stagger_timer_.cancel();
     pending_ready_connect_.cancel();
-    socket_.close();
+    transport_->close();
     return;
   }
 
-  // Resend hello packet and restart the timer
+  // Resend hello packet and back off exponentially
+  if (hello_retries_++ > 0)
+    hello_timeout_ = std::min(hello_timeout_ * 2, hello_timeout_maximum_);
   curvecpr_client_connected(&client_);
 
-  hello_timed_out_.expires_from_now(boost::posix_time::seconds(1));
-  hello_timed_out_.async_wait(session_.get_strand().wrap(
+  // Restart the timer with up to 25% jitter, so that clients which lost
+  // their Hello packets together do not retransmit in lockstep
+  std::int64_t timeout = hello_timeout_.total_microseconds();
+  timeout += static_cast<std::int64_t>(jitter_() % static_cast<std::uint64_t>(timeout / 2 + 1)) - timeout / 4;
+
+  hello_timed_out_.expires_from_now(boost::posix_time::microseconds(timeout));
+  hello_timed_out_.async_wait(boost::asio::bind_executor(session_.get_strand(),
     boost::bind(&client_stream::handle_hello_timeout, this, _1)));
 }
 
+void client_stream::handle_connect_stagger(const boost::system::error_code &error)
+{
+  if (error || !racing_ || candidates_racing_ >= candidates_.size())
+    return;
+
+  // Let the next candidate join the race with the last Hello packet
+  candidate &next = candidates_[candidates_racing_++];
+  if (!hello_packet_.empty()) {
+    send_lower(&hello_packet_[0], hello_packet_.size(), &next.endpoint);
+    next.hello_sent = boost::posix_time::microsec_clock::universal_time();
+    next.hellos++;
+  }
+
+  if (candidates_racing_ < candidates_.size()) {
+    connect_stagger_timer_.expires_from_now(connect_stagger_);
+    connect_stagger_timer_.async_wait(boost::asio::bind_executor(session_.get_strand(),
+      boost::bind(&client_stream::handle_connect_stagger, this, _1)));
+  }
+}
+
 void client_stream::handle_upper_send(const unsigned char *buffer, std::size_t length)
 {
   curvecpr_client_send(&client_, buffer, length);
@@ -141,21 +294,44 @@ void client_stream::handle_lower_read(const boost::system::error_code &error, st
   if (error == boost::asio::error::operation_aborted || error == boost::asio::error::bad_descriptor)
     return;
 
-  // Push received datagram into client
-  if (curvecpr_client_recv(&client_, &lower_recv_buffer_[0], bytes) == 0) {
+  // While racing, only datagrams from candidates in the race are accepted
+  std::size_t source = 0;
+  if (racing_) {
+    while (source < candidates_racing_ && candidates_[source].endpoint != lower_recv_endpoint_)
+      source++;
+  }
+
+  // Push received datagram into client; once the cookie has been received
+  // the session is started, which sends data written before the connection
+  // was established inside the Initiate packet
+  if (source < candidates_racing_ && curvecpr_client_recv(&client_, &lower_recv_buffer_[0], bytes) == 0 &&
+      !session_.is_running()) {
     if (client_.negotiated != curvecpr_client::CURVECPR_CLIENT_PENDING) {
       hello_retries_ = 0;
       hello_timed_out_.cancel();
+      connect_stagger_timer_.cancel();
+
+      // The first candidate to answer wins the race
+      if (racing_) {
+        racing_ = false;
+        transport_->connect(candidates_[source].endpoint);
+      }
+
+      // The round-trip time is only known when the cookie can not be an
+      // answer to a retransmitted Hello
+      const candidate &winner = candidates_[source];
+      if (winner.hellos == 1) {
+        handshake_rtt_ = boost::posix_time::microsec_clock::universal_time() - winner.hello_sent;
+        rtt_estimate_ = handshake_rtt_;
+      }
+
+      connecting_ = false;
       session_.start();
       pending_ready_connect_.cancel();
     }
   }
 
-  socket_.async_receive(
-    boost::asio::buffer(lower_recv_buffer_),
-    session_.get_strand().wrap(boost::bind(&client_stream::handle_lower_read, this,
-      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred))
-  );
+  start_lower_receive();
 }
 
 int client_stream::handle_send(struct curvecpr_client *client,
@@ -164,15 +340,22 @@ int client_stream::handle_send(struct curvecpr_client *client,
 {
   client_stream *self = static_cast<client_stream*>(client->cf.priv);
 
-  boost::shared_ptr<std::vector<unsigned char>> buffer(
-    boost::make_shared<std::vector<unsigned char>>(num));
-  std::memcpy(&(*buffer)[0], buf, num);
+  if (client->negotiated != curvecpr_client::CURVECPR_CLIENT_PENDING) {
+    self->send_lower(buf, num, nullptr);
+    return 0;
+  }
 
-  // Transmit data
-  self->socket_.async_send(
-    boost::asio::buffer(&(*buffer)[0], num),
-    self->session_.get_strand().wrap([buffer](const boost::system::error_code&, std::size_t) {})
-  );
+  // Hello packets are sent to all candidates in the race and remembered
+  // for candidates that join later
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  if (self->racing_)
+    self->hello_packet_.assign(buf, buf + num);
+
+  for (std::size_t i = 0; i < self->candidates_racing_; i++) {
+    self->send_lower(buf, num, self->racing_ ? &self->candidates_[i].endpoint : nullptr);
+    self->candidates_[i].hello_sent = now;
+    self->candidates_[i].hellos++;
+  }
 
   return 0;
 }
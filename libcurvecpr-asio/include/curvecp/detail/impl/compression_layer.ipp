@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_COMPRESSION_LAYER_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_COMPRESSION_LAYER_IPP
+
+#include <algorithm>
+#include <cstring>
+
+namespace curvecp {
+
+namespace detail {
+
+#define COMPRESSION_RECORD_RAW 1
+#define COMPRESSION_RECORD_ZSTD 2
+#define COMPRESSION_RECORD_HEADER_SIZE 4
+#define COMPRESSION_RECORD_MAXIMUM 65536
+#define COMPRESSION_CHUNK_SIZE 16384
+#define COMPRESSION_CHUNK_SMALL 256
+#define COMPRESSION_OUTPUT_SIZE 65536
+#define COMPRESSION_BACKOFF_MAXIMUM 64
+
+compression_layer::compression_layer()
+  : enabled_(false),
+    skip_(0),
+    backoff_(0),
+    send_head_(0),
+    record_fill_(0),
+    record_pos_(0),
+    record_active_(false),
+    record_more_(false),
+    output_head_(0),
+    counters_()
+{
+}
+
+void compression_layer::set_enabled(bool value)
+{
+  // The peer starts decompressing from scratch after the raw chunks that
+  // are sent while compression is off, so our history has to go
+  if (enabled_ && !value)
+    codec_.reset_compressor();
+  enabled_ = value;
+}
+
+std::size_t compression_layer::put_chunk(const unsigned char *first, std::size_t first_length,
+                                         const unsigned char *second, std::size_t second_length,
+                                         bool compress)
+{
+  send_.clear();
+  send_head_ = 0;
+
+  std::size_t length = std::min<std::size_t>(first_length + second_length, COMPRESSION_CHUNK_SIZE);
+  first_length = std::min(first_length, length);
+  second_length = length - first_length;
+
+  // Chunks are framed by a type and a 24-bit length
+  unsigned char type = COMPRESSION_RECORD_RAW;
+  if (compress) {
+    if (skip_ > 0) {
+      skip_--;
+    } else {
+      send_.resize(COMPRESSION_RECORD_HEADER_SIZE);
+      // Small chunks rarely shrink but are kept compressed anyway, as the
+      // few extra bytes cost less than losing the history
+      if (codec_.compress(first, first_length, second, second_length, send_) &&
+          (send_.size() - COMPRESSION_RECORD_HEADER_SIZE < length - length / 16 ||
+           length < COMPRESSION_CHUNK_SMALL)) {
+        type = COMPRESSION_RECORD_ZSTD;
+        backoff_ = 0;
+      } else {
+        // The chunk is not worth compressing, so skip a growing number of
+        // chunks before trying again. The peer resets its decompressor on
+        // every uncompressed chunk, so our history has to go as well
+        backoff_ = std::min<std::size_t>(std::max<std::size_t>(backoff_ * 2, 1), COMPRESSION_BACKOFF_MAXIMUM);
+        skip_ = backoff_;
+        codec_.reset_compressor();
+      }
+    }
+  }
+
+  if (type == COMPRESSION_RECORD_RAW) {
+    send_.resize(COMPRESSION_RECORD_HEADER_SIZE + length);
+    std::memcpy(&send_[COMPRESSION_RECORD_HEADER_SIZE], first, first_length);
+    std::memcpy(&send_[COMPRESSION_RECORD_HEADER_SIZE + first_length], second, second_length);
+    counters_.chunks_raw++;
+  } else {
+    counters_.chunks_compressed++;
+  }
+
+  std::size_t framed = send_.size() - COMPRESSION_RECORD_HEADER_SIZE;
+  send_[0] = type;
+  send_[1] = static_cast<unsigned char>(framed >> 16);
+  send_[2] = static_cast<unsigned char>(framed >> 8);
+  send_[3] = static_cast<unsigned char>(framed);
+  counters_.bytes_in += length;
+  counters_.bytes_out += send_.size();
+  return length;
+}
+
+std::size_t compression_layer::take_frames(unsigned char *data, std::size_t length)
+{
+  length = std::min(send_.size() - send_head_, length);
+  std::memcpy(data, &send_[send_head_], length);
+  send_head_ += length;
+  return length;
+}
+
+template <typename Source>
+std::size_t compression_layer::read(unsigned char *buffer, std::size_t length, Source source,
+                                    boost::system::error_code &ec)
+{
+  std::size_t copied = 0;
+  while (copied < length && decompress_more(source, ec)) {
+    std::size_t len = std::min(length - copied, output_.size() - output_head_);
+    if (len == 0)
+      break;
+
+    std::memcpy(buffer + copied, &output_[output_head_], len);
+    output_head_ += len;
+    copied += len;
+  }
+
+  return copied;
+}
+
+template <typename Source>
+std::size_t compression_layer::available(Source source)
+{
+  // Only data that has already been decompressed is counted
+  boost::system::error_code ec;
+  decompress_more(source, ec);
+  return output_.size() - output_head_;
+}
+
+void compression_layer::clear()
+{
+  skip_ = 0;
+  backoff_ = 0;
+  send_.clear();
+  send_head_ = 0;
+  record_fill_ = 0;
+  record_active_ = false;
+  output_.clear();
+  output_head_ = 0;
+  codec_.reset_compressor();
+  codec_.reset_decompressor();
+}
+
+template <typename Source>
+bool compression_layer::pull_record(Source &source, boost::system::error_code &ec)
+{
+  // Assemble the header first and then the rest of the chunk
+  for (;;) {
+    std::size_t needed = COMPRESSION_RECORD_HEADER_SIZE;
+    if (record_fill_ >= COMPRESSION_RECORD_HEADER_SIZE) {
+      std::size_t length = (static_cast<std::size_t>(record_[1]) << 16) |
+                           (static_cast<std::size_t>(record_[2]) << 8) |
+                           static_cast<std::size_t>(record_[3]);
+      if (length > COMPRESSION_RECORD_MAXIMUM) {
+        ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+        return false;
+      }
+
+      needed += length;
+    }
+
+    if (record_fill_ == needed)
+      return true;
+
+    if (record_.size() < needed)
+      record_.resize(needed);
+
+    std::size_t received = source(&record_[record_fill_], needed - record_fill_);
+    if (received == 0)
+      return false;
+    record_fill_ += received;
+  }
+}
+
+template <typename Source>
+bool compression_layer::decompress_more(Source &source, boost::system::error_code &ec)
+{
+  while (output_head_ == output_.size()) {
+    output_.clear();
+    output_head_ = 0;
+
+    if (record_active_) {
+      // Decompress the current chunk piece by piece, so that a chunk that
+      // expands a lot does not need a large buffer
+      std::size_t produced;
+      output_.resize(COMPRESSION_OUTPUT_SIZE);
+      compression_codec::status result = codec_.decompress(&record_[0], record_fill_, record_pos_,
+        &output_[0], output_.size(), produced);
+      output_.resize(produced);
+
+      if (result == compression_codec::status::error) {
+        ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+        return false;
+      }
+
+      record_more_ = result == compression_codec::status::more;
+      if (record_pos_ == record_fill_ && !record_more_) {
+        record_active_ = false;
+        record_fill_ = 0;
+      }
+      continue;
+    }
+
+    if (!pull_record(source, ec))
+      return !ec;
+
+    switch (record_[0]) {
+      case COMPRESSION_RECORD_RAW: {
+        // The peer starts compressing from scratch after every uncompressed
+        // chunk, so we do the same
+        codec_.reset_decompressor();
+        output_.assign(record_.begin() + COMPRESSION_RECORD_HEADER_SIZE, record_.begin() + record_fill_);
+        record_fill_ = 0;
+        break;
+      }
+      case COMPRESSION_RECORD_ZSTD: {
+        if (!compression_codec::supported()) {
+          ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+          return false;
+        }
+
+        record_active_ = true;
+        record_more_ = false;
+        record_pos_ = COMPRESSION_RECORD_HEADER_SIZE;
+        break;
+      }
+      default: {
+        ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_FEC_LAYER_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_FEC_LAYER_IPP
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <utility>
+
+namespace curvecp {
+
+namespace detail {
+
+#define FEC_REPAIR_TRAILER 0x80
+#define FEC_REPAIR_HEADER_SIZE 10
+
+fec_layer::fec_layer(send_handler send, rebuild_handler rebuild)
+  : send_handler_(send),
+    rebuild_handler_(rebuild),
+    data_blocks_(0),
+    repair_blocks_(0),
+    window_(512),
+    group_offset_(0),
+    counters_()
+{
+}
+
+void fec_layer::configure(std::size_t data_blocks, std::size_t repair_blocks)
+{
+  // The limits are copied, as binding them to references would require
+  // out-of-class definitions
+  data_blocks_ = std::min(std::max<std::size_t>(data_blocks, 1), std::size_t(fec_codec::maximum_data_blocks));
+  repair_blocks_ = std::min(repair_blocks, std::size_t(fec_codec::maximum_repair_blocks));
+  group_lengths_.clear();
+  repairs_.assign(repair_blocks_ * sizeof(curvecpr_block::data), 0);
+
+  if (repair_blocks_ == 0) {
+    received_.clear();
+    received_order_.clear();
+    pending_.clear();
+  }
+}
+
+bool fec_layer::is_repair(const unsigned char *buf, std::size_t num)
+{
+  // Repairs use trailers with the high bit set
+  return (buf[num - 1] & FEC_REPAIR_TRAILER) != 0;
+}
+
+void fec_layer::protect(const curvecpr_block &block)
+{
+  // Groups are identified by the offset of their first block, so a block
+  // that does not continue the group closes it early
+  std::uint64_t end = group_offset_;
+  for (std::uint16_t length : group_lengths_)
+    end += length;
+  if (!group_lengths_.empty() && block.offset != end)
+    close_group();
+
+  if (group_lengths_.empty()) {
+    group_offset_ = block.offset;
+    std::fill(repairs_.begin(), repairs_.end(), 0);
+  }
+
+  // Repairs are updated as blocks are sent, so closing a group only needs
+  // to frame them
+  std::size_t index = group_lengths_.size();
+  for (std::size_t j = 0; j < repair_blocks_; j++) {
+    fec_codec::multiply_add(&repairs_[j * sizeof(block.data)], block.data,
+      fec_codec::coefficient(j, index), block.data_len);
+  }
+
+  group_lengths_.push_back(static_cast<std::uint16_t>(block.data_len));
+  if (group_lengths_.size() >= data_blocks_)
+    close_group();
+}
+
+void fec_layer::close_group()
+{
+  if (group_lengths_.empty())
+    return;
+
+  // Each repair is framed like a datagram, followed by a trailer that also
+  // has the high bit set: the group offset, the number of blocks and the
+  // index of the repair, the lengths of the blocks and then the repair
+  // itself, which is as long as the longest block
+  std::size_t count = group_lengths_.size();
+  std::size_t length = *std::max_element(group_lengths_.begin(), group_lengths_.end());
+  unsigned char frame[FEC_REPAIR_HEADER_SIZE + 2 * fec_codec::maximum_data_blocks + sizeof(curvecpr_block::data) + 2];
+
+  for (std::size_t j = 0; j < repair_blocks_; j++) {
+    std::size_t size = 0;
+    for (int shift = 56; shift >= 0; shift -= 8)
+      frame[size++] = static_cast<unsigned char>(group_offset_ >> shift);
+    frame[size++] = static_cast<unsigned char>(count);
+    frame[size++] = static_cast<unsigned char>(j);
+    for (std::uint16_t block_length : group_lengths_) {
+      frame[size++] = static_cast<unsigned char>(block_length >> 8);
+      frame[size++] = static_cast<unsigned char>(block_length);
+    }
+
+    std::memcpy(frame + size, &repairs_[j * sizeof(curvecpr_block::data)], length);
+    size += length;
+
+    if ((size + 1) & 15) {
+      frame[size++] = FEC_REPAIR_TRAILER | 1;
+    } else {
+      frame[size++] = 0;
+      frame[size++] = FEC_REPAIR_TRAILER | 2;
+    }
+
+    send_handler_(frame, size);
+    counters_.repairs_sent++;
+  }
+
+  group_lengths_.clear();
+}
+
+int fec_layer::receive_repair(const unsigned char *buf, std::size_t num, std::uint64_t distributed)
+{
+  std::size_t trailer = buf[num - 1] & ~FEC_REPAIR_TRAILER;
+  if (trailer < 1 || trailer > 2 || num < FEC_REPAIR_HEADER_SIZE + trailer)
+    return -1;
+
+  num -= trailer;
+  counters_.repairs_received++;
+  if (repair_blocks_ == 0)
+    return 0;
+
+  repair received;
+  received.offset = 0;
+  for (std::size_t i = 0; i < 8; i++)
+    received.offset = (received.offset << 8) | buf[i];
+  received.index = buf[9];
+
+  std::size_t count = buf[8];
+  if (count == 0 || count > fec_codec::maximum_data_blocks || received.index >= fec_codec::maximum_repair_blocks ||
+      num < FEC_REPAIR_HEADER_SIZE + 2 * count)
+    return -1;
+
+  std::size_t length = 0;
+  std::uint64_t end = received.offset;
+  for (std::size_t i = 0; i < count; i++) {
+    std::uint16_t block_length = (buf[FEC_REPAIR_HEADER_SIZE + 2 * i] << 8) | buf[FEC_REPAIR_HEADER_SIZE + 2 * i + 1];
+    if (block_length == 0 || block_length > sizeof(curvecpr_block::data))
+      return -1;
+
+    received.lengths.push_back(block_length);
+    length = std::max<std::size_t>(length, block_length);
+    end += block_length;
+  }
+
+  const unsigned char *data = buf + FEC_REPAIR_HEADER_SIZE + 2 * count;
+  if (num != FEC_REPAIR_HEADER_SIZE + 2 * count + length)
+    return -1;
+
+  // Repairs of groups that have already been read are of no use
+  if (end <= distributed)
+    return 0;
+
+  // Repairs are no longer than blocks, so as many of them are kept as
+  // copies of blocks
+  received.data.assign(data, data + length);
+  if (pending_.size() >= received_maximum())
+    pending_.pop_front();
+  pending_.push_back(std::move(received));
+
+  return static_cast<int>(rebuild_group(pending_.back().offset, distributed));
+}
+
+std::size_t fec_layer::remember(const curvecpr_block &block, std::uint64_t distributed)
+{
+  if (repair_blocks_ == 0 || block.data_len == 0 || block.eof != CURVECPR_BLOCK_STREAM ||
+      received_.count(block.offset))
+    return 0;
+
+  // Keep copies of recent blocks, which are needed to rebuild the other
+  // blocks of their groups. Groups that lose a copy can not be rebuilt, so
+  // their repairs are dropped as well
+  while (received_order_.size() >= received_maximum()) {
+    received_.erase(received_order_.front());
+    forget_groups(received_order_.front());
+    received_order_.pop_front();
+  }
+
+  received_[block.offset].assign(block.data, block.data + block.data_len);
+  received_order_.push_back(block.offset);
+
+  // Waiting repairs of the group of this block may now suffice
+  std::set<std::uint64_t> groups;
+  for (const repair &r : pending_) {
+    std::uint64_t end = r.offset;
+    for (std::uint16_t length : r.lengths)
+      end += length;
+
+    if (block.offset >= r.offset && block.offset < end)
+      groups.insert(r.offset);
+  }
+
+  std::size_t rebuilt = 0;
+  for (std::uint64_t offset : groups)
+    rebuilt += rebuild_group(offset, distributed);
+  return rebuilt;
+}
+
+void fec_layer::clear()
+{
+  group_lengths_.clear();
+  received_.clear();
+  received_order_.clear();
+  pending_.clear();
+}
+
+std::size_t fec_layer::received_maximum() const
+{
+  // Repairs of a group are sent after its last block, so copies are needed
+  // for every group in flight: those covering the send window and partial
+  // ones at both of its ends. The group size of the peer is not known, so
+  // the largest one is assumed
+  std::size_t group = fec_codec::maximum_data_blocks;
+  return (window_ / group + 2) * group;
+}
+
+void fec_layer::forget_groups(std::uint64_t offset)
+{
+  pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+    [offset](const repair &r) {
+      std::uint64_t end = r.offset;
+      for (std::uint16_t length : r.lengths)
+        end += length;
+
+      return offset >= r.offset && offset < end;
+    }), pending_.end());
+}
+
+std::size_t fec_layer::rebuild_group(std::uint64_t offset, std::uint64_t distributed)
+{
+  // Collect distinct repairs of the group
+  std::vector<const repair*> repairs;
+  for (const repair &r : pending_) {
+    if (r.offset != offset)
+      continue;
+    if (!repairs.empty() && r.lengths != repairs.front()->lengths)
+      continue;
+    if (std::none_of(repairs.begin(), repairs.end(), [&](const repair *other) { return other->index == r.index; }))
+      repairs.push_back(&r);
+  }
+
+  if (repairs.empty())
+    return 0;
+
+  // Find the blocks of the group that are missing and still needed
+  std::vector<std::uint16_t> lengths = repairs.front()->lengths;
+  std::vector<std::uint64_t> offsets;
+  std::vector<std::size_t> missing;
+  std::uint64_t position = offset;
+  bool needed = false;
+
+  for (std::size_t i = 0; i < lengths.size(); i++) {
+    auto it = received_.find(position);
+    if (it == received_.end() || it->second.size() != lengths[i]) {
+      missing.push_back(i);
+      if (position + lengths[i] > distributed)
+        needed = true;
+    }
+
+    offsets.push_back(position);
+    position += lengths[i];
+  }
+
+  auto forget = [this, offset]() {
+    pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+      [offset](const repair &r) { return r.offset == offset; }), pending_.end());
+  };
+
+  if (!needed) {
+    forget();
+    return 0;
+  } else if (missing.size() > repairs.size()) {
+    return 0;
+  }
+
+  // Subtract the received blocks from the repairs, which leaves linear
+  // combinations of the missing blocks, and solve for them
+  std::size_t m = missing.size();
+  std::vector<std::vector<unsigned char>> syndromes(m);
+  std::vector<unsigned char> matrix(m * m);
+
+  for (std::size_t r = 0; r < m; r++) {
+    syndromes[r] = repairs[r]->data;
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < lengths.size(); i++) {
+      if (next < m && missing[next] == i) {
+        matrix[r * m + next] = fec_codec::coefficient(repairs[r]->index, i);
+        next++;
+        continue;
+      }
+
+      fec_codec::multiply_add(&syndromes[r][0], &received_[offsets[i]][0],
+        fec_codec::coefficient(repairs[r]->index, i), lengths[i]);
+    }
+  }
+
+  forget();
+  if (!fec_codec::invert(matrix, m))
+    return 0;
+
+  std::size_t rebuilt = 0;
+  for (std::size_t c = 0; c < m; c++) {
+    std::size_t i = missing[c];
+    if (offsets[i] + lengths[i] <= distributed)
+      continue;
+
+    curvecpr_block block = curvecpr_block();
+    block.offset = offsets[i];
+    block.data_len = lengths[i];
+    block.eof = CURVECPR_BLOCK_STREAM;
+    for (std::size_t r = 0; r < m; r++)
+      fec_codec::multiply_add(block.data, &syndromes[r][0], matrix[c * m + r], lengths[i]);
+
+    // Rebuilt blocks are queued like received ones, so they are also
+    // acknowledged and the sender does not have to retransmit them
+    if (!rebuild_handler_(block))
+      continue;
+
+    counters_.blocks_rebuilt++;
+    rebuilt += 1 + remember(block, distributed);
+  }
+
+  return rebuilt;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_LOOPBACK_TRANSPORT_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_LOOPBACK_TRANSPORT_IPP
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <utility>
+
+namespace curvecp {
+
+namespace detail {
+
+void loopback_network::attach(const transport::endpoint_type &endpoint, loopback_transport *transport)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (transports_.find(endpoint) != transports_.end())
+    throw boost::system::system_error(boost::asio::error::address_in_use);
+
+  transports_[endpoint] = transport;
+}
+
+transport::endpoint_type loopback_network::attach_ephemeral(loopback_transport *transport)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (unsigned int i = 0; i < 16384; i++) {
+    transport::endpoint_type endpoint(boost::asio::ip::udp::endpoint(
+      boost::asio::ip::address_v4::loopback(), next_port_));
+    next_port_ = next_port_ == 65535 ? 49152 : next_port_ + 1;
+
+    if (transports_.find(endpoint) == transports_.end()) {
+      transports_[endpoint] = transport;
+      return endpoint;
+    }
+  }
+
+  throw boost::system::system_error(boost::asio::error::address_in_use);
+}
+
+void loopback_network::detach(const transport::endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  transports_.erase(endpoint);
+}
+
+void loopback_network::deliver(const transport::endpoint_type &source,
+                               const transport::endpoint_type &destination,
+                               const boost::asio::const_buffer &buffer)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = transports_.find(destination);
+  if (it == transports_.end())
+    return;
+
+  it->second->enqueue(source, buffer);
+}
+
+loopback_transport::loopback_transport(boost::asio::io_context &service, loopback_network &network)
+  : service_(service),
+    network_(network),
+    attached_(false),
+    connected_(false),
+    receive_queue_(service, 1024)
+{
+}
+
+loopback_transport::~loopback_transport()
+{
+  close();
+}
+
+void loopback_transport::bind(const endpoint_type &endpoint)
+{
+  // The network lock is always acquired before the transport lock, so the
+  // network must not be called while holding the transport lock
+  network_.attach(endpoint, this);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (attached_) {
+    lock.unlock();
+    network_.detach(endpoint);
+    throw boost::system::system_error(boost::asio::error::invalid_argument);
+  }
+
+  local_ = endpoint;
+  attached_ = true;
+}
+
+void loopback_transport::connect(const endpoint_type &endpoint)
+{
+  ensure_attached();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  remote_ = endpoint;
+  connected_ = true;
+}
+
+void loopback_transport::close()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool detach = attached_;
+  attached_ = false;
+  connected_ = false;
+  lock.unlock();
+
+  // After detaching, no further datagrams can be delivered to this transport
+  // so nothing can be queued after the queue is cancelled
+  if (detach)
+    network_.detach(local_);
+
+  receive_queue_.cancel();
+}
+
+loopback_transport::endpoint_type loopback_transport::local_endpoint() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  return local_;
+}
+
+void loopback_transport::async_receive(const boost::asio::mutable_buffer &buffer,
+                                       handler_type handler)
+{
+  async_receive_from(buffer, connected_sender_, std::move(handler));
+}
+
+void loopback_transport::async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                            endpoint_type &sender,
+                                            handler_type handler)
+{
+  ensure_attached();
+  receive_queue_.async_receive_from(buffer, sender, std::move(handler));
+}
+
+std::size_t loopback_transport::try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                                 endpoint_type &sender,
+                                                 boost::system::error_code &ec)
+{
+  return receive_queue_.try_receive_from(buffer, sender, ec);
+}
+
+void loopback_transport::async_send(const boost::asio::const_buffer &buffer,
+                                    handler_type handler)
+{
+  endpoint_type destination;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    destination = remote_;
+  }
+
+  async_send_to(buffer, destination, std::move(handler));
+}
+
+void loopback_transport::async_send_to(const boost::asio::const_buffer &buffer,
+                                       const endpoint_type &destination,
+                                       handler_type handler)
+{
+  ensure_attached();
+
+  endpoint_type source;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    source = local_;
+  }
+
+  // The datagram is copied on delivery, so the operation completes at once
+  network_.deliver(source, destination, buffer);
+  post_transport_handler(service_, std::move(handler), boost::system::error_code(), boost::asio::buffer_size(buffer));
+}
+
+void loopback_transport::enqueue(const endpoint_type &source, const boost::asio::const_buffer &buffer)
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (connected_ && source != remote_)
+      return;
+  }
+
+  receive_queue_.push(source, buffer);
+}
+
+void loopback_transport::ensure_attached()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (attached_)
+      return;
+  }
+
+  // Like an unbound UDP socket, pick an ephemeral address on first use
+  endpoint_type endpoint = network_.attach_ephemeral(this);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (attached_) {
+    // Lost a race with a concurrent attach
+    lock.unlock();
+    network_.detach(endpoint);
+    return;
+  }
+
+  local_ = endpoint;
+  attached_ = true;
+}
+
+}
+
+}
+
+#endif
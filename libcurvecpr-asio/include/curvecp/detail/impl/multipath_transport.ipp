@@ -0,0 +1,624 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_MULTIPATH_TRANSPORT_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_MULTIPATH_TRANSPORT_IPP
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+namespace curvecp {
+
+namespace detail {
+
+// Probes start with a magic that no CurveCP packet starts with, followed by
+// the probe type, the group identifier of the sender and a random token
+static const char multipath_probe_magic[7] = { 'M', 'p', 'a', 't', 'h', 'P', 'r' };
+static const unsigned char multipath_probe_request = 'Q';
+static const unsigned char multipath_probe_answer = 'A';
+
+multipath_transport::multipath_transport(boost::asio::io_context &service)
+  : service_(service),
+    learned_(0),
+    random_((static_cast<std::uint64_t>(std::random_device()()) << 32) | std::random_device()()),
+    started_(false),
+    connected_(false),
+    probe_interval_(boost::posix_time::milliseconds(100)),
+    path_timeout_(boost::posix_time::seconds(1)),
+    probe_timer_(service),
+    receive_queue_(service, 1024)
+{
+  group_ = random_() | 1;
+}
+
+multipath_transport::~multipath_transport()
+{
+  close();
+}
+
+std::size_t multipath_transport::add_path(boost::shared_ptr<transport> path)
+{
+  return add_path(path, endpoint_type());
+}
+
+std::size_t multipath_transport::add_path(boost::shared_ptr<transport> path, const endpoint_type &remote)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (started_)
+    throw boost::system::system_error(boost::asio::error::already_started);
+
+  path_state state;
+  state.transport = path;
+  state.has_remote = remote != endpoint_type();
+  state.remote = remote;
+  state.buffer.resize(path->maximum_datagram_size());
+  paths_.push_back(state);
+  return paths_.size() - 1;
+}
+
+void multipath_transport::set_probe_interval(const boost::posix_time::time_duration &interval)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  probe_interval_ = interval;
+}
+
+void multipath_transport::set_path_timeout(const boost::posix_time::time_duration &timeout)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  path_timeout_ = timeout;
+}
+
+std::vector<multipath_transport::path_statistics> multipath_transport::get_path_statistics() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<path_statistics> statistics;
+  for (const auto &target : targets_) {
+    const target_state &state = target.second;
+    statistics.push_back(path_statistics{ target.first.second, target.first.first,
+      boost::posix_time::microseconds(state.srtt), state.loss, state.up, state.sent, state.received });
+  }
+
+  return statistics;
+}
+
+void multipath_transport::bind(const endpoint_type &endpoint)
+{
+  if (paths_.empty())
+    throw boost::system::system_error(boost::asio::error::invalid_argument);
+
+  paths_.front().transport->bind(endpoint);
+}
+
+void multipath_transport::connect(const endpoint_type &endpoint)
+{
+  if (paths_.empty())
+    throw boost::system::system_error(boost::asio::error::invalid_argument);
+
+  for (path_state &path : paths_)
+    path.transport->connect(path.has_remote ? path.remote : endpoint);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    connected_ = true;
+
+    std::int64_t time = now();
+    for (std::size_t i = 0; i < paths_.size(); i++) {
+      target_key key(paths_[i].has_remote ? paths_[i].remote : endpoint, i);
+      if (targets_.find(key) == targets_.end())
+        add_target(key, true, false, time);
+    }
+  }
+
+  start();
+}
+
+void multipath_transport::open(const endpoint_type &endpoint)
+{
+  if (paths_.empty())
+    throw boost::system::system_error(boost::asio::error::invalid_argument);
+
+  for (path_state &path : paths_)
+    path.transport->open(path.has_remote ? path.remote : endpoint);
+
+  start();
+}
+
+void multipath_transport::close()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    started_ = false;
+    connected_ = false;
+    probe_timer_.cancel();
+  }
+
+  for (path_state &path : paths_)
+    path.transport->close();
+
+  receive_queue_.cancel();
+}
+
+multipath_transport::endpoint_type multipath_transport::local_endpoint() const
+{
+  if (paths_.empty())
+    return endpoint_type();
+
+  return paths_.front().transport->local_endpoint();
+}
+
+void multipath_transport::async_receive(const boost::asio::mutable_buffer &buffer,
+                                        handler_type handler)
+{
+  start();
+  receive_queue_.async_receive_from(buffer, connected_sender_, std::move(handler));
+}
+
+void multipath_transport::async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                             endpoint_type &sender,
+                                             handler_type handler)
+{
+  start();
+  receive_queue_.async_receive_from(buffer, sender, std::move(handler));
+}
+
+std::size_t multipath_transport::try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                                  endpoint_type &sender,
+                                                  boost::system::error_code &ec)
+{
+  return receive_queue_.try_receive_from(buffer, sender, ec);
+}
+
+std::size_t multipath_transport::maximum_datagram_size() const
+{
+  std::size_t maximum = 0;
+  for (const path_state &path : paths_)
+    maximum = std::max(maximum, path.buffer.size());
+
+  return paths_.empty() ? transport::maximum_datagram_size() : maximum;
+}
+
+void multipath_transport::async_send(const boost::asio::const_buffer &buffer,
+                                     handler_type handler)
+{
+  target_key key;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<target_key> candidates;
+    for (const auto &target : targets_) {
+      if (target.second.connected)
+        candidates.push_back(target.first);
+    }
+
+    auto it = pick(candidates);
+    if (it == targets_.end()) {
+      post_transport_handler(service_, std::move(handler),
+        boost::system::error_code(boost::asio::error::not_connected), 0);
+      return;
+    }
+
+    key = it->first;
+  }
+
+  send_via(key, true, buffer, std::move(handler));
+}
+
+void multipath_transport::async_send_to(const boost::asio::const_buffer &buffer,
+                                        const endpoint_type &destination,
+                                        handler_type handler)
+{
+  target_key key(destination, 0);
+  bool connected = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = targets_.lower_bound(key);
+    if (it != targets_.end() && it->first.first == destination) {
+      // Datagrams to any endpoint of a peer with several paths are spread
+      // over all of its paths
+      auto chosen = targets_.end();
+      if (it->second.group)
+        chosen = pick(groups_[it->second.group]);
+      if (chosen == targets_.end()) {
+        chosen = it;
+        chosen->second.sent++;
+      }
+
+      key = chosen->first;
+      connected = chosen->second.connected;
+    } else {
+      // Unknown endpoints are answered over the path they were heard on
+      auto route = routes_.find(destination);
+      if (route != routes_.end())
+        key.second = route->second;
+    }
+  }
+
+  send_via(key, connected, buffer, std::move(handler));
+}
+
+void multipath_transport::start()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (started_ || paths_.empty())
+      return;
+
+    started_ = true;
+
+    // The first probes are sent right away, so that path estimates are
+    // available after the first round trip
+    probe_timer_.expires_from_now(boost::posix_time::time_duration());
+    probe_timer_.async_wait(boost::bind(&multipath_transport::handle_probe_timer,
+      boost::weak_ptr<multipath_transport>(shared_from_this()), boost::asio::placeholders::error));
+  }
+
+  for (std::size_t i = 0; i < paths_.size(); i++)
+    start_receive(i);
+}
+
+void multipath_transport::start_receive(std::size_t index)
+{
+  path_state &path = paths_[index];
+  path.transport->async_receive_from(
+    boost::asio::buffer(path.buffer),
+    path.sender,
+    boost::bind(&multipath_transport::handle_receive, boost::weak_ptr<multipath_transport>(shared_from_this()),
+      index, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
+  );
+}
+
+void multipath_transport::handle_receive(boost::weak_ptr<multipath_transport> weak,
+                                         std::size_t index,
+                                         const boost::system::error_code &error,
+                                         std::size_t bytes)
+{
+  boost::shared_ptr<multipath_transport> self = weak.lock();
+  if (!self || error == boost::asio::error::operation_aborted || error == boost::asio::error::bad_descriptor)
+    return;
+
+  path_state &path = self->paths_[index];
+  if (!error)
+    self->process(index, bytes);
+
+  // Drain datagrams that are already waiting so that a burst is handled
+  // with a single reactor round trip
+  for (int i = 0; i < 32; i++) {
+    boost::system::error_code ec;
+    std::size_t length = path.transport->try_receive_from(boost::asio::buffer(path.buffer), path.sender, ec);
+    if (ec)
+      break;
+
+    self->process(index, length);
+  }
+
+  self->start_receive(index);
+}
+
+void multipath_transport::process(std::size_t index, std::size_t length)
+{
+  path_state &path = paths_[index];
+  if (length == probe_size && std::memcmp(&path.buffer[0], multipath_probe_magic, sizeof(multipath_probe_magic)) == 0) {
+    handle_probe(index, path.sender, &path.buffer[0]);
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = targets_.find(target_key(path.sender, index));
+    if (it != targets_.end()) {
+      it->second.received++;
+      it->second.last_heard = now();
+    } else if (!connected_) {
+      // Remember the path, so that replies leave from the address the
+      // sender talked to
+      auto route = routes_.find(path.sender);
+      if (route == routes_.end()) {
+        routes_[path.sender] = index;
+        route_order_.push_back(path.sender);
+        if (route_order_.size() > maximum_routes) {
+          routes_.erase(route_order_.front());
+          route_order_.pop_front();
+        }
+      } else {
+        route->second = index;
+      }
+    }
+  }
+
+  receive_queue_.push(path.sender, boost::asio::buffer(&path.buffer[0], length));
+}
+
+void multipath_transport::handle_probe(std::size_t index, const endpoint_type &source,
+                                       const unsigned char *data)
+{
+  std::uint64_t group = 0;
+  std::uint64_t token = 0;
+  for (int i = 0; i < 8; i++) {
+    group = (group << 8) | data[8 + i];
+    token = (token << 8) | data[16 + i];
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::int64_t time = now();
+  target_key key(source, index);
+  auto it = targets_.find(key);
+
+  if (data[7] == multipath_probe_request) {
+    // Unconnected transports learn the endpoints of peers with several
+    // paths; they are only used once they have answered a probe of ours
+    if (!connected_ && group) {
+      if (it == targets_.end() && learned_ < maximum_learned_targets) {
+        add_target(key, false, true, time).group = group;
+        groups_[group].push_back(key);
+      } else if (it != targets_.end() && it->second.learned && it->second.group != group) {
+        std::vector<target_key> &members = groups_[it->second.group];
+        members.erase(std::remove(members.begin(), members.end(), key), members.end());
+        if (members.empty())
+          groups_.erase(it->second.group);
+
+        it->second.group = group;
+        groups_[group].push_back(key);
+      }
+    }
+
+    it = targets_.find(key);
+    if (it != targets_.end())
+      it->second.last_heard = time;
+
+    bool connected = connected_;
+    lock.unlock();
+    send_probe(index, source, connected, multipath_probe_answer, token);
+    return;
+  } else if (data[7] != multipath_probe_answer || it == targets_.end()) {
+    return;
+  }
+
+  target_state &target = it->second;
+  auto probe = std::find_if(target.probes.begin(), target.probes.end(),
+    [token](const probe_record &record) { return record.token == token; });
+  if (probe == target.probes.end())
+    return;
+
+  // Update the round-trip time estimate as in RFC 6298
+  std::int64_t sample = std::max<std::int64_t>(time - probe->sent, 1);
+  target.probes.erase(probe);
+  if (!target.srtt) {
+    target.srtt = sample;
+    target.rttvar = sample / 2;
+  } else {
+    target.rttvar = (3 * target.rttvar + std::abs(target.srtt - sample)) / 4;
+    target.srtt = (7 * target.srtt + sample) / 8;
+  }
+
+  target.loss *= 0.875;
+  target.unanswered = 0;
+  target.last_answer = time;
+  target.last_heard = time;
+  target.validated = true;
+  if (!target.up)
+    resume(key, target);
+}
+
+void multipath_transport::handle_probe_timer(boost::weak_ptr<multipath_transport> weak,
+                                             const boost::system::error_code &error)
+{
+  boost::shared_ptr<multipath_transport> self = weak.lock();
+  if (!self || error)
+    return;
+
+  self->schedule_probes();
+}
+
+void multipath_transport::schedule_probes()
+{
+  struct probe {
+    target_key key;
+    bool connected;
+    std::uint64_t token;
+  };
+  std::vector<probe> probes;
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!started_)
+      return;
+
+    std::int64_t time = now();
+    std::int64_t interval = probe_interval_.total_microseconds();
+    std::int64_t timeout = path_timeout_.total_microseconds();
+
+    for (auto it = targets_.begin(); it != targets_.end();) {
+      target_state &target = it->second;
+
+      // Probes are lost when they are not answered within the retransmission
+      // timeout of the path, or within the path timeout until it is known
+      std::int64_t rto = target.srtt ? std::max(target.srtt + 4 * target.rttvar, interval) : std::max(timeout, interval);
+      while (!target.probes.empty() && time - target.probes.front().sent > rto) {
+        target.probes.pop_front();
+        target.loss = target.loss * 0.875 + 0.125;
+        target.unanswered++;
+      }
+
+      if (target.up && time - target.last_answer > timeout)
+        target.up = false;
+
+      // Learned endpoints that never answered or went silent are forgotten
+      if (target.learned && ((!target.validated && target.unanswered >= 3) || time - target.last_heard > 10 * timeout)) {
+        it = erase_target(it);
+        continue;
+      }
+
+      if (target.probes.size() >= maximum_probes)
+        target.probes.pop_front();
+
+      std::uint64_t token = random_();
+      target.probes.push_back(probe_record{ token, time });
+      probes.push_back(probe{ it->first, target.connected, token });
+      ++it;
+    }
+
+    probe_timer_.expires_from_now(probe_interval_);
+    probe_timer_.async_wait(boost::bind(&multipath_transport::handle_probe_timer,
+      boost::weak_ptr<multipath_transport>(shared_from_this()), boost::asio::placeholders::error));
+  }
+
+  for (const probe &p : probes)
+    send_probe(p.key.second, p.key.first, p.connected, multipath_probe_request, p.token);
+}
+
+void multipath_transport::send_probe(std::size_t path, const endpoint_type &remote, bool connected,
+                                     unsigned char type, std::uint64_t token)
+{
+  boost::shared_ptr<std::array<unsigned char, probe_size>> probe(
+    boost::make_shared<std::array<unsigned char, probe_size>>());
+  std::memcpy(&(*probe)[0], multipath_probe_magic, sizeof(multipath_probe_magic));
+  (*probe)[7] = type;
+  for (int i = 0; i < 8; i++) {
+    (*probe)[8 + i] = static_cast<unsigned char>(group_ >> (56 - 8 * i));
+    (*probe)[16 + i] = static_cast<unsigned char>(token >> (56 - 8 * i));
+  }
+  std::memset(&(*probe)[24], 0, probe_size - 24);
+
+  auto handler = [probe](const boost::system::error_code&, std::size_t) {};
+  if (connected)
+    paths_[path].transport->async_send(boost::asio::buffer(*probe), handler);
+  else
+    paths_[path].transport->async_send_to(boost::asio::buffer(*probe), remote, handler);
+}
+
+multipath_transport::target_state &multipath_transport::add_target(const target_key &key, bool connected,
+                                                                    bool learned, std::int64_t now)
+{
+  target_state &target = targets_[key];
+  target.connected = connected;
+  target.learned = learned;
+  target.validated = !learned;
+  target.up = !learned;
+  target.group = 0;
+  target.srtt = 0;
+  target.rttvar = 0;
+  target.loss = 0.0;
+  target.pass = 0.0;
+  target.last_answer = now;
+  target.last_heard = now;
+  target.unanswered = 0;
+  target.sent = 0;
+  target.received = 0;
+  if (learned)
+    learned_++;
+
+  return target;
+}
+
+std::map<multipath_transport::target_key, multipath_transport::target_state>::iterator
+multipath_transport::erase_target(std::map<target_key, target_state>::iterator it)
+{
+  if (it->second.group) {
+    std::vector<target_key> &members = groups_[it->second.group];
+    members.erase(std::remove(members.begin(), members.end(), it->first), members.end());
+    if (members.empty())
+      groups_.erase(it->second.group);
+  }
+
+  if (it->second.learned)
+    learned_--;
+
+  return targets_.erase(it);
+}
+
+void multipath_transport::resume(const target_key &key, target_state &target)
+{
+  // A path that comes up joins at the virtual time of the busiest path
+  // that is still up, so that it does not take all traffic until it has
+  // caught up with the others
+  bool found = false;
+  double pass = 0.0;
+  auto consider = [&](const target_key &other) {
+    auto it = targets_.find(other);
+    if (other == key || it == targets_.end() || !it->second.up)
+      return;
+
+    pass = found ? std::min(pass, it->second.pass) : it->second.pass;
+    found = true;
+  };
+
+  if (target.connected) {
+    for (const auto &other : targets_) {
+      if (other.second.connected)
+        consider(other.first);
+    }
+  } else if (target.group) {
+    for (const target_key &other : groups_[target.group])
+      consider(other);
+  }
+
+  target.up = true;
+  if (found)
+    target.pass = pass;
+}
+
+std::map<multipath_transport::target_key, multipath_transport::target_state>::iterator
+multipath_transport::pick(const std::vector<target_key> &candidates)
+{
+  // Prefer paths that are up; when all of them are down any path is used,
+  // so that the session can recover as soon as one of them does
+  auto best = targets_.end();
+  std::int64_t fastest = 0;
+  for (int pass = 0; pass < 2 && best == targets_.end(); pass++) {
+    for (const target_key &key : candidates) {
+      auto it = targets_.find(key);
+      if (it == targets_.end() || !it->second.validated || (pass == 0 && !it->second.up))
+        continue;
+
+      if (it->second.srtt && (!fastest || it->second.srtt < fastest))
+        fastest = it->second.srtt;
+      if (best == targets_.end() || it->second.pass < best->second.pass)
+        best = it;
+    }
+  }
+
+  if (best == targets_.end())
+    return best;
+
+  // Advance the virtual time of the chosen path by the inverse of its
+  // weight; paths that have not been measured yet count as the fastest
+  target_state &target = best->second;
+  std::int64_t rtt = target.srtt ? target.srtt : (fastest ? fastest : 1000);
+  double delivery = 1.0 - std::min(target.loss, 0.99);
+  target.pass += static_cast<double>(rtt) / (delivery * delivery);
+  target.sent++;
+  return best;
+}
+
+void multipath_transport::send_via(const target_key &key, bool connected,
+                                   const boost::asio::const_buffer &buffer, handler_type handler)
+{
+  if (connected)
+    paths_[key.second].transport->async_send(buffer, std::move(handler));
+  else
+    paths_[key.second].transport->async_send_to(buffer, key.first, std::move(handler));
+}
+
+std::int64_t multipath_transport::now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+}
+
+#endif
@@ -20,9 +20,22 @@ namespace detail {
 #define RECVMARKQ_ELEMENT_ACKNOWLEDGED (1 << 1)
 #define RECVMARKQ_ELEMENT_DONE (RECVMARKQ_ELEMENT_DISTRIBUTED | RECVMARKQ_ELEMENT_ACKNOWLEDGED)
 
-session::session(boost::asio::io_service &service,
+#define UNORDERED_BLOCK_CONTINUATION 0
+#define UNORDERED_BLOCK_START 1
+#define UNORDERED_BLOCK_START_SIZE 5
+
+#define SESSION_HELLO_MAGIC "\x89" "CPHELLO"
+#define SESSION_HELLO_MAGIC_SIZE 8
+#define SESSION_HELLO_SIZE 10
+#define SESSION_FEATURE_DATAGRAMS 1
+#define SESSION_FEATURE_REPAIRS 2
+#define SESSION_FEATURE_RECORDS 4
+
+#define COMPRESSION_CODEC_ZSTD 1
+
+session::session(boost::asio::io_context &service,
                  type session_type)
-  : strand_(service),
+  : strand_(service.get_executor()),
     pending_maximum_(65536),
     sendmarkq_maximum_(512),
     recvmarkq_maximum_(512),
@@ -34,12 +47,28 @@ session::session(boost::asio::io_service &service,
     sendq_head_exists_(false),
     recvmarkq_distributed_(0),
     recvmarkq_read_offset_(0),
+    recvmarkq_eof_(UINT64_MAX),
+    unordered_messages_(false),
+    pending_message_sent_(0),
+    multiplexed_(false),
+    substreams_(session_type == session::type::client),
+    datagram_queue_maximum_(64),
+    datagram_counters_(),
+    datagrams_enabled_(false),
+    stream_started_(false),
+    peer_hello_received_(false),
+    peer_features_(0),
+    fec_([this](const unsigned char *buf, std::size_t num) { lower_send_handler_(buf, num); },
+         [this](const curvecpr_block &block) { return queue_rebuilt_block(block); }),
+    compression_records_(false),
+    compression_peer_codecs_(0),
     send_queue_timer_(service),
     pending_ready_read_(service),
     pending_ready_write_(service),
     pending_ready_close_(service),
     close_timer_(service),
-    running_(false)
+    running_(false),
+    closed_(false)
 {
   pending_ready_read_.expires_at(boost::posix_time::pos_infin);
   pending_ready_write_.expires_at(boost::posix_time::pos_infin);
@@ -78,16 +107,74 @@ void session::async_pending_wait(session::want what, BOOST_ASIO_MOVE_ARG(Handler
 {
   switch (what) {
     case session::want::nothing: return;
-    case session::want::read: pending_ready_read_.async_wait(strand_.wrap(handler)); break;
-    case session::want::write: pending_ready_write_.async_wait(strand_.wrap(handler)); break;
-    case session::want::close: pending_ready_close_.async_wait(strand_.wrap(handler)); break;
+    case session::want::read: pending_ready_read_.async_wait(boost::asio::bind_executor(strand_, BOOST_ASIO_MOVE_CAST(Handler)(handler))); break;
+    case session::want::write: pending_ready_write_.async_wait(boost::asio::bind_executor(strand_, BOOST_ASIO_MOVE_CAST(Handler)(handler))); break;
+    case session::want::close: pending_ready_close_.async_wait(boost::asio::bind_executor(strand_, BOOST_ASIO_MOVE_CAST(Handler)(handler))); break;
+  }
+}
+
+void session::cancel_pending_waits()
+{
+  boost::asio::dispatch(strand_, [this]() {
+    pending_ready_read_.cancel();
+    pending_ready_write_.cancel();
+    pending_ready_close_.cancel();
+  });
+}
+
+template <typename Function>
+typename std::result_of<Function()>::type session::invoke(Function function)
+{
+  if (strand_.running_in_this_thread())
+    return function();
+
+  std::packaged_task<typename std::result_of<Function()>::type()> task(function);
+  auto result = task.get_future();
+  boost::asio::dispatch(strand_, [&task]() { task(); });
+  return result.get();
+}
+
+template <typename Function>
+bool session::try_invoke(Function function)
+{
+  if (strand_.running_in_this_thread()) {
+    function();
+    return true;
   }
+
+  // Dispatching runs the function inline when the strand is free; when it
+  // has been queued instead, it is abandoned unless another thread has
+  // already started to execute it
+  enum { pending, running, done, abandoned };
+  boost::shared_ptr<std::atomic<int>> state(boost::make_shared<std::atomic<int>>(pending));
+  boost::asio::dispatch(strand_, [state, function]() mutable {
+    int expected = pending;
+    if (state->compare_exchange_strong(expected, running)) {
+      function();
+      state->store(done);
+    }
+  });
+
+  int expected = pending;
+  if (state->compare_exchange_strong(expected, abandoned))
+    return false;
+
+  while (state->load() != done)
+    std::this_thread::yield();
+  return true;
 }
 
 void session::start()
 {
-  running_ = true;
-  strand_.dispatch(boost::bind(&session::handle_process_send_queue, this, boost::system::error_code()));
+  // The flags are only accessed on the strand, so a late start can not race
+  // a close or revive a closed session
+  boost::asio::dispatch(strand_, [this]() {
+    if (running_ || closed_)
+      return;
+
+    running_ = true;
+    handle_process_send_queue(boost::system::error_code());
+  });
 }
 
 void session::handle_process_send_queue(const boost::system::error_code &error)
@@ -99,15 +186,26 @@ void session::handle_process_send_queue(const boost::system::error_code &error)
   if (messager_.my_final && messager_.their_final)
     return do_close(boost::system::error_code());
 
+  close_idle_group();
   reschedule_process_send_queue();
 }
 
+void session::close_idle_group()
+{
+  // Close an incomplete group of forward error correction once there is
+  // nothing more to send, so that its blocks are protected without delay
+  if (fec_.group_open() && handle_sendq_is_empty(&messager_))
+    fec_.close_group();
+}
+
 void session::reschedule_process_send_queue()
 {
   send_queue_timer_.expires_from_now(
     boost::posix_time::microseconds(curvecpr_messager_next_timeout(&messager_) / 1000)
   );
-  send_queue_timer_.async_wait(strand_.wrap(boost::bind(&session::handle_process_send_queue, this, _1)));
+  boost::shared_ptr<session> self(keep_alive());
+  send_queue_timer_.async_wait(boost::asio::bind_executor(strand_,
+    [this, self](const boost::system::error_code &error) { handle_process_send_queue(error); }));
 }
 
 void session::do_close(const boost::system::error_code &error)
@@ -129,7 +227,10 @@ void session::do_close(const boost::system::error_code &error)
   sendq_head_exists_ = false;
   recvmarkq_distributed_ = 0;
   recvmarkq_read_offset_ = 0;
+  recvmarkq_eof_ = UINT64_MAX;
+  pending_message_sent_ = 0;
   running_ = false;
+  closed_ = true;
 
   for (curvecpr_block *b : sendmarkq_)
     delete b;
@@ -138,6 +239,17 @@ void session::do_close(const boost::system::error_code &error)
 
   sendmarkq_.clear();
   recvmarkq_.clear();
+  recvmarkq_consumed_.clear();
+  pending_messages_.clear();
+  substreams_.clear();
+  datagrams_.clear();
+  stream_started_ = false;
+  peer_hello_received_ = false;
+  peer_features_ = 0;
+  fec_.clear();
+  compression_.clear();
+  compression_records_ = false;
+  compression_peer_codecs_ = 0;
 
   if (close_handler_)
     close_handler_();
@@ -173,26 +285,191 @@ bool session::close()
 
   // Start a close timer so that if we don't get ACKs we close anyway
   close_timer_.expires_from_now(boost::posix_time::seconds(5));
-  close_timer_.async_wait(strand_.wrap(boost::bind(&session::do_close, this, _1)));
+  boost::shared_ptr<session> self(keep_alive());
+  close_timer_.async_wait(boost::asio::bind_executor(strand_,
+    [this, self](const boost::system::error_code &error) { do_close(error); }));
 
   return false;
 }
 
+void session::expire()
+{
+  // Release all session state as if the close had completed and then mark
+  // the stream as finished so that waiting operations observe EOF
+  do_close(boost::system::error_code());
+  pending_eof_ = true;
+  pending_ready_read_.cancel();
+  pending_ready_write_.cancel();
+}
+
 int session::lower_receive(const unsigned char *buf, size_t num)
 {
   // Ensure that receive is initiated via the session strand
   if (!strand_.running_in_this_thread()) {
     boost::shared_ptr<std::vector<unsigned char>> data(boost::make_shared<std::vector<unsigned char>>(num));
     std::memcpy(&(*data)[0], buf, num);
-    strand_.dispatch([this, data]() {
-      curvecpr_messager_recv(&messager_, &(*data)[0], data->size());
+    boost::shared_ptr<session> self(keep_alive());
+    boost::asio::dispatch(strand_, [this, self, data]() {
+      lower_receive(&(*data)[0], data->size());
     });
     return 0;
   }
 
+  // Messager messages are always a multiple of 16 bytes long, so frames of
+  // any other length carry datagrams
+  if (num & 15)
+    return lower_receive_datagram(buf, num);
+
   return curvecpr_messager_recv(&messager_, buf, num);
 }
 
+bool session::hello_wanted() const
+{
+  return datagrams_enabled_ || fec_.enabled() || compressing();
+}
+
+void session::put_hello()
+{
+  // The hello is a block of its own, so that it can be recognized and
+  // consumed on arrival no matter how the rest of the stream is read
+  curvecpr_bytes_zero(&sendq_head_, sizeof(struct curvecpr_block));
+  std::memcpy(sendq_head_.data, SESSION_HELLO_MAGIC, SESSION_HELLO_MAGIC_SIZE);
+  sendq_head_.data[SESSION_HELLO_MAGIC_SIZE] =
+    (datagrams_enabled_ ? SESSION_FEATURE_DATAGRAMS : 0) | (fec_.enabled() ? SESSION_FEATURE_REPAIRS : 0) |
+    (compression_records_ ? SESSION_FEATURE_RECORDS : 0);
+  sendq_head_.data[SESSION_HELLO_MAGIC_SIZE + 1] =
+    compression_records_ && compression_codec::supported() ? COMPRESSION_CODEC_ZSTD : 0;
+  sendq_head_.data_len = SESSION_HELLO_SIZE;
+  sendq_head_.eof = CURVECPR_BLOCK_STREAM;
+  sendq_head_exists_ = true;
+}
+
+bool session::receive_hello(const curvecpr_block &block)
+{
+  // Datagram sends wait for the first block of the peer, which is either
+  // its hello or, when the peer has no features enabled, its data
+  peer_hello_received_ = true;
+  pending_ready_write_.cancel();
+
+  if (block.data_len != SESSION_HELLO_SIZE || block.eof != CURVECPR_BLOCK_STREAM ||
+      std::memcmp(block.data, SESSION_HELLO_MAGIC, SESSION_HELLO_MAGIC_SIZE) != 0)
+    return false;
+
+  // The hello is not part of the stream, so it is consumed right away
+  peer_features_ = block.data[SESSION_HELLO_MAGIC_SIZE];
+  compression_peer_codecs_ = block.data[SESSION_HELLO_MAGIC_SIZE + 1];
+  consume(0, SESSION_HELLO_SIZE);
+  return true;
+}
+
+int session::lower_receive_datagram(const unsigned char *buf, size_t num)
+{
+  // Repairs of forward error correction are told apart by their trailers
+  if (fec_layer::is_repair(buf, num)) {
+    int rebuilt = fec_.receive_repair(buf, num, recvmarkq_distributed_);
+    if (rebuilt > 0)
+      deliver_received();
+    return rebuilt < 0 ? -1 : 0;
+  }
+
+  // Strip the trailer, its last byte holds the trailer length
+  std::size_t trailer = buf[num - 1];
+  if (trailer < 1 || trailer > 2 || trailer > num)
+    return -1;
+
+  // Peers only send datagrams after we have announced that we accept them
+  if (!datagrams_enabled_ || datagram_queue_maximum_ == 0) {
+    datagram_counters_.dropped++;
+    return 0;
+  }
+
+  // Prefer fresh datagrams, so drop the oldest one when the queue is full
+  if (datagrams_.size() >= datagram_queue_maximum_) {
+    datagrams_.pop_front();
+    datagram_counters_.dropped++;
+  }
+
+  datagrams_.emplace_back(buf, buf + num - trailer);
+  datagram_counters_.received++;
+  pending_ready_read_.cancel();
+  return 0;
+}
+
+bool session::queue_rebuilt_block(const curvecpr_block &block)
+{
+  if (recvmarkq_.size() >= recvmarkq_maximum_)
+    return false;
+
+  curvecpr_block_status *new_block = new curvecpr_block_status();
+  new_block->status = pending_eof_ ? RECVMARKQ_ELEMENT_DISTRIBUTED : RECVMARKQ_ELEMENT_NONE;
+  new_block->block = block;
+
+  recvmarkq_.insert(new_block);
+  if (!peer_hello_received_ && new_block->block.offset == 0 && receive_hello(new_block->block))
+    new_block->status |= RECVMARKQ_ELEMENT_DISTRIBUTED;
+  return true;
+}
+
+void session::deliver_received()
+{
+  if (multiplexed_)
+    demultiplex();
+  else if (!pending_eof_)
+    pending_ready_read_.cancel();
+}
+
+void session::set_compression(bool value)
+{
+  // Compression state is used by the send and receive queue handlers, so
+  // it is only changed on the strand
+  boost::asio::dispatch(strand_, [this, value]() { compression_.set_enabled(value); });
+}
+
+bool session::compressing() const
+{
+  return compression_.enabled() && !unordered_messages_ && !multiplexed_;
+}
+
+bool session::decompressing() const
+{
+  return (peer_features_ & SESSION_FEATURE_RECORDS) != 0;
+}
+
+bool session::compress_pending()
+{
+  if (compression_.frames_pending())
+    return true;
+  else if (pending_used_ == 0)
+    return false;
+
+  // Take the next chunk from the pending buffer, which may wrap around
+  std::size_t first_length = static_cast<std::size_t>(std::min<std::uint64_t>(pending_used_,
+    pending_maximum_ - pending_current_));
+  std::size_t length = compression_.put_chunk(&pending_[0] + pending_current_, first_length,
+    &pending_[0], static_cast<std::size_t>(pending_used_ - first_length),
+    compressing() && (compression_peer_codecs_ & COMPRESSION_CODEC_ZSTD) && compression_codec::supported());
+
+  pending_current_ = length > first_length ? length - first_length : pending_current_ + length;
+  pending_used_ -= length;
+  pending_ready_write_.cancel();
+  return true;
+}
+
+std::size_t session::receive(unsigned char *buffer, std::size_t length, boost::system::error_code &ec)
+{
+  if (!decompressing())
+    return distribute(buffer, length);
+
+  return compression_.read(buffer, length,
+    [this](unsigned char *chunk, std::size_t chunk_length) { return distribute(chunk, chunk_length); }, ec);
+}
+
+bool session::received_eof() const
+{
+  // Decompressed data may still be waiting after the last block was read
+  return pending_eof_ && (!decompressing() || compression_.drained());
+}
+
 bool session::read(const boost::asio::mutable_buffer &data,
                    boost::system::error_code &ec,
                    std::size_t &bytes_transferred)
@@ -200,7 +477,10 @@ bool session::read(const boost::asio::mutable_buffer &data,
   bytes_transferred = 0;
   ec = boost::system::error_code();
 
-  if (boost::asio::buffer_size(data) == 0) {
+  if (unordered_messages_ || multiplexed_) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  } else if (boost::asio::buffer_size(data) == 0) {
     recvmarkq_read_offset_ = 0;
     return true;
   }
@@ -208,6 +488,80 @@ bool session::read(const boost::asio::mutable_buffer &data,
   // Check if there are enough sequential blocks available in the buffer
   size_t buffer_length = boost::asio::buffer_size(data);
   unsigned char *buffer = boost::asio::buffer_cast<unsigned char*>(data) + recvmarkq_read_offset_;
+  recvmarkq_read_offset_ += receive(buffer, buffer_length - recvmarkq_read_offset_, ec);
+
+  bool eof = received_eof();
+  if (recvmarkq_read_offset_ == buffer_length || eof || ec) {
+    // Read is complete
+    bytes_transferred = recvmarkq_read_offset_;
+    recvmarkq_read_offset_ = 0;
+
+    if (eof && !ec)
+      ec = boost::system::error_code(boost::asio::error::eof);
+    return true;
+  }
+
+  return false;
+}
+
+std::size_t session::read_some(const boost::asio::mutable_buffer &data,
+                               boost::system::error_code &ec)
+{
+  ec = boost::system::error_code();
+
+  std::size_t buffer_length = boost::asio::buffer_size(data);
+  if (unordered_messages_ || multiplexed_) {
+    ec = boost::asio::error::operation_not_supported;
+    return 0;
+  } else if (buffer_length == 0) {
+    return 0;
+  }
+
+  std::size_t bytes_transferred = receive(boost::asio::buffer_cast<unsigned char*>(data), buffer_length, ec);
+  if (ec)
+    return bytes_transferred;
+  else if (bytes_transferred == 0 && received_eof())
+    ec = boost::asio::error::eof;
+  else if (bytes_transferred == 0)
+    ec = boost::asio::error::would_block;
+
+  return bytes_transferred;
+}
+
+std::size_t session::available()
+{
+  if (decompressing()) {
+    return compression_.available(
+      [this](unsigned char *chunk, std::size_t chunk_length) { return distribute(chunk, chunk_length); });
+  }
+
+  bool eof;
+  return contiguous(eof);
+}
+
+std::size_t session::contiguous(bool &eof) const
+{
+  std::uint64_t offset = recvmarkq_distributed_;
+  eof = false;
+
+  for (curvecpr_block_status *b : recvmarkq_) {
+    if (b->block.offset > offset)
+      break;
+
+    if (b->block.offset + b->block.data_len > offset)
+      offset = b->block.offset + b->block.data_len;
+    if (b->block.eof != CURVECPR_BLOCK_STREAM) {
+      eof = true;
+      break;
+    }
+  }
+
+  return static_cast<std::size_t>(offset - recvmarkq_distributed_);
+}
+
+std::size_t session::distribute(unsigned char *buffer, std::size_t length)
+{
+  std::size_t copied = 0;
 
   for (auto it = recvmarkq_.begin(); it != recvmarkq_.end();) {
     auto jt = it;
@@ -219,15 +573,15 @@ bool session::read(const boost::asio::mutable_buffer &data,
         size_t len = static_cast<size_t>((*jt)->block.data_len - idx);
 
         bool should_break = false;
-        if (len > buffer_length - recvmarkq_read_offset_) {
+        if (len > length - copied) {
           // This block has more data than we need, so we can't yet mark this block as distributed
-          len = buffer_length - recvmarkq_read_offset_;
+          len = length - copied;
           should_break = true;
         }
 
         std::memcpy(buffer, (*jt)->block.data + idx, len);
         recvmarkq_distributed_ += len;
-        recvmarkq_read_offset_ += len;
+        copied += len;
         buffer += len;
 
         if (should_break)
@@ -254,17 +608,390 @@ bool session::read(const boost::asio::mutable_buffer &data,
     }
   }
 
-  if (recvmarkq_read_offset_ == buffer_length || pending_eof_) {
-    // Read is complete
-    bytes_transferred = recvmarkq_read_offset_;
-    recvmarkq_read_offset_ = 0;
+  return copied;
+}
 
-    if (pending_eof_)
-      ec = boost::system::error_code(boost::asio::error::eof);
+std::size_t session::peek(unsigned char *buffer, std::size_t length) const
+{
+  std::uint64_t offset = recvmarkq_distributed_;
+  std::size_t copied = 0;
+
+  for (curvecpr_block_status *b : recvmarkq_) {
+    if (copied == length || b->block.offset > offset)
+      break;
+
+    if (b->block.offset + b->block.data_len > offset) {
+      std::uint64_t idx = offset - b->block.offset;
+      std::size_t len = std::min(static_cast<std::size_t>(b->block.data_len - idx), length - copied);
+
+      std::memcpy(buffer + copied, b->block.data + idx, len);
+      offset += len;
+      copied += len;
+    }
+  }
+
+  return copied;
+}
+
+template <typename DynamicBuffer>
+bool session::read_until(DynamicBuffer &buffers,
+                         const std::string &delimiter,
+                         std::size_t &searched,
+                         boost::system::error_code &ec,
+                         std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  if (unordered_messages_ || multiplexed_ || compressing() || decompressing()) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  } else if (delimiter.empty()) {
     return true;
   }
 
-  return false;
+  // Data that is already in the buffer comes first, followed by the blocks
+  // that have been received in order, which are only collected as far as
+  // the search gets
+  std::size_t buffered = buffers.size();
+  recvmarkq_segments_.clear();
+  auto contents = buffers.data();
+  auto contents_end = boost::asio::buffer_sequence_end(contents);
+  for (auto it = boost::asio::buffer_sequence_begin(contents); it != contents_end; ++it)
+    recvmarkq_segments_.push_back(boost::asio::const_buffer(*it));
+
+  auto block = recvmarkq_.begin();
+  std::uint64_t offset = recvmarkq_distributed_;
+  std::size_t collected = buffered;
+  auto collect = [&](std::size_t needed) {
+    for (; collected < needed && block != recvmarkq_.end(); ++block) {
+      curvecpr_block_status *b = *block;
+      if (b->block.offset > offset) {
+        block = recvmarkq_.end();
+        break;
+      }
+
+      if (b->block.offset + b->block.data_len > offset) {
+        std::size_t idx = static_cast<std::size_t>(offset - b->block.offset);
+        std::size_t len = b->block.data_len - idx;
+        recvmarkq_segments_.push_back(boost::asio::const_buffer(b->block.data + idx, len));
+        offset += len;
+        collected += len;
+      }
+      if (b->block.eof != CURVECPR_BLOCK_STREAM) {
+        block = recvmarkq_.end();
+        break;
+      }
+    }
+  };
+
+  // Search for the first byte of the delimiter and then compare the rest,
+  // which may continue in the following segments
+  const unsigned char first = static_cast<unsigned char>(delimiter[0]);
+  std::size_t maximum = std::max(buffers.max_size(), buffered);
+  std::size_t found = maximum;
+  bool stopped = false;
+  std::size_t start = 0;
+  for (std::size_t i = 0; !stopped && start < maximum; i++) {
+    if (i == recvmarkq_segments_.size()) {
+      collect(collected + 1);
+      if (i == recvmarkq_segments_.size())
+        break;
+    }
+
+    const unsigned char *data = static_cast<const unsigned char*>(recvmarkq_segments_[i].data());
+    std::size_t end = start + std::min(recvmarkq_segments_[i].size(), maximum - start);
+
+    while (searched < end) {
+      std::size_t candidate = searched + byte_search::find(data + (searched - start), end - searched, first);
+      if (candidate == end) {
+        searched = end;
+        break;
+      }
+
+      collect(candidate + delimiter.size());
+      if (candidate + delimiter.size() > std::min(collected, maximum)) {
+        // The delimiter may be completed by data that has not arrived yet
+        searched = candidate;
+        stopped = true;
+        break;
+      }
+
+      std::size_t matched = 1;
+      std::size_t segment = i;
+      std::size_t position = candidate - start + 1;
+      while (matched < delimiter.size()) {
+        if (position == recvmarkq_segments_[segment].size()) {
+          segment++;
+          position = 0;
+        } else if (static_cast<const unsigned char*>(recvmarkq_segments_[segment].data())[position] ==
+                   static_cast<unsigned char>(delimiter[matched])) {
+          matched++;
+          position++;
+        } else {
+          break;
+        }
+      }
+
+      if (matched == delimiter.size()) {
+        found = candidate;
+        stopped = true;
+        break;
+      }
+      searched = candidate + 1;
+    }
+
+    start += recvmarkq_segments_[i].size();
+  }
+
+  if (found == maximum) {
+    bool eof;
+    std::size_t total = buffered + contiguous(eof);
+    if (total >= buffers.max_size()) {
+      // The buffer is full without containing the delimiter
+      ec = boost::asio::error::not_found;
+      return true;
+    } else if (!eof && !pending_eof_) {
+      return false;
+    }
+
+    // Move what is left into the buffer as boost::asio::read_until does
+    ec = boost::asio::error::eof;
+    found = total;
+  } else {
+    found += delimiter.size();
+    bytes_transferred = found;
+  }
+
+  // Copy the data up to the end of the delimiter directly from received
+  // blocks into the buffer
+  if (found > buffered) {
+    std::size_t length = found - buffered;
+    auto prepared = buffers.prepare(length);
+    auto prepared_end = boost::asio::buffer_sequence_end(prepared);
+    for (auto it = boost::asio::buffer_sequence_begin(prepared); it != prepared_end; ++it) {
+      boost::asio::mutable_buffer buffer(*it);
+      distribute(static_cast<unsigned char*>(buffer.data()), buffer.size());
+    }
+    buffers.commit(length);
+  }
+
+  searched = 0;
+  return true;
+}
+
+template <typename MutableBufferSequence>
+bool session::read_message(const MutableBufferSequence &buffers,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred)
+{
+  if (unordered_messages_)
+    return read_unordered_message(buffers, ec, bytes_transferred);
+
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  if (multiplexed_ || compressing() || decompressing()) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  }
+
+  // Wait until the header and the whole message have been received in order
+  bool eof;
+  std::size_t ready = contiguous(eof);
+  std::size_t length = 0;
+  unsigned char header[message_header_size];
+
+  if (ready >= message_header_size) {
+    peek(header, message_header_size);
+    length = (static_cast<std::size_t>(header[0]) << 24) | (static_cast<std::size_t>(header[1]) << 16) |
+             (static_cast<std::size_t>(header[2]) << 8) | static_cast<std::size_t>(header[3]);
+  }
+
+  if (ready < message_header_size || ready < message_header_size + length) {
+    if (!eof && !pending_eof_)
+      return false;
+
+    ec = boost::asio::error::eof;
+    return true;
+  }
+
+  // Copy the message directly from received blocks into the buffers
+  distribute(header, message_header_size);
+
+  std::size_t remaining = length;
+  auto end = boost::asio::buffer_sequence_end(buffers);
+  for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end && remaining > 0; ++it) {
+    boost::asio::mutable_buffer buffer(*it);
+    std::size_t len = std::min(buffer.size(), remaining);
+    distribute(static_cast<unsigned char*>(buffer.data()), len);
+    bytes_transferred += len;
+    remaining -= len;
+  }
+
+  if (remaining > 0) {
+    // The buffers are too small, so discard the rest of the message
+    unsigned char scratch[256];
+    while (remaining > 0)
+      remaining -= distribute(scratch, std::min(remaining, sizeof(scratch)));
+
+    ec = boost::asio::error::message_size;
+  }
+
+  return true;
+}
+
+template <typename MutableBufferSequence>
+bool session::read_unordered_message(const MutableBufferSequence &buffers,
+                                     boost::system::error_code &ec,
+                                     std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  for (auto it = recvmarkq_.begin(); it != recvmarkq_.end();) {
+    auto jt = it;
+    ++it;
+
+    curvecpr_block &block = (*jt)->block;
+    if ((*jt)->status & RECVMARKQ_ELEMENT_DISTRIBUTED)
+      continue;
+
+    if (block.data_len == 0 || consumed(block.offset, block.data_len)) {
+      // Retransmitted copies of consumed blocks and empty EOF blocks carry no
+      // message data
+      if (block.eof != CURVECPR_BLOCK_STREAM)
+        recvmarkq_eof_ = std::min<std::uint64_t>(recvmarkq_eof_, block.offset + block.data_len);
+
+      (*jt)->status |= RECVMARKQ_ELEMENT_DISTRIBUTED;
+      if ((*jt)->status == RECVMARKQ_ELEMENT_DONE) {
+        delete *jt;
+        recvmarkq_.erase(jt);
+      }
+      continue;
+    }
+
+    if (block.data[0] != UNORDERED_BLOCK_START || block.data_len < UNORDERED_BLOCK_START_SIZE)
+      continue;
+
+    // Collect the blocks that follow the start block until the message is
+    // complete; any gap means that the message has not been fully received
+    std::size_t length = (static_cast<std::size_t>(block.data[1]) << 24) | (static_cast<std::size_t>(block.data[2]) << 16) |
+                         (static_cast<std::size_t>(block.data[3]) << 8) | static_cast<std::size_t>(block.data[4]);
+    std::size_t collected = block.data_len - UNORDERED_BLOCK_START_SIZE;
+    std::uint64_t start = block.offset;
+    std::uint64_t next = block.offset + block.data_len;
+
+    recvmarkq_message_.clear();
+    recvmarkq_message_.push_back(*jt);
+
+    for (auto kt = it; kt != recvmarkq_.end() && collected < length; ++kt) {
+      curvecpr_block &part = (*kt)->block;
+      if (part.offset < next)
+        continue;
+      if (part.offset > next || part.data_len == 0 || part.data[0] != UNORDERED_BLOCK_CONTINUATION)
+        break;
+
+      collected += part.data_len - 1;
+      next += part.data_len;
+      recvmarkq_message_.push_back(*kt);
+    }
+
+    if (collected < length)
+      continue;
+
+    // Copy the message directly from the blocks into the buffers
+    auto buffer = boost::asio::buffer_sequence_begin(buffers);
+    auto end = boost::asio::buffer_sequence_end(buffers);
+    std::size_t buffer_offset = 0;
+    std::size_t remaining = length;
+
+    for (curvecpr_block_status *b : recvmarkq_message_) {
+      std::size_t skip = b == recvmarkq_message_.front() ? UNORDERED_BLOCK_START_SIZE : 1;
+      const unsigned char *data = b->block.data + skip;
+      std::size_t len = std::min<std::size_t>(b->block.data_len - skip, remaining);
+      remaining -= len;
+
+      while (len > 0 && buffer != end) {
+        boost::asio::mutable_buffer target = boost::asio::mutable_buffer(*buffer) + buffer_offset;
+        std::size_t n = std::min(target.size(), len);
+        std::memcpy(target.data(), data, n);
+        data += n;
+        len -= n;
+        bytes_transferred += n;
+        buffer_offset += n;
+
+        if (buffer_offset == boost::asio::mutable_buffer(*buffer).size()) {
+          ++buffer;
+          buffer_offset = 0;
+        }
+      }
+
+      if (b->block.eof != CURVECPR_BLOCK_STREAM)
+        recvmarkq_eof_ = std::min<std::uint64_t>(recvmarkq_eof_, next);
+    }
+
+    if (bytes_transferred < length)
+      ec = boost::asio::error::message_size;
+
+    // Mark the blocks as distributed; they are removed once acknowledged
+    for (curvecpr_block_status *b : recvmarkq_message_) {
+      b->status |= RECVMARKQ_ELEMENT_DISTRIBUTED;
+      if (b->status == RECVMARKQ_ELEMENT_DONE) {
+        auto range = recvmarkq_.equal_range(b);
+        recvmarkq_.erase(std::find(range.first, range.second, b));
+        delete b;
+      }
+    }
+
+    consume(start, next);
+    return true;
+  }
+
+  if (recvmarkq_distributed_ >= recvmarkq_eof_)
+    pending_eof_ = true;
+  if (!pending_eof_)
+    return false;
+
+  ec = boost::asio::error::eof;
+  return true;
+}
+
+bool session::consumed(std::uint64_t offset, std::size_t length) const
+{
+  if (offset + length <= recvmarkq_distributed_)
+    return true;
+
+  auto it = recvmarkq_consumed_.upper_bound(offset);
+  if (it == recvmarkq_consumed_.begin())
+    return false;
+
+  --it;
+  return offset + length <= it->second;
+}
+
+void session::consume(std::uint64_t start, std::uint64_t end)
+{
+  recvmarkq_consumed_[start] = end;
+
+  // Advance the distributed offset over ranges that have become contiguous
+  for (auto it = recvmarkq_consumed_.begin(); it != recvmarkq_consumed_.end() && it->first <= recvmarkq_distributed_;) {
+    recvmarkq_distributed_ = std::max(recvmarkq_distributed_, it->second);
+    it = recvmarkq_consumed_.erase(it);
+  }
+
+  if (messager_.their_contiguous_sent_bytes < recvmarkq_distributed_)
+    messager_.their_contiguous_sent_bytes = recvmarkq_distributed_;
+
+  if (recvmarkq_distributed_ >= recvmarkq_eof_)
+    pending_eof_ = true;
+}
+
+std::size_t session::abort_read()
+{
+  std::size_t bytes_transferred = recvmarkq_read_offset_;
+  recvmarkq_read_offset_ = 0;
+  return bytes_transferred;
 }
 
 bool session::write(const boost::asio::const_buffer &data,
@@ -275,7 +1002,10 @@ bool session::write(const boost::asio::const_buffer &data,
   bytes_transferred = 0;
   ec = boost::system::error_code();
 
-  if (buffer_length == 0) {
+  if (unordered_messages_ || multiplexed_) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  } else if (buffer_length == 0) {
     return true;
   } else if (pending_eof_) {
     ec = boost::system::error_code(boost::asio::error::eof);
@@ -284,11 +1014,20 @@ bool session::write(const boost::asio::const_buffer &data,
     return false;
   }
 
+  append(boost::asio::buffer_cast<const unsigned char*>(data), buffer_length);
+  bytes_transferred = buffer_length;
+
+  if (running_)
+    reschedule_process_send_queue();
+
+  return true;
+}
+
+void session::append(const unsigned char *buffer, std::size_t buffer_length)
+{
   if (pending_.empty())
     pending_.resize(pending_maximum_);
 
-  const unsigned char *buffer = boost::asio::buffer_cast<const unsigned char*>(data);
-
   if (pending_next_ + buffer_length > pending_maximum_) {
     // Two writes; one at the end and one at the beginning
     int avail = static_cast<int>(pending_maximum_ - pending_next_);
@@ -305,7 +1044,70 @@ bool session::write(const boost::asio::const_buffer &data,
   }
 
   pending_used_ += buffer_length;
-  bytes_transferred = buffer_length;
+}
+
+std::size_t session::write_some(const boost::asio::const_buffer &data,
+                                boost::system::error_code &ec)
+{
+  ec = boost::system::error_code();
+
+  std::size_t buffer_length = boost::asio::buffer_size(data);
+  if (buffer_length == 0)
+    return 0;
+
+  std::size_t chunk = std::min(buffer_length, write_capacity());
+  if (chunk == 0 && !pending_eof_) {
+    ec = boost::asio::error::would_block;
+    return 0;
+  }
+
+  std::size_t bytes_transferred;
+  write(boost::asio::buffer(data, chunk ? chunk : buffer_length), ec, bytes_transferred);
+  return bytes_transferred;
+}
+
+template <typename ConstBufferSequence>
+bool session::write_message(const ConstBufferSequence &buffers,
+                            boost::system::error_code &ec,
+                            std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  std::size_t length = boost::asio::buffer_size(buffers);
+  if (multiplexed_ || compressing()) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  } else if (length > 0xFFFFFFFF || length > pending_maximum_ - message_header_size) {
+    ec = boost::asio::error::message_size;
+    return true;
+  } else if (pending_eof_) {
+    ec = boost::asio::error::eof;
+    return true;
+  } else if (message_header_size + length > write_capacity()) {
+    return false;
+  }
+
+  unsigned char header[message_header_size] = {
+    static_cast<unsigned char>(length >> 24),
+    static_cast<unsigned char>(length >> 16),
+    static_cast<unsigned char>(length >> 8),
+    static_cast<unsigned char>(length)
+  };
+
+  append(header, message_header_size);
+
+  auto end = boost::asio::buffer_sequence_end(buffers);
+  for (auto it = boost::asio::buffer_sequence_begin(buffers); it != end; ++it) {
+    boost::asio::const_buffer buffer(*it);
+    append(static_cast<const unsigned char*>(buffer.data()), buffer.size());
+  }
+
+  // Remember where the message ends, so that blocks can be cut there
+  if (unordered_messages_)
+    pending_messages_.push_back(message_header_size + length);
+
+  bytes_transferred = length;
 
   if (running_)
     reschedule_process_send_queue();
@@ -313,6 +1115,196 @@ bool session::write(const boost::asio::const_buffer &data,
   return true;
 }
 
+template <typename ConstBufferSequence>
+bool session::send_datagram(const ConstBufferSequence &buffers,
+                            boost::system::error_code &ec,
+                            std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  std::size_t length = boost::asio::buffer_size(buffers);
+  if (length > maximum_datagram_size) {
+    ec = boost::asio::error::message_size;
+    return true;
+  } else if (pending_eof_) {
+    ec = boost::asio::error::eof;
+    return true;
+  } else if (!running_) {
+    ec = boost::asio::error::not_connected;
+    return true;
+  } else if (!datagrams_enabled_) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  } else if (!peer_hello_received_) {
+    // Wait until we know whether the peer accepts datagrams
+    return false;
+  } else if (!(peer_features_ & SESSION_FEATURE_DATAGRAMS)) {
+    ec = boost::asio::error::operation_not_supported;
+    return true;
+  }
+
+  // Append a trailer that makes the frame length differ from a multiple of
+  // 16 bytes, so the peer can tell it apart from messager messages
+  unsigned char frame[maximum_datagram_size + 2];
+  std::size_t size = boost::asio::buffer_copy(boost::asio::buffer(frame, length), buffers);
+  if ((size + 1) & 15) {
+    frame[size++] = 1;
+  } else {
+    frame[size++] = 0;
+    frame[size++] = 2;
+  }
+
+  lower_send_handler_(frame, size);
+  datagram_counters_.sent++;
+  bytes_transferred = length;
+  return true;
+}
+
+template <typename MutableBufferSequence>
+bool session::receive_datagram(const MutableBufferSequence &buffers,
+                               boost::system::error_code &ec,
+                               std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  if (datagrams_.empty()) {
+    if (!pending_eof_)
+      return false;
+
+    ec = boost::asio::error::eof;
+    return true;
+  }
+
+  const std::vector<unsigned char> &datagram = datagrams_.front();
+  bytes_transferred = boost::asio::buffer_copy(buffers, boost::asio::buffer(datagram));
+  if (bytes_transferred < datagram.size()) {
+    ec = boost::asio::error::message_size;
+    datagram_counters_.truncated++;
+  }
+
+  datagrams_.pop_front();
+  return true;
+}
+
+std::uint32_t session::open_substream()
+{
+  return substreams_.open();
+}
+
+bool session::accept_substream(std::uint32_t &id,
+                               boost::system::error_code &ec)
+{
+  ec = boost::system::error_code();
+
+  if (substreams_.accept(id))
+    return true;
+  else if (!pending_eof_)
+    return false;
+
+  ec = boost::asio::error::eof;
+  return true;
+}
+
+bool session::read_substream(std::uint32_t id,
+                             const boost::asio::mutable_buffer &data,
+                             boost::system::error_code &ec,
+                             std::size_t &bytes_transferred)
+{
+  if (!substreams_.read(id, data, pending_eof_, ec, bytes_transferred))
+    return false;
+
+  // Return credit to the peer once the substream owes a window update
+  if (bytes_transferred > 0 && substreams_.window_due(id) && running_)
+    reschedule_process_send_queue();
+
+  return true;
+}
+
+bool session::write_substream(std::uint32_t id,
+                              const boost::asio::const_buffer &data,
+                              boost::system::error_code &ec,
+                              std::size_t &bytes_transferred)
+{
+  if (!substreams_.write(id, data, pending_eof_, ec, bytes_transferred))
+    return false;
+
+  if (bytes_transferred > 0 && running_)
+    reschedule_process_send_queue();
+
+  return true;
+}
+
+void session::close_substream(std::uint32_t id)
+{
+  if (substreams_.close(id) && running_)
+    reschedule_process_send_queue();
+}
+
+bool session::build_multiplexed_block()
+{
+  curvecpr_bytes_zero(&sendq_head_, sizeof(struct curvecpr_block));
+
+  bool sent_data = false;
+  std::size_t limit = std::min<std::size_t>(messager_.my_maximum_send_bytes, sizeof(sendq_head_.data));
+  sendq_head_.data_len = static_cast<unsigned int>(substreams_.build(sendq_head_.data, limit, sent_data));
+
+  if (sent_data)
+    pending_ready_write_.cancel();
+
+  if (sendq_head_.data_len == 0 && !pending_eof_)
+    return false;
+
+  sendq_head_.eof = sendq_head_.data_len == 0 ? CURVECPR_BLOCK_EOF_SUCCESS : CURVECPR_BLOCK_STREAM;
+  sendq_head_exists_ = true;
+  return true;
+}
+
+void session::demultiplex()
+{
+  bool readable = false;
+  bool writable = false;
+
+  for (auto it = recvmarkq_.begin(); it != recvmarkq_.end();) {
+    auto jt = it;
+    ++it;
+
+    curvecpr_block &block = (*jt)->block;
+    if (block.offset > recvmarkq_distributed_)
+      break;
+
+    if (block.offset == recvmarkq_distributed_ && !((*jt)->status & RECVMARKQ_ELEMENT_DISTRIBUTED)) {
+      substreams_.receive(block.data, block.data_len, readable, writable);
+
+      recvmarkq_distributed_ += block.data_len;
+      if (block.eof != CURVECPR_BLOCK_STREAM) {
+        pending_eof_ = true;
+        readable = true;
+      }
+    }
+
+    // Blocks are consumed as soon as they are received in order, as flow
+    // control of the substreams bounds the amount of buffered data
+    (*jt)->status |= RECVMARKQ_ELEMENT_DISTRIBUTED;
+    if ((*jt)->status == RECVMARKQ_ELEMENT_DONE) {
+      delete *jt;
+      recvmarkq_.erase(jt);
+    }
+  }
+
+  if (messager_.their_contiguous_sent_bytes < recvmarkq_distributed_)
+    messager_.their_contiguous_sent_bytes = recvmarkq_distributed_;
+
+  if (readable)
+    pending_ready_read_.cancel();
+  if (writable) {
+    pending_ready_write_.cancel();
+    if (running_)
+      reschedule_process_send_queue();
+  }
+}
+
 int session::handle_sendq_head(struct curvecpr_messager *messager,
                                struct curvecpr_block **block_stored)
 {
@@ -323,28 +1315,88 @@ int session::handle_sendq_head(struct curvecpr_messager *messager,
     return 0;
   }
 
+  // The first block decides whether the stream is framed in chunks, and
+  // peers that use any features announced in the hello start with it
+  if (!self->stream_started_) {
+    self->stream_started_ = true;
+    self->compression_records_ = self->compressing();
+    if (self->hello_wanted()) {
+      self->put_hello();
+      *block_stored = &self->sendq_head_;
+      return 0;
+    }
+  }
+
+  if (self->multiplexed_) {
+    if (!self->build_multiplexed_block())
+      return -1;
+
+    *block_stored = &self->sendq_head_;
+    return 0;
+  }
+
+  if (self->compression_records_) {
+    // Blocks carry framed chunks, which are packed together when small
+    curvecpr_bytes_zero(&self->sendq_head_, sizeof(struct curvecpr_block));
+    std::size_t limit = self->messager_.my_maximum_send_bytes;
+    while (self->sendq_head_.data_len < limit && self->compress_pending()) {
+      self->sendq_head_.data_len += static_cast<unsigned int>(self->compression_.take_frames(
+        self->sendq_head_.data + self->sendq_head_.data_len, limit - self->sendq_head_.data_len));
+    }
+
+    if (self->sendq_head_.data_len == 0 && !self->pending_eof_)
+      return -1;
+
+    if (self->pending_eof_ && !self->compression_.frames_pending() && self->pending_used_ == 0)
+      self->sendq_head_.eof = CURVECPR_BLOCK_EOF_SUCCESS;
+    else
+      self->sendq_head_.eof = CURVECPR_BLOCK_STREAM;
+
+    self->sendq_head_exists_ = true;
+    *block_stored = &self->sendq_head_;
+    return 0;
+  }
+
   if (self->pending_used_ || self->pending_eof_) {
     curvecpr_bytes_zero(&self->sendq_head_, sizeof(struct curvecpr_block));
 
     if (!self->pending_.empty()) {
-      int requested = std::min<size_t>(self->pending_used_, self->messager_.my_maximum_send_bytes);
+      std::size_t limit = self->messager_.my_maximum_send_bytes;
+      unsigned char *data = self->sendq_head_.data;
+
+      if (self->unordered_messages_ && !self->pending_messages_.empty()) {
+        // Each block only carries data of a single message and starts with
+        // a tag, so that messages can be reassembled out of order
+        *data++ = self->pending_message_sent_ == 0 ? UNORDERED_BLOCK_START : UNORDERED_BLOCK_CONTINUATION;
+        limit = std::min<std::uint64_t>(limit - 1, self->pending_messages_.front() - self->pending_message_sent_);
+      }
+
+      int requested = std::min<size_t>(self->pending_used_, limit);
 
-      self->sendq_head_.data_len = requested;
+      self->sendq_head_.data_len = static_cast<unsigned int>(data - self->sendq_head_.data) + requested;
       if (self->pending_current_ + requested > self->pending_maximum_) {
         // Two reads, one from the end and one from the beginning
         int avail = static_cast<int>(self->pending_maximum_ - self->pending_current_);
 
-        std::memcpy(self->sendq_head_.data, &self->pending_[0] + self->pending_current_, avail);
-        std::memcpy(self->sendq_head_.data + avail, &self->pending_[0], requested - avail);
+        std::memcpy(data, &self->pending_[0] + self->pending_current_, avail);
+        std::memcpy(data + avail, &self->pending_[0], requested - avail);
 
         self->pending_current_ = requested - avail;
       } else {
         // Just one read at the end
-        std::memcpy(self->sendq_head_.data, &self->pending_[0] + self->pending_current_, requested);
+        std::memcpy(data, &self->pending_[0] + self->pending_current_, requested);
 
         self->pending_current_ += requested;
       }
 
+      if (self->unordered_messages_ && !self->pending_messages_.empty()) {
+        self->pending_message_sent_ += requested;
+        if (self->pending_message_sent_ == self->pending_messages_.front()) {
+          self->pending_messages_.pop_front();
+          self->pending_message_sent_ = 0;
+        }
+      }
+
       self->pending_used_ -= requested;
       self->pending_ready_write_.cancel();
     }
@@ -388,6 +1440,12 @@ int session::handle_sendq_move_to_sendmarkq(struct curvecpr_messager *messager,
   // We have just removed the head
   self->sendq_head_exists_ = false;
 
+  // New blocks carrying data are protected by forward error correction,
+  // once the peer has announced that it accepts repairs
+  if (self->fec_.enabled() && (self->peer_features_ & SESSION_FEATURE_REPAIRS) &&
+      new_block->data_len > 0 && new_block->eof == CURVECPR_BLOCK_STREAM)
+    self->fec_.protect(*new_block);
+
   if (block_stored)
     *block_stored = new_block;
 
@@ -399,7 +1457,10 @@ unsigned char session::handle_sendq_is_empty(struct curvecpr_messager *messager)
   session *self = static_cast<session*>(messager->cf.priv);
 
   return !self->sendq_head_exists_ && // We don't have a block actually waiting to be written
+         !(!self->stream_started_ && self->hello_wanted()) && // Nor a hello to start the stream with
          self->pending_used_ == 0 &&  // We don't have any bytes that we could turn into a block to be written
+         !(self->multiplexed_ && self->substreams_.frames_pending()) && // Nor any substream frames
+         !(self->compression_records_ && self->compression_.frames_pending()) && // Nor any compressed chunks
          (
            !self->pending_eof_ ||     // The EOF flag is not set
            self->messager_.my_eof     // Even if our EOF flag is set, the messager must not have sent
@@ -482,8 +1543,11 @@ int session::handle_recvmarkq_put(struct curvecpr_messager *messager,
 
   self->recvmarkq_.insert(new_block);
 
-  if (!self->pending_eof_)
-    self->pending_ready_read_.cancel();
+  if (!self->peer_hello_received_ && new_block->block.offset == 0 && self->receive_hello(new_block->block))
+    new_block->status |= RECVMARKQ_ELEMENT_DISTRIBUTED;
+
+  self->fec_.remember(new_block->block, self->recvmarkq_distributed_);
+  self->deliver_received();
 
   if (block_stored)
     *block_stored = &new_block->block;
@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_SOCKET_TRANSPORT_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_SOCKET_TRANSPORT_IPP
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace curvecp {
+
+namespace detail {
+
+void socket_transport::set_segmentation_offload(bool enabled)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+#if defined(CURVECP_ASIO_HAS_UDP_OFFLOAD)
+  offload_ = enabled;
+#endif
+  if (socket_.is_open())
+    enable_receive_offload();
+}
+
+void socket_transport::bind(const endpoint_type &endpoint)
+{
+  socket_.open(endpoint.protocol());
+  socket_.bind(endpoint);
+  opened(endpoint);
+}
+
+void socket_transport::connect(const endpoint_type &endpoint)
+{
+  socket_.connect(endpoint);
+  opened(endpoint);
+}
+
+void socket_transport::open(const endpoint_type &endpoint)
+{
+  if (!socket_.is_open()) {
+    socket_.open(endpoint.protocol());
+    opened(endpoint);
+  }
+}
+
+void socket_transport::opened(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  udp_ = endpoint.protocol().family() == AF_INET || endpoint.protocol().family() == AF_INET6;
+  protocol_ = endpoint.protocol().protocol();
+  enable_receive_offload();
+}
+
+void socket_transport::enable_receive_offload()
+{
+#if defined(CURVECP_ASIO_HAS_UDP_OFFLOAD)
+  if (!udp_ || (!offload_ && !receive_offload_))
+    return;
+
+  int value = offload_ ? 1 : 0;
+  receive_offload_ = setsockopt(socket_.native_handle(), SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0 && offload_;
+#endif
+}
+
+void socket_transport::close()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    receive_offload_ = false;
+    coalesced_length_ = 0;
+    segment_offset_ = 0;
+  }
+
+  boost::system::error_code ec;
+  socket_.close(ec);
+}
+
+void socket_transport::async_receive(const boost::asio::mutable_buffer &buffer,
+                                     handler_type handler)
+{
+  receive(buffer, nullptr, std::move(handler));
+}
+
+void socket_transport::async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                          endpoint_type &sender,
+                                          handler_type handler)
+{
+  receive(buffer, &sender, std::move(handler));
+}
+
+void socket_transport::receive(const boost::asio::mutable_buffer &buffer,
+                               endpoint_type *sender,
+                               handler_type handler)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // Segments of the last coalesced datagram are delivered first
+  if (segment_offset_ < coalesced_length_) {
+    std::size_t length = deliver_segment(buffer, sender);
+    lock.unlock();
+    post_transport_handler(context_, std::move(handler), boost::system::error_code(), length);
+    return;
+  }
+
+  if (!receive_offload_) {
+    lock.unlock();
+    if (sender)
+      socket_.async_receive_from(boost::asio::mutable_buffers_1(buffer), *sender, std::move(handler));
+    else
+      socket_.async_receive(boost::asio::mutable_buffers_1(buffer), std::move(handler));
+    return;
+  }
+
+  // Coalesced datagrams need their control messages, so the socket is only
+  // waited on and read directly
+  receive_buffer_ = buffer;
+  receive_sender_ = sender;
+  receive_handler_ = std::move(handler);
+  wait_receive();
+}
+
+void socket_transport::wait_receive()
+{
+  boost::shared_ptr<socket_transport> self(shared_from_this());
+  socket_.async_wait(boost::asio::socket_base::wait_read,
+    [self](const boost::system::error_code &error) { self->handle_receive_ready(error); });
+}
+
+void socket_transport::handle_receive_ready(const boost::system::error_code &error)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  boost::system::error_code ec = error;
+  std::size_t length = 0;
+
+  if (!ec) {
+    if (segment_offset_ >= coalesced_length_)
+      read_coalesced(ec);
+
+    // The datagram may have been taken by a concurrent receive
+    if (ec == boost::asio::error::would_block) {
+      wait_receive();
+      return;
+    }
+
+    if (!ec)
+      length = deliver_segment(receive_buffer_, receive_sender_);
+  }
+
+  handler_type handler(std::move(receive_handler_));
+  lock.unlock();
+  handler(ec, length);
+}
+
+void socket_transport::read_coalesced(boost::system::error_code &ec)
+{
+#if defined(CURVECP_ASIO_HAS_UDP_OFFLOAD)
+  if (coalesced_.empty())
+    coalesced_.resize(65535);
+
+  sockaddr_storage address;
+  iovec payload = { &coalesced_[0], coalesced_.size() };
+  union {
+    cmsghdr header;
+    unsigned char data[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  msghdr message;
+  std::memset(&message, 0, sizeof(message));
+  message.msg_name = &address;
+  message.msg_namelen = sizeof(address);
+  message.msg_iov = &payload;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data;
+  message.msg_controllen = sizeof(control.data);
+
+  ssize_t result = recvmsg(socket_.native_handle(), &message, MSG_DONTWAIT);
+  if (result < 0) {
+    ec = boost::system::error_code(errno, boost::system::system_category());
+    return;
+  }
+
+  // Without a segment size the datagram was not coalesced
+  ec = boost::system::error_code();
+  coalesced_length_ = static_cast<std::size_t>(result);
+  segment_offset_ = 0;
+  segment_size_ = coalesced_length_;
+  for (cmsghdr *c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c)) {
+    if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+      int size;
+      std::memcpy(&size, CMSG_DATA(c), sizeof(size));
+      if (size > 0)
+        segment_size_ = static_cast<std::size_t>(size);
+    }
+  }
+
+  coalesced_sender_ = endpoint_type(&address, message.msg_namelen, protocol_);
+#else
+  ec = boost::asio::error::operation_not_supported;
+#endif
+}
+
+std::size_t socket_transport::deliver_segment(const boost::asio::mutable_buffer &buffer,
+                                              endpoint_type *sender)
+{
+  std::size_t length = std::min(segment_size_, coalesced_length_ - segment_offset_);
+  std::size_t copied = std::min(length, buffer.size());
+  if (copied)
+    std::memcpy(buffer.data(), &coalesced_[segment_offset_], copied);
+  segment_offset_ += length;
+
+  if (sender)
+    *sender = coalesced_sender_;
+  return copied;
+}
+
+std::size_t socket_transport::try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                               endpoint_type &sender,
+                                               boost::system::error_code &ec)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (segment_offset_ < coalesced_length_ || receive_offload_) {
+    ec = boost::system::error_code();
+    if (segment_offset_ >= coalesced_length_)
+      read_coalesced(ec);
+    return ec ? 0 : deliver_segment(buffer, &sender);
+  }
+  lock.unlock();
+
+  // ASIO tracks user non-blocking mode separately from its own, so this
+  // does not affect outstanding asynchronous operations
+  if (!socket_.non_blocking()) {
+    socket_.non_blocking(true, ec);
+    if (ec)
+      return 0;
+  }
+
+  return socket_.receive_from(boost::asio::mutable_buffers_1(buffer), sender, 0, ec);
+}
+
+void socket_transport::async_send(const boost::asio::const_buffer &buffer,
+                                  handler_type handler)
+{
+  queue_send(buffer, nullptr, std::move(handler));
+}
+
+void socket_transport::async_send_to(const boost::asio::const_buffer &buffer,
+                                     const endpoint_type &destination,
+                                     handler_type handler)
+{
+  queue_send(buffer, &destination, std::move(handler));
+}
+
+void socket_transport::queue_send(const boost::asio::const_buffer &buffer,
+                                  const endpoint_type *destination,
+                                  handler_type handler)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!offload_ || !udp_) {
+    lock.unlock();
+    if (destination)
+      socket_.async_send_to(boost::asio::const_buffers_1(buffer), *destination, std::move(handler));
+    else
+      socket_.async_send(boost::asio::const_buffers_1(buffer), std::move(handler));
+    return;
+  }
+
+  // Datagrams sent while handlers run are collected and handed to the
+  // kernel together once the IO context gets to the flush
+  sends_.push_back(pending_send{ buffer, destination ? *destination : endpoint_type(), !destination, std::move(handler) });
+  if (!flush_pending_) {
+    flush_pending_ = true;
+    boost::shared_ptr<socket_transport> self(shared_from_this());
+    boost::asio::post(context_, [self]() { self->flush(); });
+  }
+}
+
+void socket_transport::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  flush_pending_ = false;
+  std::vector<pending_send> sends;
+  sends.swap(sends_);
+
+  // Split the queue into runs to the same destination where all datagrams
+  // have the same size, except for the last one which may be shorter; the
+  // kernel accepts at most 64 segments per super-datagram. Once a run has
+  // to be sent one by one, the rest follows it to keep datagrams in order
+  bool segmented = true;
+  for (std::size_t first = 0; first < sends.size();) {
+    std::size_t size = sends[first].buffer.size();
+    std::size_t total = size;
+    std::size_t last = first + 1;
+    while (last < sends.size() && last - first < 64 &&
+           sends[last - 1].buffer.size() == size && sends[last].buffer.size() <= size &&
+           sends[last].buffer.size() > 0 && total + sends[last].buffer.size() <= 65000 &&
+           sends[last].connected == sends[first].connected &&
+           (sends[first].connected || sends[last].destination == sends[first].destination)) {
+      total += sends[last].buffer.size();
+      last++;
+    }
+
+    if (!segmented || last - first == 1 || !(segmented = send_segments(sends, first, last))) {
+      for (std::size_t i = first; i < last; i++)
+        send_one(sends[i]);
+    }
+
+    first = last;
+  }
+
+  // Keep the queue storage around for the next flush
+  sends.clear();
+  if (sends_.empty())
+    sends_.swap(sends);
+}
+
+bool socket_transport::send_segments(std::vector<pending_send> &sends, std::size_t first, std::size_t last)
+{
+#if defined(CURVECP_ASIO_HAS_UDP_OFFLOAD)
+  iovec payload[64];
+  for (std::size_t i = first; i < last; i++) {
+    payload[i - first].iov_base = const_cast<void*>(sends[i].buffer.data());
+    payload[i - first].iov_len = sends[i].buffer.size();
+  }
+
+  union {
+    cmsghdr header;
+    unsigned char data[CMSG_SPACE(sizeof(std::uint16_t))];
+  } control;
+  std::memset(&control, 0, sizeof(control));
+
+  msghdr message;
+  std::memset(&message, 0, sizeof(message));
+  if (!sends[first].connected) {
+    message.msg_name = const_cast<sockaddr*>(sends[first].destination.data());
+    message.msg_namelen = static_cast<socklen_t>(sends[first].destination.size());
+  }
+  message.msg_iov = payload;
+  message.msg_iovlen = last - first;
+  message.msg_control = control.data;
+  message.msg_controllen = sizeof(control.data);
+
+  cmsghdr *c = CMSG_FIRSTHDR(&message);
+  c->cmsg_level = SOL_UDP;
+  c->cmsg_type = UDP_SEGMENT;
+  c->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+  std::uint16_t segment = static_cast<std::uint16_t>(sends[first].buffer.size());
+  std::memcpy(CMSG_DATA(c), &segment, sizeof(segment));
+
+  if (sendmsg(socket_.native_handle(), &message, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+    // Without support in the kernel or the device, datagrams are sent one
+    // by one from now on; a full send buffer is left to the reactor
+    if (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT)
+      offload_ = false;
+    return false;
+  }
+
+  for (std::size_t i = first; i < last; i++) {
+    post_transport_handler(context_, std::move(sends[i].handler), boost::system::error_code(),
+      sends[i].buffer.size());
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void socket_transport::send_one(pending_send &send)
+{
+  if (send.connected)
+    socket_.async_send(boost::asio::const_buffers_1(send.buffer), std::move(send.handler));
+  else
+    socket_.async_send_to(boost::asio::const_buffers_1(send.buffer), send.destination, std::move(send.handler));
+}
+
+}
+
+}
+
+#endif
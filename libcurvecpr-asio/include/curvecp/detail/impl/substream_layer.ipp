@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_SUBSTREAM_LAYER_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_SUBSTREAM_LAYER_IPP
+
+#include <boost/asio/error.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace curvecp {
+
+namespace detail {
+
+#define SUBSTREAM_FRAME_DATA 0
+#define SUBSTREAM_FRAME_WINDOW 1
+#define SUBSTREAM_FRAME_FIN 2
+#define SUBSTREAM_FRAME_HEADER_SIZE 7
+
+substream_layer::substream_layer(bool client)
+  : window_(16384),
+    next_id_(client ? 1 : 2),
+    remote_max_(0),
+    cursor_(0)
+{
+}
+
+std::uint32_t substream_layer::open()
+{
+  std::uint32_t id = next_id_;
+  next_id_ += 2;
+
+  create(id);
+  return id;
+}
+
+bool substream_layer::accept(std::uint32_t &id)
+{
+  while (!accept_queue_.empty()) {
+    id = accept_queue_.front();
+    accept_queue_.pop_front();
+
+    if (substreams_.count(id))
+      return true;
+  }
+
+  return false;
+}
+
+bool substream_layer::read(std::uint32_t id,
+                           const boost::asio::mutable_buffer &data,
+                           bool eof,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  auto it = substreams_.find(id);
+  if (it == substreams_.end()) {
+    ec = boost::asio::error::eof;
+    return true;
+  }
+
+  substream_state &state = it->second;
+  std::size_t available = state.recv.size() - state.recv_head;
+  if (available == 0) {
+    if (!state.fin_received && !eof)
+      return false;
+
+    // Both sides are done with the substream
+    if (state.fin_received && state.fin_sent)
+      erase(it);
+
+    ec = boost::asio::error::eof;
+    return true;
+  } else if (data.size() == 0) {
+    return true;
+  }
+
+  bytes_transferred = std::min(available, data.size());
+  std::memcpy(data.data(), &state.recv[state.recv_head], bytes_transferred);
+  state.recv_head += bytes_transferred;
+  if (state.recv_head == state.recv.size()) {
+    state.recv.clear();
+    state.recv_head = 0;
+  }
+
+  // Return credit to the peer once half of the window has been consumed
+  state.recv_unannounced += bytes_transferred;
+  if (state.recv_unannounced >= window_ / 2)
+    window_due_.insert(id);
+
+  return true;
+}
+
+bool substream_layer::write(std::uint32_t id,
+                            const boost::asio::const_buffer &data,
+                            bool eof,
+                            boost::system::error_code &ec,
+                            std::size_t &bytes_transferred)
+{
+  bytes_transferred = 0;
+  ec = boost::system::error_code();
+
+  auto it = substreams_.find(id);
+  if (it == substreams_.end() || it->second.fin_pending || it->second.fin_sent) {
+    ec = boost::asio::error::shut_down;
+    return true;
+  } else if (eof) {
+    ec = boost::asio::error::eof;
+    return true;
+  } else if (data.size() == 0) {
+    return true;
+  }
+
+  substream_state &state = it->second;
+  std::size_t queued = state.send.size() - state.send_head;
+  if (queued >= window_)
+    return false;
+
+  // Drop data that has already been sent before growing the buffer
+  if (state.send_head > 0 && state.send_head >= state.send.size() / 2) {
+    state.send.erase(state.send.begin(), state.send.begin() + state.send_head);
+    state.send_head = 0;
+  }
+
+  const unsigned char *buffer = static_cast<const unsigned char*>(data.data());
+  bytes_transferred = std::min(data.size(), window_ - queued);
+  state.send.insert(state.send.end(), buffer, buffer + bytes_transferred);
+  update_sendable(id, state);
+  return true;
+}
+
+bool substream_layer::close(std::uint32_t id)
+{
+  auto it = substreams_.find(id);
+  if (it == substreams_.end() || it->second.fin_sent)
+    return false;
+
+  it->second.fin_pending = true;
+  update_sendable(id, it->second);
+  return true;
+}
+
+std::size_t substream_layer::build(unsigned char *data, std::size_t length, bool &sent_data)
+{
+  unsigned char *start = data;
+  unsigned char *end = data + length;
+
+  // Window updates go first, so that peers are never starved of credit
+  while (!window_due_.empty() && end - data >= SUBSTREAM_FRAME_HEADER_SIZE + 4) {
+    std::uint32_t id = *window_due_.begin();
+    window_due_.erase(window_due_.begin());
+
+    substream_state &state = substreams_.find(id)->second;
+    data = put_frame(data, SUBSTREAM_FRAME_WINDOW, id, 4);
+    data[0] = static_cast<unsigned char>(state.recv_unannounced >> 24);
+    data[1] = static_cast<unsigned char>(state.recv_unannounced >> 16);
+    data[2] = static_cast<unsigned char>(state.recv_unannounced >> 8);
+    data[3] = static_cast<unsigned char>(state.recv_unannounced);
+    data += 4;
+    state.recv_unannounced = 0;
+  }
+
+  // Interleave frames round-robin over the substreams that have something to
+  // send, starting after the one that was served last; each substream gets
+  // an equal share of the space that is left in the block and is shut down
+  // once its data has been sent completely
+  while (!sendable_.empty() && end - data > SUBSTREAM_FRAME_HEADER_SIZE) {
+    auto next = sendable_.upper_bound(cursor_);
+    std::uint32_t id = next != sendable_.end() ? *next : *sendable_.begin();
+    std::size_t space = static_cast<std::size_t>(end - data);
+    std::size_t share = std::max<std::size_t>(space / sendable_.size(), SUBSTREAM_FRAME_HEADER_SIZE + 64);
+    cursor_ = id;
+
+    auto it = substreams_.find(id);
+    substream_state &state = it->second;
+    std::size_t queued = state.send.size() - state.send_head;
+    if (queued > 0) {
+      std::size_t frame_length = std::min<std::uint64_t>(std::min(queued, state.send_credit),
+        std::min(share, space) - SUBSTREAM_FRAME_HEADER_SIZE);
+      data = put_frame(data, SUBSTREAM_FRAME_DATA, id, frame_length);
+      std::memcpy(data, &state.send[state.send_head], frame_length);
+      data += frame_length;
+
+      state.send_head += frame_length;
+      state.send_credit -= frame_length;
+      if (state.send_head == state.send.size()) {
+        state.send.clear();
+        state.send_head = 0;
+      }
+      sent_data = true;
+    }
+
+    if (state.fin_pending && state.send.empty() && end - data >= SUBSTREAM_FRAME_HEADER_SIZE) {
+      data = put_frame(data, SUBSTREAM_FRAME_FIN, id, 0);
+      state.fin_pending = false;
+      state.fin_sent = true;
+
+      if (state.fin_received && state.recv.empty()) {
+        erase(it);
+        continue;
+      }
+    }
+
+    update_sendable(id, state);
+  }
+
+  return static_cast<std::size_t>(data - start);
+}
+
+void substream_layer::receive(const unsigned char *data, std::size_t length, bool &readable, bool &writable)
+{
+  const unsigned char *end = data + length;
+
+  while (end - data >= SUBSTREAM_FRAME_HEADER_SIZE) {
+    unsigned char type = data[0];
+    std::uint32_t id = get_uint32(data + 1);
+    std::size_t frame_length = (static_cast<std::size_t>(data[5]) << 8) | data[6];
+    data += SUBSTREAM_FRAME_HEADER_SIZE;
+    if (static_cast<std::size_t>(end - data) < frame_length)
+      break;
+
+    const unsigned char *payload = data;
+    data += frame_length;
+
+    // Frames of unknown types are skipped
+    if (type != SUBSTREAM_FRAME_DATA && type != SUBSTREAM_FRAME_WINDOW && type != SUBSTREAM_FRAME_FIN)
+      continue;
+
+    auto st = substreams_.find(id);
+    if (st == substreams_.end()) {
+      // Frames of substreams that have already been closed are ignored,
+      // data and FIN frames of new substreams opened by the peer create
+      // them
+      if (type == SUBSTREAM_FRAME_WINDOW || (id & 1) == (next_id_ & 1) || id <= remote_max_)
+        continue;
+
+      remote_max_ = id;
+      create(id);
+      st = substreams_.find(id);
+      accept_queue_.push_back(id);
+      readable = true;
+    }
+
+    substream_state &state = st->second;
+    switch (type) {
+      case SUBSTREAM_FRAME_DATA: {
+        if (state.recv_head > 0 && state.recv_head >= state.recv.size() / 2) {
+          state.recv.erase(state.recv.begin(), state.recv.begin() + state.recv_head);
+          state.recv_head = 0;
+        }
+
+        state.recv.insert(state.recv.end(), payload, payload + frame_length);
+        readable = true;
+        break;
+      }
+      case SUBSTREAM_FRAME_WINDOW: {
+        if (frame_length >= 4) {
+          state.send_credit += get_uint32(payload);
+          update_sendable(id, state);
+          writable = true;
+        }
+        break;
+      }
+      case SUBSTREAM_FRAME_FIN: {
+        state.fin_received = true;
+        readable = true;
+
+        if (state.fin_sent && state.recv.size() == state.recv_head)
+          erase(st);
+        break;
+      }
+    }
+  }
+}
+
+void substream_layer::clear()
+{
+  substreams_.clear();
+  accept_queue_.clear();
+  sendable_.clear();
+  window_due_.clear();
+}
+
+substream_layer::substream_state &substream_layer::create(std::uint32_t id)
+{
+  substream_state &state = substreams_[id];
+  state.send_head = 0;
+  state.recv_head = 0;
+  state.send_credit = window_;
+  state.recv_unannounced = 0;
+  state.fin_pending = false;
+  state.fin_sent = false;
+  state.fin_received = false;
+  return state;
+}
+
+void substream_layer::update_sendable(std::uint32_t id, const substream_state &state)
+{
+  std::size_t queued = state.send.size() - state.send_head;
+
+  if ((queued > 0 && state.send_credit > 0) || (queued == 0 && state.fin_pending))
+    sendable_.insert(id);
+  else
+    sendable_.erase(id);
+}
+
+void substream_layer::erase(std::map<std::uint32_t, substream_state>::iterator it)
+{
+  sendable_.erase(it->first);
+  window_due_.erase(it->first);
+  substreams_.erase(it);
+}
+
+unsigned char *substream_layer::put_frame(unsigned char *data, unsigned char type,
+                                          std::uint32_t id, std::size_t length)
+{
+  data[0] = type;
+  data[1] = static_cast<unsigned char>(id >> 24);
+  data[2] = static_cast<unsigned char>(id >> 16);
+  data[3] = static_cast<unsigned char>(id >> 8);
+  data[4] = static_cast<unsigned char>(id);
+  data[5] = static_cast<unsigned char>(length >> 8);
+  data[6] = static_cast<unsigned char>(length);
+  return data + SUBSTREAM_FRAME_HEADER_SIZE;
+}
+
+std::uint32_t substream_layer::get_uint32(const unsigned char *data)
+{
+  return (static_cast<std::uint32_t>(data[0]) << 24) | (static_cast<std::uint32_t>(data[1]) << 16) |
+         (static_cast<std::uint32_t>(data[2]) << 8) | static_cast<std::uint32_t>(data[3]);
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,574 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_IMPL_URING_TRANSPORT_IPP
+#define CURVECP_ASIO_DETAIL_IMPL_URING_TRANSPORT_IPP
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+// Size of each pooled receive buffer; it holds the receive header, the
+// sender address and the payload
+#define URING_BUFFER_SIZE 2048
+#define URING_BUFFER_GROUP 0
+#define URING_RECEIVE_TAG 1
+
+namespace curvecp {
+
+namespace detail {
+
+uring_transport::uring_transport(boost::asio::io_context &service, std::size_t buffers)
+  : service_(service),
+    ring_descriptor_(service),
+    socket_(-1),
+    protocol_(0),
+    sq_ring_(MAP_FAILED),
+    sq_ring_size_(0),
+    cq_ring_(MAP_FAILED),
+    cq_ring_size_(0),
+    sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+    buffer_ring_(static_cast<io_uring_buf*>(MAP_FAILED)),
+    buffer_count_(1),
+    buffer_tail_(0),
+    buffers_free_(0),
+    receive_armed_(false),
+    ring_waiting_(false),
+    flush_pending_(false),
+    receive_pending_(false),
+    receive_sender_(nullptr)
+{
+  while (buffer_count_ < std::min<std::size_t>(buffers, 32768))
+    buffer_count_ <<= 1;
+
+  // Room for a completion of every pooled buffer and plenty of sends
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 4 * std::max<unsigned>(buffer_count_, 256);
+
+  int fd = static_cast<int>(syscall(__NR_io_uring_setup, 256, &params));
+  if (fd < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()),
+      "io_uring_setup");
+  ring_descriptor_.assign(fd);
+
+  try {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+      IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED)
+      throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "mmap");
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED)
+        throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "mmap");
+    }
+
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED)
+      throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "mmap");
+
+    unsigned char *sq = static_cast<unsigned char*>(sq_ring_);
+    unsigned char *cq = static_cast<unsigned char*>(cq_ring_);
+    sq_entries_ = params.sq_entries;
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqe_tail_ = sqe_submitted_ = *sq_tail_;
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Submission queue entries are always used in ring order
+    unsigned *array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; i++)
+      array[i] = i;
+
+    // Register the ring of pooled buffers that receives select from
+    buffer_ring_ = static_cast<io_uring_buf*>(mmap(nullptr, buffer_count_ * sizeof(io_uring_buf),
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buffer_ring_ == MAP_FAILED)
+      throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "mmap");
+
+    io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<std::uint64_t>(buffer_ring_);
+    registration.ring_entries = buffer_count_;
+    registration.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+      throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()),
+        "io_uring_register");
+
+    buffer_memory_.resize(static_cast<std::size_t>(buffer_count_) * URING_BUFFER_SIZE);
+    for (std::uint16_t i = 0; i < buffer_count_; i++)
+      provide_buffer(i);
+  } catch (...) {
+    destroy();
+    throw;
+  }
+
+  // The multishot receive reserves room for any address in each buffer
+  std::memset(&receive_message_, 0, sizeof(receive_message_));
+  receive_message_.msg_namelen = sizeof(sockaddr_storage);
+}
+
+uring_transport::~uring_transport()
+{
+  destroy();
+}
+
+void uring_transport::destroy()
+{
+  if (socket_ >= 0) {
+    ::close(socket_);
+    socket_ = -1;
+  }
+
+  // Closing the ring cancels all requests that are still in flight
+  boost::system::error_code ec;
+  ring_descriptor_.close(ec);
+
+  if (buffer_ring_ != MAP_FAILED)
+    munmap(buffer_ring_, buffer_count_ * sizeof(io_uring_buf));
+  if (sqes_ != MAP_FAILED)
+    munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_ != MAP_FAILED)
+    munmap(sq_ring_, sq_ring_size_);
+
+  buffer_ring_ = static_cast<io_uring_buf*>(MAP_FAILED);
+  sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+  sq_ring_ = cq_ring_ = MAP_FAILED;
+}
+
+void uring_transport::open_socket(const endpoint_type &endpoint)
+{
+  if (socket_ >= 0)
+    return;
+
+  socket_ = ::socket(endpoint.protocol().family(), SOCK_DGRAM | SOCK_CLOEXEC, endpoint.protocol().protocol());
+  if (socket_ < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "socket");
+  protocol_ = endpoint.protocol().protocol();
+}
+
+void uring_transport::bind(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_socket(endpoint);
+  if (::bind(socket_, endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "bind");
+  start();
+}
+
+void uring_transport::connect(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_socket(endpoint);
+  if (::connect(socket_, endpoint.data(), static_cast<socklen_t>(endpoint.size())) < 0)
+    throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "connect");
+  start();
+}
+
+void uring_transport::open(const endpoint_type &endpoint)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  open_socket(endpoint);
+  start();
+}
+
+void uring_transport::start()
+{
+  arm_receive();
+  if (!ring_waiting_) {
+    ring_waiting_ = true;
+    wait_ring();
+  }
+}
+
+void uring_transport::close()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0)
+    return;
+
+  if (receive_armed_) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_RECEIVE_TAG;
+    submit();
+  }
+
+  ::close(socket_);
+  socket_ = -1;
+
+  for (const datagram &d : received_)
+    provide_buffer(d.buffer);
+  received_.clear();
+
+  if (receive_pending_) {
+    receive_pending_ = false;
+    post_transport_handler(service_, std::move(receive_handler_),
+      boost::system::error_code(boost::asio::error::operation_aborted), 0);
+  }
+}
+
+transport::endpoint_type uring_transport::local_endpoint() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  if (socket_ < 0 || getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length) < 0)
+    throw boost::system::system_error(boost::asio::error::bad_descriptor);
+
+  return endpoint_type(&address, length, protocol_);
+}
+
+std::size_t uring_transport::maximum_datagram_size() const
+{
+  return URING_BUFFER_SIZE - sizeof(io_uring_recvmsg_out) - sizeof(sockaddr_storage);
+}
+
+void uring_transport::async_receive(const boost::asio::mutable_buffer &buffer,
+                                    handler_type handler)
+{
+  receive(buffer, nullptr, std::move(handler));
+}
+
+void uring_transport::async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                         endpoint_type &sender,
+                                         handler_type handler)
+{
+  receive(buffer, &sender, std::move(handler));
+}
+
+void uring_transport::receive(const boost::asio::mutable_buffer &buffer,
+                              endpoint_type *sender,
+                              handler_type handler)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0) {
+    post_transport_handler(service_, std::move(handler),
+      boost::system::error_code(boost::asio::error::bad_descriptor), 0);
+    return;
+  }
+
+  if (!received_.empty()) {
+    std::size_t length = deliver(received_.front(), buffer, sender);
+    received_.pop_front();
+    post_transport_handler(service_, std::move(handler), boost::system::error_code(), length);
+    return;
+  }
+
+  receive_pending_ = true;
+  receive_buffer_ = buffer;
+  receive_sender_ = sender;
+  receive_handler_ = std::move(handler);
+}
+
+std::size_t uring_transport::try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                              endpoint_type &sender,
+                                              boost::system::error_code &ec)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  ec = boost::system::error_code();
+
+  // Completions are reaped here as well, so that a receiver draining
+  // datagrams does not need to wait for the ring to be watched again
+  if (received_.empty())
+    reap();
+  if (received_.empty()) {
+    ec = boost::asio::error::would_block;
+    return 0;
+  }
+
+  std::size_t length = deliver(received_.front(), buffer, &sender);
+  received_.pop_front();
+  return length;
+}
+
+void uring_transport::async_send(const boost::asio::const_buffer &buffer,
+                                 handler_type handler)
+{
+  send(buffer, nullptr, std::move(handler));
+}
+
+void uring_transport::async_send_to(const boost::asio::const_buffer &buffer,
+                                    const endpoint_type &destination,
+                                    handler_type handler)
+{
+  send(buffer, &destination, std::move(handler));
+}
+
+void uring_transport::send(const boost::asio::const_buffer &buffer,
+                           const endpoint_type *destination,
+                           handler_type handler)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (socket_ < 0) {
+    post_transport_handler(service_, std::move(handler),
+      boost::system::error_code(boost::asio::error::bad_descriptor), 0);
+    return;
+  }
+
+  send_op *op;
+  if (free_send_ops_.empty()) {
+    send_ops_.emplace_back();
+    op = &send_ops_.back();
+  } else {
+    op = free_send_ops_.back();
+    free_send_ops_.pop_back();
+  }
+
+  std::memset(&op->message, 0, sizeof(op->message));
+  op->payload.iov_base = const_cast<void*>(buffer.data());
+  op->payload.iov_len = buffer.size();
+  op->message.msg_iov = &op->payload;
+  op->message.msg_iovlen = 1;
+  if (destination) {
+    std::memcpy(&op->destination, destination->data(), destination->size());
+    op->message.msg_name = &op->destination;
+    op->message.msg_namelen = static_cast<socklen_t>(destination->size());
+  }
+  op->handler = std::move(handler);
+
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = socket_;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&op->message);
+  sqe->len = 1;
+  sqe->user_data = reinterpret_cast<std::uint64_t>(op);
+
+  // Sends issued by the handlers that run before the submission is
+  // executed are submitted together with a single system call
+  if (!flush_pending_) {
+    flush_pending_ = true;
+    boost::weak_ptr<uring_transport> self(shared_from_this());
+    boost::asio::post(service_, [self]() {
+      if (boost::shared_ptr<uring_transport> transport = self.lock()) {
+        std::unique_lock<std::mutex> lock(transport->mutex_);
+        transport->flush_pending_ = false;
+        transport->submit();
+      }
+    });
+  }
+}
+
+io_uring_sqe *uring_transport::get_sqe()
+{
+  // Without kernel polling, entering the ring consumes all published
+  // entries, so a full queue only needs to be submitted
+  if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+    submit();
+
+  io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe_tail_++;
+  return sqe;
+}
+
+void uring_transport::submit()
+{
+  unsigned count = sqe_tail_ - sqe_submitted_;
+  if (count == 0)
+    return;
+
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  long submitted = syscall(__NR_io_uring_enter, ring_descriptor_.native_handle(), count, 0, 0, nullptr, 0);
+  if (submitted > 0)
+    sqe_submitted_ += static_cast<unsigned>(submitted);
+}
+
+void uring_transport::arm_receive()
+{
+  // A multishot receive without free buffers would terminate immediately,
+  // so it is armed again once a buffer has been returned
+  if (receive_armed_ || socket_ < 0 || buffers_free_ == 0)
+    return;
+
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = socket_;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&receive_message_);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = URING_RECEIVE_TAG;
+  receive_armed_ = true;
+  submit();
+}
+
+void uring_transport::provide_buffer(std::uint16_t id)
+{
+  // The ring is addressed as an array of buffers because the C++ layout
+  // of io_uring_buf_ring places its flexible array at the wrong offset;
+  // the ring tail overlays the reserved field of the first buffer
+  io_uring_buf *buffer = &buffer_ring_[buffer_tail_ & (buffer_count_ - 1)];
+  buffer->addr = reinterpret_cast<std::uint64_t>(&buffer_memory_[static_cast<std::size_t>(id) * URING_BUFFER_SIZE]);
+  buffer->len = URING_BUFFER_SIZE;
+  buffer->bid = id;
+  buffer_tail_++;
+  __atomic_store_n(&buffer_ring_[0].resv, buffer_tail_, __ATOMIC_RELEASE);
+  buffers_free_++;
+}
+
+std::size_t uring_transport::deliver(const datagram &d,
+                                     const boost::asio::mutable_buffer &buffer,
+                                     endpoint_type *sender)
+{
+  const unsigned char *payload = &buffer_memory_[static_cast<std::size_t>(d.buffer) * URING_BUFFER_SIZE] +
+    sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_storage);
+  std::size_t length = std::min(d.length, buffer.size());
+  std::memcpy(buffer.data(), payload, length);
+  if (sender)
+    *sender = d.sender;
+
+  provide_buffer(d.buffer);
+  arm_receive();
+  return length;
+}
+
+void uring_transport::wait_ring()
+{
+  boost::weak_ptr<uring_transport> self(shared_from_this());
+  ring_descriptor_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+    [self](const boost::system::error_code &error) {
+      if (boost::shared_ptr<uring_transport> transport = self.lock())
+        transport->handle_ring_ready(error);
+    });
+}
+
+void uring_transport::handle_ring_ready(const boost::system::error_code &error)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (error) {
+    ring_waiting_ = false;
+    return;
+  }
+
+  reap();
+  wait_ring();
+
+  // The reactor only reports new readiness, so completions that arrived
+  // before the wait was registered are reaped separately
+  if (*cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    boost::weak_ptr<uring_transport> self(shared_from_this());
+    boost::asio::post(service_, [self]() {
+      if (boost::shared_ptr<uring_transport> transport = self.lock()) {
+        std::unique_lock<std::mutex> lock(transport->mutex_);
+        transport->reap();
+      }
+    });
+  }
+}
+
+void uring_transport::reap()
+{
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+    if (cqe.user_data == URING_RECEIVE_TAG) {
+      handle_receive_completion(cqe.res, cqe.flags);
+    } else if (cqe.user_data != 0) {
+      send_op *op = reinterpret_cast<send_op*>(cqe.user_data);
+      if (cqe.res < 0) {
+        post_transport_handler(service_, std::move(op->handler),
+          boost::system::error_code(-cqe.res, boost::system::system_category()), 0);
+      } else {
+        post_transport_handler(service_, std::move(op->handler),
+          boost::system::error_code(), static_cast<std::size_t>(cqe.res));
+      }
+
+      free_send_ops_.push_back(op);
+    }
+  }
+
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  arm_receive();
+}
+
+void uring_transport::handle_receive_completion(int result, std::uint32_t flags)
+{
+  if (!(flags & IORING_CQE_F_MORE))
+    receive_armed_ = false;
+
+  if (result < 0) {
+    // Running out of buffers or being cancelled only ends the multishot
+    // receive, anything else is reported to the waiting receiver
+    if (result != -ENOBUFS && result != -ECANCELED && receive_pending_) {
+      receive_pending_ = false;
+      post_transport_handler(service_, std::move(receive_handler_),
+        boost::system::error_code(-result, boost::system::system_category()), 0);
+    }
+    return;
+  } else if (!(flags & IORING_CQE_F_BUFFER)) {
+    return;
+  }
+
+  std::uint16_t id = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+  buffers_free_--;
+
+  const unsigned char *base = &buffer_memory_[static_cast<std::size_t>(id) * URING_BUFFER_SIZE];
+  io_uring_recvmsg_out header;
+  std::memcpy(&header, base, sizeof(header));
+
+  // Datagrams that did not fit into a buffer or arrived after the socket
+  // has been closed are dropped
+  if ((header.flags & MSG_TRUNC) || socket_ < 0) {
+    provide_buffer(id);
+    return;
+  }
+
+  datagram d;
+  d.buffer = id;
+  d.length = header.payloadlen;
+  d.sender = endpoint_type(base + sizeof(header), std::min<std::size_t>(header.namelen, sizeof(sockaddr_storage)),
+    protocol_);
+
+  if (receive_pending_) {
+    receive_pending_ = false;
+    std::size_t length = deliver(d, receive_buffer_, receive_sender_);
+    post_transport_handler(service_, std::move(receive_handler_), boost::system::error_code(), length);
+  } else {
+    received_.push_back(d);
+  }
+}
+
+}
+
+}
+
+#undef URING_BUFFER_SIZE
+#undef URING_BUFFER_GROUP
+#undef URING_RECEIVE_TAG
+
+#endif
@@ -7,10 +7,17 @@
 #ifndef CURVECP_ASIO_DETAIL_IO_HPP
 #define CURVECP_ASIO_DETAIL_IO_HPP
 
+#include <curvecp/detail/completion.hpp>
+#include <curvecp/detail/handler_memory.hpp>
 #include <curvecp/detail/session.hpp>
 
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
 #include <boost/bind.hpp>
 
+#include <type_traits>
+#include <utility>
+
 namespace curvecp {
 
 namespace detail {
@@ -21,6 +28,13 @@ namespace detail {
 template <typename Stream, typename Operation, typename Handler>
 class io_op {
 public:
+  /// The executor used to invoke the handler
+  typedef typename boost::asio::associated_executor<Handler,
+    boost::asio::io_context::executor_type>::type executor_type;
+  /// The allocator used for intermediate handlers
+  typedef typename boost::asio::associated_allocator<Handler,
+    handler_allocator<void>>::type allocator_type;
+
   /**
    * Constructs an async IO operation.
    *
@@ -29,52 +43,92 @@ public:
    * @param op IO operation to perform
    * @param handler Handler to call after operation completes
    */
-  io_op(session &session, Stream &stream, const Operation &op, Handler &handler)
+  template <typename CompletionHandler>
+  io_op(session &session, Stream &stream, const Operation &op, BOOST_ASIO_MOVE_ARG(CompletionHandler) handler)
     : stream_(stream),
       op_(op),
-      handler_(BOOST_ASIO_MOVE_CAST(Handler)(handler)),
+      handler_(BOOST_ASIO_MOVE_CAST(CompletionHandler)(handler)),
+      work_(boost::asio::get_associated_executor(handler_, stream.get_io_context().get_executor())),
       session_(session),
+      bytes_transferred_(0),
       finished_(false)
   {
+    cancellation_.install(handler_, waker{ &session });
+  }
+
+  /**
+   * Returns the executor associated with the handler.
+   */
+  executor_type get_executor() const
+  {
+    return boost::asio::get_associated_executor(handler_, stream_.get_io_context().get_executor());
+  }
+
+  /**
+   * Returns the allocator associated with the handler, or the recycling
+   * allocator of the session when the handler does not specify one.
+   */
+  allocator_type get_allocator() const
+  {
+    return boost::asio::get_associated_allocator(handler_, handler_allocator<void>(session_.get_handler_memory()));
   }
 
   /**
    * Executes the IO operation. If the operation needs to be retried
-   * it is scheduled via the underlying stream.
+   * it is scheduled via the underlying stream. The error code of a wait
+   * on the session is ignored, as waits are cancelled to wake up the
+   * operation and the operation itself reports its result.
    *
    * @param start Set to true for direct invocation by caller
    */
-  void operator()(const boost::system::error_code &ec = boost::system::error_code(),
+  void operator()(const boost::system::error_code &/*ec*/ = boost::system::error_code(),
                   bool start = false)
   {
     if (!finished_) {
       // Ensure that this I/O operation is dispatched via the session strand; if it
       // is not, defer execution via the strand
       if (!session_.get_strand().running_in_this_thread())
-        return session_.get_strand().dispatch(BOOST_ASIO_MOVE_CAST(io_op)(*this));
+        return boost::asio::dispatch(session_.get_strand(), BOOST_ASIO_MOVE_CAST(io_op)(*this));
 
-      session::want result = op_(session_, ec_, bytes_transferred_);
-      if (result != session::want::nothing)
-        return session_.async_pending_wait(result, BOOST_ASIO_MOVE_CAST(io_op)(*this));
+      if (cancellation_.cancelled()) {
+        op_.abort(session_, ec_, bytes_transferred_);
+      } else {
+        session::want result = op_(session_, ec_, bytes_transferred_);
+        if (result != session::want::nothing)
+          return session_.async_pending_wait(result, BOOST_ASIO_MOVE_CAST(io_op)(*this));
+      }
 
+      // Invoke the handler through its associated executor; when we are called
+      // directly by the async operation, the invocation must be deferred
       finished_ = true;
-      if (start) {
-        // We are being called directly by the async operation, so need to
-        // defer the invocation of the handler
-        stream_.get_io_service().post(BOOST_ASIO_MOVE_CAST(io_op)(*this));
-        return;
-      }
+      cancellation_.clear(handler_);
+      return dispatch_completion(handler_, stream_.get_io_context().get_executor(), start,
+        BOOST_ASIO_MOVE_CAST(io_op)(*this));
     }
 
+    work_.reset();
     op_.call_handler(handler_, ec_, bytes_transferred_);
   }
 private:
+  /**
+   * Wakes up a cancelled operation waiting on the session.
+   */
+  struct waker {
+    session *session_;
+
+    void operator()() const { session_->cancel_pending_waits(); }
+  };
+
   /// Stream reference
   Stream &stream_;
   /// IO operation to perform
   Operation op_;
   /// Handler to call after operation completes
   Handler handler_;
+  /// Outstanding work on the handler executor
+  handler_work<executor_type> work_;
+  /// Cancellation state
+  operation_cancellation cancellation_;
   /// Internal CurveCP session reference
   session &session_;
   /// Resulting error code
@@ -85,6 +139,32 @@ private:
   bool finished_;
 };
 
+/**
+ * Initiation function object for IO operations, used with async_initiate.
+ */
+template <typename Stream>
+class initiate_io_op {
+public:
+  /**
+   * Constructs the initiation function object.
+   *
+   * @param stream Stream reference
+   */
+  explicit initiate_io_op(Stream &stream)
+    : stream_(stream)
+  {
+  }
+
+  template <typename Handler, typename Operation>
+  void operator()(BOOST_ASIO_MOVE_ARG(Handler) handler, const Operation &op) const
+  {
+    stream_.async_io_operation(op, BOOST_ASIO_MOVE_CAST(Handler)(handler));
+  }
+private:
+  /// Stream reference
+  Stream &stream_;
+};
+
 }
 
 }
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_LOOPBACK_TRANSPORT_HPP
+#define CURVECP_ASIO_DETAIL_LOOPBACK_TRANSPORT_HPP
+
+#include <curvecp/detail/datagram_queue.hpp>
+#include <curvecp/detail/transport.hpp>
+
+#include <map>
+#include <mutex>
+
+namespace curvecp {
+
+namespace detail {
+
+class loopback_transport;
+
+/**
+ * In-process datagram network connecting loopback transports. Any endpoint
+ * type may be used as an address; unbound transports are assigned an
+ * ephemeral 127.0.0.1 UDP endpoint on first use.
+ */
+class loopback_network {
+public:
+  friend class loopback_transport;
+
+  /**
+   * Constructs a new empty loopback network.
+   */
+  loopback_network()
+    : next_port_(49152)
+  {
+  }
+
+  loopback_network(const loopback_network&) = delete;
+  loopback_network &operator=(const loopback_network&) = delete;
+protected:
+  inline void attach(const transport::endpoint_type &endpoint, loopback_transport *transport);
+
+  inline transport::endpoint_type attach_ephemeral(loopback_transport *transport);
+
+  inline void detach(const transport::endpoint_type &endpoint);
+
+  inline void deliver(const transport::endpoint_type &source,
+                      const transport::endpoint_type &destination,
+                      const boost::asio::const_buffer &buffer);
+private:
+  /// Mutex
+  std::mutex mutex_;
+  /// Transports attached to the network
+  std::map<transport::endpoint_type, loopback_transport*> transports_;
+  /// Next ephemeral port to try
+  unsigned short next_port_;
+};
+
+/**
+ * Transport that exchanges datagrams with other transports on the same
+ * loopback network without any system calls. Like UDP, datagrams sent to
+ * unknown endpoints or arriving at a full receive queue are dropped.
+ */
+class loopback_transport : public transport {
+public:
+  friend class loopback_network;
+
+  /**
+   * Constructs a new loopback transport.
+   *
+   * @param service ASIO IO context
+   * @param network Loopback network to attach to
+   */
+  inline loopback_transport(boost::asio::io_context &service, loopback_network &network);
+
+  inline ~loopback_transport();
+
+  loopback_transport(const loopback_transport&) = delete;
+  loopback_transport &operator=(const loopback_transport&) = delete;
+
+  boost::asio::io_context &get_io_context() override { return service_; }
+
+  /**
+   * Configures the maximum number of datagrams queued for reception.
+   *
+   * @param value Maximum number of queued datagrams
+   */
+  void set_receive_queue_maximum(std::size_t value) { receive_queue_.set_maximum(value); }
+
+  inline void bind(const endpoint_type &endpoint) override;
+
+  inline void connect(const endpoint_type &endpoint) override;
+
+  void open(const endpoint_type&) override { ensure_attached(); }
+
+  inline void close() override;
+
+  inline endpoint_type local_endpoint() const override;
+
+  inline void async_receive(const boost::asio::mutable_buffer &buffer,
+                            handler_type handler) override;
+
+  inline void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                 endpoint_type &sender,
+                                 handler_type handler) override;
+
+  inline std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                      endpoint_type &sender,
+                                      boost::system::error_code &ec) override;
+
+  inline void async_send(const boost::asio::const_buffer &buffer,
+                         handler_type handler) override;
+
+  inline void async_send_to(const boost::asio::const_buffer &buffer,
+                            const endpoint_type &destination,
+                            handler_type handler) override;
+protected:
+  inline void enqueue(const endpoint_type &source, const boost::asio::const_buffer &buffer);
+
+  inline void ensure_attached();
+private:
+  /// ASIO IO context
+  boost::asio::io_context &service_;
+  /// Loopback network
+  loopback_network &network_;
+  /// Mutex
+  mutable std::mutex mutex_;
+  /// True when attached to the network
+  bool attached_;
+  /// Local endpoint
+  endpoint_type local_;
+  /// True when connected to a remote endpoint
+  bool connected_;
+  /// Connected remote endpoint
+  endpoint_type remote_;
+  /// Sender destination for receives on a connected transport
+  endpoint_type connected_sender_;
+  /// Datagrams waiting for reception
+  datagram_queue receive_queue_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/loopback_transport.ipp>
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_MULTIPATH_TRANSPORT_HPP
+#define CURVECP_ASIO_DETAIL_MULTIPATH_TRANSPORT_HPP
+
+#include <curvecp/detail/datagram_queue.hpp>
+#include <curvecp/detail/transport.hpp>
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Transport that spreads datagrams over several paths, each of them a
+ * transport of its own, such as sockets bound to different local ports or
+ * interfaces. CurveCP servers identify sessions by the client short-term
+ * key rather than by address, so every packet of a session may take any
+ * path and a retransmitted block usually leaves on another path than the
+ * lost one.
+ *
+ * Multipath transports on both ends exchange small probes over every path
+ * to measure its round-trip time and loss. Each datagram is sent over one
+ * of the paths that are up, which are chosen in proportion to
+ * (1 - loss)^2 / rtt, so faster paths carry more traffic and a path that
+ * stops answering probes carries none until it recovers. Probes carry a
+ * random group identifier of the sending transport, which lets the remote
+ * transport recognize the endpoints of all paths of its peer and spread
+ * its replies the same way once each endpoint has answered a probe of its
+ * own. Peers that do not use a multipath transport simply drop the probes,
+ * in which case all paths look lossy and are used alike.
+ *
+ * Paths must be added before the transport is used and the transport must
+ * be owned by a boost::shared_ptr.
+ */
+class multipath_transport : public transport,
+                            public boost::enable_shared_from_this<multipath_transport> {
+public:
+  /**
+   * Statistics of a path to a remote endpoint.
+   */
+  struct path_statistics {
+    /// Index of the local path
+    std::size_t path;
+    /// Remote endpoint
+    endpoint_type remote;
+    /// Smoothed round-trip time, zero until measured
+    boost::posix_time::time_duration rtt;
+    /// Smoothed fraction of probes that were lost
+    double loss;
+    /// True when the path is used for sending
+    bool up;
+    /// Number of datagrams sent
+    std::uint64_t sent;
+    /// Number of datagrams received
+    std::uint64_t received;
+  };
+
+  /// Size of a probe datagram
+  static const std::size_t probe_size = 32;
+  /// Maximum number of probes of a path waiting for an answer
+  static const std::size_t maximum_probes = 16;
+  /// Maximum number of remote endpoints learned from probes
+  static const std::size_t maximum_learned_targets = 65536;
+  /// Maximum number of remembered routes to unknown endpoints
+  static const std::size_t maximum_routes = 65536;
+
+  /**
+   * Constructs a new multipath transport without any paths.
+   *
+   * @param service ASIO IO context
+   */
+  inline explicit multipath_transport(boost::asio::io_context &service);
+
+  inline ~multipath_transport();
+
+  multipath_transport(const multipath_transport&) = delete;
+  multipath_transport &operator=(const multipath_transport&) = delete;
+
+  /**
+   * Adds a path over the given transport. When the multipath transport is
+   * connected, the path transport is connected to the endpoint given to
+   * connect(). Servers add a path for each transport they listen on; the
+   * first path is bound by bind(), the others must already be bound.
+   *
+   * @param path Transport of the path
+   * @return Index of the path
+   */
+  inline std::size_t add_path(boost::shared_ptr<transport> path);
+
+  /**
+   * Adds a path over the given transport that leads to a specific remote
+   * endpoint, such as another address or port of the same server. When the
+   * multipath transport is connected, the path transport is connected to
+   * this endpoint instead of the one given to connect().
+   *
+   * @param path Transport of the path
+   * @param remote Remote endpoint of the path
+   * @return Index of the path
+   */
+  inline std::size_t add_path(boost::shared_ptr<transport> path, const endpoint_type &remote);
+
+  /**
+   * Configures the interval between probes sent over each path.
+   *
+   * @param interval Probe interval
+   */
+  inline void set_probe_interval(const boost::posix_time::time_duration &interval);
+
+  /**
+   * Configures the time without answered probes after which a path is
+   * considered down and no longer used for sending.
+   *
+   * @param timeout Path timeout
+   */
+  inline void set_path_timeout(const boost::posix_time::time_duration &timeout);
+
+  /**
+   * Returns the statistics of all paths to remote endpoints.
+   */
+  inline std::vector<path_statistics> get_path_statistics() const;
+
+  boost::asio::io_context &get_io_context() override { return service_; }
+
+  inline void bind(const endpoint_type &endpoint) override;
+
+  inline void connect(const endpoint_type &endpoint) override;
+
+  inline void open(const endpoint_type &endpoint) override;
+
+  inline void close() override;
+
+  inline endpoint_type local_endpoint() const override;
+
+  inline void async_receive(const boost::asio::mutable_buffer &buffer,
+                            handler_type handler) override;
+
+  inline void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                 endpoint_type &sender,
+                                 handler_type handler) override;
+
+  inline std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                      endpoint_type &sender,
+                                      boost::system::error_code &ec) override;
+
+  inline std::size_t maximum_datagram_size() const override;
+
+  inline void async_send(const boost::asio::const_buffer &buffer,
+                         handler_type handler) override;
+
+  inline void async_send_to(const boost::asio::const_buffer &buffer,
+                            const endpoint_type &destination,
+                            handler_type handler) override;
+protected:
+  /// Remote endpoint and index of the local path it is reached over
+  typedef std::pair<endpoint_type, std::size_t> target_key;
+
+  /**
+   * A probe that has not been answered yet.
+   */
+  struct probe_record {
+    /// Random token echoed by the answer
+    std::uint64_t token;
+    /// Time the probe was sent, in microseconds
+    std::int64_t sent;
+  };
+
+  /**
+   * A remote endpoint reached over a local path.
+   */
+  struct target_state {
+    /// True when sent to over the connected path transport
+    bool connected;
+    /// True when learned from probes of the peer
+    bool learned;
+    /// True once the endpoint has answered a probe
+    bool validated;
+    /// True when the target is used for sending
+    bool up;
+    /// Group identifier of the peer, zero when unknown
+    std::uint64_t group;
+    /// Smoothed round-trip time in microseconds, zero until measured
+    std::int64_t srtt;
+    /// Round-trip time variation in microseconds
+    std::int64_t rttvar;
+    /// Smoothed fraction of lost probes
+    double loss;
+    /// Virtual time of the scheduler
+    double pass;
+    /// Time of the last answered probe, in microseconds
+    std::int64_t last_answer;
+    /// Time of the last datagram received from the target, in microseconds
+    std::int64_t last_heard;
+    /// Number of consecutive probes that were not answered
+    unsigned unanswered;
+    /// Probes waiting for an answer
+    std::deque<probe_record> probes;
+    /// Number of datagrams sent
+    std::uint64_t sent;
+    /// Number of datagrams received
+    std::uint64_t received;
+  };
+
+  /**
+   * A local path along with its receive state.
+   */
+  struct path_state {
+    /// Transport of the path
+    boost::shared_ptr<detail::transport> transport;
+    /// True when the path leads to a specific remote endpoint
+    bool has_remote;
+    /// Remote endpoint of the path
+    endpoint_type remote;
+    /// Receive buffer space
+    std::vector<unsigned char> buffer;
+    /// Sender of the last received datagram
+    endpoint_type sender;
+  };
+
+  inline void start();
+
+  inline void start_receive(std::size_t index);
+
+  inline static void handle_receive(boost::weak_ptr<multipath_transport> weak,
+                                    std::size_t index,
+                                    const boost::system::error_code &error,
+                                    std::size_t bytes);
+
+  inline void process(std::size_t index, std::size_t length);
+
+  inline void handle_probe(std::size_t index, const endpoint_type &source,
+                           const unsigned char *data);
+
+  inline static void handle_probe_timer(boost::weak_ptr<multipath_transport> weak,
+                                        const boost::system::error_code &error);
+
+  inline void schedule_probes();
+
+  inline void send_probe(std::size_t path, const endpoint_type &remote, bool connected,
+                         unsigned char type, std::uint64_t token);
+
+  inline target_state &add_target(const target_key &key, bool connected, bool learned,
+                                  std::int64_t now);
+
+  inline std::map<target_key, target_state>::iterator erase_target(std::map<target_key, target_state>::iterator it);
+
+  inline void resume(const target_key &key, target_state &target);
+
+  inline std::map<target_key, target_state>::iterator pick(const std::vector<target_key> &candidates);
+
+  inline void send_via(const target_key &key, bool connected,
+                       const boost::asio::const_buffer &buffer, handler_type handler);
+
+  inline static std::int64_t now();
+private:
+  /// ASIO IO context
+  boost::asio::io_context &service_;
+  /// Mutex protecting paths and targets
+  mutable std::mutex mutex_;
+  /// Local paths
+  std::vector<path_state> paths_;
+  /// Remote endpoints reached over each path
+  std::map<target_key, target_state> targets_;
+  /// Learned targets by the group identifier of their peer
+  std::map<std::uint64_t, std::vector<target_key>> groups_;
+  /// Number of targets learned from probes
+  std::size_t learned_;
+  /// Path over which datagrams from unknown endpoints were last received
+  std::map<endpoint_type, std::size_t> routes_;
+  /// Route insertion order, used to bound the number of routes
+  std::deque<endpoint_type> route_order_;
+  /// Random group identifier of this transport
+  std::uint64_t group_;
+  /// Source of group identifiers and probe tokens
+  std::mt19937_64 random_;
+  /// True once receiving and probing have been started
+  bool started_;
+  /// True while connected to remote endpoints
+  bool connected_;
+  /// Interval between probes
+  boost::posix_time::time_duration probe_interval_;
+  /// Time without answered probes after which a path is down
+  boost::posix_time::time_duration path_timeout_;
+  /// Probe timer
+  boost::asio::deadline_timer probe_timer_;
+  /// Sender destination for receives on a connected transport
+  endpoint_type connected_sender_;
+  /// Datagrams waiting for reception
+  datagram_queue receive_queue_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/multipath_transport.ipp>
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_READ_EXACTLY_OP_HPP
+#define CURVECP_ASIO_DETAIL_READ_EXACTLY_OP_HPP
+
+#include <curvecp/detail/session.hpp>
+
+#include <iterator>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Implementation of an async read operation that fills all buffers of the
+ * sequence. Each execution drains as much received data as is available
+ * and the operation only waits when the session runs out of data.
+ */
+template <typename MutableBufferSequence>
+class read_exactly_op {
+public:
+  /**
+   * Constructs an async read operation.
+   *
+   * @param buffers A mutable buffer sequence to write to
+   */
+  read_exactly_op(const MutableBufferSequence& buffers)
+    : buffers_(buffers),
+      index_(0),
+      total_(0)
+  {
+  }
+
+  /**
+   * Executes the read operation.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   * @return Whether the operation should be retried
+   */
+  session::want operator()(session &session,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred)
+  {
+    auto it = boost::asio::buffer_sequence_begin(buffers_);
+    auto end = boost::asio::buffer_sequence_end(buffers_);
+    std::advance(it, index_);
+
+    for (; it != end; ++it, ++index_) {
+      std::size_t bytes;
+      if (!session.read(boost::asio::mutable_buffer(*it), ec, bytes))
+        return session::want::read;
+
+      total_ += bytes;
+      if (ec)
+        break;
+    }
+
+    bytes_transferred = total_;
+    return session::want::nothing;
+  }
+
+  /**
+   * Abandons the read operation after it has been cancelled. Data that has
+   * already been read into the buffers is reported as transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session &session,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = total_ + session.abort_read();
+  }
+
+  /**
+   * Calls the handler for this operation.
+   *
+   * @param handler Handler reference
+   * @param ec Error code
+   * @param bytes_transferred Number of bytes transferred
+   */
+  template <typename Handler>
+  void call_handler(Handler &handler,
+                    const boost::system::error_code &ec,
+                    const std::size_t &bytes_transferred) const
+  {
+    handler(ec, bytes_transferred);
+  }
+private:
+  /// Buffers to read into
+  MutableBufferSequence buffers_;
+  /// Index of the buffer currently being filled
+  std::size_t index_;
+  /// Number of bytes read into completely filled buffers
+  std::size_t total_;
+};
+
+}
+
+}
+
+#endif
@@ -48,6 +48,22 @@ public:
     return session.read(buffer, ec, bytes_transferred) ? session::want::nothing : session::want::read;
   }
 
+  /**
+   * Abandons the read operation after it has been cancelled. Data that has
+   * already been read into the buffer is reported as transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session &session,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = session.abort_read();
+  }
+
   /**
    * Calls the handler for this operation.
    *
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_READ_UNTIL_OP_HPP
+#define CURVECP_ASIO_DETAIL_READ_UNTIL_OP_HPP
+
+#include <curvecp/detail/session.hpp>
+
+#include <string>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Implementation of an async read operation that reads up to and including
+ * a delimiter. Received data is searched in place and the search resumes
+ * where it stopped when more data arrives.
+ */
+template <typename DynamicBuffer>
+class read_until_op {
+public:
+  /**
+   * Constructs an async delimited read operation.
+   *
+   * @param buffers Dynamic buffer to append to
+   * @param delimiter Delimiter to search for
+   */
+  read_until_op(const DynamicBuffer &buffers, const std::string &delimiter)
+    : buffers_(buffers),
+      delimiter_(delimiter),
+      searched_(0)
+  {
+  }
+
+  /**
+   * Executes the read operation.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   * @return Whether the operation should be retried
+   */
+  session::want operator()(session &session,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred)
+  {
+    return session.read_until(buffers_, delimiter_, searched_, ec, bytes_transferred) ?
+      session::want::nothing : session::want::read;
+  }
+
+  /**
+   * Abandons the read operation after it has been cancelled. Data is only
+   * moved into the buffer on completion, so nothing has been transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session&,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = 0;
+  }
+
+  /**
+   * Calls the handler for this operation.
+   *
+   * @param handler Handler reference
+   * @param ec Error code
+   * @param bytes_transferred Number of bytes transferred
+   */
+  template <typename Handler>
+  void call_handler(Handler &handler,
+                    const boost::system::error_code &ec,
+                    const std::size_t &bytes_transferred) const
+  {
+    handler(ec, bytes_transferred);
+  }
+private:
+  /// Buffer to append to
+  DynamicBuffer buffers_;
+  /// Delimiter to search for
+  std::string delimiter_;
+  /// Number of bytes already ruled out as the start of the delimiter
+  std::size_t searched_;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_RECEIVE_MESSAGE_OP_HPP
+#define CURVECP_ASIO_DETAIL_RECEIVE_MESSAGE_OP_HPP
+
+#include <curvecp/detail/session.hpp>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Implementation of an async message receive operation. Completes once a
+ * whole message has been received.
+ */
+template <typename MutableBufferSequence>
+class receive_message_op {
+public:
+  /**
+   * Constructs an async message receive operation.
+   *
+   * @param buffers A mutable buffer sequence to write to
+   */
+  receive_message_op(const MutableBufferSequence& buffers)
+    : buffers_(buffers)
+  {
+  }
+
+  /**
+   * Executes the message receive operation.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   * @return Whether the operation should be retried
+   */
+  session::want operator()(session &session,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred) const
+  {
+    return session.read_message(buffers_, ec, bytes_transferred) ? session::want::nothing : session::want::read;
+  }
+
+  /**
+   * Abandons the message receive operation after it has been cancelled.
+   * Messages are only consumed as a whole, so nothing has been transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session&,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = 0;
+  }
+
+  /**
+   * Calls the handler for this operation.
+   *
+   * @param handler Handler reference
+   * @param ec Error code
+   * @param bytes_transferred Number of bytes transferred
+   */
+  template <typename Handler>
+  void call_handler(Handler &handler,
+                    const boost::system::error_code &ec,
+                    const std::size_t &bytes_transferred) const
+  {
+    handler(ec, bytes_transferred);
+  }
+private:
+  MutableBufferSequence buffers_;
+};
+
+}
+
+}
+
+#endif
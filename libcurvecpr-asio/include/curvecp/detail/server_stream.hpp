@@ -30,9 +30,9 @@ public:
                        boost::shared_ptr<session> session);
 
   /**
-   * Returns the ASIO IO service associated with this stream.
+   * Returns the ASIO IO context associated with this stream.
    */
-  boost::asio::io_service &get_io_service() { return acceptor_->get_io_service(); }
+  boost::asio::io_context &get_io_context() { return acceptor_->get_io_context(); }
 protected:
   /// Parent acceptor instance
   boost::shared_ptr<acceptor> acceptor_;
@@ -9,16 +9,35 @@
 
 #include <curvecpr.h>
 
-#include <boost/asio/io_service.hpp>
+#include <curvecp/detail/byte_search.hpp>
+#include <curvecp/detail/compression_layer.hpp>
+#include <curvecp/detail/fec_layer.hpp>
+#include <curvecp/detail/handler_memory.hpp>
+#include <curvecp/detail/substream_layer.hpp>
+#include <curvecp/detail/transport.hpp>
+
+#include <boost/asio/io_context.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/dispatch.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/buffer.hpp>
-#include <boost/asio/ip/udp.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <boost/intrusive/list_hook.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
 #include <set>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace curvecp {
@@ -28,12 +47,16 @@ namespace detail {
 class acceptor;
 
 /**
- * An internal CurveCP session implementation.
+ * An internal CurveCP session implementation. Sessions owned by a shared
+ * pointer are kept alive by their outstanding timer and receive handlers.
  */
-class session {
+class session : public boost::enable_shared_from_this<session> {
 public:
   friend class curvecp::detail::acceptor;
 
+  /// The strand type used to serialize session access
+  typedef boost::asio::strand<boost::asio::io_context::executor_type> strand_type;
+
   /**
    * Type of CurveCP session.
    */
@@ -58,19 +81,48 @@ public:
     close
   };
 
+  /**
+   * Counters of the unreliable datagram channel.
+   */
+  struct datagram_counters {
+    /// Number of datagrams sent
+    std::uint64_t sent;
+    /// Number of datagrams received and queued
+    std::uint64_t received;
+    /// Number of received datagrams dropped because the queue was full
+    std::uint64_t dropped;
+    /// Number of datagrams truncated because the read buffers were too small
+    std::uint64_t truncated;
+  };
+
+  /// Counters of forward error correction
+  typedef fec_layer::counters fec_counters;
+
+  /// Counters of stream compression
+  typedef compression_layer::counters compression_counters;
+
+  /// Maximum size of a single datagram
+  static const std::size_t maximum_datagram_size = 1086;
+
   /**
    * Constructs an internal CurveCP session implementation.
    *
-   * @param service ASIO IO service
+   * @param service ASIO IO context
    * @param session_type Session type
    */
-  inline session(boost::asio::io_service &service,
+  inline session(boost::asio::io_context &service,
                  type session_type);
 
   /**
    * Returns the ASIO strand that is allowed to call this session.
    */
-  boost::asio::strand &get_strand() { return strand_; }
+  strand_type &get_strand() { return strand_; }
+
+  /**
+   * Returns the memory used for intermediate handlers of operations on
+   * this session.
+   */
+  handler_memory &get_handler_memory() { return handler_memory_; }
 
   /**
    * Schedules a handler to be executed after the session is ready for
@@ -83,7 +135,40 @@ public:
   inline void async_pending_wait(want what, BOOST_ASIO_MOVE_ARG(Handler) handler);
 
   /**
-   * Starts session send queue processing.
+   * Wakes up all handlers waiting for the session to become ready, so that
+   * cancelled operations can complete. Handlers of operations that were
+   * not cancelled simply wait again. Safe to call from any thread.
+   */
+  inline void cancel_pending_waits();
+
+  /**
+   * Executes a function on the session strand and waits for its result.
+   * When called from a thread that runs the IO context, the function runs
+   * inline unless another thread currently holds the strand, in which case
+   * the caller waits for the strand to execute it. When called from any
+   * other thread, some thread must be running the IO context.
+   *
+   * @param function Function to execute
+   * @return Result of the function
+   */
+  template <typename Function>
+  inline typename std::result_of<Function()>::type invoke(Function function);
+
+  /**
+   * Executes a function on the session strand when the strand can be
+   * entered without waiting, which is the case on the strand itself and,
+   * from a thread that runs the IO context, when no other thread holds it.
+   *
+   * @param function Function to execute
+   * @return True when the function has been executed
+   */
+  template <typename Function>
+  inline bool try_invoke(Function function);
+
+  /**
+   * Starts session send queue processing on the session strand. Data
+   * written before the session is started is sent right away. Has no
+   * effect when the session is already running or has been closed.
    */
   inline void start();
 
@@ -120,7 +205,11 @@ public:
    *
    * @param value Maximum number of unacknowledged sent blocks
    */
-  void set_sendmarkq_maximum(std::size_t value) { sendmarkq_maximum_ = value; }
+  void set_sendmarkq_maximum(std::size_t value)
+  {
+    sendmarkq_maximum_ = value;
+    fec_.set_window(value);
+  }
 
   /**
    * Configures the maximum number of unacknowledged received blocks.
@@ -129,18 +218,141 @@ public:
    */
   void set_recvmarkq_maximum(std::size_t value) { recvmarkq_maximum_ = value; }
 
+  /**
+   * Enables reliable but unordered delivery of messages. Each message is
+   * then delivered as soon as all of its blocks have been received, even
+   * when earlier messages are still waiting for retransmissions, while
+   * acknowledgements and retransmissions work as usual. Blocks are cut at
+   * message boundaries and tagged, so the mode must be enabled on both
+   * peers before any message is sent or received, and the session may only
+   * be used with message operations.
+   *
+   * @param value True to deliver messages out of order
+   */
+  void set_unordered_messages(bool value) { unordered_messages_ = value; }
+
+  /**
+   * Enables multiplexing of logical substreams over this session. Blocks
+   * then carry framed data of many substreams, each with its own flow
+   * control, so opening a substream needs neither a handshake nor a session
+   * of its own. Must be enabled on both peers before any data is exchanged
+   * and the session may then only be used through substreams.
+   *
+   * @param value True to multiplex substreams
+   */
+  void set_multiplexed(bool value) { multiplexed_ = value; }
+
+  /**
+   * Configures the receive window of each substream. The window is also
+   * the initial send credit of substreams and bounds their send buffers,
+   * so both peers must use the same value.
+   *
+   * @param value Window size in bytes
+   */
+  void set_substream_window(std::size_t value) { substreams_.set_window(value); }
+
+  /**
+   * Configures the maximum number of received datagrams that are queued
+   * until they are read. When the queue is full, the oldest datagram is
+   * dropped.
+   *
+   * @param value Maximum number of queued datagrams
+   */
+  void set_datagram_queue_maximum(std::size_t value) { datagram_queue_maximum_ = value; }
+
+  /**
+   * Enables the unreliable datagram channel. Datagrams travel in frames
+   * that are not messager messages, so peers first announce whether they
+   * accept them in a hello that starts their stream and datagrams are only
+   * sent to a peer that has done so. Must be enabled before any data is
+   * exchanged.
+   *
+   * @param value True to accept and send datagrams
+   */
+  void set_datagrams(bool value) { datagrams_enabled_ = value; }
+
+  /**
+   * Returns the datagram channel counters. This method must only be called
+   * from within the session strand!
+   */
+  const datagram_counters &get_datagram_counters() const { return datagram_counters_; }
+
+  /**
+   * Enables forward error correction of sent blocks. Blocks are protected
+   * in groups and after each group the given number of repairs is sent,
+   * so the peer can rebuild as many lost blocks of the group as it has
+   * received repairs without waiting for retransmissions. Rebuilt blocks
+   * are acknowledged with the next message, so they are not retransmitted
+   * when that message arrives in time. A single repair is the XOR of the
+   * group; more repairs use a Cauchy Reed-Solomon code. Incomplete groups
+   * are closed when the send queue runs empty. Must be enabled on both
+   * peers, which may use different group sizes. Repairs are only sent
+   * once the peer has announced in its hello that it accepts them. The
+   * receiver keeps copies
+   * of the blocks and the repairs of all groups that fit in the send
+   * window, which is assumed to be the same on both peers, so with the
+   * default window of 512 blocks this takes up to about 1 MB per session.
+   *
+   * @param data_blocks Number of blocks in a group, at most 16
+   * @param repair_blocks Number of repairs per group, at most 16 or zero
+   *   to disable forward error correction
+   */
+  void set_forward_error_correction(std::size_t data_blocks, std::size_t repair_blocks)
+  {
+    fec_.configure(data_blocks, repair_blocks);
+  }
+
+  /**
+   * Returns the forward error correction counters. This method must only
+   * be called from within the session strand!
+   */
+  const fec_counters &get_fec_counters() const { return fec_.get_counters(); }
+
+  /**
+   * Enables compression of the byte stream. Written data is compressed in
+   * chunks with zstd before it is cut into blocks and decompressed again
+   * on reads. A session with compression enabled announces in its hello
+   * that its stream is framed in chunks and which codecs it can
+   * decompress, so the peer reads the stream whether or not it compresses
+   * itself, and chunks are only compressed for a peer that has announced
+   * that it can decompress them. Until then, and for peers that never do,
+   * chunks are sent raw. Chunks that do not compress well are sent as they
+   * are and compression is then retried after an exponentially growing
+   * number of chunks, so incompressible data costs little. Framing is
+   * decided when the first block is sent, so compression must be enabled
+   * before any data is exchanged; disabling it later sends the remaining
+   * chunks raw. The session may then only be used with byte stream
+   * operations. Safe to call from any thread.
+   *
+   * @param value True to compress the byte stream
+   */
+  inline void set_compression(bool value);
+
+  /**
+   * Configures the zstd compression level.
+   *
+   * @param value Compression level, 3 by default
+   */
+  void set_compression_level(int value) { compression_.set_level(value); }
+
+  /**
+   * Returns the stream compression counters. This method must only be
+   * called from within the session strand!
+   */
+  const compression_counters &get_compression_counters() const { return compression_.get_counters(); }
+
   /**
    * Configures the session remote endpoint. Only used for server
    * sessions.
    *
    * @param endpoint Session endpoint
    */
-  void set_endpoint(const boost::asio::ip::udp::endpoint &endpoint) { endpoint_ = endpoint; }
+  void set_endpoint(const transport::endpoint_type &endpoint) { endpoint_ = endpoint; }
 
   /**
    * Returns the configured session endpoint.
    */
-  boost::asio::ip::udp::endpoint get_endpoint() const { return endpoint_; }
+  transport::endpoint_type get_endpoint() const { return endpoint_; }
 
   /**
    * Closes this session. This method must only be called from within the
@@ -150,6 +362,13 @@ public:
    */
   inline bool close();
 
+  /**
+   * Terminates this session without waiting for the peer, releasing its
+   * buffers and timers. Pending and later reads and writes complete with
+   * EOF. This method must only be called from within the session strand!
+   */
+  inline void expire();
+
   /**
    * Handles receive event from underlying CurveCP client/server.
    */
@@ -168,6 +387,57 @@ public:
                    boost::system::error_code &ec,
                    std::size_t &bytes_transferred);
 
+  /**
+   * Abandons a read that has not yet been completed. This method must only
+   * be called from within the session strand!
+   *
+   * @return Number of bytes already transferred into the read buffer
+   */
+  inline std::size_t abort_read();
+
+  /**
+   * Reads data that has already been received in order, without waiting.
+   * Must not be used while a read operation is outstanding. This method
+   * must only be called from within the session strand!
+   *
+   * @param data Destination buffer to read into
+   * @param ec Resulting error code, would_block when no data is available
+   * @return Number of bytes transferred
+   */
+  inline std::size_t read_some(const boost::asio::mutable_buffer &data,
+                               boost::system::error_code &ec);
+
+  /**
+   * Returns the number of bytes that have been received in order and can
+   * be read without waiting. This method must only be called from within
+   * the session strand!
+   */
+  inline std::size_t available();
+
+  /**
+   * Reads data up to and including a delimiter into a dynamic buffer. The
+   * delimiter is searched for directly in the received blocks, continuing
+   * with the data already in the buffer, and only the bytes up to its end
+   * are moved into the buffer. On EOF the remaining data is moved into the
+   * buffer. This method must only be called from within the session strand!
+   *
+   * @param buffers Dynamic buffer to append to
+   * @param delimiter Delimiter to search for
+   * @param searched Number of bytes known not to start the delimiter, kept
+   *   between retries of the same read
+   * @param ec Resulting error code, not_found when the buffer would exceed
+   *   its maximum size
+   * @param bytes_transferred Resulting size of the buffer up to and
+   *   including the delimiter
+   * @return True when read has been completed, false when it must be retried
+   */
+  template <typename DynamicBuffer>
+  inline bool read_until(DynamicBuffer &buffers,
+                         const std::string &delimiter,
+                         std::size_t &searched,
+                         boost::system::error_code &ec,
+                         std::size_t &bytes_transferred);
+
   /**
    * Performs a write on this session. This method must only be called from
    * within the session strand!
@@ -180,12 +450,209 @@ public:
   inline bool write(const boost::asio::const_buffer &data,
                     boost::system::error_code &ec,
                     std::size_t &bytes_transferred);
+
+  /**
+   * Returns the number of bytes that can currently be written without
+   * waiting. This method must only be called from within the session
+   * strand!
+   */
+  std::size_t write_capacity() const { return static_cast<std::size_t>(pending_maximum_ - pending_used_); }
+
+  /**
+   * Writes as much data as fits into the pending write buffer, without
+   * waiting. This method must only be called from within the session
+   * strand!
+   *
+   * @param data Source buffer to read from
+   * @param ec Resulting error code, would_block when the buffer is full
+   * @return Number of bytes transferred
+   */
+  inline std::size_t write_some(const boost::asio::const_buffer &data,
+                                boost::system::error_code &ec);
+
+  /**
+   * Reads a complete message into the buffers. Messages are framed by a
+   * length header within the stream, so a session must be used either in
+   * message or in stream mode. When the message is larger than the buffers,
+   * the remainder is discarded and message_size is reported. This method
+   * must only be called from within the session strand!
+   *
+   * @param buffers A mutable buffer sequence to write to
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when read has been completed, false when it must be retried
+   */
+  template <typename MutableBufferSequence>
+  inline bool read_message(const MutableBufferSequence &buffers,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred);
+
+  /**
+   * Writes a complete message. The message is copied into the pending write
+   * buffer as a whole, so it must not be larger than the pending write
+   * buffer. This method must only be called from within the session strand!
+   *
+   * @param buffers A constant buffer sequence to read from
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when write has been completed, false when it must be retried
+   */
+  template <typename ConstBufferSequence>
+  inline bool write_message(const ConstBufferSequence &buffers,
+                            boost::system::error_code &ec,
+                            std::size_t &bytes_transferred);
+
+  /// Size of the length header preceding each message
+  static const std::size_t message_header_size = 4;
+
+  /**
+   * Sends an unreliable datagram. Datagrams are encrypted like the stream,
+   * but bypass the send queue, so they are never retransmitted and may be
+   * lost or reordered. Sends wait until the start of the peer's stream has
+   * been received and fail with operation_not_supported when datagrams are
+   * not enabled on both peers. This method must only be called from within
+   * the session strand!
+   *
+   * @param buffers A constant buffer sequence to read from
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when send has been completed, false when it must be retried
+   */
+  template <typename ConstBufferSequence>
+  inline bool send_datagram(const ConstBufferSequence &buffers,
+                            boost::system::error_code &ec,
+                            std::size_t &bytes_transferred);
+
+  /**
+   * Receives a queued datagram. When the datagram is larger than the
+   * buffers, the remainder is discarded and message_size is reported. This
+   * method must only be called from within the session strand!
+   *
+   * @param buffers A mutable buffer sequence to write to
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when receive has been completed, false when it must be retried
+   */
+  template <typename MutableBufferSequence>
+  inline bool receive_datagram(const MutableBufferSequence &buffers,
+                               boost::system::error_code &ec,
+                               std::size_t &bytes_transferred);
+  /**
+   * Opens a new substream. This method must only be called from within the
+   * session strand!
+   *
+   * @return Substream identifier
+   */
+  inline std::uint32_t open_substream();
+
+  /**
+   * Accepts a substream opened by the peer. This method must only be called
+   * from within the session strand!
+   *
+   * @param id Resulting substream identifier
+   * @param ec Resulting error code
+   * @return True when accept has been completed, false when it must be retried
+   */
+  inline bool accept_substream(std::uint32_t &id,
+                               boost::system::error_code &ec);
+
+  /**
+   * Reads data that has been received on a substream. Completes as soon as
+   * some data is available. This method must only be called from within the
+   * session strand!
+   *
+   * @param id Substream identifier
+   * @param data Destination buffer to read into
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when read has been completed, false when it must be retried
+   */
+  inline bool read_substream(std::uint32_t id,
+                             const boost::asio::mutable_buffer &data,
+                             boost::system::error_code &ec,
+                             std::size_t &bytes_transferred);
+
+  /**
+   * Queues data for sending on a substream. Completes as soon as some data
+   * fits into the substream send buffer. This method must only be called
+   * from within the session strand!
+   *
+   * @param id Substream identifier
+   * @param data Source buffer to read from
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when write has been completed, false when it must be retried
+   */
+  inline bool write_substream(std::uint32_t id,
+                              const boost::asio::const_buffer &data,
+                              boost::system::error_code &ec,
+                              std::size_t &bytes_transferred);
+
+  /**
+   * Shuts down the sending side of a substream. The peer reads EOF after all
+   * queued data. This method must only be called from within the session
+   * strand!
+   *
+   * @param id Substream identifier
+   */
+  inline void close_substream(std::uint32_t id);
+
+  /**
+   * Returns the number of substreams that have not yet been closed by both
+   * sides. This method must only be called from within the session strand!
+   */
+  std::size_t substream_count() const { return substreams_.count(); }
 protected:
   inline void handle_process_send_queue(const boost::system::error_code &error);
 
   inline void reschedule_process_send_queue();
 
+  inline void close_idle_group();
+
   inline void do_close(const boost::system::error_code &error);
+
+  inline std::size_t distribute(unsigned char *buffer, std::size_t length);
+
+  inline std::size_t peek(unsigned char *buffer, std::size_t length) const;
+
+  inline std::size_t contiguous(bool &eof) const;
+
+  inline void append(const unsigned char *buffer, std::size_t length);
+
+  template <typename MutableBufferSequence>
+  inline bool read_unordered_message(const MutableBufferSequence &buffers,
+                                     boost::system::error_code &ec,
+                                     std::size_t &bytes_transferred);
+
+  inline bool consumed(std::uint64_t offset, std::size_t length) const;
+
+  inline void consume(std::uint64_t start, std::uint64_t end);
+
+  inline bool build_multiplexed_block();
+
+  inline void demultiplex();
+
+  inline void deliver_received();
+
+  inline bool hello_wanted() const;
+
+  inline void put_hello();
+
+  inline bool receive_hello(const curvecpr_block &block);
+
+  inline int lower_receive_datagram(const unsigned char *buf, size_t num);
+
+  inline bool queue_rebuilt_block(const curvecpr_block &block);
+
+  inline bool compressing() const;
+
+  inline bool decompressing() const;
+
+  inline bool compress_pending();
+
+  inline std::size_t receive(unsigned char *buffer, std::size_t length, boost::system::error_code &ec);
+
+  inline bool received_eof() const;
 protected:
   /**
    * Internal handler for libcurvecpr.
@@ -263,10 +730,19 @@ protected:
                                 const unsigned char *buf,
                                 size_t num);
 private:
+  /**
+   * Returns a reference that keeps the session alive until an outstanding
+   * handler has run, or null when the session is not owned by a shared
+   * pointer.
+   */
+  boost::shared_ptr<session> keep_alive() { return weak_from_this().lock(); }
+
   /// Dispatch strand
-  boost::asio::strand strand_;
+  strand_type strand_;
+  /// Recycled memory for intermediate handlers
+  handler_memory handler_memory_;
   /// Last known endpoint
-  boost::asio::ip::udp::endpoint endpoint_;
+  transport::endpoint_type endpoint_;
   /// Optional libcurvecpr session handle
   curvecpr_session session_;
   /// Internal libcurvecpr messager handle
@@ -337,6 +813,47 @@ private:
   std::uint64_t recvmarkq_distributed_;
   /// Offset into the current read buffer
   std::size_t recvmarkq_read_offset_;
+  /// Buffered and received data searched by delimited reads
+  std::vector<boost::asio::const_buffer> recvmarkq_segments_;
+  /// Ranges beyond the distributed offset consumed by unordered reads
+  std::map<std::uint64_t, std::uint64_t> recvmarkq_consumed_;
+  /// Blocks of the message currently being assembled by unordered reads
+  std::vector<curvecpr_block_status*> recvmarkq_message_;
+  /// Offset at which the received stream ends
+  std::uint64_t recvmarkq_eof_;
+  /// Unordered message delivery flag
+  bool unordered_messages_;
+  /// Lengths of messages in the pending write buffer, used to cut blocks
+  std::deque<std::uint64_t> pending_messages_;
+  /// Amount of the first pending message already included into blocks
+  std::uint64_t pending_message_sent_;
+  /// Substream multiplexing flag
+  bool multiplexed_;
+  /// Multiplexed substreams
+  substream_layer substreams_;
+  /// Received datagrams pending distribution
+  std::deque<std::vector<unsigned char>> datagrams_;
+  /// Maximum number of queued datagrams
+  std::size_t datagram_queue_maximum_;
+  /// Datagram channel counters
+  datagram_counters datagram_counters_;
+  /// Datagram channel flag
+  bool datagrams_enabled_;
+  /// True once the first block of the stream has been built, after which
+  /// no hello may be sent anymore
+  bool stream_started_;
+  /// True once the first block of the peer's stream has been received
+  bool peer_hello_received_;
+  /// Features announced by the peer in its hello
+  unsigned char peer_features_;
+  /// Forward error correction of sent and received blocks
+  fec_layer fec_;
+  /// Compression of the stream
+  compression_layer compression_;
+  /// True when our stream is framed in chunks, decided with the first block
+  bool compression_records_;
+  /// Codecs the peer can decompress
+  unsigned char compression_peer_codecs_;
   /// Send queue processing timer
   boost::asio::deadline_timer send_queue_timer_;
   /// Pending ready read timer
@@ -353,6 +870,12 @@ private:
   std::function<void()> close_handler_;
   /// Session running flag
   bool running_;
+  /// Session closed flag, a closed session is never started again
+  bool closed_;
+  /// Link in the acceptor's list of sessions ordered by activity
+  boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> activity_hook_;
+  /// Time at which the last packet was received from the peer
+  boost::posix_time::ptime last_active_;
 };
 
 }
@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_SIMD_HPP
+#define CURVECP_ASIO_DETAIL_SIMD_HPP
+
+// SIMD kernels are compiled with target attributes and selected at run
+// time, so they need no special compiler flags
+#if !defined(CURVECP_ASIO_DISABLE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CURVECP_ASIO_HAS_X86_SIMD 1
+#endif
+
+#if defined(CURVECP_ASIO_HAS_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+#endif
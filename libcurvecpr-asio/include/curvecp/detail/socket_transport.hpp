@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_SOCKET_TRANSPORT_HPP
+#define CURVECP_ASIO_DETAIL_SOCKET_TRANSPORT_HPP
+
+#include <curvecp/detail/transport.hpp>
+
+#include <boost/asio/generic/datagram_protocol.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include <mutex>
+#include <vector>
+
+// UDP segmentation offload needs UDP_SEGMENT and UDP_GRO (Linux 5.0)
+#if defined(__linux__) && defined(UDP_SEGMENT) && defined(UDP_GRO) && \
+    !defined(CURVECP_ASIO_DISABLE_UDP_OFFLOAD)
+#define CURVECP_ASIO_HAS_UDP_OFFLOAD 1
+#endif
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Transport over a kernel datagram socket. The socket family is selected
+ * by the first endpoint it is bound or connected to, so the same transport
+ * handles both UDP and Unix domain datagram sockets. Note that Unix domain
+ * clients must bind to a local path before connecting, otherwise the
+ * server has no address to reply to.
+ */
+class socket_transport : public transport,
+                         public boost::enable_shared_from_this<socket_transport> {
+public:
+  /**
+   * Constructs a new socket transport.
+   *
+   * @param service ASIO IO context
+   */
+  explicit socket_transport(boost::asio::io_context &service)
+    : context_(service),
+      socket_(service),
+      udp_(false),
+      protocol_(0),
+      offload_(false),
+      receive_offload_(false),
+      flush_pending_(false),
+      coalesced_length_(0),
+      segment_size_(0),
+      segment_offset_(0),
+      receive_sender_(nullptr)
+  {
+  }
+
+  socket_transport(const socket_transport&) = delete;
+  socket_transport &operator=(const socket_transport&) = delete;
+
+  /**
+   * Configures UDP segmentation offload. When enabled, runs of datagrams
+   * sent to the same destination while handlers run are handed to the
+   * kernel as a single super-datagram (UDP_SEGMENT), and datagrams that
+   * the kernel coalesced on receive (UDP_GRO) are split again before they
+   * are delivered. Only UDP sockets on Linux support it; elsewhere it has
+   * no effect. The transport must be owned by a boost::shared_ptr while
+   * offload is enabled.
+   *
+   * @param enabled True to enable segmentation offload
+   */
+  inline void set_segmentation_offload(bool enabled);
+
+  boost::asio::io_context &get_io_context() override { return context_; }
+
+  inline void bind(const endpoint_type &endpoint) override;
+
+  inline void connect(const endpoint_type &endpoint) override;
+
+  inline void open(const endpoint_type &endpoint) override;
+
+  inline void close() override;
+
+  endpoint_type local_endpoint() const override { return socket_.local_endpoint(); }
+
+  inline void async_receive(const boost::asio::mutable_buffer &buffer,
+                            handler_type handler) override;
+
+  inline void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                 endpoint_type &sender,
+                                 handler_type handler) override;
+
+  inline std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                      endpoint_type &sender,
+                                      boost::system::error_code &ec) override;
+
+  inline void async_send(const boost::asio::const_buffer &buffer,
+                         handler_type handler) override;
+
+  inline void async_send_to(const boost::asio::const_buffer &buffer,
+                            const endpoint_type &destination,
+                            handler_type handler) override;
+protected:
+  /**
+   * A datagram waiting to be sent as part of a super-datagram.
+   */
+  struct pending_send {
+    /// Datagram payload
+    boost::asio::const_buffer buffer;
+    /// Destination endpoint, unused on connected sockets
+    endpoint_type destination;
+    /// True when sent to the connected endpoint
+    bool connected;
+    /// Completion handler
+    handler_type handler;
+  };
+
+  inline void opened(const endpoint_type &endpoint);
+
+  inline void enable_receive_offload();
+
+  inline void queue_send(const boost::asio::const_buffer &buffer,
+                         const endpoint_type *destination,
+                         handler_type handler);
+
+  inline void flush();
+
+  inline bool send_segments(std::vector<pending_send> &sends, std::size_t first, std::size_t last);
+
+  inline void send_one(pending_send &send);
+
+  inline void receive(const boost::asio::mutable_buffer &buffer,
+                      endpoint_type *sender,
+                      handler_type handler);
+
+  inline void wait_receive();
+
+  inline void handle_receive_ready(const boost::system::error_code &error);
+
+  inline void read_coalesced(boost::system::error_code &ec);
+
+  inline std::size_t deliver_segment(const boost::asio::mutable_buffer &buffer,
+                                     endpoint_type *sender);
+private:
+  /// ASIO IO context
+  boost::asio::io_context &context_;
+  /// Underlying datagram socket
+  boost::asio::generic::datagram_protocol::socket socket_;
+  /// Mutex protecting the offload state
+  std::mutex mutex_;
+  /// True when the socket is a UDP socket
+  bool udp_;
+  /// Socket protocol
+  int protocol_;
+  /// True when segmentation offload is enabled
+  bool offload_;
+  /// True when the socket receives coalesced datagrams
+  bool receive_offload_;
+  /// True while a flush of queued sends is scheduled
+  bool flush_pending_;
+  /// Datagrams queued for the next flush
+  std::vector<pending_send> sends_;
+  /// Last received coalesced datagram
+  std::vector<unsigned char> coalesced_;
+  /// Length of the last received coalesced datagram
+  std::size_t coalesced_length_;
+  /// Segment size of the last received coalesced datagram
+  std::size_t segment_size_;
+  /// Offset of the next segment to deliver
+  std::size_t segment_offset_;
+  /// Sender of the last received coalesced datagram
+  endpoint_type coalesced_sender_;
+  /// Buffer of the outstanding receive
+  boost::asio::mutable_buffer receive_buffer_;
+  /// Sender destination of the outstanding receive
+  endpoint_type *receive_sender_;
+  /// Handler of the outstanding receive
+  handler_type receive_handler_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/socket_transport.ipp>
+
+#endif
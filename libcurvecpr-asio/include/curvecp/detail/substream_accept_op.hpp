@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_SUBSTREAM_ACCEPT_OP_HPP
+#define CURVECP_ASIO_DETAIL_SUBSTREAM_ACCEPT_OP_HPP
+
+#include <curvecp/detail/session.hpp>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Implementation of an async operation that accepts a substream opened by
+ * the peer.
+ */
+class substream_accept_op {
+public:
+  /**
+   * Constructs an async substream accept operation.
+   *
+   * @param id Target for the accepted substream identifier
+   */
+  explicit substream_accept_op(std::uint32_t *id)
+    : id_(id)
+  {
+  }
+
+  /**
+   * Executes the substream accept operation.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @return Whether the operation should be retried
+   */
+  session::want operator()(session &session,
+                           boost::system::error_code &ec,
+                           std::size_t&) const
+  {
+    return session.accept_substream(*id_, ec) ? session::want::nothing : session::want::read;
+  }
+
+  /**
+   * Abandons the substream accept operation after it has been cancelled.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   */
+  void abort(session&,
+             boost::system::error_code &ec,
+             std::size_t&) const
+  {
+    ec = boost::asio::error::operation_aborted;
+  }
+
+  /**
+   * Calls the handler for this operation.
+   *
+   * @param handler Handler reference
+   * @param ec Error code
+   */
+  template <typename Handler>
+  void call_handler(Handler &handler,
+                    const boost::system::error_code &ec,
+                    const std::size_t&) const
+  {
+    handler(ec);
+  }
+private:
+  /// Target for the accepted substream identifier
+  std::uint32_t *id_;
+};
+
+}
+
+}
+
+#endif
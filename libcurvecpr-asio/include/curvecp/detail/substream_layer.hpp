@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_SUBSTREAM_LAYER_HPP
+#define CURVECP_ASIO_DETAIL_SUBSTREAM_LAYER_HPP
+
+#include <boost/asio/buffer.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Multiplexes logical substreams over the stream of a session. Data of the
+ * substreams travels in frames that the session packs into its blocks, and
+ * every substream has its own flow control, so a substream whose reader is
+ * slow does not stall the others. This class is not thread safe; the session
+ * only uses it from within its strand.
+ */
+class substream_layer {
+public:
+  /**
+   * Constructs an empty substream layer.
+   *
+   * @param client True on the client side, which opens substreams with odd
+   *   identifiers while the server uses even ones
+   */
+  inline explicit substream_layer(bool client);
+
+  /**
+   * Configures the receive window of each substream, which is also the
+   * initial send credit of substreams and bounds their send buffers.
+   *
+   * @param value Window size in bytes
+   */
+  void set_window(std::size_t value) { window_ = value; }
+
+  /**
+   * Returns the number of substreams that have not yet been closed by both
+   * sides.
+   */
+  std::size_t count() const { return substreams_.size(); }
+
+  /**
+   * Opens a new substream.
+   *
+   * @return Substream identifier
+   */
+  inline std::uint32_t open();
+
+  /**
+   * Takes a substream opened by the peer from the accept queue.
+   *
+   * @param id Resulting substream identifier
+   * @return True when a substream has been accepted
+   */
+  inline bool accept(std::uint32_t &id);
+
+  /**
+   * Reads data that has been received on a substream.
+   *
+   * @param id Substream identifier
+   * @param data Destination buffer to read into
+   * @param eof True when the stream of the session has ended
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when read has been completed, false when it must be retried
+   */
+  inline bool read(std::uint32_t id,
+                   const boost::asio::mutable_buffer &data,
+                   bool eof,
+                   boost::system::error_code &ec,
+                   std::size_t &bytes_transferred);
+
+  /**
+   * Queues data for sending on a substream.
+   *
+   * @param id Substream identifier
+   * @param data Source buffer to read from
+   * @param eof True when the stream of the session has ended
+   * @param ec Resulting error code
+   * @param bytes_transferred Resulting number of bytes transferred
+   * @return True when write has been completed, false when it must be retried
+   */
+  inline bool write(std::uint32_t id,
+                    const boost::asio::const_buffer &data,
+                    bool eof,
+                    boost::system::error_code &ec,
+                    std::size_t &bytes_transferred);
+
+  /**
+   * Shuts down the sending side of a substream.
+   *
+   * @param id Substream identifier
+   * @return True when a FIN has been queued
+   */
+  inline bool close(std::uint32_t id);
+
+  /**
+   * Returns true when a substream owes the peer a window update.
+   *
+   * @param id Substream identifier
+   */
+  bool window_due(std::uint32_t id) const { return window_due_.count(id) != 0; }
+
+  /**
+   * Returns true when data, FINs or window updates are waiting to be sent.
+   */
+  bool frames_pending() const { return !sendable_.empty() || !window_due_.empty(); }
+
+  /**
+   * Packs pending frames into the data of a block.
+   *
+   * @param data Block data to write to
+   * @param length Number of bytes that fit into the block
+   * @param sent_data Set when data has been taken from send buffers
+   * @return Number of bytes written
+   */
+  inline std::size_t build(unsigned char *data, std::size_t length, bool &sent_data);
+
+  /**
+   * Processes the frames of a block that has been received in order.
+   *
+   * @param data Block data
+   * @param length Length of the block data
+   * @param readable Set when a substream has become readable or acceptable
+   * @param writable Set when the peer has returned credit
+   */
+  inline void receive(const unsigned char *data, std::size_t length, bool &readable, bool &writable);
+
+  /**
+   * Drops all substreams.
+   */
+  inline void clear();
+private:
+  /**
+   * State of a logical substream.
+   */
+  struct substream_state {
+    /// Data waiting to be sent
+    std::vector<unsigned char> send;
+    /// Offset of the first unsent byte in the send buffer
+    std::size_t send_head;
+    /// Received data waiting to be read
+    std::vector<unsigned char> recv;
+    /// Offset of the first unread byte in the receive buffer
+    std::size_t recv_head;
+    /// Number of bytes the peer is still willing to receive
+    std::uint64_t send_credit;
+    /// Number of bytes read since the last window update
+    std::uint64_t recv_unannounced;
+    /// Local side has been shut down, FIN still has to be sent
+    bool fin_pending;
+    /// FIN has been sent
+    bool fin_sent;
+    /// FIN has been received
+    bool fin_received;
+  };
+
+  inline substream_state &create(std::uint32_t id);
+
+  inline void update_sendable(std::uint32_t id, const substream_state &state);
+
+  inline void erase(std::map<std::uint32_t, substream_state>::iterator it);
+
+  inline static unsigned char *put_frame(unsigned char *data, unsigned char type,
+                                         std::uint32_t id, std::size_t length);
+
+  inline static std::uint32_t get_uint32(const unsigned char *data);
+private:
+  /// Receive window of each substream
+  std::size_t window_;
+  /// Open substreams
+  std::map<std::uint32_t, substream_state> substreams_;
+  /// Substreams opened by the peer that have not yet been accepted
+  std::deque<std::uint32_t> accept_queue_;
+  /// Identifier of the next locally opened substream
+  std::uint32_t next_id_;
+  /// Highest identifier of a substream opened by the peer
+  std::uint32_t remote_max_;
+  /// Substreams with data that may be sent or with a FIN to send
+  std::set<std::uint32_t> sendable_;
+  /// Substreams that owe the peer a window update
+  std::set<std::uint32_t> window_due_;
+  /// Substream that was last served by the block builder
+  std::uint32_t cursor_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/substream_layer.ipp>
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_SUBSTREAM_READ_OP_HPP
+#define CURVECP_ASIO_DETAIL_SUBSTREAM_READ_OP_HPP
+
+#include <curvecp/detail/session.hpp>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Implementation of an async read operation on a substream.
+ */
+template <typename MutableBufferSequence>
+class substream_read_op {
+public:
+  /**
+   * Constructs an async substream read operation.
+   *
+   * @param id Substream identifier
+   * @param buffers A mutable buffer sequence to write to
+   */
+  substream_read_op(std::uint32_t id, const MutableBufferSequence& buffers)
+    : id_(id),
+      buffers_(buffers)
+  {
+  }
+
+  /**
+   * Executes the substream read operation.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   * @return Whether the operation should be retried
+   */
+  session::want operator()(session &session,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred) const
+  {
+    boost::asio::mutable_buffer buffer =
+      boost::asio::detail::buffer_sequence_adapter<boost::asio::mutable_buffer,
+        MutableBufferSequence>::first(buffers_);
+
+    return session.read_substream(id_, buffer, ec, bytes_transferred) ? session::want::nothing : session::want::read;
+  }
+
+  /**
+   * Abandons the substream read operation after it has been cancelled. Data
+   * is only transferred when the operation completes, so nothing has
+   * been transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session&,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = 0;
+  }
+
+  /**
+   * Calls the handler for this operation.
+   *
+   * @param handler Handler reference
+   * @param ec Error code
+   * @param bytes_transferred Number of bytes transferred
+   */
+  template <typename Handler>
+  void call_handler(Handler &handler,
+                    const boost::system::error_code &ec,
+                    const std::size_t &bytes_transferred) const
+  {
+    handler(ec, bytes_transferred);
+  }
+private:
+  /// Substream identifier
+  std::uint32_t id_;
+  /// Buffers to read into
+  MutableBufferSequence buffers_;
+};
+
+}
+
+}
+
+#endif
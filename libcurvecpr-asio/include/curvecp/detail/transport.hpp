@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_TRANSPORT_HPP
+#define CURVECP_ASIO_DETAIL_TRANSPORT_HPP
+
+#include <curvecp/detail/handler_memory.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/generic/datagram_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Completion handler of a transport operation. Wraps any function object
+ * that can be called with an error code and a number of bytes, like
+ * std::function, but is move-only and stores the wrapped handler in memory
+ * obtained from a handler_memory instance when one is given, so that
+ * operations armed for every datagram do not need the heap once warmed
+ * up. The same memory is used for the operations that carry the handler
+ * through the transport. A handler may be called at most once.
+ */
+class transport_handler {
+public:
+  /// The allocator used for operations that carry the handler
+  typedef handler_allocator<void> allocator_type;
+
+  transport_handler()
+    : target_(nullptr)
+  {
+  }
+
+  transport_handler(std::nullptr_t)
+    : target_(nullptr)
+  {
+  }
+
+  /**
+   * Wraps a handler.
+   *
+   * @param handler Function object to wrap
+   * @param memory Memory to store the handler in, or null for the heap
+   */
+  template <typename Handler, typename = typename std::enable_if<
+    !std::is_same<typename std::decay<Handler>::type, transport_handler>::value>::type>
+  transport_handler(Handler &&handler, handler_memory *memory = nullptr)
+    : target_(nullptr)
+  {
+    typedef holder<typename std::decay<Handler>::type> holder_type;
+    handler_allocator<holder_type> allocator(memory);
+    holder_type *pointer = allocator.allocate(1);
+    try {
+      target_ = new (pointer) holder_type(std::forward<Handler>(handler), memory);
+    } catch (...) {
+      allocator.deallocate(pointer, 1);
+      throw;
+    }
+  }
+
+  transport_handler(transport_handler &&other) noexcept
+    : target_(other.target_)
+  {
+    other.target_ = nullptr;
+  }
+
+  transport_handler &operator=(transport_handler &&other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      target_ = other.target_;
+      other.target_ = nullptr;
+    }
+    return *this;
+  }
+
+  transport_handler &operator=(std::nullptr_t) noexcept
+  {
+    reset();
+    return *this;
+  }
+
+  transport_handler(const transport_handler&) = delete;
+  transport_handler &operator=(const transport_handler&) = delete;
+
+  ~transport_handler()
+  {
+    reset();
+  }
+
+  /**
+   * Returns true when a handler is wrapped.
+   */
+  explicit operator bool() const { return target_ != nullptr; }
+
+  /**
+   * Returns the memory the handler is stored in, or null for the heap.
+   */
+  handler_memory *get_memory() const { return target_ ? target_->memory : nullptr; }
+
+  /**
+   * Returns the allocator used for operations that carry the handler.
+   */
+  allocator_type get_allocator() const { return allocator_type(get_memory()); }
+
+  /**
+   * Calls the wrapped handler. Its memory is released before the call, so
+   * the handler may start the next operation of the same kind.
+   *
+   * @param ec Error code of the operation
+   * @param bytes Number of bytes transferred
+   */
+  void operator()(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    base *target = target_;
+    target_ = nullptr;
+    target->complete(target, &ec, bytes);
+  }
+private:
+  /**
+   * Type-erased part of a wrapped handler.
+   */
+  struct base {
+    /// Calls and releases the handler, or only releases it when the error
+    /// code is null
+    void (*complete)(base *target, const boost::system::error_code *ec, std::size_t bytes);
+    /// Memory the handler is stored in
+    handler_memory *memory;
+  };
+
+  /**
+   * Wrapped handler.
+   */
+  template <typename Handler>
+  struct holder : base {
+    template <typename H>
+    holder(H &&h, handler_memory *m)
+      : handler(std::forward<H>(h))
+    {
+      this->complete = &holder::do_complete;
+      this->memory = m;
+    }
+
+    static void do_complete(base *target, const boost::system::error_code *ec, std::size_t bytes)
+    {
+      holder *self = static_cast<holder*>(target);
+      handler_allocator<holder> allocator(self->memory);
+      Handler h(std::move(self->handler));
+      self->~holder();
+      allocator.deallocate(self, 1);
+
+      if (ec)
+        h(*ec, bytes);
+    }
+
+    /// Wrapped handler
+    Handler handler;
+  };
+
+  void reset()
+  {
+    if (target_) {
+      base *target = target_;
+      target_ = nullptr;
+      target->complete(target, nullptr, 0);
+    }
+  }
+
+  /// Wrapped handler
+  base *target_;
+};
+
+/**
+ * Datagram transport used by streams and acceptors to exchange CurveCP
+ * packets with their peers. Implementations must be safe to use from
+ * multiple threads as long as each kind of asynchronous operation has at
+ * most one outstanding call.
+ */
+class transport {
+public:
+  /// The endpoint type
+  typedef boost::asio::generic::datagram_protocol::endpoint endpoint_type;
+  /// Handler type for asynchronous operations; handlers are called as
+  /// plain function objects, without regard to any associated executor,
+  /// and are moved rather than copied
+  typedef transport_handler handler_type;
+
+  virtual ~transport() {}
+
+  /**
+   * Returns the ASIO IO context associated with this transport.
+   */
+  virtual boost::asio::io_context &get_io_context() = 0;
+
+  /**
+   * Binds the transport to a specific local endpoint.
+   *
+   * @param endpoint Endpoint to bind to
+   */
+  virtual void bind(const endpoint_type &endpoint) = 0;
+
+  /**
+   * Associates the transport with a specific remote endpoint. Datagrams
+   * from other endpoints are discarded afterwards.
+   *
+   * @param endpoint Endpoint to connect with
+   */
+  virtual void connect(const endpoint_type &endpoint) = 0;
+
+  /**
+   * Prepares the transport for exchanging datagrams with any endpoint of
+   * the same family as the given one, without associating it with a
+   * remote endpoint. Used while racing connection attempts to several
+   * endpoints. The default implementation does nothing.
+   *
+   * @param endpoint Any endpoint of the family to use
+   */
+  virtual void open(const endpoint_type &/*endpoint*/) {}
+
+  /**
+   * Closes the transport. Outstanding operations are completed with the
+   * operation_aborted error.
+   */
+  virtual void close() = 0;
+
+  /**
+   * Returns the endpoint to which the transport is bound.
+   */
+  virtual endpoint_type local_endpoint() const = 0;
+
+  /**
+   * Receives a datagram from the connected endpoint.
+   *
+   * @param buffer Buffer to receive into
+   * @param handler Handler to call after a datagram has been received
+   */
+  virtual void async_receive(const boost::asio::mutable_buffer &buffer,
+                             handler_type handler) = 0;
+
+  /**
+   * Receives a datagram from any endpoint.
+   *
+   * @param buffer Buffer to receive into
+   * @param sender Destination for the endpoint of the sender
+   * @param handler Handler to call after a datagram has been received
+   */
+  virtual void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                  endpoint_type &sender,
+                                  handler_type handler) = 0;
+
+  /**
+   * Receives a datagram from any endpoint if one is already available,
+   * without waiting. Used to drain several datagrams per completion of
+   * an asynchronous receive. The default implementation never has any
+   * datagrams available.
+   *
+   * @param buffer Buffer to receive into
+   * @param sender Destination for the endpoint of the sender
+   * @param ec Set to would_block when no datagram is available
+   * @return Number of bytes received
+   */
+  virtual std::size_t try_receive_from(const boost::asio::mutable_buffer &/*buffer*/,
+                                       endpoint_type &/*sender*/,
+                                       boost::system::error_code &ec)
+  {
+    ec = boost::asio::error::would_block;
+    return 0;
+  }
+
+  /**
+   * Returns the size of the largest datagram this transport may deliver,
+   * so receivers can size their buffers accordingly.
+   */
+  virtual std::size_t maximum_datagram_size() const { return 65535; }
+
+  /**
+   * Sends a datagram to the connected endpoint. The buffer must remain
+   * valid until the handler is called.
+   *
+   * @param buffer Datagram to send
+   * @param handler Handler to call after the datagram has been sent
+   */
+  virtual void async_send(const boost::asio::const_buffer &buffer,
+                          handler_type handler) = 0;
+
+  /**
+   * Sends a datagram to a specific endpoint. The buffer must remain valid
+   * until the handler is called.
+   *
+   * @param buffer Datagram to send
+   * @param destination Endpoint to send the datagram to
+   * @param handler Handler to call after the datagram has been sent
+   */
+  virtual void async_send_to(const boost::asio::const_buffer &buffer,
+                             const endpoint_type &destination,
+                             handler_type handler) = 0;
+};
+
+/**
+ * Handler bound to the result of a transport operation, ready to be posted
+ * or dispatched to an executor. Memory for the operation is taken from the
+ * given handler memory.
+ */
+template <typename Handler>
+class bound_transport_handler {
+public:
+  /// The allocator used for the operation
+  typedef handler_allocator<void> allocator_type;
+
+  bound_transport_handler(Handler &&handler, const boost::system::error_code &ec,
+                          std::size_t bytes, handler_memory *memory)
+    : handler_(std::move(handler)),
+      ec_(ec),
+      bytes_(bytes),
+      memory_(memory)
+  {
+  }
+
+  allocator_type get_allocator() const { return allocator_type(memory_); }
+
+  void operator()() { handler_(ec_, bytes_); }
+private:
+  /// Bound handler
+  Handler handler_;
+  /// Error code of the operation
+  boost::system::error_code ec_;
+  /// Number of bytes transferred
+  std::size_t bytes_;
+  /// Memory for the operation
+  handler_memory *memory_;
+};
+
+/**
+ * Posts the completion of a transport operation to an IO context.
+ *
+ * @param context IO context to run the handler on
+ * @param handler Handler of the operation
+ * @param ec Error code of the operation
+ * @param bytes Number of bytes transferred
+ */
+inline void post_transport_handler(boost::asio::io_context &context, transport_handler &&handler,
+                                   const boost::system::error_code &ec, std::size_t bytes)
+{
+  handler_memory *memory = handler.get_memory();
+  boost::asio::post(context, bound_transport_handler<transport_handler>(std::move(handler), ec, bytes, memory));
+}
+
+/**
+ * Handler passed to transports by bind_transport_handler.
+ */
+template <typename Executor, typename Handler>
+class dispatching_transport_handler {
+public:
+  dispatching_transport_handler(const Executor &executor, Handler &&handler, handler_memory *memory)
+    : executor_(executor),
+      handler_(std::move(handler)),
+      memory_(memory)
+  {
+  }
+
+  void operator()(const boost::system::error_code &ec, std::size_t bytes)
+  {
+    boost::asio::dispatch(executor_, bound_transport_handler<Handler>(std::move(handler_), ec, bytes, memory_));
+  }
+private:
+  /// Executor to run the handler on
+  Executor executor_;
+  /// Wrapped handler
+  Handler handler_;
+  /// Memory for the dispatch
+  handler_memory *memory_;
+};
+
+/**
+ * Wraps a handler so that it is dispatched through the given executor,
+ * usually a strand, when a transport operation completes. The handler is
+ * moved through the operation, and both the wrapper and the dispatch are
+ * stored in the given memory.
+ *
+ * @param executor Executor to run the handler on
+ * @param handler Handler to wrap
+ * @param memory Memory to store the handler in, or null for the heap
+ * @return Handler to pass to the transport
+ */
+template <typename Executor, typename Handler>
+transport::handler_type bind_transport_handler(const Executor &executor, Handler handler,
+                                               handler_memory *memory = nullptr)
+{
+  return transport::handler_type(
+    dispatching_transport_handler<Executor, Handler>(executor, std::move(handler), memory), memory);
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_URING_TRANSPORT_HPP
+#define CURVECP_ASIO_DETAIL_URING_TRANSPORT_HPP
+
+#include <curvecp/detail/transport.hpp>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#endif
+
+// Multishot receive with provided buffer rings needs the Linux 6.0 headers
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT) && !defined(CURVECP_ASIO_DISABLE_IO_URING)
+#define CURVECP_ASIO_HAS_IO_URING 1
+#endif
+
+#if defined(CURVECP_ASIO_HAS_IO_URING)
+
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Transport over a kernel datagram socket that performs its I/O through
+ * io_uring instead of the ASIO reactor. A single multishot receive lets
+ * the kernel write incoming datagrams directly into a ring of pooled
+ * buffers, and sends issued while handlers run are submitted together
+ * with one system call. The ring is watched by the IO context, so
+ * handlers are invoked like those of any other transport. Requires Linux
+ * 6.0 or newer and must be owned by a boost::shared_ptr.
+ */
+class uring_transport : public transport,
+                        public boost::enable_shared_from_this<uring_transport> {
+public:
+  /**
+   * Constructs a new io_uring transport. Throws if the kernel does not
+   * support io_uring or provided buffer rings.
+   *
+   * @param service ASIO IO context
+   * @param buffers Number of pooled receive buffers, rounded up to a power of two
+   */
+  inline explicit uring_transport(boost::asio::io_context &service, std::size_t buffers = 512);
+
+  inline ~uring_transport();
+
+  uring_transport(const uring_transport&) = delete;
+  uring_transport &operator=(const uring_transport&) = delete;
+
+  boost::asio::io_context &get_io_context() override { return service_; }
+
+  inline void bind(const endpoint_type &endpoint) override;
+
+  inline void connect(const endpoint_type &endpoint) override;
+
+  inline void open(const endpoint_type &endpoint) override;
+
+  inline void close() override;
+
+  inline endpoint_type local_endpoint() const override;
+
+  inline void async_receive(const boost::asio::mutable_buffer &buffer,
+                            handler_type handler) override;
+
+  inline void async_receive_from(const boost::asio::mutable_buffer &buffer,
+                                 endpoint_type &sender,
+                                 handler_type handler) override;
+
+  inline std::size_t try_receive_from(const boost::asio::mutable_buffer &buffer,
+                                      endpoint_type &sender,
+                                      boost::system::error_code &ec) override;
+
+  inline std::size_t maximum_datagram_size() const override;
+
+  inline void async_send(const boost::asio::const_buffer &buffer,
+                         handler_type handler) override;
+
+  inline void async_send_to(const boost::asio::const_buffer &buffer,
+                            const endpoint_type &destination,
+                            handler_type handler) override;
+protected:
+  /**
+   * A send operation whose message must stay valid until it completes.
+   */
+  struct send_op {
+    /// Message header
+    msghdr message;
+    /// Datagram payload
+    iovec payload;
+    /// Destination address
+    sockaddr_storage destination;
+    /// Completion handler
+    handler_type handler;
+  };
+
+  /**
+   * A received datagram that is still held in a pooled buffer.
+   */
+  struct datagram {
+    /// Pooled buffer identifier
+    std::uint16_t buffer;
+    /// Payload length
+    std::size_t length;
+    /// Endpoint of the sender
+    endpoint_type sender;
+  };
+
+  inline void destroy();
+
+  inline void open_socket(const endpoint_type &endpoint);
+
+  inline void start();
+
+  inline io_uring_sqe *get_sqe();
+
+  inline void submit();
+
+  inline void arm_receive();
+
+  inline void provide_buffer(std::uint16_t id);
+
+  inline std::size_t deliver(const datagram &d,
+                             const boost::asio::mutable_buffer &buffer,
+                             endpoint_type *sender);
+
+  inline void receive(const boost::asio::mutable_buffer &buffer,
+                      endpoint_type *sender,
+                      handler_type handler);
+
+  inline void send(const boost::asio::const_buffer &buffer,
+                   const endpoint_type *destination,
+                   handler_type handler);
+
+  inline void wait_ring();
+
+  inline void handle_ring_ready(const boost::system::error_code &error);
+
+  inline void reap();
+
+  inline void handle_receive_completion(int result, std::uint32_t flags);
+private:
+  /// ASIO IO context
+  boost::asio::io_context &service_;
+  /// Mutex
+  mutable std::mutex mutex_;
+  /// Ring file descriptor, watched for completions
+  boost::asio::posix::stream_descriptor ring_descriptor_;
+  /// Datagram socket, -1 when closed
+  int socket_;
+  /// Socket protocol
+  int protocol_;
+  /// Mapped submission queue ring
+  void *sq_ring_;
+  /// Size of the mapped submission queue ring
+  std::size_t sq_ring_size_;
+  /// Mapped completion queue ring
+  void *cq_ring_;
+  /// Size of the mapped completion queue ring
+  std::size_t cq_ring_size_;
+  /// Mapped submission queue entries
+  io_uring_sqe *sqes_;
+  /// Number of submission queue entries
+  unsigned sq_entries_;
+  /// Submission queue head, advanced by the kernel
+  unsigned *sq_head_;
+  /// Submission queue tail
+  unsigned *sq_tail_;
+  /// Submission queue index mask
+  unsigned sq_mask_;
+  /// Tail of entries prepared but not yet published
+  unsigned sqe_tail_;
+  /// Tail of entries handed to the kernel
+  unsigned sqe_submitted_;
+  /// Completion queue head
+  unsigned *cq_head_;
+  /// Completion queue tail, advanced by the kernel
+  unsigned *cq_tail_;
+  /// Completion queue index mask
+  unsigned cq_mask_;
+  /// Completion queue entries
+  io_uring_cqe *cqes_;
+  /// Provided buffer ring
+  io_uring_buf *buffer_ring_;
+  /// Number of pooled buffers
+  std::uint16_t buffer_count_;
+  /// Tail of the provided buffer ring
+  std::uint16_t buffer_tail_;
+  /// Number of buffers currently owned by the kernel
+  std::size_t buffers_free_;
+  /// Pooled receive buffer memory
+  std::vector<unsigned char> buffer_memory_;
+  /// Message header template of the multishot receive
+  msghdr receive_message_;
+  /// True while the multishot receive is armed
+  bool receive_armed_;
+  /// True while the ring descriptor is being watched
+  bool ring_waiting_;
+  /// True while a submission of queued sends is scheduled
+  bool flush_pending_;
+  /// Datagrams received while no receive was outstanding
+  std::deque<datagram> received_;
+  /// True while a receive operation is outstanding
+  bool receive_pending_;
+  /// Buffer of the outstanding receive
+  boost::asio::mutable_buffer receive_buffer_;
+  /// Sender destination of the outstanding receive
+  endpoint_type *receive_sender_;
+  /// Handler of the outstanding receive
+  handler_type receive_handler_;
+  /// Storage of send operations
+  std::deque<send_op> send_ops_;
+  /// Send operations available for reuse
+  std::vector<send_op*> free_send_ops_;
+};
+
+}
+
+}
+
+#include <curvecp/detail/impl/uring_transport.ipp>
+
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_DETAIL_WRITE_ALL_OP_HPP
+#define CURVECP_ASIO_DETAIL_WRITE_ALL_OP_HPP
+
+#include <curvecp/detail/session.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+namespace curvecp {
+
+namespace detail {
+
+/**
+ * Implementation of an async write operation that writes all buffers of
+ * the sequence. Each execution copies as much data as fits into the
+ * pending write buffer and the operation only waits when the buffer is
+ * full. Buffers larger than the pending write buffer are split.
+ */
+template <typename ConstBufferSequence>
+class write_all_op {
+public:
+  /**
+   * Constructs an async write operation.
+   *
+   * @param buffers A constant buffer sequence to read from
+   */
+  write_all_op(const ConstBufferSequence& buffers)
+    : buffers_(buffers),
+      index_(0),
+      offset_(0),
+      total_(0)
+  {
+  }
+
+  /**
+   * Executes the write operation.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   * @return Whether the operation should be retried
+   */
+  session::want operator()(session &session,
+                           boost::system::error_code &ec,
+                           std::size_t &bytes_transferred)
+  {
+    auto it = boost::asio::buffer_sequence_begin(buffers_);
+    auto end = boost::asio::buffer_sequence_end(buffers_);
+    std::advance(it, index_);
+
+    for (; it != end; ++it, ++index_, offset_ = 0) {
+      boost::asio::const_buffer buffer(*it);
+
+      while (offset_ < buffer.size()) {
+        // When the pending buffer is full, the write below waits for space
+        std::size_t remaining = buffer.size() - offset_;
+        std::size_t capacity = session.write_capacity();
+        std::size_t chunk = capacity ? std::min(remaining, capacity) : remaining;
+
+        std::size_t bytes;
+        if (!session.write(boost::asio::buffer(buffer + offset_, chunk), ec, bytes))
+          return session::want::write;
+
+        offset_ += bytes;
+        total_ += bytes;
+        if (ec) {
+          bytes_transferred = total_;
+          return session::want::nothing;
+        }
+      }
+    }
+
+    bytes_transferred = total_;
+    return session::want::nothing;
+  }
+
+  /**
+   * Abandons the write operation after it has been cancelled. Data that has
+   * already been copied into the pending write buffer is reported as
+   * transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session&,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = total_;
+  }
+
+  /**
+   * Calls the handler for this operation.
+   *
+   * @param handler Handler reference
+   * @param ec Error code
+   * @param bytes_transferred Number of bytes transferred
+   */
+  template <typename Handler>
+  void call_handler(Handler &handler,
+                    const boost::system::error_code &ec,
+                    const std::size_t &bytes_transferred) const
+  {
+    handler(ec, bytes_transferred);
+  }
+private:
+  /// Buffers to write from
+  ConstBufferSequence buffers_;
+  /// Index of the buffer currently being written
+  std::size_t index_;
+  /// Offset into the buffer currently being written
+  std::size_t offset_;
+  /// Number of bytes written
+  std::size_t total_;
+};
+
+}
+
+}
+
+#endif
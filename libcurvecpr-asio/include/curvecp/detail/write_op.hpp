@@ -48,6 +48,22 @@ public:
     return session.write(buffer, ec, bytes_transferred) ? session::want::nothing : session::want::write;
   }
 
+  /**
+   * Abandons the write operation after it has been cancelled. Writes are
+   * all-or-nothing, so nothing has been transferred.
+   *
+   * @param session Internal CurveCP session reference
+   * @param ec Output error code
+   * @param bytes_transferred Output number of bytes transferred
+   */
+  void abort(session&,
+             boost::system::error_code &ec,
+             std::size_t &bytes_transferred) const
+  {
+    ec = boost::asio::error::operation_aborted;
+    bytes_transferred = 0;
+  }
+
   /**
    * Calls the handler for this operation.
    *
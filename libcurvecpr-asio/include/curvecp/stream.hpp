@@ -7,16 +7,29 @@
 #ifndef CURVECP_ASIO_STREAM_HPP
 #define CURVECP_ASIO_STREAM_HPP
 
+#include <curvecp/client_endpoint.hpp>
+#include <curvecp/transport.hpp>
 #include <curvecp/detail/client_stream.hpp>
 #include <curvecp/detail/read_op.hpp>
+#include <curvecp/detail/read_exactly_op.hpp>
+#include <curvecp/detail/read_until_op.hpp>
+#include <curvecp/detail/receive_datagram_op.hpp>
+#include <curvecp/detail/receive_message_op.hpp>
+#include <curvecp/detail/send_datagram_op.hpp>
+#include <curvecp/detail/send_message_op.hpp>
 #include <curvecp/detail/write_op.hpp>
+#include <curvecp/detail/write_all_op.hpp>
 #include <curvecp/detail/connect_op.hpp>
 #include <curvecp/detail/close_op.hpp>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
-#include <boost/asio/io_service.hpp>
+#include <boost/asio/io_context.hpp>
 #include <boost/asio/async_result.hpp>
+#include <boost/asio/streambuf.hpp>
+
+#include <string>
+#include <type_traits>
 
 namespace curvecp {
 
@@ -24,6 +37,8 @@ namespace detail {
   class acceptor;
 }
 
+class substream;
+
 /**
  * CurveCP client stream.
  *
@@ -34,31 +49,71 @@ namespace detail {
 class stream {
 public:
   friend class curvecp::detail::acceptor;
+  friend class curvecp::substream;
 
   /// CurveCP endpoint type
   typedef curvecp::detail::basic_stream::endpoint_type endpoint;
+  /// The type of the executor associated with the stream
+  typedef boost::asio::io_context::executor_type executor_type;
+  /// Counters of the unreliable datagram channel
+  typedef curvecp::detail::session::datagram_counters datagram_counters;
+  /// Counters of forward error correction
+  typedef curvecp::detail::session::fec_counters fec_counters;
+  /// Counters of stream compression
+  typedef curvecp::detail::session::compression_counters compression_counters;
 
   /**
    * Constructs a CurveCP client stream.
    *
-   * @param service ASIO IO service
+   * @param service ASIO IO context
    */
-  stream(boost::asio::io_service &service)
+  stream(boost::asio::io_context &service)
     : stream_(boost::make_shared<detail::client_stream>(service))
   {
   }
 
+  /**
+   * Constructs a CurveCP client stream over a specific datagram transport.
+   *
+   * @param transport Datagram transport
+   */
+  stream(boost::shared_ptr<transport> transport)
+    : stream_(boost::make_shared<detail::client_stream>(transport))
+  {
+  }
+
+  /**
+   * Constructs a CurveCP client stream attached to a shared-socket client
+   * endpoint. The local extension is assigned by the endpoint and can not
+   * be changed.
+   *
+   * @param endpoint Client endpoint
+   */
+  stream(client_endpoint &endpoint)
+  {
+    boost::shared_ptr<detail::client_endpoint_channel> channel = endpoint.endpoint_->create_channel();
+    boost::shared_ptr<detail::client_stream> s = boost::make_shared<detail::client_stream>(channel);
+    s->assign_local_extension(channel->extension());
+    stream_ = s;
+  }
+
   stream(const stream&) = delete;
   stream &operator=(const stream&) = delete;
 
   /**
-   * Returns the ASIO IO service associated with this stream.
+   * Returns the ASIO IO context associated with this stream.
+   */
+  boost::asio::io_context &get_io_context() { return stream_->get_io_context(); }
+
+  /**
+   * Returns the executor associated with this stream.
    */
-  boost::asio::io_service &get_io_service() { return stream_->get_io_service(); }
+  executor_type get_executor() { return stream_->get_io_context().get_executor(); }
 
   /**
    * Configures the local CurveCP extension. Must be set before starting
-   * the connection.
+   * the connection. Ignored for streams attached to a client endpoint, as
+   * the endpoint routes replies by the extension it assigned.
    *
    * @param extension A 16-byte local extension
    */
@@ -114,15 +169,64 @@ public:
   void set_nonce_generator(NonceGenerator generator) { stream_->set_nonce_generator(generator); }
 
   /**
-   * Binds the underlying UDP socket to a specific local endpoint.
+   * Configures retransmission of Hello packets. The timeout starts at the
+   * initial value (250 ms by default), or at twice the round-trip time
+   * estimate when one is available, doubles with every retransmission up
+   * to the maximum (8 s by default) and is randomized by up to 25%. The
+   * connection fails after the given number of Hello packets (6 by
+   * default) has not been answered. Must be set before starting the
+   * connection.
+   *
+   * @param initial Initial retransmission timeout
+   * @param maximum Maximum retransmission timeout
+   * @param attempts Number of Hello packets sent before giving up
+   */
+  void set_hello_backoff(const boost::posix_time::time_duration &initial,
+                         const boost::posix_time::time_duration &maximum,
+                         int attempts)
+  {
+    stream_->set_hello_backoff(initial, maximum, attempts);
+  }
+
+  /**
+   * Configures the round-trip time estimate that seeds the Hello
+   * retransmission timeout, for example the handshake round-trip time of
+   * an earlier stream to the same server. Must be set before starting the
+   * connection.
+   *
+   * @param rtt Round-trip time estimate
+   */
+  void set_rtt_estimate(const boost::posix_time::time_duration &rtt) { stream_->set_rtt_estimate(rtt); }
+
+  /**
+   * Configures the delay after which the next candidate endpoint joins a
+   * connection race started with several endpoints (250 ms by default).
+   * Must be set before starting the connection.
+   *
+   * @param delay Delay between connection attempts
+   */
+  void set_connect_stagger(const boost::posix_time::time_duration &delay) { stream_->set_connect_stagger(delay); }
+
+  /**
+   * Returns the round-trip time between the Hello packet and the cookie
+   * measured while connecting, or zero when the cookie answered a
+   * retransmitted Hello and the round-trip time is unknown.
+   */
+  boost::posix_time::time_duration get_handshake_rtt() { return stream_->get_handshake_rtt(); }
+
+  /**
+   * Binds the underlying transport to a specific local endpoint.
    *
    * @param endpoint Endpoint to bind to
    */
   void bind(const detail::basic_stream::endpoint_type &endpoint) { stream_->bind(endpoint); }
 
   /**
-   * Connects the underlying UDP socket with a specific remote endpoint and
-   * starts the CurveCP connection.
+   * Connects the underlying transport with a specific remote endpoint and
+   * starts the CurveCP connection. Data written before the connection is
+   * established is buffered and its first block is carried inside the
+   * Initiate packet, so a request does not wait for the handshake to
+   * complete.
    *
    * @param endpoint Endpoint to connect with
    */
@@ -131,13 +235,27 @@ public:
   async_connect(const typename detail::basic_stream::endpoint_type &endpoint,
                 BOOST_ASIO_MOVE_ARG(ConnectHandler) handler)
   {
-    boost::asio::detail::async_result_init<
-      ConnectHandler, void (boost::system::error_code)> init(
-        BOOST_ASIO_MOVE_CAST(ConnectHandler)(handler));
+    return boost::asio::async_initiate<ConnectHandler, void (boost::system::error_code)>(
+      detail::initiate_connect_op<curvecp::detail::basic_stream>(*stream_), handler, endpoint);
+  }
 
-    detail::connect_op<curvecp::detail::basic_stream, decltype(init.handler)>(
-      endpoint, *stream_, init.handler)(boost::system::error_code(), true);
-    return init.result.get();
+  /**
+   * Races connection attempts to several candidate endpoints, such as
+   * replicas of one server, and keeps the session with the first one that
+   * answers. Hello packets are sent to the first candidate right away and
+   * to one more candidate after every stagger delay, so the connect latency
+   * follows the fastest reachable candidate. All candidates must use the
+   * same address family, remote public key and extension.
+   *
+   * @param endpoints Candidate endpoints, in order of preference
+   */
+  template <typename ConnectHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ConnectHandler, void (boost::system::error_code))
+  async_connect(const std::vector<detail::basic_stream::endpoint_type> &endpoints,
+                BOOST_ASIO_MOVE_ARG(ConnectHandler) handler)
+  {
+    return boost::asio::async_initiate<ConnectHandler, void (boost::system::error_code)>(
+      detail::initiate_connect_op<curvecp::detail::basic_stream>(*stream_), handler, endpoints);
   }
 
   /**
@@ -147,12 +265,9 @@ public:
   BOOST_ASIO_INITFN_RESULT_TYPE(CloseHandler, void())
   async_close(BOOST_ASIO_MOVE_ARG(CloseHandler) handler)
   {
-    boost::asio::detail::async_result_init<
-      CloseHandler, void()> init(
-        BOOST_ASIO_MOVE_CAST(CloseHandler)(handler));
-
-    stream_->async_io_operation(curvecp::detail::close_op(), init.handler);
-    return init.result.get();
+    return boost::asio::async_initiate<CloseHandler, void()>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::close_op());
   }
 
   /**
@@ -163,17 +278,9 @@ public:
   async_read_some(const MutableBufferSequence &buffers,
                   BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
   {
-    // If you get an error on the following line it means that your handler does
-    // not meet the documented type requirements for a ReadHandler.
-    using boost::asio::handler_type;
-    BOOST_ASIO_READ_HANDLER_CHECK(ReadHandler, handler) type_check;
-
-    boost::asio::detail::async_result_init<
-      ReadHandler, void (boost::system::error_code, std::size_t)> init(
-        BOOST_ASIO_MOVE_CAST(ReadHandler)(handler));
-
-    stream_->async_io_operation(curvecp::detail::read_op<MutableBufferSequence>(buffers), init.handler);
-    return init.result.get();
+    return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::read_op<MutableBufferSequence>(buffers));
   }
 
   /**
@@ -184,18 +291,338 @@ public:
   async_write_some(const ConstBufferSequence &buffers,
                    BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
   {
-    // If you get an error on the following line it means that your handler does
-    // not meet the documented type requirements for a WriteHandler.
-    using boost::asio::handler_type;
-    BOOST_ASIO_WRITE_HANDLER_CHECK(WriteHandler, handler) type_check;
+    return boost::asio::async_initiate<WriteHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::write_op<ConstBufferSequence>(buffers));
+  }
+
+  /**
+   * Returns the number of bytes that have been received in order and can
+   * be read without waiting. Returns zero when the session strand is busy
+   * on another thread.
+   */
+  std::size_t available() { return stream_->available(); }
+
+  /**
+   * Reads data that has already been received, without waiting. Must not
+   * be used while an asynchronous read is outstanding. The call executes on
+   * the session strand when it can be entered without waiting, that is from
+   * a handler running on it or from a thread running the IO context while
+   * no other thread holds it, and fails with would_block otherwise.
+   *
+   * @param buffers A mutable buffer sequence to write to
+   * @param ec Resulting error code, would_block when no data is available
+   *   or the session strand is busy
+   * @return Number of bytes transferred
+   */
+  template <typename MutableBufferSequence>
+  std::size_t try_read_some(const MutableBufferSequence &buffers,
+                            boost::system::error_code &ec)
+  {
+    return stream_->try_read_some(buffers, ec);
+  }
 
-    boost::asio::detail::async_result_init<
-      WriteHandler, void (boost::system::error_code, std::size_t)> init(
-        BOOST_ASIO_MOVE_CAST(WriteHandler)(handler));
+  /**
+   * Writes as much data as fits into the pending write buffer, without
+   * waiting. The call executes on the session strand when it can be
+   * entered without waiting, as for try_read_some, and fails with
+   * would_block otherwise.
+   *
+   * @param buffers A constant buffer sequence to read from
+   * @param ec Resulting error code, would_block when the buffer is full
+   *   or the session strand is busy
+   * @return Number of bytes transferred
+   */
+  template <typename ConstBufferSequence>
+  std::size_t try_write_some(const ConstBufferSequence &buffers,
+                             boost::system::error_code &ec)
+  {
+    return stream_->try_write_some(buffers, ec);
+  }
 
-    stream_->async_io_operation(curvecp::detail::write_op<ConstBufferSequence>(buffers), init.handler);
-    return init.result.get();
+  /**
+   * Performs a read operation on the stream that completes only after all
+   * buffers of the sequence have been filled, the stream has reached EOF
+   * or an error occurs. Unlike boost::asio::async_read, data that has
+   * already been received is copied into all buffers within a single
+   * execution on the session strand.
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_read_exactly(const MutableBufferSequence &buffers,
+                     BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::read_exactly_op<MutableBufferSequence>(buffers));
+  }
+
+  /**
+   * Performs a read operation on the stream that completes once the
+   * dynamic buffer contains the delimiter, like boost::asio::async_read_until
+   * but without reading past it. Received blocks are searched in place and
+   * only the data up to and including the delimiter is appended to the
+   * buffer, so the handler receives the exact size of the record and the
+   * buffer holds nothing beyond it. Data already in the buffer is searched
+   * first. Fails with not_found when the buffer would exceed its maximum
+   * size and with eof once the stream ends, after appending the rest of
+   * the data.
+   */
+  template <typename DynamicBuffer, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_read_until(BOOST_ASIO_MOVE_ARG(DynamicBuffer) buffers,
+                   const std::string &delimiter,
+                   BOOST_ASIO_MOVE_ARG(ReadHandler) handler,
+                   typename std::enable_if<boost::asio::is_dynamic_buffer<
+                     typename std::decay<DynamicBuffer>::type>::value>::type* = 0)
+  {
+    return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::read_until_op<typename std::decay<DynamicBuffer>::type>(buffers, delimiter));
+  }
+
+  /**
+   * Performs a read operation on the stream that completes once the
+   * dynamic buffer contains the delimiter character.
+   */
+  template <typename DynamicBuffer, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_read_until(BOOST_ASIO_MOVE_ARG(DynamicBuffer) buffers,
+                   char delimiter,
+                   BOOST_ASIO_MOVE_ARG(ReadHandler) handler,
+                   typename std::enable_if<boost::asio::is_dynamic_buffer<
+                     typename std::decay<DynamicBuffer>::type>::value>::type* = 0)
+  {
+    return async_read_until(BOOST_ASIO_MOVE_CAST(DynamicBuffer)(buffers), std::string(1, delimiter),
+      BOOST_ASIO_MOVE_CAST(ReadHandler)(handler));
+  }
+
+  /**
+   * Performs a read operation on the stream that completes once the
+   * stream buffer contains the delimiter.
+   */
+  template <typename Allocator, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_read_until(boost::asio::basic_streambuf<Allocator> &buffer,
+                   const std::string &delimiter,
+                   BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return async_read_until(boost::asio::basic_streambuf_ref<Allocator>(buffer), delimiter,
+      BOOST_ASIO_MOVE_CAST(ReadHandler)(handler));
   }
+
+  /**
+   * Performs a read operation on the stream that completes once the
+   * stream buffer contains the delimiter character.
+   */
+  template <typename Allocator, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_read_until(boost::asio::basic_streambuf<Allocator> &buffer,
+                   char delimiter,
+                   BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return async_read_until(boost::asio::basic_streambuf_ref<Allocator>(buffer), std::string(1, delimiter),
+      BOOST_ASIO_MOVE_CAST(ReadHandler)(handler));
+  }
+
+  /**
+   * Performs a write operation on the stream that completes only after all
+   * buffers of the sequence have been written or an error occurs. Unlike
+   * boost::asio::async_write, all buffers are copied within a single
+   * execution on the session strand as long as there is space in the
+   * pending write buffer.
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler, void (boost::system::error_code, std::size_t))
+  async_write_all(const ConstBufferSequence &buffers,
+                  BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return boost::asio::async_initiate<WriteHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::write_all_op<ConstBufferSequence>(buffers));
+  }
+
+  /**
+   * Sends the buffer sequence as a single message. The peer receives it
+   * as a whole with async_receive_message, regardless of how it was split
+   * into CurveCP blocks. Messages must fit into the pending write buffer
+   * and fail with message_size otherwise. A stream must either be used
+   * with messages only or with byte stream operations only.
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler, void (boost::system::error_code, std::size_t))
+  async_send_message(const ConstBufferSequence &buffers,
+                     BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return boost::asio::async_initiate<WriteHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::send_message_op<ConstBufferSequence>(buffers));
+  }
+
+  /**
+   * Receives a single message sent with async_send_message. Completes
+   * once the whole message has arrived and reports its size. When the
+   * message does not fit into the buffers, they are filled, the rest of
+   * the message is discarded and the operation fails with message_size.
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_receive_message(const MutableBufferSequence &buffers,
+                        BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::receive_message_op<MutableBufferSequence>(buffers));
+  }
+
+  /**
+   * Enables reliable but unordered delivery of messages. A message is
+   * then received as soon as all of its blocks have arrived, even when
+   * earlier messages are still waiting for retransmissions, so a lost
+   * block only delays the message it belongs to. Must be enabled on both
+   * peers before any message is sent or received; byte stream operations
+   * fail with operation_not_supported in this mode.
+   *
+   * @param value True to deliver messages out of order
+   */
+  void set_unordered_messages(bool value) { stream_->set_unordered_messages(value); }
+
+  /**
+   * Enables multiplexing of logical substreams over this stream. Opening a
+   * substream needs neither a handshake nor a session of its own. Must be
+   * enabled on both peers before any data is exchanged; the stream may then
+   * only be used through substreams.
+   *
+   * @param value True to multiplex substreams
+   */
+  void set_multiplexed(bool value) { stream_->set_multiplexed(value); }
+
+  /**
+   * Configures the receive window of each substream, 16 KiB by default.
+   * The window is also the initial send credit of substreams, so both peers
+   * must use the same value.
+   *
+   * @param value Window size in bytes
+   */
+  void set_substream_window(std::size_t value) { stream_->set_substream_window(value); }
+
+  /**
+   * Sends an unreliable datagram over the established session. Datagrams
+   * are encrypted and authenticated like the stream, but are not
+   * sequenced or retransmitted, so they may be lost or reordered and never
+   * wait behind lost stream data. The operation completes as soon as the
+   * datagram has been handed to the transport. Datagrams larger than
+   * maximum_datagram_size fail with message_size. Datagrams must be enabled
+   * with set_datagrams; the first send waits until the start of the peer's
+   * stream has arrived and fails with operation_not_supported when the
+   * peer has not announced that it accepts datagrams.
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler, void (boost::system::error_code, std::size_t))
+  async_send_datagram(const ConstBufferSequence &buffers,
+                      BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return boost::asio::async_initiate<WriteHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::send_datagram_op<ConstBufferSequence>(buffers));
+  }
+
+  /**
+   * Receives a single datagram sent with async_send_datagram. When the
+   * datagram does not fit into the buffers, they are filled, the rest is
+   * discarded and the operation fails with message_size.
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_receive_datagram(const MutableBufferSequence &buffers,
+                         BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::receive_datagram_op<MutableBufferSequence>(buffers));
+  }
+
+  /**
+   * Configures the maximum number of received datagrams that are queued
+   * until they are read. When the queue is full, the oldest datagram is
+   * dropped and counted.
+   *
+   * @param value Maximum number of queued datagrams
+   */
+  void set_datagram_queue_maximum(std::size_t value) { stream_->set_datagram_queue_maximum(value); }
+
+  /**
+   * Enables the unreliable datagram channel. Datagrams are carried in
+   * frames that only peers using this library understand, so each peer
+   * with datagrams or forward error correction enabled starts its stream
+   * with a short hello that announces them, and neither datagrams nor
+   * repairs are sent before the peer has announced that it accepts them.
+   * The hello is removed from the stream by any peer using this library.
+   * Must be enabled before data is exchanged.
+   *
+   * @param value True to accept and send datagrams
+   */
+  void set_datagrams(bool value) { stream_->set_datagrams(value); }
+
+  /**
+   * Returns the counters of sent, received, dropped and truncated
+   * datagrams.
+   */
+  datagram_counters get_datagram_counters() { return stream_->get_datagram_counters(); }
+
+  /**
+   * Enables forward error correction of sent blocks. After each group of
+   * data_blocks blocks, repair_blocks repairs are sent, so the peer can
+   * rebuild up to that many lost blocks of the group without waiting for
+   * retransmissions, at an overhead of repair_blocks / data_blocks. Must be
+   * enabled on both peers before data is exchanged; repairs are only sent
+   * once the peer has announced in its hello that it accepts them.
+   *
+   * @param data_blocks Number of blocks in a group, at most 16
+   * @param repair_blocks Number of repairs per group, at most 16 or zero
+   *   to disable forward error correction
+   */
+  void set_forward_error_correction(std::size_t data_blocks, std::size_t repair_blocks)
+  {
+    stream_->set_forward_error_correction(data_blocks, repair_blocks);
+  }
+
+  /**
+   * Returns the counters of sent and received repairs and of rebuilt
+   * blocks.
+   */
+  fec_counters get_fec_counters() { return stream_->get_fec_counters(); }
+
+  /**
+   * Enables compression of the byte stream with zstd, which is available
+   * when the library is built with CURVECP_ASIO_ENABLE_ZSTD. The stream is
+   * then framed in chunks, which is announced in the hello that starts it
+   * together with the codecs this end can decompress, so the peer reads it
+   * whether or not it compresses itself. Chunks are only compressed for a
+   * peer that has announced zstd and are otherwise sent raw, as are chunks
+   * that do not compress well. Must be enabled before data is exchanged;
+   * switching it off later sends the remaining chunks raw. Message
+   * operations are not supported on compressed streams.
+   *
+   * @param value True to compress the byte stream
+   */
+  void set_compression(bool value) { stream_->set_compression(value); }
+
+  /**
+   * Configures the zstd compression level.
+   *
+   * @param value Compression level, 3 by default
+   */
+  void set_compression_level(int value) { stream_->set_compression_level(value); }
+
+  /**
+   * Returns the counters of bytes before and after compression and of
+   * compressed and uncompressed chunks.
+   */
+  compression_counters get_compression_counters() { return stream_->get_compression_counters(); }
+
+  /// Maximum size of a single datagram
+  static const std::size_t maximum_datagram_size = curvecp::detail::session::maximum_datagram_size;
 private:
   /// Private stream implementation
   boost::shared_ptr<detail::basic_stream> stream_;
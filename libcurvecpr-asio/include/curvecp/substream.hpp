@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_SUBSTREAM_HPP
+#define CURVECP_ASIO_SUBSTREAM_HPP
+
+#include <curvecp/stream.hpp>
+#include <curvecp/detail/substream_accept_op.hpp>
+#include <curvecp/detail/substream_read_op.hpp>
+#include <curvecp/detail/substream_write_op.hpp>
+
+namespace curvecp {
+
+/**
+ * Logical substream multiplexed over the session of a CurveCP stream. The
+ * stream must have multiplexing enabled on both sides. Substreams share the
+ * session, its handshake and its timers, and each has its own flow
+ * control, so a slow reader on one substream does not hold back others.
+ *
+ * @par Thread Safety
+ * @e Distinct @e objects: Safe.@n
+ * @e Shared @e objects: Unsafe.
+ */
+class substream {
+public:
+  /// The type of the executor associated with the substream
+  typedef boost::asio::io_context::executor_type executor_type;
+
+  /**
+   * Constructs a substream of the given stream. The substream must be
+   * opened or accepted before it can be used.
+   *
+   * @param parent Stream that carries the substream
+   */
+  explicit substream(stream &parent)
+    : stream_(parent.stream_),
+      id_(0)
+  {
+  }
+
+  substream(const substream&) = delete;
+  substream &operator=(const substream&) = delete;
+
+  /**
+   * Returns the ASIO IO context associated with this substream.
+   */
+  boost::asio::io_context &get_io_context() { return stream_->get_io_context(); }
+
+  /**
+   * Returns the executor associated with this substream.
+   */
+  executor_type get_executor() { return stream_->get_io_context().get_executor(); }
+
+  /**
+   * Returns the substream identifier, or zero when the substream has not
+   * yet been opened or accepted.
+   */
+  std::uint32_t id() const { return id_; }
+
+  /**
+   * Opens a new substream. The peer accepts it when the first data
+   * arrives, so opening does not need a round trip.
+   */
+  void open() { id_ = stream_->open_substream(); }
+
+  /**
+   * Accepts the next substream opened by the peer.
+   */
+  template <typename AcceptHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(AcceptHandler, void (boost::system::error_code))
+  async_accept(BOOST_ASIO_MOVE_ARG(AcceptHandler) handler)
+  {
+    return boost::asio::async_initiate<AcceptHandler, void (boost::system::error_code)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::substream_accept_op(&id_));
+  }
+
+  /**
+   * Shuts down the sending side of the substream. The peer reads EOF after
+   * all data that has already been written, while data can still be read
+   * until the peer shuts down its side as well.
+   */
+  void close() { stream_->close_substream(id_); }
+
+  /**
+   * Performs a read operation on the substream. Completes as soon as some
+   * data has been received.
+   */
+  template <typename MutableBufferSequence, typename ReadHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(ReadHandler, void (boost::system::error_code, std::size_t))
+  async_read_some(const MutableBufferSequence &buffers,
+                  BOOST_ASIO_MOVE_ARG(ReadHandler) handler)
+  {
+    return boost::asio::async_initiate<ReadHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::substream_read_op<MutableBufferSequence>(id_, buffers));
+  }
+
+  /**
+   * Performs a write operation on the substream. Completes as soon as some
+   * data fits into the substream send buffer, which is bounded by the
+   * substream window.
+   */
+  template <typename ConstBufferSequence, typename WriteHandler>
+  BOOST_ASIO_INITFN_RESULT_TYPE(WriteHandler, void (boost::system::error_code, std::size_t))
+  async_write_some(const ConstBufferSequence &buffers,
+                   BOOST_ASIO_MOVE_ARG(WriteHandler) handler)
+  {
+    return boost::asio::async_initiate<WriteHandler, void (boost::system::error_code, std::size_t)>(
+      detail::initiate_io_op<curvecp::detail::basic_stream>(*stream_), handler,
+      curvecp::detail::substream_write_op<ConstBufferSequence>(id_, buffers));
+  }
+private:
+  /// Private implementation of the parent stream
+  boost::shared_ptr<detail::basic_stream> stream_;
+  /// Substream identifier
+  std::uint32_t id_;
+};
+
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_TRANSPORT_HPP
+#define CURVECP_ASIO_TRANSPORT_HPP
+
+#include <curvecp/detail/transport.hpp>
+#include <curvecp/detail/socket_transport.hpp>
+#include <curvecp/detail/loopback_transport.hpp>
+#include <curvecp/detail/uring_transport.hpp>
+#include <curvecp/detail/busy_poll_transport.hpp>
+#include <curvecp/detail/multipath_transport.hpp>
+
+namespace curvecp {
+
+/// Datagram transport interface that streams and acceptors run over
+typedef detail::transport transport;
+
+/// Transport over a UDP or Unix domain datagram socket
+typedef detail::socket_transport socket_transport;
+
+/// In-process network connecting loopback transports
+typedef detail::loopback_network loopback_network;
+
+/// Transport over an in-process loopback network
+typedef detail::loopback_transport loopback_transport;
+
+/// Transport that spreads datagrams over several paths
+typedef detail::multipath_transport multipath_transport;
+
+#if defined(CURVECP_ASIO_HAS_IO_URING)
+/// Transport over a UDP or Unix domain datagram socket driven by io_uring
+typedef detail::uring_transport uring_transport;
+#endif
+
+#if defined(CURVECP_ASIO_HAS_BUSY_POLL)
+/// Transport over a UDP or Unix domain datagram socket polled by a dedicated spinning thread
+typedef detail::busy_poll_transport busy_poll_transport;
+#endif
+
+}
+
+#endif
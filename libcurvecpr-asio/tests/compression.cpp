@@ -0,0 +1,75 @@
+/*
+ * Stream compression test.
+ *
+ * Runs two sessions over loopback transports with compression enabled on
+ * both, on one and on neither of them, and checks that each stream arrives
+ * intact, as the framing of a stream in chunks is announced in the hello
+ * of its sender. Compression is also switched off in the middle of a
+ * stream.
+ */
+#include "session_pair.hpp"
+
+#include <cstdlib>
+#include <random>
+
+typedef curvecp::detail::session session;
+
+std::string make_text(std::size_t length, unsigned seed)
+{
+  static const char *words[] = { "request", "completed", "gateway", "latency", "status", "\n" };
+  std::mt19937 random(seed);
+  std::string text;
+  while (text.size() < length) {
+    text += words[random() % 6];
+    text += ' ';
+  }
+  text.resize(length);
+  return text;
+}
+
+void exchange(bool client_compression, bool server_compression)
+{
+  test::session_pair pair;
+  pair.client().set_compression(client_compression);
+  pair.server().set_compression(server_compression);
+  pair.start();
+
+  const std::string request = make_text(100000, 1);
+  const std::string response = make_text(50000, 2);
+  test::check(pair.write(pair.client(), request), "client writes to the stream");
+  test::check(pair.read(pair.server(), request.size()) == request, "server reads the stream of the client");
+  test::check(pair.write(pair.server(), response), "server writes to the stream");
+  test::check(pair.read(pair.client(), response.size()) == response, "client reads the stream of the server");
+
+  session::compression_counters counters = session::compression_counters();
+  pair.call(pair.client(), [&]() { counters = pair.client().get_compression_counters(); });
+  test::check((counters.chunks_raw + counters.chunks_compressed > 0) == client_compression,
+    "only a client with compression enabled frames its stream in chunks");
+}
+
+void compression_switched_off()
+{
+  test::session_pair pair;
+  pair.client().set_compression(true);
+  pair.server().set_compression(true);
+  pair.start();
+
+  const std::string first = make_text(40000, 3);
+  const std::string second = make_text(40000, 4);
+  test::check(pair.write(pair.client(), first), "client writes compressed data");
+  test::check(pair.read(pair.server(), first.size()) == first, "server reads compressed data");
+
+  pair.client().set_compression(false);
+  test::check(pair.write(pair.client(), second), "client writes after switching compression off");
+  test::check(pair.read(pair.server(), second.size()) == second, "server reads data sent after switching compression off");
+}
+
+int main()
+{
+  exchange(true, true);
+  exchange(true, false);
+  exchange(false, true);
+  exchange(false, false);
+  compression_switched_off();
+  return test::failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
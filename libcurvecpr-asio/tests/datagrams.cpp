@@ -0,0 +1,88 @@
+/*
+ * Datagram channel test.
+ *
+ * Runs two sessions over loopback transports and checks that datagrams
+ * and repairs of forward error correction are only sent once the peer has
+ * announced in its hello that it accepts them, and that the hello never
+ * shows up in the stream of the peer.
+ */
+#include "session_pair.hpp"
+
+#include <cstdlib>
+
+typedef curvecp::detail::session session;
+
+void datagrams_between_enabled_peers()
+{
+  test::session_pair pair;
+  pair.client().set_datagrams(true);
+  pair.server().set_datagrams(true);
+  pair.start();
+
+  // The first send waits for the hello of the server
+  const std::string ping("ping");
+  boost::system::error_code ec;
+  std::size_t bytes = 0;
+  pair.run_until([&]() {
+    bool done = false;
+    pair.call(pair.client(), [&]() { done = pair.client().send_datagram(boost::asio::buffer(ping), ec, bytes); });
+    return done;
+  });
+  test::check(!ec && bytes == ping.size(), "datagram is sent to a peer that accepts datagrams");
+
+  std::string received(session::maximum_datagram_size, '\0');
+  bytes = 0;
+  pair.run_until([&]() {
+    bool done = false;
+    pair.call(pair.server(), [&]() { done = pair.server().receive_datagram(boost::asio::buffer(&received[0], received.size()), ec, bytes); });
+    return done;
+  });
+  received.resize(bytes);
+  test::check(!ec && received == ping, "datagram is received by a peer that accepts datagrams");
+
+  // Both hellos are removed from the streams
+  test::check(pair.write(pair.client(), "client stream"), "client writes to the stream");
+  test::check(pair.write(pair.server(), "server stream"), "server writes to the stream");
+  test::check(pair.read(pair.server(), 13) == "client stream", "server reads the stream without the hello");
+  test::check(pair.read(pair.client(), 13) == "server stream", "client reads the stream without the hello");
+}
+
+void datagrams_refused_without_announcement()
+{
+  test::session_pair pair;
+  pair.client().set_datagrams(true);
+  pair.client().set_forward_error_correction(2, 1);
+  pair.start();
+
+  // The server has nothing to announce, so its stream starts with data
+  test::check(pair.write(pair.server(), "server stream"), "server writes to the stream");
+  test::check(pair.read(pair.client(), 13) == "server stream", "client reads the stream of a peer without a hello");
+
+  boost::system::error_code ec;
+  std::size_t bytes = 0;
+  bool done = false;
+  pair.call(pair.client(), [&]() { done = pair.client().send_datagram(boost::asio::buffer("ping", 4), ec, bytes); });
+  test::check(done && ec == boost::asio::error::operation_not_supported,
+    "datagram to a peer that has not announced datagrams is refused");
+
+  // Neither datagrams nor repairs reach the server, which still removes
+  // the hello of the client from the stream
+  test::check(pair.write(pair.client(), "client stream"), "client writes to the stream");
+  test::check(pair.read(pair.server(), 13) == "client stream", "server reads the stream without the hello");
+
+  session::datagram_counters datagrams = session::datagram_counters();
+  session::fec_counters repairs = session::fec_counters();
+  pair.call(pair.server(), [&]() {
+    datagrams = pair.server().get_datagram_counters();
+    repairs = pair.server().get_fec_counters();
+  });
+  test::check(datagrams.received == 0 && datagrams.dropped == 0, "no datagrams are sent to the peer");
+  test::check(repairs.repairs_received == 0, "no repairs are sent to the peer");
+}
+
+int main()
+{
+  datagrams_between_enabled_peers();
+  datagrams_refused_without_announcement();
+  return test::failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+/*
+ * Message mode test.
+ *
+ * Runs two sessions over loopback transports and checks that messages keep
+ * their boundaries, including empty messages and messages spanning several
+ * blocks, and that messages too large for the read buffers are reported.
+ * With unordered delivery, a message whose block is held back does not
+ * stall the messages sent after it.
+ */
+#include "session_pair.hpp"
+
+#include <cstdlib>
+
+typedef curvecp::detail::session session;
+
+bool write_message(test::session_pair &pair, session &target, const std::string &message)
+{
+  return pair.run_until([&]() {
+    bool done = false;
+    boost::system::error_code ec;
+    std::size_t bytes = 0;
+    pair.call(target, [&]() { done = target.write_message(boost::asio::buffer(message), ec, bytes); });
+    return done && !ec && bytes == message.size();
+  });
+}
+
+bool read_message(test::session_pair &pair, session &target, std::string &message,
+                  boost::system::error_code &ec, std::size_t length = 4096)
+{
+  message.assign(length, '\0');
+  std::size_t bytes = 0;
+  bool done = pair.run_until([&]() {
+    bool completed = false;
+    pair.call(target, [&]() { completed = target.read_message(boost::asio::buffer(&message[0], length), ec, bytes); });
+    return completed;
+  });
+  message.resize(bytes);
+  return done;
+}
+
+void message_boundaries()
+{
+  test::session_pair pair;
+  pair.start();
+
+  const std::string messages[] = { "", "a", std::string(100, 'b'), std::string(3000, 'c'), "ddddd" };
+  for (const std::string &message : messages)
+    test::check(write_message(pair, pair.client(), message), "client writes a message");
+
+  for (const std::string &message : messages) {
+    std::string received;
+    boost::system::error_code ec;
+    test::check(read_message(pair, pair.server(), received, ec) && !ec && received == message,
+      "server reads each message with its boundaries");
+  }
+
+  // A message larger than the buffer is truncated without affecting the
+  // next one
+  test::check(write_message(pair, pair.client(), std::string(100, 'e')), "client writes a large message");
+  test::check(write_message(pair, pair.client(), "next"), "client writes a small message");
+
+  std::string received;
+  boost::system::error_code ec;
+  test::check(read_message(pair, pair.server(), received, ec, 16) && ec == boost::asio::error::message_size &&
+    received == std::string(16, 'e'), "message larger than the buffer is reported");
+  ec.clear();
+  test::check(read_message(pair, pair.server(), received, ec) && !ec && received == "next",
+    "message after a truncated one is intact");
+}
+
+void unordered_delivery()
+{
+  test::session_pair pair;
+  pair.client().set_unordered_messages(true);
+  pair.server().set_unordered_messages(true);
+  pair.start();
+
+  // The marker ends up in a block in the middle of the first message
+  const std::string marker("held-back-marker");
+  std::string first(3000, 'a');
+  first.replace(1200, marker.size(), marker);
+  const std::string second("second message");
+
+  pair.hold(pair.client(), marker);
+  test::check(write_message(pair, pair.client(), first), "client writes a message");
+  test::check(write_message(pair, pair.client(), second), "client writes another message");
+
+  std::string received;
+  boost::system::error_code ec;
+  test::check(read_message(pair, pair.server(), received, ec) && !ec && received == second,
+    "message is delivered before an earlier incomplete one");
+  test::check(pair.held() >= 1, "block of the first message is held back");
+
+  bool done = true;
+  std::size_t bytes = 0;
+  std::string buffer(4096, '\0');
+  pair.call(pair.server(), [&]() { done = pair.server().read_message(boost::asio::buffer(&buffer[0], buffer.size()), ec, bytes); });
+  test::check(!done, "incomplete message is not delivered");
+
+  pair.release();
+  test::check(read_message(pair, pair.server(), received, ec) && !ec && received == first,
+    "incomplete message is delivered once its block arrives");
+}
+
+int main()
+{
+  message_boundaries();
+  unordered_delivery();
+  return test::failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
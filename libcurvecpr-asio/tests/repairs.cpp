@@ -0,0 +1,51 @@
+/*
+ * Forward error correction test.
+ *
+ * Runs two sessions over loopback transports with forward error correction
+ * enabled on both and holds back a block of the client as if it were lost,
+ * then checks that the server rebuilds it from the repair of its group and
+ * reads the stream intact without waiting for a retransmission.
+ */
+#include "session_pair.hpp"
+
+#include <cstdlib>
+
+typedef curvecp::detail::session session;
+
+void lost_block_rebuilt()
+{
+  test::session_pair pair;
+  pair.client().set_forward_error_correction(4, 1);
+  pair.server().set_forward_error_correction(4, 1);
+  pair.start();
+
+  // Repairs are only sent once the hello of the server has arrived
+  test::check(pair.write(pair.server(), "ready"), "server writes to the stream");
+  test::check(pair.read(pair.client(), 5) == "ready", "client reads the hello and the stream of the server");
+
+  // The marker ends up in the first block of the data
+  const std::string marker("held-back-marker");
+  std::string data(4000, 'x');
+  data.replace(100, marker.size(), marker);
+
+  pair.hold(pair.client(), marker);
+  test::check(pair.write(pair.client(), data), "client writes to the stream");
+  test::check(pair.read(pair.server(), data.size()) == data, "server reads the stream with a block held back");
+  test::check(pair.held() >= 1, "block of the client is held back");
+
+  session::fec_counters counters = session::fec_counters();
+  pair.call(pair.server(), [&]() { counters = pair.server().get_fec_counters(); });
+  test::check(counters.repairs_received >= 1, "server receives repairs");
+  test::check(counters.blocks_rebuilt >= 1, "server rebuilds the block that is held back");
+
+  // The block that was held back is a duplicate by now
+  pair.release();
+  test::check(pair.write(pair.client(), "after"), "client writes after the release");
+  test::check(pair.read(pair.server(), 5) == "after", "server reads past the duplicate block");
+}
+
+int main()
+{
+  lost_block_rebuilt();
+  return test::failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2014 Jernej Kos (jernej@kos.mx)
+ *
+ * Distributed under the Boost Software License, Version 1.0. (See accompanying
+ * file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef CURVECP_ASIO_TESTS_SESSION_PAIR_HPP
+#define CURVECP_ASIO_TESTS_SESSION_PAIR_HPP
+
+#include <curvecp/curvecp.hpp>
+
+#include <boost/asio/post.hpp>
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace test {
+
+/**
+ * Returns the number of failed checks.
+ */
+inline int &failures()
+{
+  static int count = 0;
+  return count;
+}
+
+/**
+ * Records the outcome of a check and reports failures.
+ *
+ * @param condition Outcome of the check
+ * @param description Description of what was checked
+ * @return The outcome of the check
+ */
+inline bool check(bool condition, const char *description)
+{
+  if (!condition) {
+    std::printf("FAILED: %s\n", description);
+    failures()++;
+  }
+  return condition;
+}
+
+/**
+ * A client and a server session that exchange messager messages over a
+ * pair of connected loopback transports, without a handshake or crypto.
+ * The IO context is only run by the calling thread while it waits for
+ * something to happen, so tests run deterministically in a single thread.
+ * Messages carrying given data can be held back to simulate loss and
+ * reordering.
+ */
+class session_pair {
+public:
+  typedef curvecp::detail::session session;
+
+  session_pair()
+    : client_transport_(service_, network_),
+      server_transport_(service_, network_),
+      client_(boost::make_shared<session>(service_, session::type::client)),
+      server_(boost::make_shared<session>(service_, session::type::server)),
+      client_buffer_(65536),
+      server_buffer_(65536),
+      hold_session_(nullptr)
+  {
+    curvecp::transport::endpoint_type client_endpoint(
+      boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 1));
+    curvecp::transport::endpoint_type server_endpoint(
+      boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), 2));
+
+    client_transport_.bind(client_endpoint);
+    server_transport_.bind(server_endpoint);
+    client_transport_.connect(server_endpoint);
+    server_transport_.connect(client_endpoint);
+    attach(*client_, client_transport_, client_buffer_);
+    attach(*server_, server_transport_, server_buffer_);
+  }
+
+  session &client() { return *client_; }
+
+  session &server() { return *server_; }
+
+  /**
+   * Starts both sessions.
+   */
+  void start()
+  {
+    client_->start();
+    server_->start();
+  }
+
+  /**
+   * Runs the IO context until the predicate holds or a second has passed.
+   *
+   * @param predicate Function that returns true when done
+   * @return True when the predicate holds
+   */
+  template <typename Predicate>
+  bool run_until(Predicate predicate)
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!predicate()) {
+      if (std::chrono::steady_clock::now() >= deadline)
+        return false;
+      service_.run_one_for(std::chrono::milliseconds(10));
+    }
+    return true;
+  }
+
+  /**
+   * Runs the IO context for a while.
+   *
+   * @param duration Time to run for
+   */
+  void run_for(std::chrono::milliseconds duration)
+  {
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < deadline)
+      service_.run_one_for(std::chrono::milliseconds(10));
+  }
+
+  /**
+   * Holds back the messager messages sent by a session that contain the
+   * given data, including their retransmissions, as if they were lost.
+   *
+   * @param target Session whose messages to hold back
+   * @param marker Data to look for
+   */
+  void hold(session &target, const std::string &marker)
+  {
+    hold_session_ = &target;
+    hold_marker_ = marker;
+  }
+
+  /**
+   * Delivers the messages that have been held back and stops holding.
+   */
+  void release()
+  {
+    hold_session_ = nullptr;
+    for (auto &frame : held_)
+      send(*frame.first, frame.second);
+    held_.clear();
+  }
+
+  /**
+   * Returns the number of messages that are being held back.
+   */
+  std::size_t held() const { return held_.size(); }
+
+  /**
+   * Executes a function on the strand of a session.
+   *
+   * @param target Session to execute the function on
+   * @param function Function to execute
+   */
+  template <typename Function>
+  void call(session &target, Function function)
+  {
+    bool done = false;
+    boost::asio::post(target.get_strand(), [&]() {
+      function();
+      done = true;
+    });
+    run_until([&done]() { return done; });
+  }
+
+  /**
+   * Writes data to the stream of a session.
+   *
+   * @param target Session to write to
+   * @param data Data to write
+   * @return True when all data has been written
+   */
+  bool write(session &target, const std::string &data)
+  {
+    std::size_t written = 0;
+    return run_until([&]() {
+      call(target, [&]() {
+        boost::system::error_code ec;
+        written += target.write_some(boost::asio::buffer(data.data() + written, data.size() - written), ec);
+      });
+      return written == data.size();
+    });
+  }
+
+  /**
+   * Reads the given number of bytes from the stream of a session.
+   *
+   * @param target Session to read from
+   * @param length Number of bytes to read
+   * @return Data that has been read, shorter on timeouts and errors
+   */
+  std::string read(session &target, std::size_t length)
+  {
+    std::string data(length, '\0');
+    std::size_t received = 0;
+    bool failed = false;
+    run_until([&]() {
+      call(target, [&]() {
+        boost::system::error_code ec;
+        received += target.read_some(boost::asio::buffer(&data[received], length - received), ec);
+        failed = ec && ec != boost::asio::error::would_block;
+      });
+      return received == length || failed;
+    });
+    data.resize(received);
+    return data;
+  }
+private:
+  void attach(session &target, curvecp::loopback_transport &transport, std::vector<unsigned char> &buffer)
+  {
+    target.set_lower_send_handler([this, &target, &transport](const unsigned char *buf, std::size_t num) {
+      boost::shared_ptr<std::vector<unsigned char>> data(boost::make_shared<std::vector<unsigned char>>(buf, buf + num));
+
+      // Only messager messages are held back, which are a multiple of 16
+      // bytes long unlike datagrams and repairs
+      if (&target == hold_session_ && !(num & 15) &&
+          std::search(buf, buf + num, hold_marker_.begin(), hold_marker_.end()) != buf + num) {
+        held_.push_back(std::make_pair(&transport, data));
+        return;
+      }
+
+      send(transport, data);
+    });
+    receive(target, transport, buffer);
+  }
+
+  void send(curvecp::loopback_transport &transport, boost::shared_ptr<std::vector<unsigned char>> data)
+  {
+    transport.async_send(boost::asio::buffer(*data), [data](const boost::system::error_code&, std::size_t) {});
+  }
+
+  void receive(session &target, curvecp::loopback_transport &transport, std::vector<unsigned char> &buffer)
+  {
+    transport.async_receive(boost::asio::buffer(buffer),
+      [this, &target, &transport, &buffer](const boost::system::error_code &ec, std::size_t bytes) {
+        if (ec)
+          return;
+
+        target.lower_receive(&buffer[0], bytes);
+        receive(target, transport, buffer);
+      });
+  }
+private:
+  /// ASIO IO context, destroyed last so that it releases the sessions
+  boost::asio::io_context service_;
+  /// Loopback network of the transports
+  curvecp::loopback_network network_;
+  /// Transport of the client session
+  curvecp::loopback_transport client_transport_;
+  /// Transport of the server session
+  curvecp::loopback_transport server_transport_;
+  /// Client session
+  boost::shared_ptr<session> client_;
+  /// Server session
+  boost::shared_ptr<session> server_;
+  /// Receive buffer of the client transport
+  std::vector<unsigned char> client_buffer_;
+  /// Receive buffer of the server transport
+  std::vector<unsigned char> server_buffer_;
+  /// Session whose messages are held back, if any
+  session *hold_session_;
+  /// Data identifying the messages to hold back
+  std::string hold_marker_;
+  /// Messages held back with the transport to send them with
+  std::vector<std::pair<curvecp::loopback_transport*, boost::shared_ptr<std::vector<unsigned char>>>> held_;
+};
+
+}
+
+#endif
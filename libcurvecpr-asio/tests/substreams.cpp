@@ -0,0 +1,208 @@
+/*
+ * Substream multiplexing test.
+ *
+ * Runs two multiplexed sessions over loopback transports and checks that
+ * the data of several substreams is framed and delivered to the right
+ * substreams, that a substream whose reader is idle stops at its credit
+ * and resumes once read, and that substreams closed by both sides are
+ * erased.
+ */
+#include "session_pair.hpp"
+
+#include <cstdlib>
+
+typedef curvecp::detail::session session;
+
+std::size_t write_substream(test::session_pair &pair, session &target, std::uint32_t id, const std::string &data)
+{
+  std::size_t written = 0;
+  pair.run_until([&]() {
+    pair.call(target, [&]() {
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      if (target.write_substream(id, boost::asio::buffer(data.data() + written, data.size() - written), ec, bytes) && !ec)
+        written += bytes;
+    });
+    return written == data.size();
+  });
+  return written;
+}
+
+std::string read_substream(test::session_pair &pair, session &target, std::uint32_t id, std::size_t length)
+{
+  std::string data(length, '\0');
+  std::size_t received = 0;
+  bool failed = false;
+  pair.run_until([&]() {
+    pair.call(target, [&]() {
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      if (target.read_substream(id, boost::asio::buffer(&data[received], length - received), ec, bytes)) {
+        received += bytes;
+        failed = !!ec;
+      }
+    });
+    return received == length || failed;
+  });
+  data.resize(received);
+  return data;
+}
+
+bool accept_substream(test::session_pair &pair, session &target, std::uint32_t &id)
+{
+  return pair.run_until([&]() {
+    bool done = false;
+    boost::system::error_code ec;
+    pair.call(target, [&]() { done = target.accept_substream(id, ec) && !ec; });
+    return done;
+  });
+}
+
+bool read_eof(test::session_pair &pair, session &target, std::uint32_t id)
+{
+  boost::system::error_code ec;
+  return pair.run_until([&]() {
+    bool done = false;
+    pair.call(target, [&]() {
+      char byte;
+      std::size_t bytes = 0;
+      done = target.read_substream(id, boost::asio::buffer(&byte, 1), ec, bytes);
+    });
+    return done;
+  }) && ec == boost::asio::error::eof;
+}
+
+void multiplex(test::session_pair &pair, std::size_t window)
+{
+  pair.client().set_multiplexed(true);
+  pair.server().set_multiplexed(true);
+  pair.client().set_substream_window(window);
+  pair.server().set_substream_window(window);
+  pair.start();
+}
+
+void substream_framing()
+{
+  test::session_pair pair;
+  multiplex(pair, 16384);
+
+  std::uint32_t ids[3];
+  std::string data[3];
+  for (int i = 0; i < 3; i++) {
+    pair.call(pair.client(), [&]() { ids[i] = pair.client().open_substream(); });
+    data[i] = std::string(1000 + 700 * i, static_cast<char>('a' + i));
+  }
+  test::check(ids[0] != ids[1] && ids[1] != ids[2] && (ids[0] & 1), "client opens distinct odd substreams");
+
+  for (int i = 0; i < 3; i++)
+    test::check(write_substream(pair, pair.client(), ids[i], data[i]) == data[i].size(), "client writes to a substream");
+
+  for (int i = 0; i < 3; i++) {
+    std::uint32_t id = 0;
+    test::check(accept_substream(pair, pair.server(), id) && id == ids[i], "server accepts the substreams in order");
+  }
+
+  // Reading the substreams in reverse shows that their data is not mixed
+  for (int i = 2; i >= 0; i--)
+    test::check(read_substream(pair, pair.server(), ids[i], data[i].size()) == data[i], "server reads each substream intact");
+}
+
+void substream_credit()
+{
+  const std::size_t window = 1024;
+  test::session_pair pair;
+  multiplex(pair, window);
+
+  std::uint32_t id = 0;
+  pair.call(pair.client(), [&]() { id = pair.client().open_substream(); });
+
+  // With an idle reader, the peer takes a window of data and the send
+  // buffer holds another one
+  const std::string data(8 * window, 'x');
+  std::size_t written = 0;
+  bool done = true;
+  while (done) {
+    // Give the session time to send what has been written so far
+    pair.run_for(std::chrono::milliseconds(20));
+    pair.call(pair.client(), [&]() {
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      done = pair.client().write_substream(id, boost::asio::buffer(data.data() + written, data.size() - written), ec, bytes);
+      written += bytes;
+    });
+  }
+  test::check(written == 2 * window, "writer stops once the credit and its send buffer are used up");
+
+  std::uint32_t accepted = 0;
+  test::check(accept_substream(pair, pair.server(), accepted) && accepted == id, "server accepts the substream");
+
+  std::string buffer(8 * window, '\0');
+  std::size_t received = 0;
+  done = true;
+  while (done) {
+    pair.call(pair.server(), [&]() {
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      done = pair.server().read_substream(id, boost::asio::buffer(&buffer[received], buffer.size() - received), ec, bytes);
+      received += bytes;
+    });
+  }
+  test::check(received == window, "peer receives no more than the credit");
+
+  // Reading returns credit, so the rest of the data follows
+  pair.run_until([&]() {
+    pair.call(pair.client(), [&]() {
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      if (pair.client().write_substream(id, boost::asio::buffer(data.data() + written, data.size() - written), ec, bytes))
+        written += bytes;
+    });
+    pair.call(pair.server(), [&]() {
+      boost::system::error_code ec;
+      std::size_t bytes = 0;
+      if (pair.server().read_substream(id, boost::asio::buffer(&buffer[received], buffer.size() - received), ec, bytes))
+        received += bytes;
+    });
+    return received == data.size();
+  });
+  test::check(written == data.size(), "writer resumes once credit is returned");
+  test::check(buffer == data, "remaining data arrives intact");
+}
+
+void substream_close()
+{
+  test::session_pair pair;
+  multiplex(pair, 16384);
+
+  std::uint32_t id = 0;
+  pair.call(pair.client(), [&]() { id = pair.client().open_substream(); });
+  test::check(write_substream(pair, pair.client(), id, "request") == 7, "client writes a request");
+  pair.call(pair.client(), [&]() { pair.client().close_substream(id); });
+
+  std::uint32_t accepted = 0;
+  test::check(accept_substream(pair, pair.server(), accepted) && accepted == id, "server accepts the substream");
+  test::check(read_substream(pair, pair.server(), id, 7) == "request", "server reads the request");
+
+  test::check(read_eof(pair, pair.server(), id), "server reads EOF after the FIN");
+
+  test::check(write_substream(pair, pair.server(), id, "response") == 8, "server writes a response");
+  pair.call(pair.server(), [&]() { pair.server().close_substream(id); });
+  test::check(read_substream(pair, pair.client(), id, 8) == "response", "client reads the response");
+  test::check(read_eof(pair, pair.client(), id), "client reads EOF after the FIN");
+
+  std::size_t client_count = 1;
+  std::size_t server_count = 1;
+  test::check(pair.run_until([&]() {
+    pair.call(pair.client(), [&]() { client_count = pair.client().substream_count(); });
+    pair.call(pair.server(), [&]() { server_count = pair.server().substream_count(); });
+    return client_count == 0 && server_count == 0;
+  }), "substream closed by both sides is erased on both of them");
+}
+
+int main()
+{
+  substream_framing();
+  substream_credit();
+  substream_close();
+  return test::failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}